@@ -1,553 +1,10627 @@
-#include <stdio.h>
-#include <string.h>
-#include <ctype.h>
-#include <stdlib.h>
-
-// =================================================================
-// PART 1: LEXER (DFA-BASED) - CORRECTED
-// =================================================================
-
-#define MAX_TOKEN_LEN 100
-#define MAX_TOKENS 500
-#define MAXSYM 50
-
-// Token Definitions (Matching Parser's Terminals)
-typedef enum {
-    TOKEN_EOF = 0,
-    TOKEN_INCLUDE, // 1: #include<stdio.h>
-    TOKEN_KW_INT, // 2: int
-    TOKEN_KW_DEC, // 3: dec
-    TOKEN_VAR_NAME, // 4: _alpha...digit_alpha
-    TOKEN_FUNC_NAME, // 5: alpha...Fn
-    TOKEN_MAIN_FUNC, // 6: main
-    TOKEN_LOOP_KW, // 7: loop
-    TOKEN_WHILE, // 8: while
-    TOKEN_OPEN_PAREN, // 9: (
-    TOKEN_CLOSE_PAREN, // 10: )
-    TOKEN_OPEN_BRACE, // 11: {
-    TOKEN_CLOSE_BRACE, // 12: }
-    TOKEN_DOTDOT, // 13: .. (End of statement)
-    TOKEN_ASSIGN, // 14: =
-    TOKEN_COMPARATOR, // 15: <
-    TOKEN_NUMBER, // 16: 10, 5, 2 etc.
-    TOKEN_PLUS, // 17: +
-    TOKEN_RETURN, // 18: return
-    TOKEN_PRINTF, // 19: printf
-    TOKEN_BREAK, // 20: break
-    TOKEN_COMMA, // 21: ,
-    TOKEN_COLON, // 22: : (For loop termination)
-    TOKEN_ERROR // 23: Unrecognized token
-} TokenType;
-
-// Global structure to hold tokens
-typedef struct {
-    TokenType type;
-    char lexeme[MAX_TOKEN_LEN];
-} Token;
-
-Token tokens[MAX_TOKENS];
-int token_count = 0;
-
-// DFA States
-enum {
-    S0, // Start
-    S_INC, // Start state for #include
-    S_DATATYPE_I, S_DATATYPE_IN, S_DATATYPE_INT,
-    S_DATATYPE_D, S_DATATYPE_DE, S_DATATYPE_DEC,
-    S_VAR_START, S_VAR_ALPHA, S_VAR_DIGIT, S_VAR_END,
-    S_FUNC_ALPHA, S_FUNC_F, S_FUNC_FN, // Simplified FuncName
-    S_MAIN_M, S_MAIN_MA, S_MAIN_MAIN,
-    S_LOOP_L, S_LOOP_LO, S_LOOP_LOOP, S_LOOP_UNDERSCORE, S_LOOP_ALPHA, S_LOOP_DIGIT1, S_LOOP_DIGIT2, S_LOOP_COLON,
-    S_W_W, S_W_WH, S_W_WHI, S_W_WHIL, S_W_WHILE,
-    S_R_R, S_R_RE, S_R_RET, S_R_RETU, S_R_RETUR, S_R_RETURN,
-    S_B_B, S_B_BR, S_B_BRE, S_B_BREA, S_B_BREAK,
-    S_P_P, S_P_PR, S_P_PRI, S_P_PRIN, S_P_PRINT, S_P_PRINTF,
-    S_NUM_DIGIT,
-    S_DOT1, S_DOTDOT,
-    S_COMPARATOR, S_PLUS, S_OPEN_PAREN, S_CLOSE_PAREN, S_OPEN_BRACE, S_CLOSE_BRACE, S_ASSIGN, S_COMMA, S_COLON_ONLY,
-    DEAD // Dead state
-};
-
-#define NUM_STATES 58
-#define NUM_INPUTS 16
-
-// Input Mapping for the DFA (FIXED LOGIC)
-int get_input(char c) {
-    if (c == '#') return 0;
-    // Grouping specific letters needed for multi-character tokens (i.e., keywords)
-    if (strchr("intdecmaloprbfwuk", c) != NULL) return 1;
-    if (islower(c)) return 2; // Remaining lowercase alphabet
-    if (c == '_') return 3;
-    if (isdigit(c)) return 4;
-    if (c == '(') return 5;
-    if (c == ')') return 6;
-    if (c == '{') return 7;
-    if (c == '}') return 8;
-    if (c == '=') return 9;
-    if (c == '<') return 10;
-    if (c == '+') return 11;
-    if (c == '.') return 12;
-    if (c == ',') return 13;
-    if (c == ':') return 14;
-    return 15;
-}
-
-// DFA transition table: next_state[current_state][input_symbol] - CORRECTED
-int next_state[NUM_STATES][NUM_INPUTS] = {
-// 0:# 1:spec_alpha 2:other_alpha 3:_ 4:0-9 5:( 6:) 7:{ 8:} 9:= 10:< 11:+ 12:. 13:, 14:: 15:Other
-/* S0 */ {S_INC, S_DATATYPE_I, S_FUNC_ALPHA, S_VAR_START, S_NUM_DIGIT, S_OPEN_PAREN, S_CLOSE_PAREN, S_OPEN_BRACE, S_CLOSE_BRACE, S_ASSIGN, S_COMPARATOR, S_PLUS, S_DOT1, S_COMMA, S_COLON_ONLY, DEAD},
-/* S_INC */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // #include<stdio.h> (TERMINAL - Handled in lex())
-
-// int
-/* S_DATATYPE_I */ {DEAD, S_DATATYPE_IN, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_DATATYPE_IN */ {DEAD, S_DATATYPE_INT, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_DATATYPE_INT */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT int
-// dec
-/* S_DATATYPE_D */ {DEAD, S_DATATYPE_DE, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_DATATYPE_DE */ {DEAD, S_DATATYPE_DEC, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_DATATYPE_DEC */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT dec
-
-// VAR_NAME
-/* S_VAR_START */ {DEAD, S_VAR_ALPHA, S_VAR_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_VAR_ALPHA */ {DEAD, S_VAR_ALPHA, S_VAR_ALPHA, DEAD, S_VAR_DIGIT, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_VAR_DIGIT */ {DEAD, S_VAR_END, S_VAR_END, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // FIXED: digits can be followed by alpha/spec_alpha
-/* S_VAR_END */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT _var...
-
-// FUNC_NAME (alpha...Fn) - Added loop to allow multiple characters
-/* S_FUNC_ALPHA */ {DEAD, S_FUNC_ALPHA, S_FUNC_ALPHA, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_FUNC_F */ {DEAD, S_FUNC_FN, S_FUNC_ALPHA, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_FUNC_FN */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT funcname
-
-// main
-/* S_MAIN_M */ {DEAD, S_MAIN_MA, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_MAIN_MA */ {DEAD, S_MAIN_MAIN, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_MAIN_MAIN */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT main (allows mainFn, main_loop, etc.)
-
-// LOOP_KW
-/* S_LOOP_L */ {DEAD, S_LOOP_LO, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_LOOP_LO */ {DEAD, S_LOOP_LOOP, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_LOOP_LOOP */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT loop (Allows loop_var)
-/* S_LOOP_UNDERSCORE */ {DEAD, S_LOOP_ALPHA, S_LOOP_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_LOOP_ALPHA */ {DEAD, S_LOOP_ALPHA, S_LOOP_ALPHA, DEAD, S_LOOP_DIGIT1, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_LOOP_DIGIT1 */ {DEAD, DEAD, DEAD, DEAD, S_LOOP_DIGIT2, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_LOOP_DIGIT2 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, S_LOOP_COLON, DEAD},
-/* S_LOOP_COLON */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT loop_...:
-
-// WHILE
-/* S_W_W */ {DEAD, S_W_WH, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_W_WH */ {DEAD, S_W_WHI, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_W_WHI */ {DEAD, S_W_WHIL, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_W_WHIL */ {DEAD, S_W_WHILE, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_W_WHILE */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT while
-
-// RETURN
-/* S_R_R */ {DEAD, S_R_RE, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_R_RE */ {DEAD, S_R_RET, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_R_RET */ {DEAD, S_R_RETU, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_R_RETU */ {DEAD, S_R_RETUR, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_R_RETUR */ {DEAD, S_R_RETURN, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_R_RETURN */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT return
-
-// BREAK
-/* S_B_B */ {DEAD, S_B_BR, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_B_BR */ {DEAD, S_B_BRE, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_B_BRE */ {DEAD, S_B_BREA, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_B_BREA */ {DEAD, S_B_BREAK, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_B_BREAK */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT break
-
-// PRINTF
-/* S_P_P */ {DEAD, S_P_PR, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_P_PR */ {DEAD, S_P_PRI, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_P_PRI */ {DEAD, S_P_PRIN, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_P_PRIN */ {DEAD, S_P_PRINT, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_P_PRINT */ {DEAD, S_P_PRINTF, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_P_PRINTF */ {DEAD, DEAD, S_FUNC_ALPHA, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT printf
-
-/* S_NUM_DIGIT */ {DEAD, DEAD, DEAD, DEAD, S_NUM_DIGIT, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT 123
-/* S_DOT1 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, S_DOTDOT, DEAD, DEAD, DEAD},
-/* S_DOTDOT */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}, // ACCEPT ..
-
-// Single Char Tokens
-/* S_COMPARATOR */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_PLUS */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_OPEN_PAREN */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_CLOSE_PAREN */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_OPEN_BRACE */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_CLOSE_BRACE */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_ASSIGN */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_COMMA */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* S_COLON_ONLY */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-/* DEAD */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD}
-};
-
-// Map states to token types (Size 58)
-TokenType state_to_token_type[NUM_STATES] = {
-    TOKEN_ERROR, TOKEN_INCLUDE, // S_INC is the state after reading #
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_KW_INT,
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_KW_DEC,
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_VAR_NAME, // _var...
-    TOKEN_FUNC_NAME, TOKEN_ERROR, TOKEN_FUNC_NAME, // funcname (S_FUNC_FN)
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_MAIN_FUNC, // main (S_MAIN_MAIN)
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_LOOP_KW, // loop (S_LOOP_LOOP)
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_COLON, // loop_...: (S_LOOP_COLON)
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_WHILE,
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_RETURN,
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_BREAK,
-    TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_ERROR, TOKEN_PRINTF,
-    TOKEN_NUMBER,
-    TOKEN_ERROR, TOKEN_DOTDOT, // ..
-    TOKEN_COMPARATOR, TOKEN_PLUS,
-    TOKEN_OPEN_PAREN, TOKEN_CLOSE_PAREN, TOKEN_OPEN_BRACE, TOKEN_CLOSE_BRACE, TOKEN_ASSIGN,
-    TOKEN_COMMA, TOKEN_COLON, // S_COLON_ONLY now maps to TOKEN_COLON
-    TOKEN_ERROR // DEAD state
-};
-
-void lex(const char *program_text) {
-    token_count = 0;
-    int i = 0;
-
-    // Special case for #include<stdio.h> - Lookahead logic correction
-    while (isspace(program_text[i])) i++;
-    if (strncmp(program_text + i, "#include<stdio.h>", 17) == 0) {
-        if (token_count < MAX_TOKENS) {
-            strcpy(tokens[token_count].lexeme, "#include<stdio.h>");
-            tokens[token_count].type = TOKEN_INCLUDE;
-            token_count++;
-            i += 17;
-        }
-    } else {
-        // If the code doesn't start with the required line, it will be rejected later
-    }
-
-    while (program_text[i] != '\0') {
-        while (isspace(program_text[i])) {
-            i++;
-        }
-        if (program_text[i] == '\0') break;
-
-        int start = i;
-        int state = S0;
-        int last_accepting_pos = -1;
-        int last_accepting_state = DEAD;
-
-        int j = start;
-
-        // DFA simulation
-        while (program_text[j] != '\0') {
-            int input = get_input(program_text[j]);
-            int next = next_state[state][input];
-
-            if (next == DEAD) {
-                break;
-            }
-
-            // Custom handling for FuncName: if it's 'F' and the previous state was S_FUNC_ALPHA
-            if (state == S_FUNC_ALPHA && program_text[j] == 'F') {
-                next = S_FUNC_F; // Manually transition to S_FUNC_F for "Fn" check
-            } else if (state == S_FUNC_F && program_text[j] == 'n') {
-                next = S_FUNC_FN; // Final check for "Fn"
-            }
-
-            state = next;
-            j++;
-
-            // If the state is accepting, record it
-            if (state_to_token_type[state] != TOKEN_ERROR) {
-                last_accepting_pos = j;
-                last_accepting_state = state;
-
-                // Stop immediately for single-char and fixed multi-char tokens
-                if (state_to_token_type[state] != TOKEN_VAR_NAME && state_to_token_type[state] != TOKEN_FUNC_NAME && state_to_token_type[state] != TOKEN_NUMBER) {
-                    break;
-                }
-            }
-        }
-
-        if (last_accepting_pos != -1) {
-            TokenType accepted_type = state_to_token_type[last_accepting_state];
-            int len = last_accepting_pos - start;
-
-            if (len >= MAX_TOKEN_LEN) len = MAX_TOKEN_LEN - 1;
-
-            strncpy(tokens[token_count].lexeme, program_text + start, len);
-            tokens[token_count].lexeme[len] = '\0';
-
-            tokens[token_count].type = accepted_type;
-            token_count++;
-            i = last_accepting_pos;
-        } else {
-            // Error handling: unrecognized token
-            fprintf(stderr, "Lexer Error: Unrecognized token starting at index %d: '%c'\n", i, program_text[i]);
-            i++; // Move past the character to continue scanning
-        }
-    }
-
-    // Add EOF
-    tokens[token_count].type = TOKEN_EOF;
-    strcpy(tokens[token_count].lexeme, "$");
-    token_count++;
-}
-
-// =================================================================
-// PART 2: PARSER (LL(1)-BASED) - CORRECTED
-// =================================================================
-
-#define NNT 16   // Number of Non-Terminals (0 to 15)
-#define NTER 24  // Number of Terminals (0 to 23) (23 is ERROR)
-#define MAXSTACK 500 // For the stack implementation
-
-// Non-terminals (NT)
-char *NT[] = {"Program","OptFuncs","FuncDef","FuncParams","DataType","StatementList","Statement","Assignment","Loop","MainFunc","FuncCall","PrintfCall","ReturnStmt","Expression","Term","Expr_Tail"};
-// Terminals (T) - Must match the order of the TABLE
-char *TERMINALS[] = {
-    "#include<stdio.h>", "int", "dec", "_VAR_NAME", "FUNC_NAME", "main", "loop", "while", "(", ")", "{", "}", "..", "=", "<", "NUMBER", "+", "return", "printf", "break", ",", ":", "$", "ERROR"
-};
-
-// LL(1) Table Helper: Maps TokenType to TERMINALS index (FIXED)
-int token_type_to_ter_index(TokenType type, const char* lexeme) {
-    if (type == TOKEN_INCLUDE) return 0;
-    if (type == TOKEN_KW_INT) return 1;
-    if (type == TOKEN_KW_DEC) return 2;
-    if (type == TOKEN_VAR_NAME) return 3;
-    if (type == TOKEN_FUNC_NAME) return 4;
-    if (type == TOKEN_MAIN_FUNC) return 5;
-    if (type == TOKEN_LOOP_KW) return 6;
-    if (type == TOKEN_WHILE) return 7;
-    if (type == TOKEN_OPEN_PAREN) return 8;
-    if (type == TOKEN_CLOSE_PAREN) return 9;
-    if (type == TOKEN_OPEN_BRACE) return 10;
-    if (type == TOKEN_CLOSE_BRACE) return 11;
-    if (type == TOKEN_DOTDOT) return 12;
-    if (type == TOKEN_ASSIGN) return 13;
-    if (type == TOKEN_COMPARATOR) return 14;
-    if (type == TOKEN_NUMBER) return 15;
-    if (type == TOKEN_PLUS) return 16;
-    if (type == TOKEN_RETURN) return 17;
-    if (type == TOKEN_PRINTF) return 18;
-    if (type == TOKEN_BREAK) return 19;
-    if (type == TOKEN_COMMA) return 20;
-    if (type == TOKEN_COLON) return 21;
-    if (type == TOKEN_EOF) return 22;
-    return 23; // ERROR
-}
-
-// Production Rules (RHS)
-char *RHS[] = {
-    "#include<stdio.h> OptFuncs MainFunc", // 1: Program
-    "FuncDef OptFuncs", // 2: OptFuncs -> FuncDef OptFuncs
-    "", // 3: OptFuncs -> epsilon (Follow: DataType of MainFunc)
-    "DataType FUNC_NAME ( FuncParams ) { StatementList ReturnStmt }", // 4: FuncDef
-    "DataType _VAR_NAME OptParams", // 5: FuncParams
-    "", // 6: OptParams -> epsilon (Follow: ')')
-    "int", // 7: DataType -> int
-    "dec", // 8: DataType -> dec
-    "Statement StatementList", // 9: StatementList -> Statement StatementList
-    "", // 10: StatementList -> epsilon (Follow: return, '}')
-    "Assignment ..", // 11: Statement -> Assignment .. (Assignment includes declarations)
-    "Loop", // 12: Statement -> Loop
-    "PrintfCall ..", // 13: Statement -> PrintfCall ..
-    "break ..", // 14: Statement -> break ..
-    "DataType _VAR_NAME = Expression", // 15: Assignment (Declaration and initialization)
-    "DataType _VAR_NAME", // 16: Assignment (Declaration only)
-    "_VAR_NAME = Expression", // 17: Assignment (Re-assignment)
-    "loop _VAR_NAME : while ( _VAR_NAME < NUMBER ) { StatementList break .. }", // 18: Loop
-    "printf ( _VAR_NAME )", // 19: PrintfCall
-    "return Expression ..", // 20: ReturnStmt
-    "Term Expr_Tail", // 21: Expression -> Term Expr_Tail (LL(1) for E -> T E')
-    "NUMBER", // 22: Term -> NUMBER
-    "_VAR_NAME", // 23: Term -> _VAR_NAME
-    "DataType main ( ) { StatementList ReturnStmt }", // 24: MainFunc
-    "+ Term Expr_Tail", // 25: Expr_Tail -> + Term Expr_Tail (E' -> + T E')
-    "" // 26: Expr_Tail -> epsilon (E' -> epsilon)
-};
-
-// LL(1) Table (CORRECTED with Expression Fix)
-int TABLE[NNT][NTER] = {
-// 0:# 1:int 2:dec 3:_VAR 4:FNAME 5:main 6:loop 7:while 8:( 9:) 10:{ 11:} 12:.. 13:= 14:< 15:NUM 16:+ 17:ret 18:printf 19:break 20:, 21:: 22:$ 23:ERR
-/* 0:Program */      {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 1:OptFuncs */     {0, 2, 2, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 2:FuncDef */      {0, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 3:FuncParams */   {0, 5, 5, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 4:DataType */     {0, 7, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 5:StatementList */{0, 9, 9, 9, 0, 0, 9, 0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 10, 9, 9, 0, 0, 0, 0}, // Follow(StatementList) is RETURN or }
-/* 6:Statement */    {0, 11, 11, 17, 0, 0, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 14, 0, 0, 0, 0}, // R11 for decl/init, R17 for reassign
-/* 7:Assignment */   {0, 15, 15, 17, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 8:Loop */         {0, 0, 0, 0, 0, 0, 18, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 9:MainFunc */     {0, 24, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 10:FuncCall */    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 11:PrintfCall */  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 0, 0, 0, 0, 0},
-/* 12:ReturnStmt */  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 20, 0, 0, 0, 0, 0, 0},
-/* 13:Expression */  {0, 0, 0, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 21, 0, 0, 0, 0, 0, 0, 0, 0}, // R21: E -> T E'
-/* 14:Term */        {0, 0, 0, 23, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 22, 0, 0, 0, 0, 0, 0, 0, 0},
-/* 15:Expr_Tail */   {0, 0, 0, 0, 0, 0, 0, 0, 0, 26, 0, 26, 26, 0, 0, 0, 25, 26, 0, 0, 26, 0, 0, 0} // E' -> + T E' | epsilon (Follows: ), }, .., RETURN, ,)
-};
-
-
-// --- Stack implementation (from LL(1).c) ---
-char stack[MAXSTACK][MAXSYM];
-int top = -1;
-
-void push(char *s){ strcpy(stack[++top], s); }
-char* pop(){ return (top>=0)?stack[top--]:NULL; }
-void print_stack(){
-    printf("[");
-    for(int i=top;i>=0;i--){
-        printf("%s",stack[i]);
-        if(i>0) printf(", ");
-    }
-    printf("]");
-}
-
-int find_nt(char *x){ for(int i=0;i<NNT;i++) if(strcmp(NT[i],x)==0) return i; return -1; }
-int find_t(char *x){ for(int i=0;i<NTER;i++) if(strcmp(TERMINALS[i],x)==0) return i; return -1; }
-
-// Helper to split RHS into symbols
-void split_rhs(char *rhs, char symbols[][MAXSYM], int *k) {
-    *k = 0;
-    char temp[200];
-    strcpy(temp, rhs);
-    char *p = strtok(temp," ");
-    while(p){
-        strcpy(symbols[(*k)++],p);
-        p=strtok(NULL," ");
-    }
-}
-// --- End Stack implementation ---
-
-void parse() {
-    printf("\n--- PARSER EXECUTION ---\n");
-    push("$");
-    push(NT[0]); // Start symbol: Program
-
-    int ip = 0;
-    printf("%-25s %-15s %-10s %-25s\n","Stack","Lookahead (Token)","Top","Production Applied");
-    printf("----------------------------------------------------------------------------------\n");
-
-    while (top >= 0 && ip < token_count) {
-        char X[MAXSYM];
-        if (top < 0) break;
-        strcpy(X, pop());
-
-        Token *a = &tokens[ip];
-        int ter_idx = token_type_to_ter_index(a->type, a->lexeme);
-        char *lookahead_name = (ter_idx >= 0 && ter_idx < NTER) ? TERMINALS[ter_idx] : "ERROR";
-
-        // Custom mapping for generic terminals (VAR_NAME, FUNC_NAME, etc.)
-        if (a->type == TOKEN_VAR_NAME) lookahead_name = TERMINALS[3];
-        else if (a->type == TOKEN_FUNC_NAME) lookahead_name = TERMINALS[4];
-        else if (a->type == TOKEN_MAIN_FUNC) lookahead_name = TERMINALS[5];
-        else if (a->type == TOKEN_LOOP_KW) lookahead_name = TERMINALS[6];
-        else if (a->type == TOKEN_KW_INT) lookahead_name = TERMINALS[1];
-        else if (a->type == TOKEN_KW_DEC) lookahead_name = TERMINALS[2];
-        else if (a->type == TOKEN_INCLUDE) lookahead_name = TERMINALS[0];
-        else if (a->type == TOKEN_NUMBER) lookahead_name = TERMINALS[15];
-        else if (a->type == TOKEN_RETURN) lookahead_name = TERMINALS[17];
-        else if (a->type == TOKEN_PRINTF) lookahead_name = TERMINALS[18];
-        else if (a->type == TOKEN_BREAK) lookahead_name = TERMINALS[19];
-
-
-        // Print stack state
-        if(find_nt(X) != -1) push(X);
-        print_stack();
-        if(find_nt(X) != -1) strcpy(X, pop());
-
-        printf("%-25s %-15s %-10s ", "" , lookahead_name, X);
-
-        // 1. Check if X is a terminal
-        if (find_t(X) != -1) {
-            if (ter_idx != 23 && strcmp(X, lookahead_name) == 0) {
-                printf("%-25s\n", "match");
-                ip++;
-            }
-            else {
-                printf("REJECTED\n");
-                fprintf(stderr, "PARSER ERROR: Expected terminal '%s', found '%s' (%s) at token index %d\n", X, a->lexeme, lookahead_name, ip);
-                return;
-            }
-        }
-        // 2. Check if X is a non-terminal
-        else {
-            int nt_idx = find_nt(X);
-            if (nt_idx == -1 || ter_idx == 23) {
-                printf("REJECTED\n");
-                fprintf(stderr, "PARSER ERROR: Invalid symbol on stack or invalid lookahead\n");
-                return;
-            }
-
-            int prod = TABLE[nt_idx][ter_idx];
-            if (prod == 0) {
-                printf("REJECTED\nNo rule for (%s, %s)\n", X, lookahead_name);
-                return;
-            }
-
-            char *rhs = RHS[prod - 1];
-
-            if (strlen(rhs) == 0) {
-                printf("%-25s\n", "epsilon");
-            } else {
-                printf("%s -> %-25s\n", X, rhs);
-            }
-
-            // Push the production rule to stack (in reverse order)
-            if (strlen(rhs) > 0) {
-                char symbols[10][MAXSYM];
-                int k;
-                split_rhs(rhs, symbols, &k);
-                for(int i=k-1;i>=0;i--) {
-                    push(symbols[i]);
-                }
-            }
-        }
-    }
-
-    if (top == 0 && strcmp(stack[0], "$") == 0 && ip == token_count - 1 && tokens[ip].type == TOKEN_EOF) {
-        print_stack();
-        pop();
-        printf("%-25s %-15s %-10s %-25s\n", "" , "$", "$", "match");
-        printf("\nSYNTAX ACCEPTED (Parser Structure Valid)\n");
-    } else {
-        printf("\nSYNTAX REJECTED: Input not fully consumed or Stack not empty\n");
-    }
-}
-
-// =================================================================
-// MAIN FUNCTION
-// =================================================================
-
-int main() {
-    char filename[100];
-
-    printf("Enter input file name (e.g., input_src): ");
-    if (fgets(filename, sizeof(filename), stdin) == NULL) {
-        fprintf(stderr, "Error reading filename.\n");
-        return 1;
-    }
-    filename[strcspn(filename, "\n")] = '\0';
-
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        printf("Error: Cannot open %s. Make sure the file is in the project folder (or bin/Debug).\n", filename);
-        return 1;
-    }
-
-    char program_text[5000] = {0};
-    size_t bytes_read = fread(program_text, 1, sizeof(program_text) - 1, fp);
-    program_text[bytes_read] = '\0';
-    fclose(fp);
-
-    printf("\n--- INPUT PROGRAM ---\n%s\n", program_text);
-
-    // 1. Lexical Analysis
-    lex(program_text);
-
-    printf("\n--- LEXER OUTPUT (Tokens) ---\n");
-    for (int i = 0; i < token_count; i++) {
-        printf("[%d: %s] ", tokens[i].type, tokens[i].lexeme);
-    }
-    printf("\n");
-
-    // 2. Syntactic Analysis
-    parse();
-
-    return 0;
-}
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <float.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#endif
+
+// =================================================================
+// PART 1: LEXER (DFA-BASED) - CORRECTED
+// =================================================================
+
+// Token Definitions (Matching Parser's Terminals)
+typedef enum {
+    TOKEN_EOF = 0,
+    TOKEN_INCLUDE, // 1: #include<stdio.h>
+    TOKEN_KW_INT, // 2: int
+    TOKEN_KW_DEC, // 3: dec
+    TOKEN_VAR_NAME, // 4: _alpha...digit_alpha
+    TOKEN_FUNC_NAME, // 5: alpha...Fn
+    TOKEN_MAIN_FUNC, // 6: main
+    TOKEN_LOOP_KW, // 7: loop
+    TOKEN_WHILE, // 8: while
+    TOKEN_OPEN_PAREN, // 9: (
+    TOKEN_CLOSE_PAREN, // 10: )
+    TOKEN_OPEN_BRACE, // 11: {
+    TOKEN_CLOSE_BRACE, // 12: }
+    TOKEN_DOTDOT, // 13: .. (End of statement)
+    TOKEN_ASSIGN, // 14: =
+    TOKEN_COMPARATOR, // 15: <
+    TOKEN_NUMBER, // 16: 10, 5, 2.5 etc.
+    TOKEN_PLUS, // 17: +
+    TOKEN_RETURN, // 18: return
+    TOKEN_PRINTF, // 19: printf
+    TOKEN_BREAK, // 20: break
+    TOKEN_COMMA, // 21: ,
+    TOKEN_COLON, // 22: : (For loop termination)
+    TOKEN_ERROR // 23: Unrecognized token
+} TokenType;
+
+// Token store. Tokens are spans (type, offset, length) into the
+// program text rather than copied strings; token_text() recovers the
+// lexeme on demand for diagnostics and tracing. With a name table in the
+// context, identifiers also carry their interned id.
+//
+// Storage is struct-of-arrays in fixed-size blocks that are never moved
+// once allocated, so growing it costs one malloc per block instead of a
+// full copy.
+#define TOKEN_BLOCK_SHIFT 12
+#define TOKEN_BLOCK_SIZE (1 << TOKEN_BLOCK_SHIFT)
+// Token indices are ints. A longer input (about 8GB of source) ends with a
+// lexer error and an early EOF at this many tokens instead of overflowing.
+#define LEX_MAX_TOKENS (INT_MAX - TOKEN_BLOCK_SIZE)
+
+typedef struct {
+    unsigned char type[TOKEN_BLOCK_SIZE];
+    unsigned int length[TOKEN_BLOCK_SIZE];
+    unsigned int name[TOKEN_BLOCK_SIZE]; // interned id of identifiers (CompileContext.names), constant id
+                                         // of numbers (CompileContext.consts), else 0
+    size_t offset[TOKEN_BLOCK_SIZE];
+} TokenBlock;
+
+typedef struct {
+    TokenBlock **blocks;
+    int nblocks;
+    int blocks_cap;
+    const char *text; // program text the spans point into
+    size_t base;      // input offset of text[0]: bytes pull mode has already dropped
+} TokenBuffer;
+
+// Identifier interner. Each distinct _VAR_NAME and FUNC_NAME spelling gets
+// an id (1, 2, ... in order of first appearance) as the lexer adds its
+// token, so later phases compare names as integers. Spellings are copied
+// into char blocks that never move (in pull mode the text they came from
+// may be gone by the time they are looked up); the table is open-addressed
+// on the FNV-1a hash.
+#define NAME_BLOCK_SIZE 65536
+
+typedef struct {
+    const char *text;
+    unsigned int len;
+    unsigned int hash;
+} InternName;
+
+typedef struct {
+    unsigned int *slots;   // ids, 0 = empty
+    unsigned int cap;      // slots: a power of two, at least twice count
+    InternName *names;     // [id]; names[0] is unused
+    unsigned int count;    // ids handed out so far
+    unsigned int names_cap;
+    char **blocks;
+    int nblocks, blocks_cap;
+    size_t block_used;     // bytes used in the newest block
+} Interner;
+
+// Literal constant pool. With a pool in the context the lexer decodes each
+// NUMBER as it adds the token and keeps one entry per distinct constant;
+// the token's name slot holds the entry's id (1, 2, ... in order of first
+// appearance), so later phases get typed values without converting the
+// digits again. Open-addressed on the value's bits, like the Interner.
+typedef struct {
+    union {
+        long long i;
+        double d;
+    } v;
+    unsigned char dec;      // [0-9]+\.[0-9]+ in v.d, else [0-9]+ in v.i
+    unsigned char overflow; // too large: v.i is LLONG_MAX, v.d infinity
+} Literal;
+
+typedef struct {
+    unsigned int *slots;   // ids, 0 = empty
+    unsigned int cap;      // slots: a power of two, at least twice count
+    Literal *items;        // [id]; items[0] is unused
+    unsigned int count;    // ids handed out so far
+    unsigned int items_cap;
+} ConstPool;
+
+// Failed (state, position) pairs remembered by the linear-time lexer
+// (LEX_ENGINE_LINEAR): a bit per DFA state and input byte, set once a scan
+// that was in that state at that byte went on without reaching another
+// accepting state. Only the window [lo, hi) since the token being scanned
+// is kept, one row of bits per state.
+typedef struct {
+    unsigned long long *bits; // [state * stride + word]
+    size_t stride;            // words per state row
+    size_t lo, hi;            // positions the rows cover; lo is a multiple of 64
+    unsigned long long rows[4]; // states with bits set
+} LexMemo;
+
+// Everything one compilation touches. The lexer and parser tables are
+// global but read-only once lexer_init()/parser_init() have run, so any
+// number of contexts can be compiled concurrently, one per thread.
+//
+// In pull mode (context_pull()) the parser asks for tokens as it needs
+// them: block 0 is reused as a ring of TOKEN_BLOCK_SIZE tokens and pull()
+// lexes more input until token_count reaches token_limit, so token memory
+// stays constant and lexing stops as soon as parsing does. Without an AST
+// nothing refers back to text the lexer is done with either, and a
+// streamed input keeps only the bytes from the current token on.
+typedef struct CompileContext CompileContext;
+typedef struct AstArena AstArena;
+typedef struct TraceSink TraceSink;
+typedef struct CompileStats CompileStats;
+struct CompileContext {
+    TokenBuffer tokens;
+    int token_count;
+    int block_mask;  // ~0 keeps every block; 0 makes block 0 a ring (pull mode)
+    int token_limit; // the lexer pauses once token_count reaches this
+    int (*pull)(CompileContext *ctx); // lexes more input; 0 at end of input. NULL = all lexed up front
+    void *pull_state;
+
+    unsigned char *stack; // parser stack of Sym (PART 2)
+    int top;
+    int stack_cap;
+    int *stack_node; // AST node of each stack entry, -1 for none (parallel to stack)
+    AstArena *ast;   // parse() builds the tree here when set
+
+    FILE *diag;  // lexer and parser errors as they happen; NULL silences them
+    TraceSink *trace; // where parse() reports each step; NULL = quiet
+    CompileStats *stats; // counters and phase timers; NULL = off
+    Interner *names;     // interns identifier tokens as they are added; NULL = off
+    ConstPool *consts;   // decodes NUMBER tokens into constants as they are added; NULL = off
+    LexMemo memo;        // linear-time lexing (PART 1)
+    long long token_base; // added to token indices in parser errors (PARTs 8 and 10 parse a program in pieces)
+    long parse_steps; // matches and expansions of the last parse_from()
+    int cached;       // the last cache_parse() loaded its result from the parse cache (PART 3)
+    int lex_errors;
+    int errors;
+    char first_error[256]; // first error message, kept for batch summaries
+};
+
+void context_init(CompileContext *ctx, FILE *diag, TraceSink *trace) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->block_mask = ~0;
+    ctx->token_limit = LEX_MAX_TOKENS;
+    ctx->top = -1;
+    ctx->diag = diag;
+    ctx->trace = trace;
+}
+
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+void report_error(CompileContext *ctx, const char *fmt, ...) {
+    va_list ap;
+    if (ctx->errors++ == 0) {
+        va_start(ap, fmt);
+        vsnprintf(ctx->first_error, sizeof(ctx->first_error), fmt, ap);
+        va_end(ap);
+    }
+    if (ctx->diag) {
+        va_start(ap, fmt);
+        vfprintf(ctx->diag, fmt, ap);
+        va_end(ap);
+        fputc('\n', ctx->diag);
+    }
+}
+
+#define TOKEN_BLOCK(ctx, i) ((ctx)->tokens.blocks[((i) >> TOKEN_BLOCK_SHIFT) & (ctx)->block_mask])
+#define TOKEN_SLOT(i) ((i) & (TOKEN_BLOCK_SIZE - 1))
+#define token_type(ctx, i) ((TokenType)TOKEN_BLOCK(ctx, i)->type[TOKEN_SLOT(i)])
+#define token_offset(ctx, i) (TOKEN_BLOCK(ctx, i)->offset[TOKEN_SLOT(i)])
+#define token_length(ctx, i) ((int)TOKEN_BLOCK(ctx, i)->length[TOKEN_SLOT(i)])
+#define token_name(ctx, i) (TOKEN_BLOCK(ctx, i)->name[TOKEN_SLOT(i)]) // interned or constant id, 0 if none
+
+// realloc() that exits when out of memory.
+void *intern_grow(void *p, size_t n, size_t size) {
+    void *grown = realloc(p, n * size);
+    if (!grown) {
+        fprintf(stderr, "Lexer Error: Out of memory growing the name table\n");
+        exit(1);
+    }
+    return grown;
+}
+
+unsigned int name_hash(const char *name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+// Returns the id of name[0 .. len), adding it if it is new.
+unsigned int intern(Interner *in, const char *name, size_t len) {
+    unsigned int h = name_hash(name, len), mask = in->cap - 1;
+    if (in->cap) {
+        for (unsigned int i = h & mask; in->slots[i]; i = (i + 1) & mask) {
+            InternName *x = &in->names[in->slots[i]];
+            if (x->hash == h && x->len == len && memcmp(x->text, name, len) == 0) return in->slots[i];
+        }
+    }
+
+    if (2 * (in->count + 1) > in->cap) {
+        unsigned int cap = in->cap ? in->cap * 2 : 256;
+        free(in->slots);
+        in->slots = calloc(cap, sizeof(unsigned int));
+        if (!in->slots) {
+            fprintf(stderr, "Lexer Error: Out of memory growing the name table\n");
+            exit(1);
+        }
+        in->cap = cap;
+        mask = cap - 1;
+        for (unsigned int id = 1; id <= in->count; id++) {
+            unsigned int i = in->names[id].hash & mask;
+            while (in->slots[i]) i = (i + 1) & mask;
+            in->slots[i] = id;
+        }
+    }
+    if (in->nblocks == 0 || in->block_used + len > NAME_BLOCK_SIZE) {
+        if (in->nblocks == in->blocks_cap) {
+            in->blocks_cap = in->blocks_cap ? in->blocks_cap * 2 : 16;
+            in->blocks = intern_grow(in->blocks, (size_t)in->blocks_cap, sizeof(char *));
+        }
+        // A spelling longer than a block gets one of its own
+        in->blocks[in->nblocks++] = intern_grow(NULL, len > NAME_BLOCK_SIZE ? len : NAME_BLOCK_SIZE, 1);
+        in->block_used = 0;
+    }
+    char *copy = in->blocks[in->nblocks - 1] + in->block_used;
+    memcpy(copy, name, len);
+    in->block_used += len;
+
+    if (in->count + 1 >= in->names_cap) {
+        in->names_cap = in->names_cap ? in->names_cap * 2 : 256;
+        in->names = intern_grow(in->names, in->names_cap, sizeof(InternName));
+    }
+    unsigned int id = ++in->count;
+    in->names[id].text = copy;
+    in->names[id].len = (unsigned int)len;
+    in->names[id].hash = h;
+    unsigned int i = h & mask;
+    while (in->slots[i]) i = (i + 1) & mask;
+    in->slots[i] = id;
+    return id;
+}
+
+void interner_free(Interner *in) {
+    for (int i = 0; i < in->nblocks; i++) free(in->blocks[i]);
+    free(in->blocks);
+    free(in->slots);
+    free(in->names);
+    memset(in, 0, sizeof(*in));
+}
+
+// Value of the eight ASCII digits at p, SWAR style: loaded as one
+// little-endian word (first digit in the low byte), then adjacent lanes
+// are combined into 2-, 4- and finally one 8-digit number. No lane carries
+// into the next, since each partial value fits its widened lane.
+unsigned int digits8(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    unsigned long long w = 0;
+    for (int k = 7; k >= 0; k--) w = w << 8 | u[k]; // compiles to a single load
+    w -= 0x3030303030303030ULL;
+    w = (w * 10 + (w >> 8)) & 0x00ff00ff00ff00ffULL;
+    w = (w * 100 + (w >> 16)) & 0x0000ffff0000ffffULL;
+    return (unsigned int)(w * 10000 + (w >> 32));
+}
+
+// Value of the decimal digits p[0 .. n), eight at a time. Returns 0 if it
+// has more than 19 significant digits, which may not fit in 64 bits.
+int digits_value(const char *p, size_t n, unsigned long long *value) {
+    while (n > 0 && *p == '0') {
+        p++;
+        n--;
+    }
+    if (n > 19) return 0;
+    unsigned long long v = 0;
+    size_t head = n & 7;
+    for (size_t i = 0; i < head; i++) v = v * 10 + (unsigned)(p[i] - '0');
+    for (size_t i = head; i < n; i += 8) v = v * 100000000ULL + digits8(p + i);
+    *value = v;
+    return 1;
+}
+
+// Decodes a NUMBER lexeme: [0-9]+ to a 64-bit integer, [0-9]+\.[0-9]+ to
+// the nearest double. A decimal whose digits fit in 53 bits, over at most
+// 22 fraction digits, is one exact division by an exact power of ten;
+// longer ones go through strtod().
+Literal literal_decode(const char *p, size_t len) {
+    static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const unsigned long long max_exact = 1ULL << 53;
+    Literal lit;
+    unsigned long long whole, frac;
+    memset(&lit, 0, sizeof(lit));
+    const char *dot = memchr(p, '.', len);
+    if (!dot) {
+        lit.overflow = !digits_value(p, len, &whole) || whole > LLONG_MAX;
+        lit.v.i = lit.overflow ? LLONG_MAX : (long long)whole;
+        return lit;
+    }
+
+    lit.dec = 1;
+    size_t whole_len = (size_t)(dot - p), frac_len = len - whole_len - 1;
+    while (frac_len > 0 && dot[frac_len] == '0') frac_len--;
+    if (frac_len < 16 && digits_value(p, whole_len, &whole) && digits_value(dot + 1, frac_len, &frac) &&
+        whole <= (max_exact - frac) / (unsigned long long)POW10[frac_len]) {
+        lit.v.d = (double)(whole * (unsigned long long)POW10[frac_len] + frac) / POW10[frac_len];
+        return lit;
+    }
+    if (frac_len <= 22 && digits_value(dot + 1, frac_len, &frac) && frac <= max_exact &&
+        digits_value(p, whole_len, &whole) && whole == 0) {
+        lit.v.d = (double)frac / POW10[frac_len];
+        return lit;
+    }
+    char small[64], *copy = len < sizeof(small) ? small : malloc(len + 1);
+    if (!copy) {
+        fprintf(stderr, "Lexer Error: Out of memory decoding a literal\n");
+        exit(1);
+    }
+    memcpy(copy, p, len);
+    copy[len] = '\0';
+    lit.v.d = strtod(copy, NULL);
+    lit.overflow = lit.v.d > DBL_MAX;
+    if (copy != small) free(copy);
+    return lit;
+}
+
+unsigned int literal_hash(const Literal *lit) {
+    unsigned long long k = (unsigned long long)lit->v.i ^ ((unsigned long long)lit->dec << 1 | lit->overflow);
+    return (unsigned int)((k * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// Returns the id of lit in the pool, adding it if it is new.
+unsigned int const_add(ConstPool *pool, Literal lit) {
+    unsigned int h = literal_hash(&lit), mask = pool->cap - 1;
+    if (pool->cap) {
+        for (unsigned int i = h & mask; pool->slots[i]; i = (i + 1) & mask) {
+            const Literal *x = &pool->items[pool->slots[i]];
+            if (x->v.i == lit.v.i && x->dec == lit.dec && x->overflow == lit.overflow) return pool->slots[i];
+        }
+    }
+
+    if (2 * (pool->count + 1) > pool->cap) {
+        unsigned int cap = pool->cap ? pool->cap * 2 : 256;
+        free(pool->slots);
+        pool->slots = calloc(cap, sizeof(unsigned int));
+        if (!pool->slots) {
+            fprintf(stderr, "Lexer Error: Out of memory growing the constant pool\n");
+            exit(1);
+        }
+        pool->cap = cap;
+        mask = cap - 1;
+        for (unsigned int id = 1; id <= pool->count; id++) {
+            unsigned int i = literal_hash(&pool->items[id]) & mask;
+            while (pool->slots[i]) i = (i + 1) & mask;
+            pool->slots[i] = id;
+        }
+    }
+    if (pool->count + 1 >= pool->items_cap) {
+        unsigned int cap = pool->items_cap ? pool->items_cap * 2 : 256;
+        Literal *grown = realloc(pool->items, cap * sizeof(Literal));
+        if (!grown) {
+            fprintf(stderr, "Lexer Error: Out of memory growing the constant pool\n");
+            exit(1);
+        }
+        pool->items = grown;
+        pool->items_cap = cap;
+    }
+    unsigned int id = ++pool->count;
+    pool->items[id] = lit;
+    unsigned int i = h & mask;
+    while (pool->slots[i]) i = (i + 1) & mask;
+    pool->slots[i] = id;
+    return id;
+}
+
+// Empties the pool but keeps its memory for the next parse.
+void const_pool_clear(ConstPool *pool) {
+    if (pool->cap) memset(pool->slots, 0, pool->cap * sizeof(unsigned int));
+    pool->count = 0;
+}
+
+void const_pool_free(ConstPool *pool) {
+    free(pool->slots);
+    free(pool->items);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Appends an empty block to the token store.
+void token_grow(TokenBuffer *tokens) {
+    if (tokens->nblocks == tokens->blocks_cap) {
+        int cap = tokens->blocks_cap ? tokens->blocks_cap * 2 : 16;
+        TokenBlock **grown = realloc(tokens->blocks, (size_t)cap * sizeof(TokenBlock *));
+        if (!grown) {
+            fprintf(stderr, "Lexer Error: Out of memory growing token buffer\n");
+            exit(1);
+        }
+        tokens->blocks = grown;
+        tokens->blocks_cap = cap;
+    }
+    tokens->blocks[tokens->nblocks] = malloc(sizeof(TokenBlock));
+    if (!tokens->blocks[tokens->nblocks]) {
+        fprintf(stderr, "Lexer Error: Out of memory growing token buffer\n");
+        exit(1);
+    }
+    tokens->nblocks++;
+}
+
+void add_token(CompileContext *ctx, TokenType type, size_t offset, size_t len) {
+    if (((ctx->token_count >> TOKEN_BLOCK_SHIFT) & ctx->block_mask) == ctx->tokens.nblocks) token_grow(&ctx->tokens);
+
+    TokenBlock *b = TOKEN_BLOCK(ctx, ctx->token_count);
+    int slot = TOKEN_SLOT(ctx->token_count);
+    b->type[slot] = (unsigned char)type;
+    b->offset[slot] = ctx->tokens.base + offset;
+    b->length[slot] = (unsigned int)len;
+    b->name[slot] = 0;
+    if (ctx->names && (type == TOKEN_VAR_NAME || type == TOKEN_FUNC_NAME)) {
+        b->name[slot] = intern(ctx->names, ctx->tokens.text + offset, len);
+    } else if (ctx->consts && type == TOKEN_NUMBER) {
+        b->name[slot] = const_add(ctx->consts, literal_decode(ctx->tokens.text + offset, len));
+    }
+    ctx->token_count++;
+}
+
+// Lexeme of token i as a (pointer, length) pair; the empty EOF span reads as "$".
+const char *token_text(const CompileContext *ctx, int i, int *len) {
+    if (token_length(ctx, i) == 0) {
+        *len = 1;
+        return "$";
+    }
+    *len = token_length(ctx, i);
+    return ctx->tokens.text + (token_offset(ctx, i) - ctx->tokens.base);
+}
+
+void free_tokens(CompileContext *ctx) {
+    for (int i = 0; i < ctx->tokens.nblocks; i++) free(ctx->tokens.blocks[i]);
+    free(ctx->tokens.blocks);
+    memset(&ctx->tokens, 0, sizeof(ctx->tokens));
+    ctx->token_count = 0;
+}
+
+// Switches ctx to pull mode: tokens are produced on demand by pull(ctx).
+void context_pull(CompileContext *ctx, int (*pull)(CompileContext *ctx), void *state) {
+    if (ctx->block_mask != 0) free_tokens(ctx); // a ring block from an earlier pull is kept
+    ctx->block_mask = 0;
+    ctx->pull = pull;
+    ctx->pull_state = state;
+}
+
+// Switches ctx back from pull mode: lex() fills the token store before
+// parse() reads it.
+void context_buffered(CompileContext *ctx) {
+    if (ctx->block_mask == 0) free_tokens(ctx); // the ring block is sized for pull mode only
+    ctx->block_mask = ~0;
+    ctx->token_limit = LEX_MAX_TOKENS;
+    ctx->pull = NULL;
+    ctx->pull_state = NULL;
+    ctx->tokens.base = 0;
+}
+
+void context_free(CompileContext *ctx) {
+    free_tokens(ctx);
+    free(ctx->stack);
+    free(ctx->stack_node);
+    free(ctx->memo.bits);
+    memset(&ctx->memo, 0, sizeof(ctx->memo));
+    ctx->stack = NULL;
+    ctx->stack_node = NULL;
+    ctx->stack_cap = 0;
+    ctx->top = -1;
+}
+
+const char *TOKEN_TYPE_NAMES[] = {
+    "TOKEN_EOF", "TOKEN_INCLUDE", "TOKEN_KW_INT", "TOKEN_KW_DEC", "TOKEN_VAR_NAME", "TOKEN_FUNC_NAME",
+    "TOKEN_MAIN_FUNC", "TOKEN_LOOP_KW", "TOKEN_WHILE", "TOKEN_OPEN_PAREN", "TOKEN_CLOSE_PAREN",
+    "TOKEN_OPEN_BRACE", "TOKEN_CLOSE_BRACE", "TOKEN_DOTDOT", "TOKEN_ASSIGN", "TOKEN_COMPARATOR",
+    "TOKEN_NUMBER", "TOKEN_PLUS", "TOKEN_RETURN", "TOKEN_PRINTF", "TOKEN_BREAK", "TOKEN_COMMA",
+    "TOKEN_COLON", "TOKEN_ERROR"
+};
+
+// Token specification: one regular expression per token type. When two
+// entries match the same longest lexeme, the earlier one wins (keywords
+// before FUNC_NAME). Syntax: literals, \x escapes, [a-z0-9] classes,
+// ( | ) grouping and the * + ? operators.
+typedef struct {
+    TokenType type;
+    const char *regex;
+} TokenSpec;
+
+TokenSpec TOKEN_SPEC[] = {
+    {TOKEN_INCLUDE, "#include<stdio\\.h>"},
+    {TOKEN_KW_INT, "int"},
+    {TOKEN_KW_DEC, "dec"},
+    {TOKEN_MAIN_FUNC, "main"},
+    {TOKEN_LOOP_KW, "loop"},
+    {TOKEN_WHILE, "while"},
+    {TOKEN_RETURN, "return"},
+    {TOKEN_PRINTF, "printf"},
+    {TOKEN_BREAK, "break"},
+    {TOKEN_VAR_NAME, "_[a-z]+[0-9][a-z]"},   // _alpha...digit_alpha
+    {TOKEN_FUNC_NAME, "[a-z][a-z0-9]*Fn"},   // alpha...Fn
+    {TOKEN_COLON, "loop_[a-z]+[0-9][0-9]:"}, // loop label form (loop_...:)
+    {TOKEN_NUMBER, "[0-9]+(\\.[0-9]+)?"},   // int or dec literal
+    {TOKEN_DOTDOT, "\\.\\."},
+    {TOKEN_OPEN_PAREN, "\\("},
+    {TOKEN_CLOSE_PAREN, "\\)"},
+    {TOKEN_OPEN_BRACE, "{"},
+    {TOKEN_CLOSE_BRACE, "}"},
+    {TOKEN_ASSIGN, "="},
+    {TOKEN_COMPARATOR, "<"},
+    {TOKEN_PLUS, "\\+"},
+    {TOKEN_COMMA, ","},
+    {TOKEN_COLON, ":"},
+};
+#define NSPEC ((int)(sizeof(TOKEN_SPEC) / sizeof(TOKEN_SPEC[0])))
+
+// --- DFA generator: Thompson NFA -> subset construction -> Hopcroft ---
+
+typedef struct {
+    int out1, out2;               // successors (-1 = none); a set state only uses out1
+    int has_set;                  // 1: consumes one byte from set, else epsilon
+    int accept;                   // TOKEN_SPEC index + 1, 0 = not accepting
+    unsigned long long set[4];    // 256-bit byte set
+} NfaState;
+
+typedef struct {
+    NfaState *nfa;
+    int n, cap;
+    const char *p;                // regex cursor
+    int spec;                     // spec being parsed (for error messages)
+} NfaBuilder;
+
+typedef struct {
+    int start, end;               // end is a fresh epsilon state with no successors
+} Frag;
+
+#define SET_HAS(s, b) (((s)[(b) >> 6] >> ((b) & 63)) & 1ULL)
+#define SET_ADD(s, b) ((s)[(b) >> 6] |= 1ULL << ((b) & 63))
+
+void lexgen_fail(NfaBuilder *b, const char *msg) {
+    fprintf(stderr, "Lexer Spec Error: %s in /%s/ (%s)\n", msg, TOKEN_SPEC[b->spec].regex, TOKEN_TYPE_NAMES[TOKEN_SPEC[b->spec].type]);
+    exit(1);
+}
+
+int nfa_new(NfaBuilder *b) {
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        b->nfa = realloc(b->nfa, (size_t)b->cap * sizeof(NfaState));
+        if (!b->nfa) lexgen_fail(b, "out of memory");
+    }
+    NfaState *s = &b->nfa[b->n];
+    memset(s, 0, sizeof(*s));
+    s->out1 = s->out2 = -1;
+    return b->n++;
+}
+
+Frag nfa_set_frag(NfaBuilder *b, const unsigned long long *set) {
+    int s = nfa_new(b), e = nfa_new(b);
+    b->nfa[s].has_set = 1;
+    memcpy(b->nfa[s].set, set, sizeof(b->nfa[s].set));
+    b->nfa[s].out1 = e;
+    return (Frag){s, e};
+}
+
+Frag parse_alt(NfaBuilder *b);
+
+int regex_char(NfaBuilder *b) {
+    if (*b->p == '\0') lexgen_fail(b, "unexpected end of pattern");
+    if (*b->p == '\\') {
+        b->p++;
+        if (*b->p == '\0') lexgen_fail(b, "dangling escape");
+    }
+    return (unsigned char)*b->p++;
+}
+
+Frag parse_atom(NfaBuilder *b) {
+    unsigned long long set[4] = {0, 0, 0, 0};
+    if (*b->p == '(') {
+        b->p++;
+        Frag f = parse_alt(b);
+        if (*b->p != ')') lexgen_fail(b, "missing ')'");
+        b->p++;
+        return f;
+    }
+    if (*b->p == '[') {
+        b->p++;
+        while (*b->p != ']') {
+            int lo = regex_char(b), hi = lo;
+            if (*b->p == '-' && b->p[1] != ']') {
+                b->p++;
+                hi = regex_char(b);
+            }
+            if (hi < lo) lexgen_fail(b, "reversed range");
+            for (int c = lo; c <= hi; c++) SET_ADD(set, c);
+        }
+        b->p++;
+        return nfa_set_frag(b, set);
+    }
+    int c = regex_char(b);
+    SET_ADD(set, c);
+    return nfa_set_frag(b, set);
+}
+
+Frag parse_repeat(NfaBuilder *b) {
+    Frag a = parse_atom(b);
+    while (*b->p == '*' || *b->p == '+' || *b->p == '?') {
+        char op = *b->p++;
+        int e = nfa_new(b);
+        if (op == '+') {
+            b->nfa[a.end].out1 = a.start;
+            b->nfa[a.end].out2 = e;
+            a.end = e;
+            continue;
+        }
+        int s = nfa_new(b);
+        b->nfa[s].out1 = a.start;
+        b->nfa[s].out2 = e;
+        b->nfa[a.end].out1 = (op == '*') ? a.start : e;
+        if (op == '*') b->nfa[a.end].out2 = e;
+        a = (Frag){s, e};
+    }
+    return a;
+}
+
+Frag parse_concat(NfaBuilder *b) {
+    Frag f = {-1, -1};
+    while (*b->p && *b->p != '|' && *b->p != ')') {
+        Frag g = parse_repeat(b);
+        if (f.start < 0) {
+            f = g;
+        } else {
+            b->nfa[f.end].out1 = g.start;
+            f.end = g.end;
+        }
+    }
+    if (f.start < 0) {
+        int s = nfa_new(b);
+        f = (Frag){s, s};
+    }
+    return f;
+}
+
+Frag parse_alt(NfaBuilder *b) {
+    Frag f = parse_concat(b);
+    while (*b->p == '|') {
+        b->p++;
+        Frag g = parse_concat(b);
+        int s = nfa_new(b), e = nfa_new(b);
+        b->nfa[s].out1 = f.start;
+        b->nfa[s].out2 = g.start;
+        b->nfa[f.end].out1 = e;
+        b->nfa[g.end].out1 = e;
+        f = (Frag){s, e};
+    }
+    return f;
+}
+
+// Adds the epsilon closure of set (a bitset over NFA states) to itself.
+void nfa_closure(const NfaBuilder *b, unsigned long long *set, int *work) {
+    int sp = 0;
+    for (int s = 0; s < b->n; s++) if (SET_HAS(set, s)) work[sp++] = s;
+    while (sp > 0) {
+        const NfaState *st = &b->nfa[work[--sp]];
+        if (st->has_set) continue;
+        int outs[2] = {st->out1, st->out2};
+        for (int k = 0; k < 2; k++) {
+            if (outs[k] >= 0 && !SET_HAS(set, outs[k])) {
+                SET_ADD(set, outs[k]);
+                work[sp++] = outs[k];
+            }
+        }
+    }
+}
+
+// Generated lexer tables. State 0 is the dead state, state 1 the start.
+#define DFA_DEAD 0
+#define DFA_START 1
+#define DFA_MAX_STATES 255
+int dfa_nstates = 0;
+int dfa_nclasses = 0;
+unsigned char dfa_class[256];         // byte -> input class
+unsigned char *dfa_next = NULL;       // [state * dfa_nclasses + class]
+unsigned char dfa_accept[DFA_MAX_STATES + 1]; // state -> TokenType (TOKEN_ERROR = not accepting)
+int lexgen_nfa_states = 0, lexgen_subset_states = 0;
+
+#define DFA_STEP(state, byte) (dfa_next[(state) * dfa_nclasses + dfa_class[(unsigned char)(byte)]])
+
+// Hopcroft partition refinement over a complete DFA with n states and k
+// classes. block[] gets each state's equivalence class; returns the count.
+int hopcroft_minimize(int n, int k, const int *trans, const int *accept, int *block) {
+    int *elems = malloc(sizeof(int) * n), *loc = malloc(sizeof(int) * n);
+    int *first = malloc(sizeof(int) * n), *size = malloc(sizeof(int) * n), *marked = calloc((size_t)n, sizeof(int));
+    int *inv_start = calloc((size_t)(n * k + 1), sizeof(int)), *inv = malloc(sizeof(int) * (size_t)(n * k));
+    char *in_work = calloc((size_t)(n * k), 1);
+    int *work = malloc(sizeof(int) * (size_t)(n * k)), *splitter = malloc(sizeof(int) * n), *touched = malloc(sizeof(int) * n);
+    int nblocks = 0, nwork = 0;
+
+    // Inverse transitions, bucketed by (target, class)
+    for (int s = 0; s < n; s++)
+        for (int c = 0; c < k; c++) inv_start[trans[s * k + c] * k + c + 1]++;
+    for (int i = 0; i < n * k; i++) inv_start[i + 1] += inv_start[i];
+    int *fill = malloc(sizeof(int) * (size_t)(n * k));
+    memcpy(fill, inv_start, sizeof(int) * (size_t)(n * k));
+    for (int s = 0; s < n; s++)
+        for (int c = 0; c < k; c++) inv[fill[trans[s * k + c] * k + c]++] = s;
+    free(fill);
+
+    // Initial partition: one block per accepted token type
+    int pos = 0;
+    for (int t = 0; t <= TOKEN_ERROR; t++) {
+        int begin = pos;
+        for (int s = 0; s < n; s++) {
+            if (accept[s] != t) continue;
+            elems[pos] = s;
+            loc[s] = pos++;
+            block[s] = nblocks;
+        }
+        if (pos > begin) {
+            first[nblocks] = begin;
+            size[nblocks] = pos - begin;
+            for (int c = 0; c < k; c++) {
+                work[nwork++] = nblocks * k + c;
+                in_work[nblocks * k + c] = 1;
+            }
+            nblocks++;
+        }
+    }
+
+    while (nwork > 0) {
+        int item = work[--nwork];
+        int a = item / k, c = item % k;
+        in_work[item] = 0;
+
+        int nsplit = 0, ntouched = 0;
+        for (int i = 0; i < size[a]; i++) splitter[nsplit++] = elems[first[a] + i];
+
+        // Move every predecessor of the splitter on c to the front of its block
+        for (int i = 0; i < nsplit; i++) {
+            int t = splitter[i];
+            for (int j = inv_start[t * k + c]; j < inv_start[t * k + c + 1]; j++) {
+                int q = inv[j], y = block[q];
+                int at = first[y] + marked[y];
+                if (loc[q] < at) continue; // already moved
+                if (marked[y] == 0) touched[ntouched++] = y;
+                int other = elems[at];
+                elems[at] = q;
+                elems[loc[q]] = other;
+                loc[other] = loc[q];
+                loc[q] = at;
+                marked[y]++;
+            }
+        }
+
+        for (int i = 0; i < ntouched; i++) {
+            int y = touched[i], m = marked[y];
+            marked[y] = 0;
+            if (m == size[y]) continue;
+            int z = nblocks++;
+            first[z] = first[y];
+            size[z] = m;
+            first[y] += m;
+            size[y] -= m;
+            for (int j = first[z]; j < first[z] + size[z]; j++) block[elems[j]] = z;
+            for (int cc = 0; cc < k; cc++) {
+                int add = (in_work[y * k + cc] || size[z] <= size[y]) ? z : y;
+                if (!in_work[add * k + cc]) {
+                    in_work[add * k + cc] = 1;
+                    work[nwork++] = add * k + cc;
+                }
+            }
+        }
+    }
+
+    free(elems); free(loc); free(first); free(size); free(marked);
+    free(inv_start); free(inv); free(in_work); free(work); free(splitter); free(touched);
+    return nblocks;
+}
+
+// Builds dfa_* from TOKEN_SPEC.
+void build_lexer_dfa() {
+    NfaBuilder b = {0};
+
+    // 1. Thompson construction: root -> (spec 0 | spec 1 | ...)
+    int root = -1, prev = -1;
+    for (int i = 0; i < NSPEC; i++) {
+        b.spec = i;
+        b.p = TOKEN_SPEC[i].regex;
+        int entry = nfa_new(&b);
+        Frag f = parse_alt(&b);
+        if (*b.p != '\0') lexgen_fail(&b, "unbalanced ')'");
+        b.nfa[entry].out1 = f.start;
+        b.nfa[f.end].accept = i + 1;
+        if (prev >= 0) b.nfa[prev].out2 = entry;
+        else root = entry;
+        prev = entry;
+    }
+    lexgen_nfa_states = b.n;
+
+    // 2. Byte equivalence classes: bytes no byte-set state can tell apart
+    int nclasses = 0, class_rep[256];
+    for (int c = 0; c < 256; c++) {
+        int cls = -1;
+        for (int k = 0; k < nclasses && cls < 0; k++) {
+            int same = 1;
+            for (int s = 0; s < b.n && same; s++)
+                if (b.nfa[s].has_set && SET_HAS(b.nfa[s].set, c) != SET_HAS(b.nfa[s].set, class_rep[k])) same = 0;
+            if (same) cls = k;
+        }
+        if (cls < 0) {
+            cls = nclasses++;
+            class_rep[cls] = c;
+        }
+        dfa_class[c] = (unsigned char)cls;
+    }
+
+    // 3. Subset construction (state 0 = empty set = dead)
+    int words = (b.n + 63) / 64, cap = 64, n = 2;
+    unsigned long long *sets = calloc((size_t)cap * words, sizeof(unsigned long long));
+    int *trans = malloc(sizeof(int) * (size_t)cap * nclasses);
+    int *work = malloc(sizeof(int) * (size_t)b.n);
+    unsigned long long *next = malloc(sizeof(unsigned long long) * (size_t)words);
+    SET_ADD(&sets[1 * words], root);
+    nfa_closure(&b, &sets[1 * words], work);
+    for (int c = 0; c < nclasses; c++) trans[c] = 0;
+
+    for (int s = 1; s < n; s++) {
+        for (int c = 0; c < nclasses; c++) {
+            memset(next, 0, sizeof(unsigned long long) * (size_t)words);
+            for (int q = 0; q < b.n; q++)
+                if (SET_HAS(&sets[s * words], q) && b.nfa[q].has_set && SET_HAS(b.nfa[q].set, class_rep[c]))
+                    SET_ADD(next, b.nfa[q].out1);
+            nfa_closure(&b, next, work);
+
+            int t = 0;
+            while (t < n && memcmp(&sets[t * words], next, sizeof(unsigned long long) * (size_t)words) != 0) t++;
+            if (t == n) {
+                if (n == cap) {
+                    cap *= 2;
+                    sets = realloc(sets, sizeof(unsigned long long) * (size_t)cap * words);
+                    trans = realloc(trans, sizeof(int) * (size_t)cap * nclasses);
+                }
+                memcpy(&sets[n * words], next, sizeof(unsigned long long) * (size_t)words);
+                n++;
+            }
+            trans[s * nclasses + c] = t;
+        }
+    }
+    lexgen_subset_states = n;
+
+    int *accept = malloc(sizeof(int) * (size_t)n);
+    for (int s = 0; s < n; s++) {
+        int best = 0;
+        for (int q = 0; q < b.n; q++)
+            if (SET_HAS(&sets[s * words], q) && b.nfa[q].accept && (!best || b.nfa[q].accept < best)) best = b.nfa[q].accept;
+        accept[s] = best ? (int)TOKEN_SPEC[best - 1].type : TOKEN_ERROR;
+    }
+
+    // 4. Hopcroft minimisation. States that can no longer reach an accepting
+    // state fall into the dead block, so the scanner stops as early as possible.
+    int *block = malloc(sizeof(int) * (size_t)n);
+    int nblocks = hopcroft_minimize(n, nclasses, trans, accept, block);
+    if (nblocks > DFA_MAX_STATES) {
+        fprintf(stderr, "Lexer Spec Error: %d DFA states exceed the limit of %d\n", nblocks, DFA_MAX_STATES);
+        exit(1);
+    }
+
+    // Renumber blocks: dead = 0, start = 1, the rest in breadth-first order
+    int *number = malloc(sizeof(int) * (size_t)nblocks), *order = malloc(sizeof(int) * (size_t)nblocks);
+    int *rep = malloc(sizeof(int) * (size_t)nblocks);
+    for (int i = 0; i < nblocks; i++) number[i] = -1;
+    for (int s = n - 1; s >= 0; s--) rep[block[s]] = s;
+    int count = 0;
+    number[block[0]] = count;
+    order[count++] = block[0];
+    if (number[block[1]] < 0) {
+        number[block[1]] = count;
+        order[count++] = block[1];
+    }
+    for (int i = 1; i < count; i++) {
+        for (int c = 0; c < nclasses; c++) {
+            int y = block[trans[rep[order[i]] * nclasses + c]];
+            if (number[y] < 0) {
+                number[y] = count;
+                order[count++] = y;
+            }
+        }
+    }
+
+    dfa_nstates = count;
+    dfa_nclasses = nclasses;
+    free(dfa_next);
+    dfa_next = malloc((size_t)count * nclasses);
+    for (int i = 0; i < count; i++) {
+        int s = rep[order[i]];
+        dfa_accept[i] = (unsigned char)accept[s];
+        for (int c = 0; c < nclasses; c++) dfa_next[i * nclasses + c] = (unsigned char)number[block[trans[s * nclasses + c]]];
+    }
+    dfa_accept[DFA_DEAD] = TOKEN_ERROR;
+
+    free(number); free(order); free(rep); free(block); free(accept);
+    free(sets); free(trans); free(work); free(next); free(b.nfa);
+}
+
+// Digest of the generated tables; the direct-coded scanner below records
+// the digest it was generated from so a stale copy is detected at startup.
+unsigned long long dfa_fingerprint() {
+    unsigned long long h = 1469598103934665603ULL;
+#define FP_MIX(v) (h = (h ^ (unsigned long long)(v)) * 1099511628211ULL)
+    FP_MIX(dfa_nstates);
+    FP_MIX(dfa_nclasses);
+    for (int c = 0; c < 256; c++) FP_MIX(dfa_class[c]);
+    for (int i = 0; i < dfa_nstates * dfa_nclasses; i++) FP_MIX(dfa_next[i]);
+    for (int s = 0; s < dfa_nstates; s++) FP_MIX(dfa_accept[s]);
+#undef FP_MIX
+    return h;
+}
+
+void emit_byte_label(FILE *out, int c) {
+    if (c == '\'' || c == '\\') fprintf(out, "'\\%c'", c);
+    else if (c >= 32 && c < 127) fprintf(out, "'%c'", c);
+    else fprintf(out, "%d", c);
+}
+
+// Prints the dense tables and a direct-coded (switch/goto) scanner as C.
+void emit_lexer(FILE *out) {
+    fprintf(out, "// Generated by all_code --emit-lexer from TOKEN_SPEC:\n");
+    fprintf(out, "// %d NFA states -> %d subset states -> %d minimal states, %d byte classes\n\n",
+            lexgen_nfa_states, lexgen_subset_states, dfa_nstates, dfa_nclasses);
+
+    fprintf(out, "static const unsigned char LEX_CLASS[256] = {");
+    for (int c = 0; c < 256; c++) fprintf(out, "%s%d,", c % 32 ? " " : "\n    ", dfa_class[c]);
+    fprintf(out, "\n};\n\nstatic const unsigned char LEX_NEXT[%d][%d] = {\n", dfa_nstates, dfa_nclasses);
+    for (int s = 0; s < dfa_nstates; s++) {
+        fprintf(out, "    /* %2d */ {", s);
+        for (int c = 0; c < dfa_nclasses; c++) fprintf(out, "%s%d", c ? ", " : "", dfa_next[s * dfa_nclasses + c]);
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "};\n\nstatic const unsigned char LEX_ACCEPT[%d] = {", dfa_nstates);
+    for (int s = 0; s < dfa_nstates; s++) fprintf(out, "%s%d,", s % 16 ? " " : "\n    ", dfa_accept[s]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "// BEGIN GENERATED DIRECT SCANNER (regenerate with: all_code --emit-lexer)\n");
+    fprintf(out, "#define DIRECT_SCANNER_FINGERPRINT 0x%016llxULL\n\n", dfa_fingerprint());
+    fprintf(out, "// Longest-match scan of one token at p[0]. Returns its type (TOKEN_ERROR if\n");
+    fprintf(out, "// nothing matched) and length; *more is set when p[n] was reached while a\n");
+    fprintf(out, "// longer token was still possible.\n");
+    fprintf(out, "TokenType scan_direct(const unsigned char *p, size_t n, size_t *len, int *more) {\n");
+    fprintf(out, "    size_t i = 0, acc_len = 0;\n    TokenType acc = TOKEN_ERROR;\n    *more = 0;\n");
+    for (int s = DFA_START; s < dfa_nstates; s++) {
+        int targeted = s != DFA_START; // the start state is entered by falling through
+        for (int i = 0; i < dfa_nstates * dfa_nclasses && !targeted; i++) targeted = dfa_next[i] == s;
+        if (targeted) fprintf(out, "s%d:\n", s);
+        if (dfa_accept[s] != TOKEN_ERROR) fprintf(out, "    acc = %s;\n    acc_len = i;\n", TOKEN_TYPE_NAMES[dfa_accept[s]]);
+        int live = 0;
+        for (int c = 0; c < dfa_nclasses; c++) live |= dfa_next[s * dfa_nclasses + c] != DFA_DEAD;
+        if (!live) {
+            fprintf(out, "    goto done;\n");
+            continue;
+        }
+        fprintf(out, "    if (i == n) goto end_of_input;\n    switch (p[i++]) {\n");
+        for (int t = DFA_START; t < dfa_nstates; t++) {
+            int col = 0, any = 0;
+            for (int c = 0; c < 256; c++) {
+                if (dfa_next[s * dfa_nclasses + dfa_class[c]] != t) continue;
+                if (col == 0) fprintf(out, "   ");
+                fprintf(out, " case ");
+                emit_byte_label(out, c);
+                fprintf(out, ":");
+                any = 1;
+                if (++col == 10) {
+                    fprintf(out, "\n");
+                    col = 0;
+                }
+            }
+            if (any) fprintf(out, "%s        goto s%d;\n", col ? "\n" : "", t);
+        }
+        fprintf(out, "    default:\n        goto done;\n    }\n");
+    }
+    fprintf(out, "end_of_input:\n    *more = 1;\ndone:\n    *len = acc_len;\n    return acc;\n}\n");
+    fprintf(out, "// END GENERATED DIRECT SCANNER\n");
+}
+// --- End DFA generator ---
+
+
+// BEGIN GENERATED DIRECT SCANNER (regenerate with: all_code --emit-lexer)
+#define DIRECT_SCANNER_FINGERPRINT 0xac05563e635361a1ULL
+
+// Longest-match scan of one token at p[0]. Returns its type (TOKEN_ERROR if
+// nothing matched) and length; *more is set when p[n] was reached while a
+// longer token was still possible.
+TokenType scan_direct(const unsigned char *p, size_t n, size_t *len, int *more) {
+    size_t i = 0, acc_len = 0;
+    TokenType acc = TOKEN_ERROR;
+    *more = 0;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '#':
+        goto s2;
+    case '(':
+        goto s3;
+    case ')':
+        goto s4;
+    case '+':
+        goto s5;
+    case ',':
+        goto s6;
+    case '.':
+        goto s7;
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s8;
+    case ':':
+        goto s9;
+    case '<':
+        goto s10;
+    case '=':
+        goto s11;
+    case '_':
+        goto s12;
+    case 'a': case 'c': case 'e': case 'f': case 'g': case 'h': case 'j': case 'k': case 'n': case 'o':
+    case 'q': case 's': case 't': case 'u': case 'v': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'b':
+        goto s14;
+    case 'd':
+        goto s15;
+    case 'i':
+        goto s16;
+    case 'l':
+        goto s17;
+    case 'm':
+        goto s18;
+    case 'p':
+        goto s19;
+    case 'r':
+        goto s20;
+    case 'w':
+        goto s21;
+    case '{':
+        goto s22;
+    case '}':
+        goto s23;
+    default:
+        goto done;
+    }
+s2:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'i':
+        goto s24;
+    default:
+        goto done;
+    }
+s3:
+    acc = TOKEN_OPEN_PAREN;
+    acc_len = i;
+    goto done;
+s4:
+    acc = TOKEN_CLOSE_PAREN;
+    acc_len = i;
+    goto done;
+s5:
+    acc = TOKEN_PLUS;
+    acc_len = i;
+    goto done;
+s6:
+    acc = TOKEN_COMMA;
+    acc_len = i;
+    goto done;
+s7:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '.':
+        goto s25;
+    default:
+        goto done;
+    }
+s8:
+    acc = TOKEN_NUMBER;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s8;
+    case '.':
+        goto s26;
+    default:
+        goto done;
+    }
+s9:
+    acc = TOKEN_COLON;
+    acc_len = i;
+    goto done;
+s10:
+    acc = TOKEN_COMPARATOR;
+    acc_len = i;
+    goto done;
+s11:
+    acc = TOKEN_ASSIGN;
+    acc_len = i;
+    goto done;
+s12:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s27;
+    default:
+        goto done;
+    }
+s13:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s14:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'r':
+        goto s29;
+    default:
+        goto done;
+    }
+s15:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'e':
+        goto s30;
+    default:
+        goto done;
+    }
+s16:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'n':
+        goto s31;
+    default:
+        goto done;
+    }
+s17:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'o':
+        goto s32;
+    default:
+        goto done;
+    }
+s18:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'a':
+        goto s33;
+    default:
+        goto done;
+    }
+s19:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'r':
+        goto s34;
+    default:
+        goto done;
+    }
+s20:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'e':
+        goto s35;
+    default:
+        goto done;
+    }
+s21:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'h':
+        goto s36;
+    default:
+        goto done;
+    }
+s22:
+    acc = TOKEN_OPEN_BRACE;
+    acc_len = i;
+    goto done;
+s23:
+    acc = TOKEN_CLOSE_BRACE;
+    acc_len = i;
+    goto done;
+s24:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'n':
+        goto s37;
+    default:
+        goto done;
+    }
+s25:
+    acc = TOKEN_DOTDOT;
+    acc_len = i;
+    goto done;
+s26:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s38;
+    default:
+        goto done;
+    }
+s27:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s27;
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s39;
+    default:
+        goto done;
+    }
+s28:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'n':
+        goto s40;
+    default:
+        goto done;
+    }
+s29:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'e':
+        goto s41;
+    default:
+        goto done;
+    }
+s30:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'c':
+        goto s42;
+    default:
+        goto done;
+    }
+s31:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 't':
+        goto s43;
+    default:
+        goto done;
+    }
+s32:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'o':
+        goto s44;
+    default:
+        goto done;
+    }
+s33:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'i':
+        goto s45;
+    default:
+        goto done;
+    }
+s34:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'i':
+        goto s46;
+    default:
+        goto done;
+    }
+s35:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 't':
+        goto s47;
+    default:
+        goto done;
+    }
+s36:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'i':
+        goto s48;
+    default:
+        goto done;
+    }
+s37:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'c':
+        goto s49;
+    default:
+        goto done;
+    }
+s38:
+    acc = TOKEN_NUMBER;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s38;
+    default:
+        goto done;
+    }
+s39:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s50;
+    default:
+        goto done;
+    }
+s40:
+    acc = TOKEN_FUNC_NAME;
+    acc_len = i;
+    goto done;
+s41:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'a':
+        goto s51;
+    default:
+        goto done;
+    }
+s42:
+    acc = TOKEN_KW_DEC;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s43:
+    acc = TOKEN_KW_INT;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s44:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'p':
+        goto s52;
+    default:
+        goto done;
+    }
+s45:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'n':
+        goto s53;
+    default:
+        goto done;
+    }
+s46:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'n':
+        goto s54;
+    default:
+        goto done;
+    }
+s47:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'u':
+        goto s55;
+    default:
+        goto done;
+    }
+s48:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'l':
+        goto s56;
+    default:
+        goto done;
+    }
+s49:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'l':
+        goto s57;
+    default:
+        goto done;
+    }
+s50:
+    acc = TOKEN_VAR_NAME;
+    acc_len = i;
+    goto done;
+s51:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'k':
+        goto s58;
+    default:
+        goto done;
+    }
+s52:
+    acc = TOKEN_LOOP_KW;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case '_':
+        goto s59;
+    default:
+        goto done;
+    }
+s53:
+    acc = TOKEN_MAIN_FUNC;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s54:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 't':
+        goto s60;
+    default:
+        goto done;
+    }
+s55:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'r':
+        goto s61;
+    default:
+        goto done;
+    }
+s56:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'f': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'e':
+        goto s62;
+    default:
+        goto done;
+    }
+s57:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'u':
+        goto s63;
+    default:
+        goto done;
+    }
+s58:
+    acc = TOKEN_BREAK;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s59:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s64;
+    default:
+        goto done;
+    }
+s60:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'g': case 'h': case 'i': case 'j': case 'k':
+    case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'f':
+        goto s65;
+    default:
+        goto done;
+    }
+s61:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    case 'n':
+        goto s66;
+    default:
+        goto done;
+    }
+s62:
+    acc = TOKEN_WHILE;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s63:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'd':
+        goto s67;
+    default:
+        goto done;
+    }
+s64:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s64;
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s68;
+    default:
+        goto done;
+    }
+s65:
+    acc = TOKEN_PRINTF;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s66:
+    acc = TOKEN_RETURN;
+    acc_len = i;
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
+    case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
+    case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
+        goto s13;
+    case 'F':
+        goto s28;
+    default:
+        goto done;
+    }
+s67:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'e':
+        goto s69;
+    default:
+        goto done;
+    }
+s68:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        goto s70;
+    default:
+        goto done;
+    }
+s69:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '<':
+        goto s71;
+    default:
+        goto done;
+    }
+s70:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case ':':
+        goto s9;
+    default:
+        goto done;
+    }
+s71:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 's':
+        goto s72;
+    default:
+        goto done;
+    }
+s72:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 't':
+        goto s73;
+    default:
+        goto done;
+    }
+s73:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'd':
+        goto s74;
+    default:
+        goto done;
+    }
+s74:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'i':
+        goto s75;
+    default:
+        goto done;
+    }
+s75:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'o':
+        goto s76;
+    default:
+        goto done;
+    }
+s76:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '.':
+        goto s77;
+    default:
+        goto done;
+    }
+s77:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case 'h':
+        goto s78;
+    default:
+        goto done;
+    }
+s78:
+    if (i == n) goto end_of_input;
+    switch (p[i++]) {
+    case '>':
+        goto s79;
+    default:
+        goto done;
+    }
+s79:
+    acc = TOKEN_INCLUDE;
+    acc_len = i;
+    goto done;
+end_of_input:
+    *more = 1;
+done:
+    *len = acc_len;
+    return acc;
+}
+// END GENERATED DIRECT SCANNER
+
+// --- Run scanners ---
+unsigned char IS_SPACE_BYTE[256];
+
+// States whose only self-loops are on one of these byte sets (identifier
+// bodies and digit strings) can skip the whole run at once.
+enum { RUN_NONE, RUN_LOWER, RUN_DIGIT, RUN_ALNUM };
+unsigned char state_run_kind[DFA_MAX_STATES + 1];
+
+size_t skip_space_scalar(const char *p, size_t n) {
+    size_t i = 0;
+    while (i < n && IS_SPACE_BYTE[(unsigned char)p[i]]) i++;
+    return i;
+}
+
+size_t scan_run_scalar(int kind, const char *p, size_t n) {
+    size_t i = 0;
+    for (; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        int lower = c >= 'a' && c <= 'z', digit = c >= '0' && c <= '9';
+        if (!(kind == RUN_LOWER ? lower : kind == RUN_DIGIT ? digit : (lower || digit))) break;
+    }
+    return i;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LEX_X86_SIMD 1
+
+// Whitespace as isspace() in the C locale: ' ' or 0x09..0x0D.
+size_t skip_space_sse2(const char *p, size_t n) {
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8(9), four = _mm_set1_epi8(4);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i d = _mm_sub_epi8(v, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(_mm_min_epu8(d, four), d));
+        unsigned other = (unsigned)_mm_movemask_epi8(ws) ^ 0xFFFFu;
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    return i + skip_space_scalar(p + i, n - i);
+}
+
+__m128i run_mask_sse2(int kind, __m128i v) {
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    return kind == RUN_LOWER ? lower : kind == RUN_DIGIT ? digit : _mm_or_si128(lower, digit);
+}
+
+size_t scan_run_sse2(int kind, const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned other = (unsigned)_mm_movemask_epi8(run_mask_sse2(kind, v)) ^ 0xFFFFu;
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    return i + scan_run_scalar(kind, p + i, n - i);
+}
+
+__attribute__((target("avx2"))) size_t skip_space_avx2(const char *p, size_t n) {
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8(9), four = _mm256_set1_epi8(4);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i d = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(_mm256_min_epu8(d, four), d));
+        unsigned other = ~(unsigned)_mm256_movemask_epi8(ws);
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    _mm256_zeroupper(); // the constants above dirty the upper halves; legacy SSE code after that stalls
+    return i + skip_space_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) size_t scan_run_avx2(int kind, const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i m = kind == RUN_LOWER ? lower : kind == RUN_DIGIT ? digit : _mm256_or_si256(lower, digit);
+        unsigned other = ~(unsigned)_mm256_movemask_epi8(m);
+        if (other) return i + (size_t)__builtin_ctz(other);
+    }
+    _mm256_zeroupper();
+    return i + scan_run_sse2(kind, p + i, n - i);
+}
+#endif
+
+enum { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+const char *SIMD_NAMES[] = {"scalar", "sse2", "avx2"};
+
+size_t (*skip_space_run)(const char *p, size_t n) = skip_space_scalar;
+size_t (*scan_class_run)(int kind, const char *p, size_t n) = scan_run_scalar;
+int simd_level = SIMD_SCALAR;
+
+// Selects the widest run scanners the CPU supports, up to max_level.
+int lexer_set_simd(int max_level) {
+    simd_level = SIMD_SCALAR;
+    skip_space_run = skip_space_scalar;
+    scan_class_run = scan_run_scalar;
+#ifdef LEX_X86_SIMD
+    if (max_level >= SIMD_SSE2) {
+        simd_level = SIMD_SSE2;
+        skip_space_run = skip_space_sse2;
+        scan_class_run = scan_run_sse2;
+    }
+    if (max_level >= SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        simd_level = SIMD_AVX2;
+        skip_space_run = skip_space_avx2;
+        scan_class_run = scan_run_avx2;
+    }
+#endif
+    return simd_level;
+}
+
+int lexer_ready = 0;
+int direct_scanner_ok = 0; // embedded scan_direct() matches the generated tables
+
+void lexer_init() {
+    if (lexer_ready) return;
+    build_lexer_dfa();
+    direct_scanner_ok = dfa_fingerprint() == DIRECT_SCANNER_FINGERPRINT;
+
+    for (int c = 0; c < 256; c++) IS_SPACE_BYTE[c] = (c == ' ' || (c >= '\t' && c <= '\r'));
+    for (int s = 0; s < dfa_nstates; s++) {
+        int kind = RUN_NONE;
+        for (int k = RUN_LOWER; k <= RUN_ALNUM && s != DFA_DEAD; k++) {
+            int match = 1;
+            for (int c = 0; c < 256 && match; c++) {
+                int in = (k != RUN_DIGIT && c >= 'a' && c <= 'z') || (k != RUN_LOWER && c >= '0' && c <= '9');
+                match = (DFA_STEP(s, c) == s) == in;
+            }
+            if (match) kind = k;
+        }
+        state_run_kind[s] = (unsigned char)kind;
+    }
+    lexer_set_simd(SIMD_AVX2);
+    lexer_ready = 1;
+}
+// --- End run scanners ---
+
+// --- Counters and phase timers ---
+// Filled in while ctx->stats is set and accumulated over every lex and
+// parse that uses the context. The lexer counts in its own instantiation
+// of the scanning loop and the parser behind one branch per step, so a
+// NULL ctx->stats costs next to nothing. Counting always walks the DFA
+// table: the direct-coded scanner has no states to count.
+struct CompileStats {
+    double lex_wall, lex_cpu;     // seconds in lex_feed()
+    double parse_wall, parse_cpu; // seconds in parse_from(), less the lexing it pulled
+    long long lex_calls, parses;
+    long long bytes, tokens, lex_errors;
+    long long transitions;     // DFA steps executed
+    long long run_bytes;       // bytes taken by run skipping instead of stepping
+    long long backtracks;      // tokens whose scan read past the last accepting state
+    long long backtrack_bytes; // bytes read past it, scanned again for the next token
+    long long memo_hits;       // scans the linear engine cut short at a known failure
+    long long state_visits[DFA_MAX_STATES + 1]; // steps into each state
+    long long steps, matches, expansions;
+    long long rejected; // parses that rejected their input
+    long long productions[256]; // expansions of each production (as in AstNode.prod)
+    int max_stack; // deepest parser stack, in entries
+    int stack_cap; // largest parser stack capacity (starts at MAXSTACK)
+    long long cache_hits, cache_misses, cache_stores; // --cache lookups (PART 3)
+};
+
+// Wall-clock and calling-thread CPU time, in seconds
+void stats_clock(double *wall, double *cpu) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *wall = (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu = (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    *wall = *cpu = (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// Adds the counts of one context to another (batch workers)
+void stats_merge(CompileStats *into, const CompileStats *from) {
+    into->lex_wall += from->lex_wall;
+    into->lex_cpu += from->lex_cpu;
+    into->parse_wall += from->parse_wall;
+    into->parse_cpu += from->parse_cpu;
+    into->lex_calls += from->lex_calls;
+    into->parses += from->parses;
+    into->bytes += from->bytes;
+    into->tokens += from->tokens;
+    into->lex_errors += from->lex_errors;
+    into->transitions += from->transitions;
+    into->run_bytes += from->run_bytes;
+    into->backtracks += from->backtracks;
+    into->backtrack_bytes += from->backtrack_bytes;
+    into->memo_hits += from->memo_hits;
+    for (int i = 0; i <= DFA_MAX_STATES; i++) into->state_visits[i] += from->state_visits[i];
+    into->steps += from->steps;
+    into->matches += from->matches;
+    into->expansions += from->expansions;
+    into->rejected += from->rejected;
+    for (int i = 0; i < 256; i++) into->productions[i] += from->productions[i];
+    if (from->max_stack > into->max_stack) into->max_stack = from->max_stack;
+    if (from->stack_cap > into->stack_cap) into->stack_cap = from->stack_cap;
+    into->cache_hits += from->cache_hits;
+    into->cache_misses += from->cache_misses;
+    into->cache_stores += from->cache_stores;
+}
+// --- End counters ---
+
+// Lexer state kept between calls to lex_feed(), so a token that straddles
+// two input chunks is resumed where the DFA stopped instead of rescanned.
+typedef struct {
+    size_t pos;                // next byte the DFA will examine
+    size_t start;              // first byte of the token being scanned
+    size_t last_accepting_pos; // 0 = no accepting state seen yet (tokens are never empty)
+    int state;
+    int last_accepting_state;
+    int in_token;              // 1 while a token is partially scanned
+    int done;                  // EOF has been emitted
+} LexState;
+
+// Scanner used by lex_feed(): the generated table with run skipping, the
+// generated direct-coded scanner, or the table walk with a memo of failed
+// scans, which keeps lexing linear in the input size.
+//
+// Maximal munch reads past the last accepting state and rescans from there,
+// so inputs like "intintint..." or "aaaa..." (every suffix a token prefix
+// that never completes) cost O(n^2) with the first two. The linear engine
+// remembers each (state, position) pair a failed scan passed through after
+// its last accepting state; a later scan that reaches one of them already
+// knows it cannot accept further on and stops (Reps, "Maximal-munch
+// tokenization in linear time", 1998). Each pair fails at most once, so a
+// file costs O(n * states) whatever its contents. The memo costs 10-15%
+// on ordinary source (--bench-lex), which is why it is the default: --serve
+// and --batch take input nobody has looked at. --lexer= picks another.
+enum { LEX_ENGINE_TABLE, LEX_ENGINE_DIRECT, LEX_ENGINE_LINEAR };
+const char *LEX_ENGINE_NAMES[] = {"table", "direct", "linear"};
+int lex_engine = LEX_ENGINE_LINEAR;
+
+#define LEX_MEMO_SLICE 256
+
+static inline size_t lowest_bit(unsigned long long w) {
+#ifdef __GNUC__
+    return (size_t)__builtin_ctzll(w);
+#else
+    size_t n = 0;
+    while (!(w & 1)) w >>= 1, n++;
+    return n;
+#endif
+}
+
+// Visits each state q whose row has bits set
+#define FOR_MEMO_ROWS(m, q) \
+    for (int w_ = 0; w_ < 4; w_++) \
+        for (unsigned long long r_ = (m)->rows[w_]; r_ && ((q) = w_ * 64 + (int)lowest_bit(r_), 1); r_ &= r_ - 1)
+
+void lex_memo_reset(LexMemo *m) {
+    size_t used = (m->hi - m->lo + 63) / 64;
+    int q;
+    FOR_MEMO_ROWS(m, q) memset(m->bits + (size_t)q * m->stride, 0, used * sizeof(*m->bits));
+    memset(m->rows, 0, sizeof(m->rows));
+    m->lo = m->hi = 0;
+}
+
+// Makes the window cover positions up to (not including) upto. Positions
+// before keep are no longer needed; the rows slide past them once they
+// are half the window, so each word moves a bounded number of times.
+void lex_memo_reserve(LexMemo *m, size_t keep, size_t upto) {
+    if (keep >= m->hi) {
+        lex_memo_reset(m);
+        m->lo = m->hi = keep & ~(size_t)63;
+    }
+    size_t used = (m->hi - m->lo + 63) / 64, drop = (keep - m->lo) / 64;
+    int q;
+    if (drop > 0 && (drop * 2 >= used || (upto - m->lo + 63) / 64 > m->stride)) {
+        FOR_MEMO_ROWS(m, q) {
+            unsigned long long *row = m->bits + (size_t)q * m->stride;
+            memmove(row, row + drop, (used - drop) * sizeof(*row));
+            memset(row + used - drop, 0, drop * sizeof(*row));
+        }
+        m->lo += drop * 64;
+        used -= drop;
+    }
+    size_t need = (upto - m->lo + 63) / 64;
+    if (need > m->stride) {
+        size_t stride = m->stride * 2 > need ? m->stride * 2 : need < 64 ? 64 : need;
+        unsigned long long *bits = calloc((size_t)dfa_nstates * stride, sizeof(*bits));
+        if (!bits) {
+            fprintf(stderr, "Lexer Error: Out of memory growing the scan memo\n");
+            exit(1);
+        }
+        FOR_MEMO_ROWS(m, q) {
+            memcpy(bits + (size_t)q * stride, m->bits + (size_t)q * m->stride, used * sizeof(*bits));
+        }
+        free(m->bits);
+        m->bits = bits;
+        m->stride = stride;
+    }
+    if (upto > m->hi) m->hi = upto;
+}
+
+// First remembered failure of state in positions [from, to), or to if none
+static inline size_t lex_memo_find(const LexMemo *m, int state, size_t from, size_t to) {
+    if (from >= to || from >= m->hi) return to;
+    const unsigned long long *row = m->bits + (size_t)state * m->stride;
+    size_t bit = from - m->lo, end = (to < m->hi ? to : m->hi) - m->lo;
+    unsigned long long w = row[bit >> 6] >> (bit & 63);
+    if (w) {
+        size_t at = bit + lowest_bit(w);
+        return at < end ? m->lo + at : to;
+    }
+    for (size_t k = (bit >> 6) + 1; k << 6 < end; k++) {
+        if (row[k]) {
+            size_t at = (k << 6) + lowest_bit(row[k]);
+            return at < end ? m->lo + at : to;
+        }
+    }
+    return to;
+}
+
+// Remembers the pairs a failed scan passed through: it left state at
+// position from (its last accepting state, or the start state at the token
+// start) and stopped at position to without accepting again.
+void lex_memo_fail(LexMemo *m, const char *text, int state, size_t from, size_t to) {
+    lex_memo_reserve(m, from, to + 1);
+    for (size_t p = from; p < to;) {
+        state = DFA_STEP(state, text[p]);
+        p++;
+        size_t end = p;
+        if (state_run_kind[state] != RUN_NONE) end += scan_class_run(state_run_kind[state], text + p, to - p);
+        // Set the bits of positions p..end in this state's row
+        unsigned long long *row = m->bits + (size_t)state * m->stride;
+        m->rows[state >> 6] |= 1ULL << (state & 63);
+        for (size_t b = p - m->lo, last = end - m->lo; b <= last;) {
+            size_t n = 64 - (b & 63);
+            if (n > last - b + 1) n = last - b + 1;
+            row[b >> 6] |= (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << (b & 63);
+            b += n;
+        }
+        p = end;
+    }
+}
+
+void lex_begin(CompileContext *ctx, LexState *ls) {
+    lexer_init();
+    memset(ls, 0, sizeof(*ls));
+    ctx->token_count = 0;
+    ctx->tokens.base = 0;
+    ctx->lex_errors = 0;
+    if (ctx->memo.hi) lex_memo_reset(&ctx->memo);
+}
+
+#ifdef __GNUC__
+#define LEX_INLINE static inline __attribute__((always_inline))
+#else
+#define LEX_INLINE static inline
+#endif
+
+void lex_error(CompileContext *ctx, const char *text, size_t at) {
+    ctx->lex_errors++;
+    report_error(ctx, "Lexer Error: Unrecognized token starting at index %zu: '%c'", ctx->tokens.base + at, text[at]);
+}
+
+// Maximal munch over the generated DFA, specialised at compile time on the
+// engine: the table walk keeps its DFA state across chunks, the direct-coded
+// scanner rescans an unfinished token from its start once more input arrives.
+// The counting instance also fills in ctx->stats; the linear instance stops
+// scans at failures remembered in ctx->memo and remembers new ones.
+LEX_INLINE void lex_feed_impl(CompileContext *ctx, LexState *ls, const char *text, size_t avail, int final, const int direct, const int counting, const int linear) {
+    CompileStats *st = ctx->stats;
+    LexMemo *memo = &ctx->memo;
+    size_t memo_hi = memo->hi; // no failures are remembered from here on
+    size_t i = ls->pos;
+    ctx->tokens.text = text; // the buffer may have moved since the last chunk
+
+    int at_end = 0;
+
+    for (;;) {
+        if (!ls->in_token) {
+            if (ctx->token_count >= ctx->token_limit) { // the consumer's window is full
+                if (ctx->token_count >= LEX_MAX_TOKENS && !ls->done) {
+                    ctx->lex_errors++;
+                    report_error(ctx, "Lexer Error: More than %d tokens; input from index %zu on is not read",
+                                 LEX_MAX_TOKENS, ctx->tokens.base + i);
+                    add_token(ctx, TOKEN_EOF, i, 0);
+                    ls->done = 1;
+                }
+                break;
+            }
+            if (i < avail && IS_SPACE_BYTE[(unsigned char)text[i]]) i += 1 + skip_space_run(text + i + 1, avail - i - 1);
+            if (i == avail) {
+                at_end = 1;
+                break;
+            }
+
+            if (direct) {
+                size_t len;
+                int more;
+                TokenType type = scan_direct((const unsigned char *)text + i, avail - i, &len, &more);
+                if (more && !final) break; // token may continue in the next chunk
+                if (len == 0) {
+                    lex_error(ctx, text, i);
+                    i++; // Move past the character to continue scanning
+                } else {
+                    add_token(ctx, type, i, len);
+                    i += len;
+                }
+                continue;
+            }
+
+            ls->start = i;
+            ls->state = DFA_START;
+            ls->last_accepting_pos = 0;
+            ls->last_accepting_state = DFA_DEAD;
+            ls->in_token = 1;
+        }
+
+        int state = ls->state;
+        size_t j = i;
+        int stopped = 0;
+
+        // DFA simulation
+        while (j < avail) {
+            int next = DFA_STEP(state, text[j]);
+            if (counting) {
+                st->transitions++;
+                st->state_visits[next]++;
+            }
+            if (next == DFA_DEAD) {
+                stopped = 1;
+                break;
+            }
+            state = next;
+            j++;
+
+            // Where a scan failed before, stop at the first place it passed
+            // through in this state: it found nothing more to accept. Runs
+            // are taken a slice at a time here so as not to read past it.
+            int known = 0, more = 1;
+            if (linear && j < memo_hi) {
+                size_t slice = state_run_kind[state] != RUN_NONE ? LEX_MEMO_SLICE : 0, n = 0;
+                known = lex_memo_find(memo, state, j, j + 1) == j;
+                while (!known && slice && j < avail && j < memo_hi) {
+                    n = scan_class_run(state_run_kind[state], text + j, avail - j < slice ? avail - j : slice);
+                    size_t failed = lex_memo_find(memo, state, j + 1, j + n + 1);
+                    if (failed <= j + n) {
+                        n = failed - j;
+                        known = 1;
+                    }
+                    j += n;
+                    if (counting) st->run_bytes += n;
+                    if (n < slice) break;
+                }
+                more = !known && slice && n == slice;
+            }
+
+            // Identifier bodies and digit strings: consume the whole run at once
+            if (more && state_run_kind[state] != RUN_NONE && j < avail) {
+                size_t run = scan_class_run(state_run_kind[state], text + j, avail - j);
+                j += run;
+                if (counting) st->run_bytes += run;
+            }
+
+            // If the state is accepting, record it
+            if (dfa_accept[state] != TOKEN_ERROR) {
+                ls->last_accepting_pos = j;
+                ls->last_accepting_state = state;
+            }
+            if (linear && known) {
+                if (counting) st->memo_hits++;
+                stopped = 1;
+                break;
+            }
+        }
+
+        if (!stopped && !final) {
+            // Token runs past the end of this chunk: resume here next time
+            ls->state = state;
+            i = j;
+            break;
+        }
+
+        ls->in_token = 0;
+        if (linear) {
+            // Everything read past the last accepting state led nowhere
+            size_t from = ls->last_accepting_pos ? ls->last_accepting_pos : ls->start;
+            if (j > from) {
+                lex_memo_fail(memo, text, ls->last_accepting_pos ? ls->last_accepting_state : DFA_START, from, j);
+                memo_hi = memo->hi;
+            }
+        }
+        if (counting) {
+            // The next scan starts after the token, or one byte after a bad one
+            size_t resume = ls->last_accepting_pos ? ls->last_accepting_pos : ls->start + 1;
+            if (j > resume) {
+                st->backtracks++;
+                st->backtrack_bytes += (long long)(j - resume);
+            }
+        }
+        if (ls->last_accepting_pos != 0) {
+            add_token(ctx, (TokenType)dfa_accept[ls->last_accepting_state], ls->start, ls->last_accepting_pos - ls->start);
+            i = ls->last_accepting_pos;
+        } else {
+            // Error handling: unrecognized token
+            lex_error(ctx, text, ls->start);
+            i = ls->start + 1; // Move past the character to continue scanning
+        }
+    }
+
+    ls->pos = i;
+    if (final && at_end && !ls->done) {
+        // Add EOF
+        add_token(ctx, TOKEN_EOF, avail, 0);
+        ls->done = 1;
+    }
+}
+
+// Scans text[ls->pos .. avail). text must hold every byte from offset 0
+// (or at least from the current token start, in which case offset 0 is
+// ctx->tokens.base bytes into the input); more bytes may be appended
+// before the next call. With final == 0 the lexer stops at the end of the
+// available input and waits for more; with final == 1 it finishes and
+// appends EOF. Either way it also stops early once ctx->token_limit
+// tokens exist; calling it again continues from there.
+void lex_feed(CompileContext *ctx, LexState *ls, const char *text, size_t avail, int final) {
+    CompileStats *st = ctx->stats;
+    if (st) {
+        double wall0, cpu0, wall1, cpu1;
+        size_t pos = ls->pos;
+        int tokens = ctx->token_count, errors = ctx->lex_errors;
+        stats_clock(&wall0, &cpu0);
+        lex_feed_impl(ctx, ls, text, avail, final, 0, 1, lex_engine == LEX_ENGINE_LINEAR);
+        stats_clock(&wall1, &cpu1);
+        st->lex_wall += wall1 - wall0;
+        st->lex_cpu += cpu1 - cpu0;
+        st->lex_calls++;
+        st->bytes += (long long)(ls->pos - pos);
+        st->tokens += ctx->token_count - tokens;
+        st->lex_errors += ctx->lex_errors - errors;
+    } else if (lex_engine == LEX_ENGINE_DIRECT && direct_scanner_ok) {
+        lex_feed_impl(ctx, ls, text, avail, final, 1, 0, 0);
+    } else if (lex_engine == LEX_ENGINE_LINEAR) {
+        lex_feed_impl(ctx, ls, text, avail, final, 0, 0, 1);
+    } else {
+        lex_feed_impl(ctx, ls, text, avail, final, 0, 0, 0);
+    }
+}
+
+void lex(CompileContext *ctx, const char *program_text, size_t len) {
+    LexState ls;
+    lex_begin(ctx, &ls);
+    lex_feed(ctx, &ls, program_text, len, 1);
+}
+
+// =================================================================
+// PART 2: PARSER (LL(1)-BASED) - CORRECTED
+// =================================================================
+
+#define NNT 21   // Number of Non-Terminals (0 to 20)
+#define NTER 24  // Number of Terminals (0 to 23) (23 is ERROR)
+#define MAXSTACK 500 // Initial capacity of the parser stack (it grows on demand)
+
+// Integer grammar symbols: terminals are 0..NTER-1 (index into TERMINALS),
+// non-terminals are NTER..NTER+NNT-1 (NTER + index into NT).
+typedef unsigned char Sym;
+#define SYM_NT(n) ((Sym)(NTER + (n)))
+#define IS_NT(s) ((s) >= NTER && (s) < NTER + NNT)
+#define T_EOF 22
+#define T_ERROR 23
+// Terminals the back ends look at (indices into TERMINALS)
+#define T_INT 1
+#define T_DEC 2
+#define T_VAR_NAME 3
+#define T_FUNC_NAME 4
+#define T_NUMBER 15
+
+// Non-terminal indices (order of NT[])
+enum {
+    NT_PROGRAM, NT_OPT_FUNCS, NT_FUNC_DEF, NT_FUNC_PARAMS, NT_DATA_TYPE, NT_STATEMENT_LIST, NT_STATEMENT,
+    NT_ASSIGNMENT, NT_LOOP, NT_MAIN_FUNC, NT_FUNC_CALL, NT_PRINTF_CALL, NT_RETURN_STMT, NT_EXPRESSION,
+    NT_TERM, NT_EXPR_TAIL, NT_TOP_DEF, NT_OPT_PARAMS, NT_OPT_INIT, NT_CALL_ARGS, NT_CALL_ARGS_TAIL
+};
+
+// Non-terminals (NT)
+char *NT[] = {"Program","OptFuncs","FuncDef","FuncParams","DataType","StatementList","Statement","Assignment","Loop","MainFunc","FuncCall","PrintfCall","ReturnStmt","Expression","Term","Expr_Tail","TopDef","OptParams","OptInit","CallArgs","CallArgsTail"};
+// Terminals (T) - Must match the order of the TABLE
+char *TERMINALS[] = {
+    "#include<stdio.h>", "int", "dec", "_VAR_NAME", "FUNC_NAME", "main", "loop", "while", "(", ")", "{", "}", "..", "=", "<", "NUMBER", "+", "return", "printf", "break", ",", ":", "$", "ERROR"
+};
+
+// LL(1) Table Helper: Maps TokenType to TERMINALS index (FIXED)
+const unsigned char TOKEN_TO_TER[TOKEN_ERROR + 1] = {
+    [TOKEN_EOF] = 22, [TOKEN_INCLUDE] = 0, [TOKEN_KW_INT] = 1, [TOKEN_KW_DEC] = 2,
+    [TOKEN_VAR_NAME] = 3, [TOKEN_FUNC_NAME] = 4, [TOKEN_MAIN_FUNC] = 5, [TOKEN_LOOP_KW] = 6,
+    [TOKEN_WHILE] = 7, [TOKEN_OPEN_PAREN] = 8, [TOKEN_CLOSE_PAREN] = 9, [TOKEN_OPEN_BRACE] = 10,
+    [TOKEN_CLOSE_BRACE] = 11, [TOKEN_DOTDOT] = 12, [TOKEN_ASSIGN] = 13, [TOKEN_COMPARATOR] = 14,
+    [TOKEN_NUMBER] = 15, [TOKEN_PLUS] = 16, [TOKEN_RETURN] = 17, [TOKEN_PRINTF] = 18,
+    [TOKEN_BREAK] = 19, [TOKEN_COMMA] = 20, [TOKEN_COLON] = 21, [TOKEN_ERROR] = 23
+};
+
+int token_type_to_ter_index(TokenType type) {
+    return ((unsigned)type <= TOKEN_ERROR) ? TOKEN_TO_TER[type] : T_ERROR;
+}
+
+// Production Rules: "LHS -> RHS", RHS empty for epsilon. Production p is
+// GRAMMAR[p-1]; the LL(1) table is generated from this list at startup.
+char *GRAMMAR[] = {
+    "Program -> #include<stdio.h> OptFuncs", // 1
+    "OptFuncs -> DataType TopDef", // 2: every top-level definition starts with its return type
+    "TopDef -> FuncDef OptFuncs", // 3
+    "TopDef -> MainFunc", // 4: main is the last definition
+    "FuncDef -> FUNC_NAME ( FuncParams ) { StatementList ReturnStmt }", // 5
+    "FuncParams -> DataType _VAR_NAME OptParams", // 6
+    "FuncParams -> ", // 7
+    "OptParams -> , DataType _VAR_NAME OptParams", // 8
+    "OptParams -> ", // 9
+    "DataType -> int", // 10
+    "DataType -> dec", // 11
+    "StatementList -> Statement StatementList", // 12
+    "StatementList -> ", // 13: Follow(StatementList) is return or break
+    "Statement -> Assignment ..", // 14 (Assignment includes declarations)
+    "Statement -> Loop", // 15
+    "Statement -> PrintfCall ..", // 16
+    "Assignment -> DataType _VAR_NAME OptInit", // 17: declaration, optionally initialised
+    "Assignment -> _VAR_NAME = Expression", // 18: re-assignment
+    "OptInit -> = Expression", // 19
+    "OptInit -> ", // 20
+    "Loop -> loop _VAR_NAME : while ( _VAR_NAME < NUMBER ) { StatementList break .. }", // 21
+    "MainFunc -> main ( ) { StatementList ReturnStmt }", // 22
+    "FuncCall -> FUNC_NAME ( CallArgs )", // 23
+    "CallArgs -> Expression CallArgsTail", // 24
+    "CallArgs -> ", // 25
+    "CallArgsTail -> , Expression CallArgsTail", // 26
+    "CallArgsTail -> ", // 27
+    "PrintfCall -> printf ( _VAR_NAME )", // 28
+    "ReturnStmt -> return Expression ..", // 29
+    "Expression -> Term Expr_Tail", // 30: E -> T E'
+    "Term -> NUMBER", // 31
+    "Term -> _VAR_NAME", // 32
+    "Term -> FuncCall", // 33
+    "Expr_Tail -> + Term Expr_Tail", // 34: E' -> + T E'
+    "Expr_Tail -> " // 35: E' -> epsilon
+};
+#define NPROD ((int)(sizeof(GRAMMAR) / sizeof(GRAMMAR[0])))
+
+// LL(1) Table: TABLE[nt][terminal] = production number, 0 = error.
+// Filled by build_parser_tables() from FIRST/FOLLOW sets.
+int TABLE[NNT][NTER];
+
+
+// --- Stack implementation (integer symbols, grows on demand, one per CompileContext) ---
+void stack_reserve(CompileContext *ctx, int extra) {
+    if (ctx->top + 1 + extra <= ctx->stack_cap) return;
+    int cap = ctx->stack_cap ? ctx->stack_cap : MAXSTACK;
+    while (cap < ctx->top + 1 + extra) cap *= 2;
+    Sym *grown = realloc(ctx->stack, (size_t)cap * sizeof(Sym));
+    int *grown_nodes = grown ? realloc(ctx->stack_node, (size_t)cap * sizeof(int)) : NULL;
+    if (!grown || !grown_nodes) {
+        fprintf(stderr, "PARSER ERROR: Out of memory growing stack to %d entries\n", cap);
+        exit(1);
+    }
+    ctx->stack = grown;
+    ctx->stack_node = grown_nodes;
+    ctx->stack_cap = cap;
+}
+
+void push(CompileContext *ctx, Sym s){ stack_reserve(ctx, 1); ctx->stack[++ctx->top] = s; }
+int pop(CompileContext *ctx){ return (ctx->top>=0)?ctx->stack[ctx->top--]:-1; }
+
+const char *sym_name(int s) {
+    if (s >= 0 && s < NTER) return TERMINALS[s];
+    if (IS_NT(s)) return NT[s - NTER];
+    return "?";
+}
+
+int find_nt(const char *x){ for(int i=0;i<NNT;i++) if(strcmp(NT[i],x)==0) return i; return -1; }
+int find_t(const char *x){ for(int i=0;i<NTER;i++) if(strcmp(TERMINALS[i],x)==0) return i; return -1; }
+
+// Precompiled productions: GRAMMAR[p-1] split once into symbol IDs, the RHS
+// stored reversed so an expansion is a single copy onto the stack.
+#define MAXPRODSYMS 256
+Sym prod_syms[MAXPRODSYMS];
+int prod_start[NPROD + 1]; // production p occupies prod_syms[prod_start[p-1] .. prod_start[p]-1]
+int prod_lhs[NPROD + 1];   // non-terminal index of production p
+const char *prod_rhs_text[NPROD + 1]; // RHS as written, for the trace
+int prod_nchildren[NPROD + 1];        // AST children of production p
+signed char prod_child_slot[MAXPRODSYMS]; // AST child index of each prod_syms entry, -1 if it gets no node
+
+// FIRST/FOLLOW as terminal bitsets (NTER <= 32)
+typedef unsigned int TerSet;
+int nt_nullable[NNT];
+TerSet nt_first[NNT], nt_follow[NNT];
+int parser_ready = 0;
+
+// FIRST of the symbol string syms[0..k-1]; *nullable set if it can derive epsilon.
+TerSet first_of_string(const Sym *syms, int k, int *nullable) {
+    TerSet f = 0;
+    for (int i = 0; i < k; i++) {
+        if (!IS_NT(syms[i])) {
+            *nullable = 0;
+            return f | (1u << syms[i]);
+        }
+        f |= nt_first[syms[i] - NTER];
+        if (!nt_nullable[syms[i] - NTER]) {
+            *nullable = 0;
+            return f;
+        }
+    }
+    *nullable = 1;
+    return f;
+}
+
+// Returns the RHS of production p in source order (prod_syms is reversed).
+int production_rhs(int p, Sym *out) {
+    int first = prod_start[p - 1], k = prod_start[p] - first;
+    for (int i = 0; i < k; i++) out[i] = prod_syms[first + k - 1 - i];
+    return k;
+}
+
+// Reads GRAMMAR, computes nullable/FIRST/FOLLOW and fills TABLE. Problems
+// (unknown symbols, non-terminals without productions, LL(1) conflicts) are
+// written to report; returns how many were found.
+int build_parser_tables(FILE *report) {
+    int problems = 0, n = 0;
+    int has_prod[NNT] = {0};
+
+    for (int p = 1; p <= NPROD; p++) {
+        char temp[200];
+        strcpy(temp, GRAMMAR[p - 1]);
+        char *arrow = strstr(temp, "->");
+        prod_rhs_text[p] = strstr(GRAMMAR[p - 1], "->") + 2;
+        while (*prod_rhs_text[p] == ' ') prod_rhs_text[p]++;
+        if (arrow) *arrow = '\0';
+        char *lhs = strtok(temp, " ");
+        prod_lhs[p] = lhs ? find_nt(lhs) : -1;
+        if (!arrow || prod_lhs[p] < 0) {
+            if (report) fprintf(report, "Grammar Error: production %d has no known left-hand side: %s\n", p, GRAMMAR[p - 1]);
+            problems++;
+            prod_lhs[p] = 0;
+        }
+        has_prod[prod_lhs[p]] = 1;
+
+        Sym symbols[16];
+        int k = 0;
+        for (char *tok = strtok(arrow ? arrow + 2 : temp, " "); tok; tok = strtok(NULL, " ")) {
+            int id = find_t(tok);
+            if (id == -1 && find_nt(tok) != -1) id = SYM_NT(find_nt(tok));
+            if (id == -1) {
+                if (report) fprintf(report, "Grammar Error: unknown symbol '%s' in production %d\n", tok, p);
+                problems++;
+                continue;
+            }
+            if (k == 16 || n + k >= MAXPRODSYMS) {
+                fprintf(stderr, "Grammar Error: production %d is too long for MAXPRODSYMS\n", p);
+                exit(1);
+            }
+            symbols[k++] = (Sym)id;
+        }
+        prod_start[p - 1] = n;
+        for (int i = k - 1; i >= 0; i--) prod_syms[n++] = symbols[i];
+    }
+    prod_start[NPROD] = n;
+
+    // AST shape: every non-terminal and each value-carrying terminal is a child
+    for (int p = 1; p <= NPROD; p++) {
+        int kids = 0;
+        for (int i = prod_start[p] - 1; i >= prod_start[p - 1]; i--) { // source order
+            Sym x = prod_syms[i];
+            int keep = IS_NT(x) || strcmp(TERMINALS[x], "_VAR_NAME") == 0 ||
+                       strcmp(TERMINALS[x], "FUNC_NAME") == 0 || strcmp(TERMINALS[x], "NUMBER") == 0;
+            prod_child_slot[i] = keep ? (signed char)kids++ : -1;
+        }
+        prod_nchildren[p] = kids;
+    }
+
+    for (int a = 0; a < NNT; a++) {
+        if (!has_prod[a]) {
+            if (report) fprintf(report, "Grammar Error: non-terminal %s has no productions\n", NT[a]);
+            problems++;
+        }
+    }
+
+    // Nullable and FIRST: iterate to a fixed point
+    memset(nt_nullable, 0, sizeof(nt_nullable));
+    memset(nt_first, 0, sizeof(nt_first));
+    memset(nt_follow, 0, sizeof(nt_follow));
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int p = 1; p <= NPROD; p++) {
+            Sym rhs[16];
+            int k = production_rhs(p, rhs), nullable;
+            TerSet f = first_of_string(rhs, k, &nullable);
+            int a = prod_lhs[p];
+            if ((nt_first[a] | f) != nt_first[a]) { nt_first[a] |= f; changed = 1; }
+            if (nullable && !nt_nullable[a]) { nt_nullable[a] = 1; changed = 1; }
+        }
+    }
+
+    // FOLLOW: $ follows the start symbol
+    nt_follow[0] = 1u << T_EOF;
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int p = 1; p <= NPROD; p++) {
+            Sym rhs[16];
+            int k = production_rhs(p, rhs);
+            for (int i = 0; i < k; i++) {
+                if (!IS_NT(rhs[i])) continue;
+                int b = rhs[i] - NTER, nullable;
+                TerSet f = first_of_string(rhs + i + 1, k - i - 1, &nullable);
+                if (nullable) f |= nt_follow[prod_lhs[p]];
+                if ((nt_follow[b] | f) != nt_follow[b]) { nt_follow[b] |= f; changed = 1; }
+            }
+        }
+    }
+
+    // TABLE[A][a] = p for a in FIRST(rhs), and for a in FOLLOW(A) if rhs is nullable
+    memset(TABLE, 0, sizeof(TABLE));
+    for (int p = 1; p <= NPROD; p++) {
+        Sym rhs[16];
+        int k = production_rhs(p, rhs), nullable, a = prod_lhs[p];
+        TerSet predict = first_of_string(rhs, k, &nullable);
+        if (nullable) predict |= nt_follow[a];
+        for (int t = 0; t < NTER; t++) {
+            if (!(predict >> t & 1)) continue;
+            if (TABLE[a][t] != 0) {
+                if (report) fprintf(report, "LL(1) Conflict: (%s, %s) predicts both production %d (%s) and %d (%s)\n",
+                                    NT[a], TERMINALS[t], TABLE[a][t], GRAMMAR[TABLE[a][t] - 1], p, GRAMMAR[p - 1]);
+                problems++;
+                continue; // keep the earlier production
+            }
+            TABLE[a][t] = p;
+        }
+    }
+
+    parser_ready = 1;
+    return problems;
+}
+
+void print_terset(FILE *out, TerSet s) {
+    int first = 1;
+    fprintf(out, "{");
+    for (int t = 0; t < NTER; t++) {
+        if (!(s >> t & 1)) continue;
+        fprintf(out, "%s%s", first ? "" : ", ", TERMINALS[t]);
+        first = 0;
+    }
+    fprintf(out, "}");
+}
+
+// Prints FIRST/FOLLOW, any conflicts, and the generated table and
+// production array as C.
+int emit_parser_tables(FILE *out) {
+    fprintf(out, "// Generated by all_code --emit-table from GRAMMAR (%d productions)\n", NPROD);
+    int problems = build_parser_tables(out);
+    for (int a = 0; a < NNT; a++) {
+        fprintf(out, "// %-14s nullable=%d FIRST=", NT[a], nt_nullable[a]);
+        print_terset(out, nt_first[a]);
+        fprintf(out, " FOLLOW=");
+        print_terset(out, nt_follow[a]);
+        fprintf(out, "\n");
+    }
+    fprintf(out, "\nint TABLE[%d][%d] = {\n", NNT, NTER);
+    for (int a = 0; a < NNT; a++) {
+        fprintf(out, "/* %2d:%-14s */ {", a, NT[a]);
+        for (int t = 0; t < NTER; t++) fprintf(out, "%s%d", t ? ", " : "", TABLE[a][t]);
+        fprintf(out, "}%s\n", a + 1 < NNT ? "," : "");
+    }
+    fprintf(out, "};\n\n// Productions, RHS reversed; production p is prod_syms[prod_start[p-1] .. prod_start[p]-1]\n");
+    fprintf(out, "int prod_start[%d] = {", NPROD + 1);
+    for (int p = 0; p <= NPROD; p++) fprintf(out, "%s%d", p ? ", " : "", prod_start[p]);
+    fprintf(out, "};\nSym prod_syms[%d] = {", prod_start[NPROD]);
+    for (int i = 0; i < prod_start[NPROD]; i++) fprintf(out, "%s%d", i ? ", " : "", prod_syms[i]);
+    fprintf(out, "};\n");
+    return problems;
+}
+
+void parser_init() {
+    if (parser_ready) return;
+    if (build_parser_tables(stderr) != 0) {
+        fprintf(stderr, "PARSER ERROR: GRAMMAR is not LL(1); see the report above (all_code --emit-table)\n");
+        exit(1);
+    }
+}
+// --- End Stack implementation ---
+
+// --- AST (built by parse() when ctx->ast is set) ---
+// One node per non-terminal expansion and per terminal that carries a
+// value (_VAR_NAME, FUNC_NAME, NUMBER); keywords and punctuation are
+// implied by the production and get no node. When a node is expanded its
+// children are allocated together, so they are the `count` consecutive
+// nodes starting at first_child, in source order.
+typedef struct {
+    Sym sym;
+    unsigned char prod;   // production that expanded a non-terminal, 0 for terminals
+    unsigned short count; // number of children
+    int first_child;
+    unsigned int length;  // terminals: the lexeme is text[offset .. offset+length)
+    unsigned int name;    // identifiers: interned id (AstArena.names); NUMBER: constant id (AstArena.consts); else 0
+    size_t offset;
+} AstNode;
+
+#define AST_BLOCK_SHIFT 12
+#define AST_BLOCK_SIZE (1 << AST_BLOCK_SHIFT)
+
+// Loops and call arguments nest at most this deep in a program that
+// check_program() accepts. The parser's stack is explicit, so any depth
+// parses, but the phases after it recurse once per level.
+#define AST_MAX_NESTING 256
+
+// Bump allocator over fixed-size blocks that never move. Nodes are never
+// freed one by one: ast_reset() reuses the blocks for the next parse and
+// ast_free() releases them all.
+struct AstArena {
+    AstNode **blocks;
+    int nblocks;
+    int blocks_cap;
+    int used;         // index of the next free node
+    int root;         // Program node, -1 before a parse
+    const char *text; // program text the terminal spans point into (set when parse() accepts)
+    const Interner *names; // spellings of the ids in AstNode.name; NULL if the parse had no name table
+    const ConstPool *consts; // values of the NUMBER ids in AstNode.name; NULL if the parse had no pool
+};
+
+#define AST_NODE(a, i) (&(a)->blocks[(i) >> AST_BLOCK_SHIFT][(i) & (AST_BLOCK_SIZE - 1)])
+
+// Returns the index of k fresh consecutive nodes; they never straddle a block.
+int ast_alloc(AstArena *a, int k) {
+    if (a->used > INT_MAX - 2 * AST_BLOCK_SIZE) { // node indices are ints
+        fprintf(stderr, "PARSER ERROR: The AST has more than %d nodes\n", INT_MAX - 2 * AST_BLOCK_SIZE);
+        exit(1);
+    }
+    if ((a->used & (AST_BLOCK_SIZE - 1)) + k > AST_BLOCK_SIZE) a->used = (a->used | (AST_BLOCK_SIZE - 1)) + 1;
+    if ((a->used + k - 1) >> AST_BLOCK_SHIFT >= a->nblocks) {
+        if (a->nblocks == a->blocks_cap) {
+            int cap = a->blocks_cap ? a->blocks_cap * 2 : 16;
+            AstNode **grown = realloc(a->blocks, (size_t)cap * sizeof(AstNode *));
+            if (!grown) {
+                fprintf(stderr, "PARSER ERROR: Out of memory growing the AST\n");
+                exit(1);
+            }
+            a->blocks = grown;
+            a->blocks_cap = cap;
+        }
+        a->blocks[a->nblocks] = malloc(AST_BLOCK_SIZE * sizeof(AstNode));
+        if (!a->blocks[a->nblocks]) {
+            fprintf(stderr, "PARSER ERROR: Out of memory growing the AST\n");
+            exit(1);
+        }
+        a->nblocks++;
+    }
+    int first = a->used;
+    a->used += k;
+    return first;
+}
+
+void ast_reset(AstArena *a) {
+    a->used = 0;
+    a->root = -1;
+}
+
+void ast_free(AstArena *a) {
+    for (int i = 0; i < a->nblocks; i++) free(a->blocks[i]);
+    free(a->blocks);
+    memset(a, 0, sizeof(*a));
+    a->root = -1;
+}
+
+// Prints the tree under node, one node per line indented by depth. Walks
+// with an explicit stack: statement and definition lists nest as deep as
+// they are long, so past AST_MAX_INDENT levels the depth is printed instead.
+#define AST_MAX_INDENT 32
+
+void ast_print(FILE *out, AstArena *a, int node) {
+    int cap = 256, n = 0;
+    int *todo = malloc((size_t)cap * 2 * sizeof(int));
+    if (!todo) return;
+    todo[n * 2] = node;
+    todo[n * 2 + 1] = 0;
+    n++;
+    while (n > 0) {
+        n--;
+        int i = todo[n * 2], depth = todo[n * 2 + 1];
+        AstNode *x = AST_NODE(a, i);
+        if (depth <= AST_MAX_INDENT) fprintf(out, "%*s", depth * 2, "");
+        else fprintf(out, "%*s[%d] ", AST_MAX_INDENT * 2, "", depth);
+        if (IS_NT(x->sym)) fprintf(out, "%s -> %s\n", sym_name(x->sym), prod_rhs_text[x->prod]);
+        else fprintf(out, "%s %.*s\n", sym_name(x->sym), (int)x->length, a->text + x->offset);
+
+        if (n + x->count > cap) {
+            while (n + x->count > cap) cap *= 2;
+            int *grown = realloc(todo, (size_t)cap * 2 * sizeof(int));
+            if (!grown) break;
+            todo = grown;
+        }
+        for (int c = x->count - 1; c >= 0; c--) { // first child on top
+            todo[n * 2] = x->first_child + c;
+            todo[n * 2 + 1] = depth + 1;
+            n++;
+        }
+    }
+    free(todo);
+}
+// --- End AST ---
+
+// --- Trace sinks ---
+// parse() reports each step to a TraceSink instead of printing it. Output
+// is assembled in one large buffer and written with a single fwrite when
+// it fills. Formats:
+//   TRACE_HUMAN   the classic table with the stack as deltas: the starting
+//                 stack once, then what each row pops and pushes; a
+//                 rejected parse ends with the stack
+//   TRACE_JSON    one JSON object per line, the stack as deltas: "match"
+//                 pops `top`, "expand" pops `top` and pushes the RHS of
+//                 production `prod`; a rejected parse ends with the stack
+//   TRACE_BINARY  "LL1T" header then fixed 8-byte records (see TraceRecord)
+// With on_error set nothing is written for accepted programs: the trace is
+// kept in memory (only the newest TRACE_BUFFER_SIZE bytes once it grows
+// past that) and flushed if the parse is rejected.
+enum { TRACE_HUMAN, TRACE_JSON, TRACE_BINARY };
+const char *TRACE_FORMAT_NAMES[] = {"human", "json", "binary"};
+
+enum { TR_MATCH, TR_EXPAND, TR_REJECT, TR_ACCEPT_END, TR_REJECT_END, TR_DROPPED };
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+// Binary record: op is TR_*, sym the popped symbol, prod the production
+// applied (TR_EXPAND), la the lookahead terminal and ip the token index
+// (little-endian). TR_DROPPED carries the number of dropped bytes in ip.
+typedef struct {
+    unsigned char op, sym, prod, la;
+    unsigned char ip[4];
+} TraceRecord;
+
+struct TraceSink {
+    int format;
+    int on_error;
+    FILE *out;
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t dropped;  // on_error: bytes discarded from the front of the buffer
+    size_t written;  // bytes written to out so far
+    long steps;
+    int rejected;    // a TR_REJECT step was recorded
+};
+
+void trace_open(TraceSink *t, FILE *out, int format, int on_error) {
+    memset(t, 0, sizeof(*t));
+    t->out = out;
+    t->format = format;
+    t->on_error = on_error;
+    t->cap = TRACE_BUFFER_SIZE;
+    t->buf = malloc(t->cap);
+    if (!t->buf) {
+        fprintf(stderr, "Error: Out of memory allocating the trace buffer\n");
+        exit(1);
+    }
+}
+
+void trace_flush(TraceSink *t) {
+    if (t->len) fwrite(t->buf, 1, t->len, t->out);
+    t->written += t->len;
+    t->len = 0;
+}
+
+void trace_close(TraceSink *t) {
+    if (!t->on_error) trace_flush(t);
+    fflush(t->out);
+    free(t->buf);
+    t->buf = NULL;
+}
+
+// Makes room for n more bytes: flushes, or in on_error mode drops the
+// oldest half of the buffer at a record boundary.
+void trace_reserve(TraceSink *t, size_t n) {
+    if (t->len + n <= t->cap) return;
+    if (!t->on_error) {
+        trace_flush(t);
+    } else if (t->len > t->cap / 2) {
+        size_t cut = t->len - t->cap / 2;
+        if (t->format == TRACE_BINARY) {
+            cut = (cut + sizeof(TraceRecord) - 1) / sizeof(TraceRecord) * sizeof(TraceRecord);
+        } else {
+            char *nl = memchr(t->buf + cut, '\n', t->len - cut);
+            cut = nl ? (size_t)(nl - t->buf) + 1 : t->len;
+        }
+        memmove(t->buf, t->buf + cut, t->len - cut);
+        t->len -= cut;
+        t->dropped += cut;
+    }
+    if (t->len + n > t->cap) { // one record larger than the whole buffer
+        while (t->len + n > t->cap) t->cap *= 2;
+        char *grown = realloc(t->buf, t->cap);
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory growing the trace buffer\n");
+            exit(1);
+        }
+        t->buf = grown;
+    }
+}
+
+void trace_write(TraceSink *t, const char *s, size_t n) {
+    trace_reserve(t, n);
+    memcpy(t->buf + t->len, s, n);
+    t->len += n;
+}
+
+#define trace_puts(t, s) trace_write(t, s, strlen(s))
+
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+void trace_printf(TraceSink *t, const char *fmt, ...) {
+    va_list ap;
+    trace_reserve(t, 256);
+    va_start(ap, fmt);
+    int n = vsnprintf(t->buf + t->len, t->cap - t->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= t->cap - t->len) { // did not fit: make room and format again
+        trace_reserve(t, (size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf(t->buf + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+    }
+    t->len += (size_t)n;
+}
+
+// s left-justified in a field of width columns, like "%-*s".
+void trace_pad(TraceSink *t, const char *s, int width) {
+    size_t n = strlen(s);
+    trace_reserve(t, n + (size_t)width);
+    memcpy(t->buf + t->len, s, n);
+    t->len += n;
+    for (; (int)n < width; n++) t->buf[t->len++] = ' ';
+}
+
+void trace_long(TraceSink *t, long v) {
+    char digits[24];
+    int n = 0;
+    unsigned long u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+    do digits[sizeof(digits) - 1 - n++] = (char)('0' + u % 10); while ((u /= 10) != 0);
+    if (v < 0) digits[sizeof(digits) - 1 - n++] = '-';
+    trace_write(t, digits + sizeof(digits) - n, (size_t)n);
+}
+
+void trace_record(TraceSink *t, int op, int sym, int prod, int la, unsigned long ip) {
+    TraceRecord r = {(unsigned char)op, (unsigned char)sym, (unsigned char)prod, (unsigned char)la,
+                     {(unsigned char)ip, (unsigned char)(ip >> 8), (unsigned char)(ip >> 16), (unsigned char)(ip >> 24)}};
+    trace_write(t, (const char *)&r, sizeof(r));
+}
+
+// Human format: the stack top first.
+void trace_stack(TraceSink *t, CompileContext *ctx) {
+    trace_puts(t, "[");
+    for (int i = ctx->top; i >= 0; i--) {
+        trace_puts(t, sym_name(ctx->stack[i]));
+        if (i > 0) trace_puts(t, ", ");
+    }
+    trace_puts(t, "]");
+}
+
+const unsigned char TRACE_BINARY_HEADER[8] = {'L', 'L', '1', 'T', 1, NTER, NNT, 0}; // magic, version, sizes
+
+// Starts a trace of a parse whose stack ctx holds.
+void trace_begin(TraceSink *t, CompileContext *ctx) {
+    t->len = 0;
+    t->dropped = 0;
+    t->steps = 0;
+    t->rejected = 0;
+    if (t->format == TRACE_HUMAN) {
+        trace_puts(t, "\n--- PARSER EXECUTION ---\nInitial stack: ");
+        trace_stack(t, ctx);
+        trace_puts(t, "\n");
+        trace_printf(t, "%-25s %-15s %-10s %-25s\n","Stack Change","Lookahead (Token)","Top","Production Applied");
+        trace_puts(t, "----------------------------------------------------------------------------------\n");
+    } else if (t->format == TRACE_BINARY && !t->on_error) {
+        trace_write(t, (const char *)TRACE_BINARY_HEADER, sizeof(TRACE_BINARY_HEADER));
+    }
+}
+
+// One parser step: X was popped off the stack and is matched against,
+// expanded by, or rejected at lookahead la / token ip.
+void trace_step(TraceSink *t, int op, int X, int la, int ip, int prod) {
+    t->steps++;
+    if (op == TR_REJECT) t->rejected = 1;
+    switch (t->format) {
+    case TRACE_HUMAN: // same layout as printf("%-25s %-15s %-10s %-25s\n", ...)
+        if (op == TR_EXPAND && prod_start[prod] > prod_start[prod - 1]) {
+            char change[32];
+            snprintf(change, sizeof(change), "pop, push %d", prod_start[prod] - prod_start[prod - 1]);
+            trace_pad(t, change, 25);
+        } else {
+            trace_pad(t, op == TR_REJECT ? "" : "pop", 25);
+        }
+        trace_puts(t, " ");
+        trace_pad(t, TERMINALS[la], 15);
+        trace_puts(t, " ");
+        trace_pad(t, sym_name(X), 10);
+        trace_puts(t, " ");
+        if (op == TR_MATCH) trace_pad(t, "match", 25);
+        else if (op == TR_REJECT) trace_puts(t, "REJECTED");
+        else if (prod_start[prod] == prod_start[prod - 1]) trace_pad(t, "epsilon", 25);
+        else {
+            trace_puts(t, sym_name(X));
+            trace_puts(t, " -> ");
+            trace_pad(t, prod_rhs_text[prod], 25);
+        }
+        trace_puts(t, "\n");
+        break;
+    case TRACE_JSON:
+        trace_puts(t, "{\"step\":");
+        trace_long(t, t->steps);
+        trace_puts(t, ",\"ip\":");
+        trace_long(t, ip);
+        trace_puts(t, ",\"la\":\"");
+        trace_puts(t, TERMINALS[la]);
+        trace_puts(t, "\",\"top\":\"");
+        trace_puts(t, sym_name(X));
+        trace_puts(t, op == TR_MATCH ? "\",\"op\":\"match\"}\n" : op == TR_REJECT ? "\",\"op\":\"reject\"}\n" : "\",\"op\":\"expand\",\"prod\":");
+        if (op == TR_EXPAND) {
+            trace_long(t, prod);
+            trace_puts(t, "}\n");
+        }
+        break;
+    default:
+        trace_record(t, op, X, op == TR_EXPAND ? prod : 0, la, (unsigned long)ip);
+        break;
+    }
+}
+
+// Ends the trace. In on_error mode an accepted parse leaves no output.
+void trace_end(TraceSink *t, CompileContext *ctx, int accepted, int ip) {
+    switch (t->format) {
+    case TRACE_HUMAN:
+        if (accepted) {
+            trace_printf(t, "%-25s %-15s %-10s %-25s\n", "pop", "$", "$", "match");
+            trace_puts(t, "\nSYNTAX ACCEPTED (Parser Structure Valid)\n");
+        } else {
+            if (!t->rejected) trace_puts(t, "\nSYNTAX REJECTED: Input not fully consumed or Stack not empty\n");
+            trace_puts(t, "Stack at rejection: ");
+            trace_stack(t, ctx);
+            trace_puts(t, "\n");
+        }
+        break;
+    case TRACE_JSON:
+        if (!accepted) {
+            trace_puts(t, "{\"op\":\"stack\",\"stack\":[");
+            for (int i = ctx->top; i >= 0; i--) trace_printf(t, "\"%s\"%s", sym_name(ctx->stack[i]), i > 0 ? "," : "");
+            trace_puts(t, "]}\n");
+        }
+        trace_printf(t, "{\"op\":\"end\",\"accepted\":%s,\"steps\":%ld,\"ip\":%d}\n", accepted ? "true" : "false", t->steps, ip);
+        break;
+    default:
+        trace_record(t, accepted ? TR_ACCEPT_END : TR_REJECT_END, 0, 0, 0, (unsigned long)ip);
+        break;
+    }
+
+    if (t->on_error && accepted) {
+        t->len = 0; // nothing to report
+        return;
+    }
+    if (t->dropped) { // on_error mode kept only the tail
+        if (t->format == TRACE_HUMAN) fprintf(t->out, "... (%zu bytes of earlier trace dropped)\n", t->dropped);
+        else if (t->format == TRACE_JSON) fprintf(t->out, "{\"op\":\"dropped\",\"bytes\":%zu}\n", t->dropped);
+    }
+    if (t->format == TRACE_BINARY && t->on_error) { // the header was left out of the kept tail
+        fwrite(TRACE_BINARY_HEADER, 1, sizeof(TRACE_BINARY_HEADER), t->out);
+        if (t->dropped) {
+            unsigned long d = t->dropped > 0xffffffffUL ? 0xffffffffUL : (unsigned long)t->dropped;
+            TraceRecord r = {TR_DROPPED, 0, 0, 0, {(unsigned char)d, (unsigned char)(d >> 8), (unsigned char)(d >> 16), (unsigned char)(d >> 24)}};
+            fwrite(&r, sizeof(r), 1, t->out);
+        }
+    }
+    trace_flush(t);
+}
+// --- End trace sinks ---
+
+// Makes token ip available, pulling more from the lexer in pull mode.
+// Only tokens from ip on are needed again, so the lexer may fill the ring
+// up to ip + TOKEN_BLOCK_SIZE - 1 (plus EOF), short of LEX_MAX_TOKENS.
+// Returns 0 past the end.
+static inline int next_token(CompileContext *ctx, int ip) {
+    while (ip >= ctx->token_count) {
+        if (!ctx->pull) return 0;
+        ctx->token_limit = ip < LEX_MAX_TOKENS - TOKEN_BLOCK_SIZE ? ip + TOKEN_BLOCK_SIZE - 1 : LEX_MAX_TOKENS;
+        if (!ctx->pull(ctx)) return 0;
+    }
+    return 1;
+}
+
+enum { PARSE_REJECTED, PARSE_ACCEPTED, PARSE_OPEN, PARSE_PARTIAL };
+
+// Parses ctx's token stream from the non-terminal start, reporting each
+// step to ctx->trace and, if ctx->ast is set, building the AST there.
+// With at_end set the stream is the whole rest of the program: the result
+// is PARSE_ACCEPTED or PARSE_REJECTED (the reason goes through
+// report_error()). Otherwise it is one piece of a longer program and its
+// EOF only ends the piece: the parser stops there and returns
+// PARSE_ACCEPTED if main was completed, PARSE_OPEN if the piece ended
+// between two function definitions (OptFuncs is all that is left) and
+// PARSE_PARTIAL if it ended inside one.
+int parse_from(CompileContext *ctx, int start, int at_end) {
+    parser_init();
+    TraceSink *trace = ctx->trace;
+    AstArena *ast = ctx->ast;
+    CompileStats *stats = ctx->stats;
+    double wall0 = 0, cpu0 = 0, lex_wall0 = 0, lex_cpu0 = 0;
+    if (stats) {
+        stats_clock(&wall0, &cpu0);
+        lex_wall0 = stats->lex_wall; // pulled tokens are lexed inside the parse
+        lex_cpu0 = stats->lex_cpu;
+    }
+    ctx->top = -1;
+    push(ctx, T_EOF);
+    push(ctx, start);
+    if (trace) trace_begin(trace, ctx);
+    if (ast) {
+        ast_reset(ast);
+        ast->root = ast_alloc(ast, 1);
+        memset(AST_NODE(ast, ast->root), 0, sizeof(AstNode));
+        AST_NODE(ast, ast->root)->sym = (Sym)start;
+        ctx->stack_node[0] = -1;
+        ctx->stack_node[1] = ast->root;
+    }
+
+    int ip = 0, rejected = 0;
+    long steps = 0;
+
+    while (ctx->top >= 0 && next_token(ctx, ip)) {
+        if (ctx->stack[ctx->top] == T_EOF) break; // '$' is matched by the acceptance check below
+        if (!at_end && token_type(ctx, ip) == TOKEN_EOF) break; // end of this piece
+        int X = pop(ctx);
+        steps++;
+        int node = ast ? ctx->stack_node[ctx->top + 1] : -1;
+
+        int ter_idx = token_type_to_ter_index(token_type(ctx, ip));
+        const char *lookahead_name = TERMINALS[ter_idx];
+
+        // 1. Check if X is a terminal
+        if (X < NTER) {
+            if (ter_idx != T_ERROR && X == ter_idx) {
+                if (trace) trace_step(trace, TR_MATCH, X, ter_idx, ip, 0);
+                if (stats) stats->matches++;
+                if (node >= 0) {
+                    AST_NODE(ast, node)->offset = token_offset(ctx, ip);
+                    AST_NODE(ast, node)->length = (unsigned int)token_length(ctx, ip);
+                    AST_NODE(ast, node)->name = ctx->names || ctx->consts ? token_name(ctx, ip) : 0;
+                }
+                ip++;
+            }
+            else {
+                int len;
+                const char *lexeme = token_text(ctx, ip, &len);
+                if (trace) trace_step(trace, TR_REJECT, X, ter_idx, ip, 0);
+                report_error(ctx, "PARSER ERROR: Expected terminal '%s', found '%.*s' (%s) at token index %lld", sym_name(X), len, lexeme, lookahead_name, ctx->token_base + ip);
+                rejected = 1;
+                break;
+            }
+        }
+        // 2. Check if X is a non-terminal
+        else {
+            if (!IS_NT(X) || ter_idx == T_ERROR) {
+                if (trace) trace_step(trace, TR_REJECT, X, ter_idx, ip, 0);
+                report_error(ctx, "PARSER ERROR: Invalid symbol on stack or invalid lookahead");
+                rejected = 1;
+                break;
+            }
+
+            int prod = TABLE[X - NTER][ter_idx];
+            if (prod == 0) {
+                if (trace) trace_step(trace, TR_REJECT, X, ter_idx, ip, 0);
+                report_error(ctx, "PARSER ERROR: No rule for (%s, %s) at token index %lld", sym_name(X), lookahead_name, ctx->token_base + ip);
+                rejected = 1;
+                break;
+            }
+
+            int first = prod_start[prod - 1];
+            int k = prod_start[prod] - first;
+            if (trace) trace_step(trace, TR_EXPAND, X, ter_idx, ip, prod);
+
+            // Push the production rule to stack (already stored in reverse order)
+            stack_reserve(ctx, k);
+            memcpy(ctx->stack + ctx->top + 1, prod_syms + first, (size_t)k * sizeof(Sym));
+            if (ast) {
+                int kids = prod_nchildren[prod];
+                int first_child = kids ? ast_alloc(ast, kids) : 0;
+                AstNode *n = AST_NODE(ast, node);
+                n->prod = (unsigned char)prod;
+                n->count = (unsigned short)kids;
+                n->first_child = first_child;
+                for (int j = 0; j < k; j++) {
+                    int slot = prod_child_slot[first + j];
+                    int child = slot >= 0 ? first_child + slot : -1;
+                    ctx->stack_node[ctx->top + 1 + j] = child;
+                    if (child >= 0) {
+                        memset(AST_NODE(ast, child), 0, sizeof(AstNode));
+                        AST_NODE(ast, child)->sym = prod_syms[first + j];
+                    }
+                }
+            }
+            ctx->top += k;
+            if (stats) {
+                stats->expansions++;
+                stats->productions[prod]++;
+                if (ctx->top + 1 > stats->max_stack) stats->max_stack = ctx->top + 1;
+            }
+        }
+    }
+
+    // EOF is only ever the last token, so matching it means all input was consumed
+    int at_eof = !rejected && next_token(ctx, ip) && token_type(ctx, ip) == TOKEN_EOF;
+    int status = at_eof && ctx->top == 0 && ctx->stack[0] == T_EOF ? PARSE_ACCEPTED : PARSE_REJECTED;
+    if (at_eof && !at_end && status != PARSE_ACCEPTED) {
+        status = ctx->top == 1 && ctx->stack[1] == SYM_NT(NT_OPT_FUNCS) ? PARSE_OPEN : PARSE_PARTIAL;
+    }
+    ctx->parse_steps = steps;
+    if (stats) {
+        double wall1, cpu1;
+        stats_clock(&wall1, &cpu1);
+        stats->parse_wall += wall1 - wall0 - (stats->lex_wall - lex_wall0);
+        stats->parse_cpu += cpu1 - cpu0 - (stats->lex_cpu - lex_cpu0);
+        stats->parses++;
+        stats->steps += steps;
+        stats->rejected += status == PARSE_REJECTED;
+        if (ctx->stack_cap > stats->stack_cap) stats->stack_cap = ctx->stack_cap;
+    }
+    if (trace) trace_end(trace, ctx, status == PARSE_ACCEPTED, ip);
+    if (ast && status != PARSE_REJECTED) {
+        ast->text = ctx->tokens.text;
+        ast->names = ctx->names;
+        ast->consts = ctx->consts;
+    }
+    if (status == PARSE_ACCEPTED) pop(ctx);
+    if (status == PARSE_REJECTED && !rejected) {
+        report_error(ctx, "PARSER ERROR: Input not fully consumed or Stack not empty at token index %lld", ctx->token_base + ip);
+    }
+    return status;
+}
+
+// Parses a whole program. Returns 1 if it is accepted, 0 if it is rejected.
+int parse(CompileContext *ctx) {
+    return parse_from(ctx, SYM_NT(NT_PROGRAM), 1) == PARSE_ACCEPTED;
+}
+
+// Writes the counters as one JSON object. DFA states and productions that
+// were never reached are left out.
+void stats_write_json(FILE *out, const CompileStats *st) {
+    fprintf(out, "{\"lex\":{\"calls\":%lld,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"bytes\":%lld,"
+                 "\"tokens\":%lld,\"errors\":%lld,\"dfa_transitions\":%lld,\"run_skipped_bytes\":%lld,"
+                 "\"backtracks\":%lld,\"backtrack_bytes\":%lld,\"memo_hits\":%lld,\"state_visits\":[",
+            st->lex_calls, st->lex_wall, st->lex_cpu, st->bytes, st->tokens, st->lex_errors, st->transitions,
+            st->run_bytes, st->backtracks, st->backtrack_bytes, st->memo_hits);
+    const char *sep = "";
+    for (int s = 0; s < dfa_nstates; s++) {
+        if (!st->state_visits[s]) continue;
+        fprintf(out, "%s{\"state\":%d,\"accepts\":", sep, s);
+        if (dfa_accept[s] != TOKEN_ERROR) fprintf(out, "\"%s\"", TOKEN_TYPE_NAMES[dfa_accept[s]]);
+        else fprintf(out, "%s", s == DFA_DEAD ? "\"(dead)\"" : "null");
+        fprintf(out, ",\"visits\":%lld}", st->state_visits[s]);
+        sep = ",";
+    }
+    fprintf(out, "]},\"parse\":{\"calls\":%lld,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"steps\":%lld,"
+                 "\"matches\":%lld,\"expansions\":%lld,\"rejected\":%lld,\"max_stack_depth\":%d,"
+                 "\"initial_stack_capacity\":%d,\"stack_capacity\":%d,\"productions\":[",
+            st->parses, st->parse_wall, st->parse_cpu, st->steps, st->matches, st->expansions, st->rejected,
+            st->max_stack, MAXSTACK, st->stack_cap);
+    sep = "";
+    for (int p = 1; p <= NPROD; p++) {
+        if (!st->productions[p]) continue;
+        fprintf(out, "%s{\"production\":%d,\"rule\":\"%s\",\"expansions\":%lld}", sep, p, GRAMMAR[p - 1],
+                st->productions[p]);
+        sep = ",";
+    }
+    fprintf(out, "]}");
+    if (st->cache_hits || st->cache_misses) {
+        fprintf(out, ",\"cache\":{\"hits\":%lld,\"misses\":%lld,\"stores\":%lld}", st->cache_hits, st->cache_misses,
+                st->cache_stores);
+    }
+    fprintf(out, "}\n");
+}
+
+
+// =================================================================
+// PART 3: INPUT (MEMORY-MAPPED OR CHUNKED READ)
+// =================================================================
+
+#define READ_CHUNK (64 * 1024)
+
+// Program text. Regular files are mapped read-only; anything else (pipes,
+// or platforms without mmap) is read in chunks into a growing buffer and
+// lexed as each chunk arrives. A pull-mode parse that builds no AST drops
+// the lexed front of that buffer as it goes (pull_recycle()), so it holds
+// about two chunks or the longest token, whichever is more.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int mapped;
+} Source;
+
+void source_free(Source *src) {
+#ifndef _WIN32
+    if (src->mapped) munmap(src->data, src->len);
+    else
+#endif
+    free(src->data);
+    memset(src, 0, sizeof(*src));
+}
+
+// Appends up to READ_CHUNK bytes from fp to src. Returns the number of
+// bytes read (0 at end of input), or -1 on a read error or out of memory.
+long source_read_chunk(Source *src, FILE *fp) {
+    if (src->cap - src->len < READ_CHUNK) {
+        size_t cap = src->cap ? src->cap * 2 : 4 * READ_CHUNK;
+        char *grown = realloc(src->data, cap);
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory reading input (%zu bytes)\n", src->len);
+            return -1;
+        }
+        src->data = grown;
+        src->cap = cap;
+    }
+    size_t n = fread(src->data + src->len, 1, READ_CHUNK, fp);
+    src->len += n;
+    if (n < READ_CHUNK && ferror(fp)) return -1;
+    return (long)n;
+}
+
+// Reads the rest of fp into src, feeding the lexer after every chunk.
+int source_read_chunked(CompileContext *ctx, Source *src, FILE *fp, LexState *ls) {
+    for (;;) {
+        long n = source_read_chunk(src, fp);
+        if (n < 0) return -1;
+        if (n < READ_CHUNK) {
+            lex_feed(ctx, ls, src->data, src->len, 1);
+            return 0;
+        }
+        lex_feed(ctx, ls, src->data, src->len, 0);
+    }
+}
+
+// Opens filename. Regular files are mapped whole into src and *fp is set
+// to NULL; otherwise src is left empty and the open stream is returned in
+// *fp for chunked reading. Returns -1 if the file cannot be opened.
+int source_open(const char *filename, Source *src, FILE **fp) {
+    memset(src, 0, sizeof(*src));
+    *fp = NULL;
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            src->data = p;
+            src->len = (size_t)st.st_size;
+            src->mapped = 1;
+            return 0;
+        }
+    }
+    *fp = fdopen(fd, "rb");
+    if (!*fp) {
+        close(fd);
+        return -1;
+    }
+#else
+    *fp = fopen(filename, "rb");
+    if (!*fp) return -1;
+#endif
+    return 0;
+}
+
+// Loads a file and lexes it into ctx. Returns 0 on success, -1 if it
+// cannot be opened or read.
+int lex_file(CompileContext *ctx, const char *filename, Source *src) {
+    LexState ls;
+    FILE *fp;
+    if (source_open(filename, src, &fp) != 0) return -1;
+    lex_begin(ctx, &ls);
+    if (!fp) {
+        lex_feed(ctx, &ls, src->data, src->len, 1);
+        return 0;
+    }
+    int rc = source_read_chunked(ctx, src, fp, &ls);
+    fclose(fp);
+    return rc;
+}
+
+// Reads the whole of filename into src. Returns -1 if it cannot.
+int read_whole_file(const char *filename, Source *src) {
+    FILE *fp;
+    if (source_open(filename, src, &fp) != 0) return -1;
+    if (!fp) return 0;
+    long n;
+    while ((n = source_read_chunk(src, fp)) == READ_CHUNK) {
+    }
+    fclose(fp);
+    return n < 0 ? -1 : 0;
+}
+
+// Input side of pull mode: lexes already-read bytes first and reads the
+// next chunk only when the lexer has run out of them.
+typedef struct {
+    LexState ls;
+    Source *src;
+    FILE *fp; // NULL once the whole input is in src
+} TokenPuller;
+
+// Drops the bytes before the current token from a streamed buffer once
+// they are at least half of it, so each byte moves at most once. Only
+// called when the parser has taken every token lexed so far and keeps no
+// AST: nothing points into the dropped text. The lexer's positions and the
+// scan memo's window move down with the text; token offsets still count
+// from the start of the input through ctx->tokens.base.
+void pull_recycle(CompileContext *ctx, TokenPuller *tp) {
+    LexState *ls = &tp->ls;
+    LexMemo *m = &ctx->memo;
+    size_t keep = ls->in_token ? ls->start : ls->pos;
+    size_t drop = keep & ~(size_t)63; // the memo window starts on a multiple of 64
+    if (m->hi > drop && m->lo < drop) drop = m->lo;
+    if (drop < READ_CHUNK || drop * 2 < tp->src->len) return;
+    memmove(tp->src->data, tp->src->data + drop, tp->src->len - drop);
+    tp->src->len -= drop;
+    ls->pos -= drop;
+    if (ls->in_token) {
+        ls->start -= drop;
+        if (ls->last_accepting_pos) ls->last_accepting_pos -= drop; // past start, so still nonzero
+    }
+    if (m->hi > drop) {
+        m->lo -= drop;
+        m->hi -= drop;
+    } else if (m->hi) {
+        lex_memo_reset(m); // every failure it remembers is behind the lexer
+    }
+    ctx->tokens.base += drop;
+}
+
+int pull_tokens(CompileContext *ctx) {
+    TokenPuller *tp = ctx->pull_state;
+    int before = ctx->token_count;
+    while (!tp->ls.done) {
+        lex_feed(ctx, &tp->ls, tp->src->data, tp->src->len, tp->fp == NULL);
+        if (ctx->token_count > before) return 1;
+        if (tp->fp) {
+            if (!ctx->ast) pull_recycle(ctx, tp);
+            long n = source_read_chunk(tp->src, tp->fp);
+            if (n < 0) report_error(ctx, "Error: Read failed after %zu bytes", ctx->tokens.base + tp->src->len);
+            if (n < READ_CHUNK) {
+                fclose(tp->fp);
+                tp->fp = NULL;
+            }
+        }
+    }
+    return ctx->token_count > before;
+}
+
+// Pull-mode parsing of text already in memory (src->data stays the
+// caller's; do not stream_close() it).
+void stream_source(CompileContext *ctx, Source *src, TokenPuller *tp) {
+    memset(tp, 0, sizeof(*tp));
+    tp->src = src;
+    context_pull(ctx, pull_tokens, tp);
+    lex_begin(ctx, &tp->ls);
+}
+
+// Opens a file for pull-mode parsing: nothing is lexed until parse() asks
+// for tokens. Returns -1 if it cannot be opened; stream_close() releases
+// the input.
+int stream_file(CompileContext *ctx, const char *filename, Source *src, TokenPuller *tp) {
+    FILE *fp;
+    if (source_open(filename, src, &fp) != 0) return -1;
+    stream_source(ctx, src, tp);
+    tp->fp = fp;
+    return 0;
+}
+
+void stream_close(TokenPuller *tp) {
+    if (tp->fp) fclose(tp->fp);
+    source_free(tp->src);
+}
+
+// Parses the text in src in pull mode. Returns parse()'s result.
+int parse_source(CompileContext *ctx, Source *src) {
+    TokenPuller tp;
+    stream_source(ctx, src, &tp);
+    int accepted = parse(ctx);
+    ctx->pull = NULL; // tp is gone
+    ctx->pull_state = NULL;
+    return accepted;
+}
+
+// --- On-disk parse cache (--cache DIR) ---
+// A file's tokens, lexer errors, verdict and AST depend only on its bytes
+// and on the token spec and grammar, so a build that checks the same
+// unchanged sources again can load them instead of lexing and parsing.
+// Each entry is one file in DIR named after a hash of the source seeded
+// with cache_stamp(); its header repeats the source length, a second hash
+// and the stamp, so a different source or table version that lands on
+// the same name is a miss rather than a wrong answer. The body is
+// fixed-width arrays in host byte order at 8-byte aligned offsets
+// (cache_layout()), mapped read-only on a hit and copied into the context;
+// commands that want only the verdict never touch the AST pages.
+//
+// Entries are written to a temporary file and renamed into place, so any
+// number of processes and threads can share DIR and a reader sees a whole
+// entry or none. A hit updates the entry's mtime; once DIR holds more
+// than its limit, the least recently used entries are deleted until it is
+// back under three quarters of it.
+//
+// A hit reports the same errors a miss did: lexer errors are replayed from
+// their offsets and a rejected parse from the parser's message. A miss
+// lexes the whole file before parsing (all tokens go in the entry), so a
+// rejected file reports every lexer error in it, where pull mode stops
+// lexing shortly after the syntax error. Traced parses bypass the cache.
+#ifndef _WIN32
+
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_DEFAULT_MAX_MB 256
+#define CACHE_SUFFIX ".ll1c"
+#define CACHE_TEMP_PREFIX ".tmp-"
+#define CACHE_TEMP_MAX_AGE 3600 // seconds before a writer's leftover temporary file is deleted
+
+typedef struct {
+    char magic[4];            // "LL1C"
+    unsigned int version;     // CACHE_FORMAT_VERSION (reads differently in the other byte order)
+    unsigned long long stamp; // cache_stamp() of the writer
+    unsigned long long check; // second hash of the source
+    unsigned long long length; // source bytes
+    long long steps;          // ctx->parse_steps
+    unsigned int tokens;      // including EOF
+    unsigned int lex_errors;
+    unsigned int names;       // distinct identifier spellings (entry-local ids 1..names)
+    unsigned int name_bytes;
+    unsigned int nodes;       // AstArena.used of an accepted parse, else 0
+    int root;
+    unsigned int message_len; // the parser's error, if rejected
+    int accepted;
+} CacheHeader;
+
+// AstNode in 16 bytes: a non-terminal has children and no span, a
+// terminal a span and no children.
+typedef struct {
+    unsigned char sym, prod;
+    unsigned short count;
+    unsigned int at;     // first_child, or offset for a terminal
+    unsigned int length;
+    unsigned int name;   // entry-local id, 0 if none
+} CacheNode;
+
+// Arrays after the header, in order
+enum { CE_TYPE, CE_LENGTH, CE_OFFSET, CE_NAME, CE_LEX_ERRORS, CE_NAME_LENGTHS, CE_NAME_TEXT, CE_NODES, CE_MESSAGE, CE_END };
+
+typedef struct {
+    char *dir;
+    unsigned long long stamp;
+    long long max_bytes;
+    pthread_mutex_t lock; // everything below
+    long long bytes;      // entry bytes in dir: the last scan plus this process's stores since
+    long long entries;
+    long long hits, misses, stores, evictions, failures;
+    long serial;          // temporary file names
+} ParseCache;
+
+ParseCache *parse_cache; // --cache DIR; NULL = off
+
+// Byte offsets of an entry's arrays (at[CE_END] is the entry size).
+size_t cache_layout(const CacheHeader *h, size_t at[CE_END + 1]) {
+    size_t size[CE_END] = {
+        h->tokens, (size_t)h->tokens * 4, (size_t)h->tokens * 4, (size_t)h->tokens * 4, (size_t)h->lex_errors * 4,
+        (size_t)h->names * 4, h->name_bytes, (size_t)h->nodes * sizeof(CacheNode), h->message_len,
+    };
+    size_t p = sizeof(CacheHeader);
+    for (int k = 0; k < CE_END; k++) {
+        at[k] = p;
+        p = (p + size[k] + 7) & ~(size_t)7;
+    }
+    at[CE_END] = p;
+    return p;
+}
+
+// Two 64-bit hashes of text, a word at a time in two independent chains:
+// the first names the entry, the second is checked against its header.
+void cache_hash(const char *text, size_t len, unsigned long long seed, unsigned long long h[2]) {
+    unsigned long long a = seed ^ 0x9e3779b97f4a7c15ULL, b = seed + len, w;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, text + i, 8);
+        a = (a ^ w) * 0xff51afd7ed558ccdULL;
+        a ^= a >> 29;
+        b = (b + w) * 0xc4ceb9fe1a85ec53ULL;
+        b ^= b >> 32;
+    }
+    w = 0;
+    if (len > i) memcpy(&w, text + i, len - i);
+    a = (a ^ w ^ len) * 0xff51afd7ed558ccdULL;
+    b = (b + w) * 0xc4ceb9fe1a85ec53ULL;
+    a ^= a >> 33;
+    a *= 0xc4ceb9fe1a85ec53ULL;
+    h[0] = a ^ (a >> 33);
+    b ^= b >> 29;
+    b *= 0xff51afd7ed558ccdULL;
+    h[1] = b ^ (b >> 32);
+}
+
+unsigned long long cache_stamp_add(unsigned long long stamp, const char *s, size_t n) {
+    unsigned long long h[2];
+    cache_hash(s, n, stamp, h);
+    return h[0];
+}
+
+// Hash of everything an entry depends on besides the source: the token
+// spec, the grammar and its symbol numbering, and the entry format.
+unsigned long long cache_stamp(void) {
+    unsigned long long stamp = CACHE_FORMAT_VERSION;
+    for (int i = 0; i < NSPEC; i++) {
+        stamp = cache_stamp_add(stamp ^ (unsigned)TOKEN_SPEC[i].type, TOKEN_SPEC[i].regex, strlen(TOKEN_SPEC[i].regex));
+    }
+    for (int i = 0; i < NTER; i++) stamp = cache_stamp_add(stamp, TERMINALS[i], strlen(TERMINALS[i]) + 1);
+    for (int i = 0; i < NNT; i++) stamp = cache_stamp_add(stamp, NT[i], strlen(NT[i]) + 1);
+    for (int p = 0; p < NPROD; p++) stamp = cache_stamp_add(stamp, GRAMMAR[p], strlen(GRAMMAR[p]) + 1);
+    return cache_stamp_add(stamp, (const char *)TOKEN_TO_TER, sizeof(TOKEN_TO_TER));
+}
+
+typedef struct {
+    time_t used; // mtime: when it was stored or last hit
+    long long size;
+    char *name;
+} CacheFile;
+
+int compare_cache_files(const void *a, const void *b) {
+    time_t x = ((const CacheFile *)a)->used, y = ((const CacheFile *)b)->used;
+    return x < y ? -1 : x > y;
+}
+
+// Rescans DIR and, if its entries add up to more than max_bytes, deletes
+// the least recently used down to three quarters of that. Temporary files
+// of writers that died are deleted once they are CACHE_TEMP_MAX_AGE old.
+// Called with cache->lock held.
+void cache_trim(ParseCache *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (!dir) return;
+    int dfd = dirfd(dir), n = 0, cap = 0;
+    CacheFile *files = NULL;
+    long long total = 0;
+    time_t now = time(NULL);
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        struct stat st;
+        size_t len = strlen(e->d_name), suffix = strlen(CACHE_SUFFIX);
+        int temp = strncmp(e->d_name, CACHE_TEMP_PREFIX, strlen(CACHE_TEMP_PREFIX)) == 0;
+        if (!temp && (len <= suffix || strcmp(e->d_name + len - suffix, CACHE_SUFFIX) != 0)) continue;
+        if (fstatat(dfd, e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (temp) {
+            if (now - st.st_mtime > CACHE_TEMP_MAX_AGE) unlinkat(dfd, e->d_name, 0);
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            CacheFile *grown = realloc(files, (size_t)cap * sizeof(CacheFile));
+            if (!grown) break;
+            files = grown;
+        }
+        files[n].used = st.st_mtime;
+        files[n].size = (long long)st.st_size;
+        files[n].name = strdup(e->d_name);
+        total += files[n++].size;
+    }
+    int removed = 0;
+    if (total > cache->max_bytes) {
+        qsort(files, (size_t)n, sizeof(CacheFile), compare_cache_files);
+        for (int i = 0; i < n && total > cache->max_bytes / 4 * 3; i++) {
+            if (unlinkat(dfd, files[i].name, 0) == 0 || errno == ENOENT) { // ENOENT: another process got there first
+                total -= files[i].size;
+                removed++;
+            }
+        }
+    }
+    cache->evictions += removed;
+    cache->entries = n - removed;
+    cache->bytes = total;
+    for (int i = 0; i < n; i++) free(files[i].name);
+    free(files);
+    closedir(dir);
+}
+
+// Opens (creating it if needed) the cache in dir, limited to max_bytes.
+// Returns NULL, having said why, if the directory cannot be used.
+ParseCache *cache_open(const char *dir, long long max_bytes) {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create cache directory %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+    if (access(dir, R_OK | W_OK | X_OK) != 0) {
+        fprintf(stderr, "Error: Cannot use cache directory %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+    ParseCache *cache = calloc(1, sizeof(ParseCache));
+    if (!cache || !(cache->dir = strdup(dir))) {
+        fprintf(stderr, "Error: Out of memory opening the cache\n");
+        exit(1);
+    }
+    cache->stamp = cache_stamp();
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache_trim(cache);
+    return cache;
+}
+
+void cache_close(ParseCache *cache) {
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
+
+void cache_count(ParseCache *cache, long long *counter) {
+    pthread_mutex_lock(&cache->lock);
+    (*counter)++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Copies an entry whose header matched into ctx (and ctx->ast), then
+// replays its errors. Returns parse()'s result as recorded, or -1 if
+// an array holds an out-of-range value or the tree is not one the
+// grammar can build; nothing is reported then.
+int cache_restore(CompileContext *ctx, const CacheHeader *h, const char *base, const size_t *at,
+                  const char *text, size_t len) {
+    const unsigned char *type = (const unsigned char *)base + at[CE_TYPE];
+    const unsigned int *length = (const unsigned int *)(base + at[CE_LENGTH]);
+    const unsigned int *offset = (const unsigned int *)(base + at[CE_OFFSET]);
+    const unsigned int *name = (const unsigned int *)(base + at[CE_NAME]);
+    const unsigned int *lex_errors = (const unsigned int *)(base + at[CE_LEX_ERRORS]);
+    const unsigned int *name_length = (const unsigned int *)(base + at[CE_NAME_LENGTHS]);
+    const CacheNode *nodes = (const CacheNode *)(base + at[CE_NODES]);
+    unsigned int ntokens = h->tokens;
+    if (ntokens == 0 || ntokens > LEX_MAX_TOKENS + 1 || type[ntokens - 1] != TOKEN_EOF) return -1;
+    if (h->accepted && (h->nodes == 0 || h->root < 0 || (unsigned)h->root >= h->nodes || h->nodes > INT_MAX)) return -1;
+    for (unsigned int k = 0; k < h->lex_errors; k++) {
+        if (lex_errors[k] >= len) return -1;
+    }
+
+    // Entry-local name ids to ctx's, interning each spelling once
+    unsigned int *ids = NULL;
+    if (ctx->names) {
+        ids = malloc(((size_t)h->names + 1) * sizeof(unsigned int));
+        if (!ids) return -1;
+        ids[0] = 0;
+        size_t p = 0;
+        for (unsigned int k = 0; k < h->names; k++) {
+            if (name_length[k] > h->name_bytes - p) {
+                free(ids);
+                return -1;
+            }
+            ids[k + 1] = intern(ctx->names, base + at[CE_NAME_TEXT] + p, name_length[k]);
+            p += name_length[k];
+        }
+    }
+
+    context_buffered(ctx);
+    ctx->tokens.text = text;
+    ctx->token_count = 0;
+    ctx->lex_errors = 0;
+    for (unsigned int first = 0; first < ntokens; first += TOKEN_BLOCK_SIZE) {
+        if ((int)(first >> TOKEN_BLOCK_SHIFT) == ctx->tokens.nblocks) token_grow(&ctx->tokens);
+        TokenBlock *b = ctx->tokens.blocks[first >> TOKEN_BLOCK_SHIFT];
+        unsigned int n = ntokens - first < TOKEN_BLOCK_SIZE ? ntokens - first : TOKEN_BLOCK_SIZE;
+        memcpy(b->type, type + first, n);
+        memcpy(b->length, length + first, (size_t)n * sizeof(unsigned int));
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int k = first + i;
+            if (type[k] >= TOKEN_ERROR || (size_t)offset[k] + length[k] > len || name[k] > h->names) {
+                free(ids);
+                return -1;
+            }
+            b->offset[i] = offset[k];
+            b->name[i] = ids ? ids[name[k]] : 0;
+            if (ctx->consts && type[k] == TOKEN_NUMBER) {
+                b->name[i] = const_add(ctx->consts, literal_decode(text + offset[k], length[k]));
+            }
+        }
+    }
+
+    AstArena *ast = ctx->ast;
+    if (ast) ast_reset(ast);
+    if (ast && h->accepted) {
+        for (unsigned int i = 0; i < h->nodes; i += AST_BLOCK_SIZE) {
+            ast_alloc(ast, h->nodes - i < AST_BLOCK_SIZE ? (int)(h->nodes - i) : AST_BLOCK_SIZE);
+        }
+        for (unsigned int i = 0; i < h->nodes; i++) {
+            const CacheNode *c = &nodes[i];
+            AstNode *x = AST_NODE(ast, i);
+            int nt = IS_NT(c->sym);
+            // An NT node must have been expanded by a production for its own
+            // symbol, with exactly that production's children after it
+            int bad_kids = c->count && (c->at <= i || (size_t)c->at + c->count > h->nodes);
+            int bad_prod = c->prod == 0 || c->prod > NPROD || SYM_NT(prod_lhs[c->prod]) != c->sym ||
+                           c->count != prod_nchildren[c->prod];
+            if ((!nt && c->sym >= NTER) || (nt && (bad_prod || bad_kids)) ||
+                (!nt && (c->count || (size_t)c->at + c->length > len)) || c->name > h->names) {
+                ast_reset(ast);
+                free(ids);
+                return -1;
+            }
+            x->sym = c->sym;
+            x->prod = c->prod;
+            x->count = c->count;
+            x->first_child = nt ? (int)c->at : 0;
+            x->offset = nt ? 0 : c->at;
+            x->length = c->length;
+            x->name = ids ? ids[c->name] : 0;
+            if (ctx->consts && c->sym == T_NUMBER) x->name = const_add(ctx->consts, literal_decode(text + c->at, c->length));
+        }
+        ast->root = h->root;
+        ast->text = text;
+        ast->names = ctx->names;
+        ast->consts = ctx->consts;
+    }
+    free(ids);
+
+    ctx->token_count = (int)ntokens;
+    ctx->parse_steps = (long)h->steps;
+    ctx->top = -1;
+    for (unsigned int k = 0; k < h->lex_errors; k++) lex_error(ctx, text, lex_errors[k]);
+    if (!h->accepted) report_error(ctx, "%.*s", (int)h->message_len, base + at[CE_MESSAGE]);
+    return h->accepted;
+}
+
+// Loads the entry at path into ctx if it holds this source. Returns
+// parse()'s result as recorded, or -1 on a miss: no entry, or one for
+// other bytes or tables. A damaged entry is deleted so a miss replaces it.
+int cache_load(ParseCache *cache, CompileContext *ctx, const char *path, const char *text, size_t len,
+               unsigned long long check) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    const CacheHeader *h = map;
+    size_t at[CE_END + 1];
+    int result = -1;
+    if (memcmp(h->magic, "LL1C", 4) == 0 && h->version == CACHE_FORMAT_VERSION && h->stamp == cache->stamp &&
+        h->check == check && h->length == len) {
+        if (cache_layout(h, at) == (size_t)st.st_size) result = cache_restore(ctx, h, map, at, text, len);
+        if (result < 0) {
+            unlink(path);
+            cache_count(cache, &cache->failures);
+        } else {
+            futimens(fd, NULL); // most recently used
+        }
+    }
+    munmap(map, (size_t)st.st_size);
+    close(fd);
+    return result;
+}
+
+// Writes the entry for the parse just done in ctx: its tokens, lexer error
+// offsets and the AST if it was accepted, else the parser's message. The
+// entry is assembled in memory, written to a temporary file and renamed
+// over path. Returns 0, or -1 if it could not be written.
+int cache_store(ParseCache *cache, CompileContext *ctx, const char *path, const char *text, size_t len,
+                unsigned long long check, int accepted, const char *message) {
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "LL1C", 4);
+    h.version = CACHE_FORMAT_VERSION;
+    h.stamp = cache->stamp;
+    h.check = check;
+    h.length = len;
+    h.steps = ctx->parse_steps;
+    h.tokens = (unsigned int)ctx->token_count;
+    h.lex_errors = (unsigned int)ctx->lex_errors;
+    h.accepted = accepted;
+    h.nodes = accepted ? (unsigned int)ctx->ast->used : 0;
+    h.root = accepted ? ctx->ast->root : -1;
+    h.message_len = accepted ? 0 : (unsigned int)strlen(message);
+
+    // Identifier ids local to the entry, so it does not depend on ctx's name table
+    Interner names = {0};
+    unsigned int *token_names = malloc((size_t)h.tokens * sizeof(unsigned int));
+    if (!token_names) return -1;
+    for (int i = 0; i < ctx->token_count; i++) {
+        TokenType t = token_type(ctx, i);
+        token_names[i] = t == TOKEN_VAR_NAME || t == TOKEN_FUNC_NAME
+            ? intern(&names, text + token_offset(ctx, i), (size_t)token_length(ctx, i)) : 0;
+    }
+    h.names = names.count;
+    for (unsigned int k = 1; k <= names.count; k++) h.name_bytes += names.names[k].len;
+
+    size_t at[CE_END + 1], size = cache_layout(&h, at);
+    char *buf = calloc(1, size);
+    unsigned char *live = accepted ? calloc(h.nodes, 1) : NULL;
+    int ok = buf && (!accepted || live);
+    if (ok) {
+        memcpy(buf, &h, sizeof(h));
+        unsigned char *type = (unsigned char *)buf + at[CE_TYPE];
+        unsigned int *length = (unsigned int *)(buf + at[CE_LENGTH]);
+        unsigned int *offset = (unsigned int *)(buf + at[CE_OFFSET]);
+        unsigned int *lex_errors = (unsigned int *)(buf + at[CE_LEX_ERRORS]);
+        unsigned int nerrors = 0;
+        size_t covered = 0; // end of the previous token
+        for (int i = 0; i < ctx->token_count; i++) {
+            size_t off = token_offset(ctx, i);
+            type[i] = (unsigned char)token_type(ctx, i);
+            length[i] = (unsigned int)token_length(ctx, i);
+            offset[i] = (unsigned int)off;
+            // The lexer skips one byte per error, so the errors are the
+            // non-space bytes between tokens
+            for (; covered < off; covered++) {
+                if (IS_SPACE_BYTE[(unsigned char)text[covered]]) continue;
+                if (nerrors < h.lex_errors) lex_errors[nerrors] = (unsigned int)covered;
+                nerrors++;
+            }
+            covered = off + length[i];
+        }
+        ok = nerrors == h.lex_errors;
+        memcpy(buf + at[CE_NAME], token_names, (size_t)h.tokens * sizeof(unsigned int));
+        unsigned int *name_length = (unsigned int *)(buf + at[CE_NAME_LENGTHS]);
+        char *name_text = buf + at[CE_NAME_TEXT];
+        for (unsigned int k = 1; k <= names.count; k++) {
+            name_length[k - 1] = names.names[k].len;
+            memcpy(name_text, names.names[k].text, names.names[k].len);
+            name_text += names.names[k].len;
+        }
+
+        // Nodes the tree reaches; the rest are gaps ast_alloc() left at
+        // block ends and are written as zeros. Children follow their parent.
+        CacheNode *nodes = (CacheNode *)(buf + at[CE_NODES]);
+        AstArena *ast = ctx->ast;
+        if (accepted) live[h.root] = 1;
+        for (unsigned int i = 0; i < h.nodes && ok; i++) {
+            if (!live[i]) continue;
+            AstNode *x = AST_NODE(ast, i);
+            CacheNode *c = &nodes[i];
+            c->sym = x->sym;
+            c->prod = x->prod;
+            c->count = x->count;
+            c->length = x->length;
+            if (IS_NT(x->sym)) {
+                c->at = (unsigned int)x->first_child;
+                for (int k = 0; k < x->count; k++) live[x->first_child + k] = 1;
+            } else {
+                c->at = (unsigned int)x->offset;
+                if (x->sym == T_VAR_NAME || x->sym == T_FUNC_NAME) c->name = intern(&names, text + x->offset, x->length);
+            }
+        }
+        ok = ok && names.count == h.names; // every identifier node has a token
+        memcpy(buf + at[CE_MESSAGE], message, h.message_len);
+    }
+    free(live);
+    free(token_names);
+    interner_free(&names);
+
+    char temp[4096];
+    pthread_mutex_lock(&cache->lock);
+    long serial = cache->serial++;
+    pthread_mutex_unlock(&cache->lock);
+    snprintf(temp, sizeof(temp), "%s/" CACHE_TEMP_PREFIX "%ld-%ld", cache->dir, (long)getpid(), serial);
+    FILE *out = ok ? fopen(temp, "wb") : NULL;
+    if (out) {
+        ok = fwrite(buf, 1, size, out) == size;
+        ok = fclose(out) == 0 && ok && rename(temp, path) == 0;
+        if (!ok) unlink(temp);
+    }
+    free(buf);
+
+    pthread_mutex_lock(&cache->lock);
+    if (out && ok) {
+        cache->stores++;
+        cache->entries++;
+        cache->bytes += (long long)size;
+        if (cache->bytes > cache->max_bytes) cache_trim(cache);
+    } else {
+        cache->failures++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return out && ok ? 0 : -1;
+}
+
+// Puts the path of text's entry in path and returns the hash its header
+// must hold.
+unsigned long long cache_entry(ParseCache *cache, const char *text, size_t len, char *path, size_t size) {
+    unsigned long long h[2];
+    cache_hash(text, len, cache->stamp, h);
+    snprintf(path, size, "%s/%016llx" CACHE_SUFFIX, cache->dir, h[0]);
+    return h[1];
+}
+
+// Lexes and parses src with ctx through the cache. A hit loads what the
+// first parse of the same bytes produced and reports its errors again; a
+// miss lexes the whole text, parses it and stores the result, with an AST
+// even if ctx has none, for later commands that need one. Traced parses,
+// and text past the entries' 32-bit offsets, are parsed in pull mode as
+// without a cache. Returns parse()'s result.
+int cache_parse(ParseCache *cache, CompileContext *ctx, Source *src) {
+    ctx->cached = 0;
+    if (ctx->trace || src->len >= UINT_MAX) return parse_source(ctx, src);
+    parser_init(); // the tables later phases read, whether or not anything is parsed
+    char path[4096];
+    unsigned long long check = cache_entry(cache, src->data, src->len, path, sizeof(path));
+    int accepted = cache_load(cache, ctx, path, src->data, src->len, check);
+    if (accepted >= 0) {
+        ctx->cached = 1;
+        cache_count(cache, &cache->hits);
+        if (ctx->stats) ctx->stats->cache_hits++;
+        return accepted;
+    }
+    cache_count(cache, &cache->misses);
+
+    AstArena scratch = {0}, *ast = ctx->ast;
+    scratch.root = -1;
+    if (!ast) ctx->ast = &scratch;
+    context_buffered(ctx);
+    lex(ctx, src->data, src->len);
+    int errors = ctx->errors;
+    char first_error[sizeof(ctx->first_error)];
+    memcpy(first_error, ctx->first_error, sizeof(first_error));
+    ctx->errors = 0; // keep the parser's own error for the entry
+    accepted = parse(ctx);
+    int stored = cache_store(cache, ctx, path, src->data, src->len, check, accepted, ctx->first_error) == 0;
+    if (errors) {
+        ctx->errors += errors;
+        memcpy(ctx->first_error, first_error, sizeof(first_error));
+    }
+    ctx->ast = ast;
+    ast_free(&scratch);
+    if (ctx->stats) {
+        ctx->stats->cache_misses++;
+        ctx->stats->cache_stores += stored;
+    }
+    return accepted;
+}
+
+#else
+typedef struct ParseCache ParseCache;
+ParseCache *parse_cache; // stays NULL: the cache maps entries and renames over them
+#define cache_parse(cache, ctx, src) parse_source(ctx, src)
+#endif
+
+// Parses the text in src with ctx, through parse_cache when it is on,
+// else in pull mode. Returns parse()'s result.
+int parse_text(CompileContext *ctx, Source *src) {
+    return parse_cache ? cache_parse(parse_cache, ctx, src) : parse_source(ctx, src);
+}
+
+// Parses filename with ctx: through parse_cache when it is on (the whole
+// file is read first, to look it up), else in pull mode. The text is left
+// in src for the AST (only its unlexed tail without one, if it was read
+// from a stream); source_free() it. Returns parse()'s
+// result, or -1 if the file cannot be opened or read.
+int parse_file(CompileContext *ctx, const char *filename, Source *src) {
+    if (parse_cache) return read_whole_file(filename, src) == 0 ? cache_parse(parse_cache, ctx, src) : -1;
+    TokenPuller tp;
+    if (stream_file(ctx, filename, src, &tp) != 0) return -1;
+    int accepted = parse(ctx);
+    if (tp.fp) fclose(tp.fp); // rejected before the end of a stream
+    ctx->pull = NULL;
+    ctx->pull_state = NULL;
+    return accepted;
+}
+// --- End parse cache ---
+
+// =================================================================
+// PART 4: BENCHMARKS
+// =================================================================
+
+double now_seconds() {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// Order-sensitive digest of the token stream, used to check that every
+// lexer configuration produces exactly the same tokens. token_digest_range()
+// continues a digest h over the first count tokens of ctx, so a stream
+// lexed in pieces can be digested piece by piece.
+unsigned long long token_digest_range(unsigned long long h, const CompileContext *ctx, int count) {
+    for (int i = 0; i < count; i++) {
+        h = (h ^ (unsigned long long)token_type(ctx, i)) * 1099511628211ULL;
+        h = (h ^ (unsigned long long)token_offset(ctx, i)) * 1099511628211ULL;
+        h = (h ^ (unsigned long long)token_length(ctx, i)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+unsigned long long token_digest(const CompileContext *ctx) {
+    return token_digest_range(1469598103934665603ULL, ctx, ctx->token_count);
+}
+
+// Lexes one file repeatedly with each lexer configuration and reports the
+// best time of each as MB/s.
+int bench_lex(const char *filename, int iterations) {
+    Source src;
+    CompileContext ctx;
+    context_init(&ctx, NULL, NULL); // error reporting would dominate the timings
+    if (lex_file(&ctx, filename, &src) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return 1;
+    }
+
+    struct { const char *name; int engine; int simd; } configs[] = {
+        {"table-driven", LEX_ENGINE_TABLE, SIMD_SCALAR},
+        {"table + sse2 runs", LEX_ENGINE_TABLE, SIMD_SSE2},
+        {"table + avx2 runs", LEX_ENGINE_TABLE, SIMD_AVX2},
+        {"direct-coded", LEX_ENGINE_DIRECT, SIMD_SCALAR},
+        {"linear (scan memo) + avx2", LEX_ENGINE_LINEAR, SIMD_AVX2},
+    };
+    int nconfigs = (int)(sizeof(configs) / sizeof(configs[0]));
+    int engine = lex_engine;
+    double baseline = 0;
+    unsigned long long expected = 0;
+    int status = 0;
+
+    printf("--- LEXER BENCHMARK: %s (%zu bytes, best of %d) ---\n", filename, src.len, iterations);
+    printf("%-26s %10s %10s %10s %8s\n", "Lexer", "Tokens", "Best (ms)", "MB/s", "Speedup");
+    for (int c = 0; c < nconfigs; c++) {
+        if (lexer_set_simd(configs[c].simd) != configs[c].simd) continue; // not supported here
+        if (configs[c].engine == LEX_ENGINE_DIRECT && !direct_scanner_ok) {
+            printf("%-26s skipped: scan_direct() is stale, regenerate it with --emit-lexer\n", configs[c].name);
+            continue;
+        }
+        lex_engine = configs[c].engine;
+        double best = 1e30;
+        for (int it = 0; it < iterations; it++) {
+            double t0 = now_seconds();
+            lex(&ctx, src.data, src.len);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+        }
+        unsigned long long digest = token_digest(&ctx);
+        if (c == 0) {
+            expected = digest;
+            baseline = best;
+        } else if (digest != expected) {
+            fprintf(stderr, "Benchmark Error: '%s' produced a different token stream\n", configs[c].name);
+            status = 1;
+        }
+        printf("%-26s %10d %10.3f %10.1f %7.2fx\n", configs[c].name, ctx.token_count, best * 1e3,
+               (double)src.len / (1024.0 * 1024.0) / best, baseline / best);
+    }
+
+    lex_engine = engine;
+    lexer_set_simd(SIMD_AVX2);
+    context_free(&ctx);
+    source_free(&src);
+    return status;
+}
+
+// Decodes every NUMBER of one file: through strtoll()/strtod() on a
+// NUL-terminated copy of the lexeme, as a consumer of the token text
+// would, with literal_decode(), and with literal_decode() feeding the
+// constant pool, as add_token() does. Checks that the values agree.
+int bench_literals(const char *filename, int iterations) {
+    const char *modes[] = {"strtoll / strtod", "SWAR decode", "SWAR decode + pool"};
+    Source src;
+    CompileContext ctx;
+    ConstPool pool = {0};
+    context_init(&ctx, NULL, NULL);
+    if (lex_file(&ctx, filename, &src) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return 1;
+    }
+    int nliterals = 0, status = 0;
+    for (int i = 0; i < ctx.token_count; i++) nliterals += token_type(&ctx, i) == TOKEN_NUMBER;
+    size_t *spans = malloc(2 * (size_t)(nliterals + 1) * sizeof(size_t)); // offset, length
+    if (!spans) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0, k = 0; i < ctx.token_count; i++) {
+        if (token_type(&ctx, i) != TOKEN_NUMBER) continue;
+        spans[k++] = token_offset(&ctx, i);
+        spans[k++] = (size_t)token_length(&ctx, i);
+    }
+
+    printf("--- LITERAL BENCHMARK: %s (%d literals, best of %d) ---\n", filename, nliterals, iterations);
+    printf("%-26s %10s %12s %8s\n", "Decoder", "Best (ms)", "ns/literal", "Speedup");
+    double baseline = 0;
+    unsigned long long expected = 0;
+    for (int m = 0; m < 3; m++) {
+        double best = 1e30;
+        unsigned long long sum = 0;
+        for (int it = 0; it < iterations; it++) {
+            const_pool_clear(&pool);
+            sum = 0;
+            double t0 = now_seconds();
+            for (int k = 0; k < nliterals; k++) {
+                const char *p = src.data + spans[2 * k];
+                size_t len = spans[2 * k + 1];
+                Literal lit;
+                if (m == 0) {
+                    char copy[64];
+                    if (len >= sizeof(copy)) len = sizeof(copy) - 1;
+                    memcpy(copy, p, len);
+                    copy[len] = '\0';
+                    lit.dec = memchr(copy, '.', len) != NULL;
+                    if (lit.dec) lit.v.d = strtod(copy, NULL);
+                    else lit.v.i = strtoll(copy, NULL, 10);
+                } else {
+                    lit = literal_decode(p, len);
+                    if (m == 2) const_add(&pool, lit);
+                }
+                sum = sum * 31 + (unsigned long long)lit.v.i;
+            }
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+        }
+        if (m == 0) {
+            expected = sum;
+            baseline = best;
+        } else if (sum != expected) {
+            fprintf(stderr, "Benchmark Error: '%s' decoded different values\n", modes[m]);
+            status = 1;
+        }
+        printf("%-26s %10.3f %12.1f %7.2fx\n", modes[m], best * 1e3, nliterals ? best * 1e9 / nliterals : 0.0,
+               baseline / best);
+    }
+    printf("constant pool: %u distinct constants\n", pool.count);
+    free(spans);
+    const_pool_free(&pool);
+    context_free(&ctx);
+    source_free(&src);
+    return status;
+}
+
+// Parses one file repeatedly: lexing it whole first, pulling tokens on
+// demand, and pulling while building the AST. Reports the best time and
+// the token and AST memory of each.
+int bench_parse(const char *filename, int iterations) {
+    const char *names[] = {"lex, then parse", "pull (next_token)", "pull + AST"};
+    AstArena ast = {0};
+    ast.root = -1;
+    printf("--- PARSER BENCHMARK: %s (best of %d) ---\n", filename, iterations);
+    printf("%-26s %10s %10s %14s %12s %9s\n", "Mode", "Tokens", "Best (ms)", "Token memory", "AST nodes", "Result");
+    for (int mode = 0; mode < 3; mode++) {
+        CompileContext ctx;
+        context_init(&ctx, NULL, NULL);
+        if (mode == 2) ctx.ast = &ast;
+        double best = 1e30;
+        int accepted = 0;
+        size_t token_bytes = 0;
+        for (int it = 0; it < iterations; it++) {
+            Source src;
+            TokenPuller tp;
+            double t0 = now_seconds();
+            int rc = mode == 0 ? lex_file(&ctx, filename, &src) : stream_file(&ctx, filename, &src, &tp);
+            if (rc != 0) {
+                fprintf(stderr, "Error: Cannot open %s\n", filename);
+                context_free(&ctx);
+                return 1;
+            }
+            accepted = parse(&ctx);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+            token_bytes = (size_t)ctx.tokens.nblocks * sizeof(TokenBlock);
+            if (mode == 0) source_free(&src);
+            else stream_close(&tp);
+        }
+        printf("%-26s %10d %10.3f %11zu KB %12d %9s\n", names[mode], ctx.token_count, best * 1e3,
+               token_bytes / 1024, mode == 2 ? ast.used : 0, accepted ? "accepted" : "rejected");
+        context_free(&ctx);
+    }
+    ast_free(&ast);
+    return 0;
+}
+// Parses one file repeatedly in pull mode with each trace format written
+// to the null device, and reports the best time and trace size of each.
+int bench_trace(const char *filename, int iterations) {
+#ifndef _WIN32
+    const char *null_device = "/dev/null";
+#else
+    const char *null_device = "NUL";
+#endif
+    struct { const char *name; int format; int on_error; } modes[] = {
+        {"quiet (no trace)", -1, 0},
+        {"human", TRACE_HUMAN, 0},
+        {"json", TRACE_JSON, 0},
+        {"binary", TRACE_BINARY, 0},
+        {"json, on error only", TRACE_JSON, 1},
+    };
+    int nmodes = (int)(sizeof(modes) / sizeof(modes[0]));
+    FILE *null_out = fopen(null_device, "wb");
+    if (!null_out) {
+        fprintf(stderr, "Error: Cannot open %s\n", null_device);
+        return 1;
+    }
+
+    printf("--- TRACE BENCHMARK: %s (best of %d) ---\n", filename, iterations);
+    printf("%-26s %10s %10s %14s %9s\n", "Trace", "Steps", "Best (ms)", "Trace bytes", "Result");
+    for (int m = 0; m < nmodes; m++) {
+        TraceSink sink;
+        CompileContext ctx;
+        if (modes[m].format >= 0) trace_open(&sink, null_out, modes[m].format, modes[m].on_error);
+        context_init(&ctx, NULL, modes[m].format >= 0 ? &sink : NULL);
+        double best = 1e30;
+        int accepted = 0;
+        size_t bytes = 0;
+        for (int it = 0; it < iterations; it++) {
+            Source src;
+            TokenPuller tp;
+            if (stream_file(&ctx, filename, &src, &tp) != 0) {
+                fprintf(stderr, "Error: Cannot open %s\n", filename);
+                fclose(null_out);
+                return 1;
+            }
+            size_t before = modes[m].format >= 0 ? sink.written : 0;
+            double t0 = now_seconds();
+            accepted = parse(&ctx);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+            if (modes[m].format >= 0) bytes = sink.written - before;
+            stream_close(&tp);
+        }
+        printf("%-26s %10ld %10.3f %14zu %9s\n", modes[m].name, modes[m].format >= 0 ? sink.steps : 0L,
+               best * 1e3, bytes, accepted ? "accepted" : "rejected");
+        if (modes[m].format >= 0) trace_close(&sink);
+        context_free(&ctx);
+    }
+    fclose(null_out);
+    return 0;
+}
+#ifndef _WIN32
+// Times parsing a file the way --check does without a cache, then through
+// a cache in a temporary directory: a miss (lex, parse, store the entry)
+// and hits that load the verdict only or the tokens, AST and names too.
+int bench_cache(const char *filename, int iterations) {
+    const char *modes[] = {"no cache (pull + AST + names)", "miss (lex, parse, store)", "hit, verdict only",
+                           "hit, tokens + AST + names"};
+    char dir[] = "/tmp/ll1-cache-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Error: Cannot create a temporary cache directory");
+        return 1;
+    }
+    ParseCache *cache = cache_open(dir, (long long)CACHE_DEFAULT_MAX_MB << 20);
+    Source src;
+    if (!cache || read_whole_file(filename, &src) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        rmdir(dir);
+        return 1;
+    }
+    char path[4096];
+    cache_entry(cache, src.data, src.len, path, sizeof(path));
+    AstArena ast = {0};
+    ast.root = -1;
+    printf("--- PARSE CACHE BENCHMARK: %s (best of %d) ---\n", filename, iterations);
+    printf("%-32s %10s %10s %9s\n", "Mode", "Best (ms)", "Speedup", "Result");
+    double baseline = 0;
+    for (int mode = 0; mode < 4; mode++) {
+        double best = 1e30;
+        int accepted = 0;
+        for (int it = 0; it < iterations; it++) {
+            CompileContext ctx;
+            Interner names = {0};
+            ConstPool consts = {0};
+            context_init(&ctx, NULL, NULL);
+            if (mode != 2) {
+                ctx.ast = &ast;
+                ctx.names = &names;
+                ctx.consts = &consts;
+            }
+            if (mode == 1) unlink(path);
+            double t0 = now_seconds();
+            accepted = mode == 0 ? parse_source(&ctx, &src) : cache_parse(cache, &ctx, &src);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+            if (mode >= 2 && !ctx.cached) fprintf(stderr, "Benchmark Error: expected a cache hit\n");
+            interner_free(&names);
+            const_pool_free(&consts);
+            context_free(&ctx);
+        }
+        if (mode == 0) baseline = best;
+        printf("%-32s %10.3f %9.1fx %9s\n", modes[mode], best * 1e3, baseline / best, accepted ? "accepted" : "rejected");
+    }
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        printf("entry: %lld KB for %zu KB of source\n", (long long)st.st_size / 1024, src.len / 1024);
+    }
+    unlink(path);
+    rmdir(dir);
+    cache_close(cache);
+    ast_free(&ast);
+    source_free(&src);
+    return 0;
+}
+#endif
+
+
+// =================================================================
+// PART 5: BATCH MODE (WORK-STEALING THREAD POOL)
+// =================================================================
+
+enum { BATCH_ACCEPTED, BATCH_REJECTED, BATCH_UNREADABLE };
+const char *BATCH_STATUS_NAMES[] = {"ACCEPTED", "REJECTED", "UNREADABLE"};
+
+// Outcome of one file, filled in by whichever worker compiled it.
+typedef struct {
+    char *path;
+    int status;
+    int token_count;
+    int lex_errors;
+    char message[256];
+} BatchResult;
+
+typedef struct {
+    BatchResult *items;
+    int count;
+    int cap;
+} BatchList;
+
+void batch_add_file(BatchList *list, const char *path) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 64;
+        BatchResult *grown = realloc(list->items, (size_t)cap * sizeof(BatchResult));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory listing batch inputs\n");
+            exit(1);
+        }
+        list->items = grown;
+        list->cap = cap;
+    }
+    BatchResult *r = &list->items[list->count++];
+    memset(r, 0, sizeof(*r));
+    r->path = strdup(path);
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Adds path, or every regular file under it (recursively, sorted, skipping
+// dot files) if it is a directory. Symbolic links to directories inside it
+// are not followed, as they can lead back up the tree.
+void batch_add_path(BatchList *list, const char *path) {
+#ifndef _WIN32
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (!dir) {
+            batch_add_file(list, path); // reported as unreadable
+            return;
+        }
+        char **names = NULL;
+        int n = 0, cap = 0;
+        struct dirent *e;
+        while ((e = readdir(dir)) != NULL) {
+            if (e->d_name[0] == '.') continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 32;
+                names = realloc(names, (size_t)cap * sizeof(char *));
+                if (!names) {
+                    fprintf(stderr, "Error: Out of memory listing %s\n", path);
+                    exit(1);
+                }
+            }
+            size_t len = strlen(path) + strlen(e->d_name) + 2;
+            names[n] = malloc(len);
+            if (!names[n]) {
+                fprintf(stderr, "Error: Out of memory listing %s\n", path);
+                exit(1);
+            }
+            snprintf(names[n], len, "%s/%s", path, e->d_name);
+            n++;
+        }
+        closedir(dir);
+        qsort(names, (size_t)n, sizeof(char *), compare_names);
+        for (int i = 0; i < n; i++) {
+            struct stat link;
+            int dir_link = lstat(names[i], &link) == 0 && S_ISLNK(link.st_mode) && stat(names[i], &st) == 0 &&
+                           S_ISDIR(st.st_mode);
+            if (!dir_link) batch_add_path(list, names[i]);
+            free(names[i]);
+        }
+        free(names);
+        return;
+    }
+#endif
+    batch_add_file(list, path);
+}
+
+// Parses one file with a worker's context (in pull mode, or through the
+// parse cache), reusing its tokens and stack from the previous file.
+void compile_batch_file(CompileContext *ctx, BatchResult *r) {
+    Source src;
+    ctx->errors = 0;
+    ctx->first_error[0] = '\0';
+    int accepted = parse_file(ctx, r->path, &src);
+    if (accepted < 0) {
+        r->status = BATCH_UNREADABLE;
+        snprintf(r->message, sizeof(r->message), "Cannot open or read file");
+        return;
+    }
+    r->status = accepted ? BATCH_ACCEPTED : BATCH_REJECTED;
+    r->token_count = ctx->token_count; // tokens lexed, which in pull mode stops at a syntax error
+    r->lex_errors = ctx->lex_errors;
+    snprintf(r->message, sizeof(r->message), "%s", ctx->first_error);
+    source_free(&src);
+}
+
+// Each worker owns a contiguous range of file indices. It takes files from
+// the front of its own range; when that is empty it steals the back half
+// of another worker's range, so a worker stuck on a few large files sheds
+// the rest of its share to idle ones.
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    int head; // next file the owner will take
+    int tail; // one past the last file in the range
+    int steals;
+} WorkQueue;
+
+#ifndef _WIN32
+#define QUEUE_LOCK(q) pthread_mutex_lock(&(q)->lock)
+#define QUEUE_UNLOCK(q) pthread_mutex_unlock(&(q)->lock)
+#else
+#define QUEUE_LOCK(q) ((void)0)
+#define QUEUE_UNLOCK(q) ((void)0)
+#endif
+
+typedef struct {
+    BatchResult *results;
+    WorkQueue *queues;
+    int nworkers;
+} BatchPool;
+
+typedef struct {
+    BatchPool *pool;
+    int id;
+    CompileStats *stats; // this worker's counters, NULL = off
+} BatchWorker;
+
+// Moves the back half of some other worker's range into queue `self`.
+// Returns 0 once every range is empty.
+int steal_work(BatchPool *pool, int self) {
+    for (int k = 1; k < pool->nworkers; k++) {
+        WorkQueue *victim = &pool->queues[(self + k) % pool->nworkers];
+        QUEUE_LOCK(victim);
+        int left = victim->tail - victim->head;
+        if (left <= 0) {
+            QUEUE_UNLOCK(victim);
+            continue;
+        }
+        int take = (left + 1) / 2;
+        victim->tail -= take;
+        int lo = victim->tail;
+        QUEUE_UNLOCK(victim);
+
+        WorkQueue *q = &pool->queues[self];
+        QUEUE_LOCK(q);
+        q->head = lo;
+        q->tail = lo + take;
+        q->steals++;
+        QUEUE_UNLOCK(q);
+        return 1;
+    }
+    return 0;
+}
+
+void *batch_worker(void *arg) {
+    BatchWorker *w = arg;
+    BatchPool *pool = w->pool;
+    WorkQueue *q = &pool->queues[w->id];
+    CompileContext ctx;
+    context_init(&ctx, NULL, NULL);
+    ctx.stats = w->stats;
+
+    for (;;) {
+        QUEUE_LOCK(q);
+        int job = q->head < q->tail ? q->head++ : -1;
+        QUEUE_UNLOCK(q);
+        if (job < 0) {
+            if (!steal_work(pool, w->id)) break;
+            continue;
+        }
+        compile_batch_file(&ctx, &pool->results[job]);
+    }
+
+    context_free(&ctx);
+    return NULL;
+}
+
+int default_jobs() {
+#ifndef _WIN32
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+// Compiles every file in paths (directories are expanded) on `jobs`
+// threads, then prints one line per file in input order and a summary.
+// With stats_out set the workers' counters are added up and written there
+// as JSON. Returns 0 if every file was accepted.
+int run_batch(char **paths, int npaths, int jobs, FILE *stats_out) {
+    BatchList list = {0};
+    for (int i = 0; i < npaths; i++) batch_add_path(&list, paths[i]);
+    if (list.count == 0) {
+        fprintf(stderr, "Error: No input files for --batch\n");
+        return 1;
+    }
+#ifdef _WIN32
+    jobs = 1;
+#endif
+    if (jobs < 1) jobs = 1;
+    if (jobs > list.count) jobs = list.count;
+
+    // Shared tables are built once, before any worker reads them
+    lexer_init();
+    parser_init();
+
+    BatchPool pool;
+    pool.results = list.items;
+    pool.nworkers = jobs;
+    pool.queues = calloc((size_t)jobs, sizeof(WorkQueue));
+    BatchWorker *workers = calloc((size_t)jobs, sizeof(BatchWorker));
+    CompileStats *stats = stats_out ? calloc((size_t)jobs, sizeof(CompileStats)) : NULL;
+    if (!pool.queues || !workers || (stats_out && !stats)) {
+        fprintf(stderr, "Error: Out of memory starting %d workers\n", jobs);
+        return 1;
+    }
+    for (int i = 0; i < jobs; i++) {
+        pool.queues[i].head = (int)((long long)list.count * i / jobs);
+        pool.queues[i].tail = (int)((long long)list.count * (i + 1) / jobs);
+#ifndef _WIN32
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+#endif
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].stats = stats ? &stats[i] : NULL;
+    }
+
+    double t0 = now_seconds();
+#ifndef _WIN32
+    pthread_t *threads = calloc((size_t)jobs, sizeof(pthread_t));
+    int started = 1;
+    for (; threads && started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &workers[started]) != 0) break;
+    }
+    batch_worker(&workers[0]); // the calling thread is worker 0
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+#else
+    batch_worker(&workers[0]);
+#endif
+    double elapsed = now_seconds() - t0;
+
+    int counts[3] = {0, 0, 0};
+    long long total_tokens = 0;
+    for (int i = 0; i < list.count; i++) {
+        BatchResult *r = &list.items[i];
+        counts[r->status]++;
+        total_tokens += r->token_count;
+        printf("%-10s %s", BATCH_STATUS_NAMES[r->status], r->path);
+        if (r->status == BATCH_ACCEPTED) {
+            printf(" (%d tokens", r->token_count);
+            if (r->lex_errors) printf(", %d lexer errors", r->lex_errors);
+            printf(")\n");
+        } else {
+            printf(": %s\n", r->message);
+        }
+    }
+
+    int steals = 0;
+    for (int i = 0; i < jobs; i++) steals += pool.queues[i].steals;
+    printf("\n--- BATCH: %d files, %d accepted, %d rejected, %d unreadable, %lld tokens ---\n",
+           list.count, counts[BATCH_ACCEPTED], counts[BATCH_REJECTED], counts[BATCH_UNREADABLE], total_tokens);
+    printf("%d jobs, %d steals, %.3f s (%.0f files/s)\n", jobs, steals, elapsed,
+           elapsed > 0 ? list.count / elapsed : 0.0);
+#ifndef _WIN32
+    if (parse_cache) {
+        printf("cache: %lld hits, %lld misses, %lld stored, %lld evicted, %lld failed; %lld entries, %.1f MB in %s\n",
+               parse_cache->hits, parse_cache->misses, parse_cache->stores, parse_cache->evictions,
+               parse_cache->failures, parse_cache->entries, parse_cache->bytes / 1048576.0, parse_cache->dir);
+    }
+#endif
+    if (stats) {
+        for (int i = 1; i < jobs; i++) stats_merge(&stats[0], &stats[i]);
+        fflush(stdout);
+        stats_write_json(stats_out, &stats[0]);
+        free(stats);
+    }
+
+    for (int i = 0; i < jobs; i++) {
+#ifndef _WIN32
+        pthread_mutex_destroy(&pool.queues[i].lock);
+#endif
+    }
+    for (int i = 0; i < list.count; i++) free(list.items[i].path);
+    free(list.items);
+    free(pool.queues);
+    free(workers);
+    return counts[BATCH_ACCEPTED] == list.count ? 0 : 1;
+}
+
+
+// =================================================================
+// PART 6: BYTECODE COMPILER AND VM
+// =================================================================
+
+// Semantics of accepted programs:
+//   int is a 64-bit integer (wrapping), dec a double; `+` on an int and a
+//   dec gives a dec, and values are converted to the declared type on
+//   assignment, argument passing and return.
+//   A NUMBER with a fraction (2.5) is a dec literal, one without (25) an
+//   int literal; an int literal above 2^63 - 1 is an error.
+//   Variables are local to their function and start at 0.
+//   `loop _v : while ( _w < N ) { body break .. }` sets _v to 0 (declaring
+//   it as an int if needed), then runs body while _w < N, adding 1 to _v
+//   after each pass. The comparison is exact when one side is a dec.
+//   printf(_v) prints the value and a newline ("%lld" or "%g").
+//   main's return value is the program's result.
+
+enum { TY_INT, TY_DEC };
+const char *TYPE_NAMES[] = {"int", "dec"};
+
+typedef union {
+    long long i;
+    double d;
+} Value;
+
+// Register machine: every function has a frame of nregs Values. Parameters
+// are registers 0..nparams-1, then locals, then temporaries.
+enum {
+    OP_MOV,    // r[a] = r[b]
+    OP_LOADK,  // r[a] = K[b]
+    OP_ADDI,   // r[a].i = r[b].i + r[c].i
+    OP_ADDD,   // r[a].d = r[b].d + r[c].d
+    OP_I2D,    // r[a].d = r[b].i
+    OP_D2I,    // r[a].i = r[b].d (dec_to_int())
+    OP_INCI,   // r[a].i += 1
+    OP_INCD,   // r[a].d += 1
+    OP_JGEI,   // if (r[a].i >= K[b].i) pc = c
+    OP_JGED,   // if (r[a].d >= K[b].d) pc = c
+    OP_JMP,    // pc = c
+    OP_PRINTI, // print r[a].i
+    OP_PRINTD, // print r[a].d
+    OP_CALL,   // r[a] = funcs[b](r[c], r[c+1], ...)
+    OP_RET,    // return r[a]
+    OP_MULKI,  // r[a].i = r[b].i * K[c].i
+    OP_COUNT
+};
+const char *OP_NAMES[] = {"MOV", "LOADK", "ADDI", "ADDD", "I2D", "D2I", "INCI", "INCD", "JGEI", "JGED",
+                          "JMP", "PRINTI", "PRINTD", "CALL", "RET", "MULKI"};
+
+typedef struct {
+    unsigned char op;
+    unsigned short a;
+    int b;
+    int c; // jump targets are absolute indices into Bytecode.code
+} Instr;
+
+typedef struct {
+    const char *name;
+    int name_len;
+    int node;        // FuncDef or MainFunc AST node
+    int body;        // StatementList node
+    int ret_stmt;    // ReturnStmt node
+    int params;      // FuncParams node
+    int ret_type;
+    int nparams;
+    int param_types; // index into Bytecode.types
+    int nregs;
+    int code_start;
+} VmFunction;
+
+typedef struct {
+    Instr *code;
+    int ncode, code_cap;
+    Value *consts;        // K[]: the parse's literal constants first (K[id - 1]), then any others
+    int nconsts, consts_cap;
+    int nliterals;
+    VmFunction *funcs;
+    int nfuncs, funcs_cap;
+    unsigned char *types; // types of the literals (types[id - 1]), then parameter types of all functions
+    int ntypes, types_cap;
+    int *func_of_name;    // [interned name] -> function index + 1, 0 for none
+    unsigned int nnames;  // entries in func_of_name
+    int main_func;
+    char error[256];
+} Bytecode;
+
+// Grows a (pointer, count, cap) array by one element, exiting when out of memory.
+#define VEC_PUSH(ptr, count, cap) do { \
+    if ((count) == (cap)) { \
+        int new_cap_ = (cap) ? (cap) * 2 : 64; \
+        void *grown_ = realloc((ptr), (size_t)new_cap_ * sizeof(*(ptr))); \
+        if (!grown_) { fprintf(stderr, "Error: Out of memory\n"); exit(1); } \
+        (ptr) = grown_; \
+        (cap) = new_cap_; \
+    } \
+    (count)++; \
+} while (0)
+
+void bytecode_free(Bytecode *bc) {
+    free(bc->code);
+    free(bc->consts);
+    free(bc->funcs);
+    free(bc->types);
+    free(bc->func_of_name);
+    memset(bc, 0, sizeof(*bc));
+}
+
+// --- Compiler: AST -> bytecode ---
+typedef struct {
+    unsigned int name; // interned id
+    int reg;
+    int type;
+} VarSlot;
+
+typedef struct {
+    Bytecode *bc;
+    AstArena *ast;
+    VmFunction *fn;
+    VarSlot *vars;
+    int nvars, vars_cap;
+    int next_var; // register of the next declared variable
+    int top;      // first free temporary
+    int depth;    // loops and call arguments open around the node being compiled
+    int failed;
+} FuncCompiler;
+
+#define NODE(a, i) AST_NODE(a, i)
+#define CHILD(a, i, k) (NODE(a, i)->first_child + (k))
+#define NODE_TEXT(a, i) ((a)->text + NODE(a, i)->offset)
+
+#ifdef __GNUC__
+__attribute__((format(printf, 3, 4)))
+#endif
+void compile_error(FuncCompiler *fc, int node, const char *fmt, ...) {
+    va_list ap;
+    if (fc->failed++) return;
+    AstNode *n = NODE(fc->ast, node);
+    int at = snprintf(fc->bc->error, sizeof(fc->bc->error), "Semantic Error at byte %zu: ", n->offset);
+    va_start(ap, fmt);
+    vsnprintf(fc->bc->error + at, sizeof(fc->bc->error) - (size_t)at, fmt, ap);
+    va_end(ap);
+}
+
+int emit(FuncCompiler *fc, int op, int a, int b, int c) {
+    Bytecode *bc = fc->bc;
+    VEC_PUSH(bc->code, bc->ncode, bc->code_cap);
+    Instr *in = &bc->code[bc->ncode - 1];
+    in->op = (unsigned char)op;
+    in->a = (unsigned short)a;
+    in->b = b;
+    in->c = c;
+    return bc->ncode - 1;
+}
+
+int add_const(Bytecode *bc, Value v) {
+    for (int i = bc->nconsts - 1; i >= 0 && i >= bc->nconsts - 16; i--) {
+        if (bc->consts[i].i == v.i) return i; // same bits as a recent constant
+    }
+    VEC_PUSH(bc->consts, bc->nconsts, bc->consts_cap);
+    bc->consts[bc->nconsts - 1] = v;
+    return bc->nconsts - 1;
+}
+
+int new_reg(FuncCompiler *fc) {
+    int r = fc->top++;
+    if (fc->top > fc->fn->nregs) fc->fn->nregs = fc->top;
+    if (fc->top > 65535) compile_error(fc, fc->fn->node, "function needs more than 65535 registers");
+    return r;
+}
+
+VarSlot *find_var(FuncCompiler *fc, unsigned int name) {
+    for (int i = fc->nvars - 1; i >= 0; i--) {
+        if (fc->vars[i].name == name) return &fc->vars[i];
+    }
+    return NULL;
+}
+
+VarSlot *declare_var(FuncCompiler *fc, int name_node, int type) {
+    AstNode *n = NODE(fc->ast, name_node);
+    VarSlot *v = find_var(fc, n->name);
+    if (v) {
+        compile_error(fc, name_node, "'%.*s' is already declared", (int)n->length, NODE_TEXT(fc->ast, name_node));
+        return v;
+    }
+    VEC_PUSH(fc->vars, fc->nvars, fc->vars_cap);
+    v = &fc->vars[fc->nvars - 1];
+    v->name = n->name;
+    v->type = type;
+    v->reg = fc->next_var++;
+    return v;
+}
+
+VarSlot *lookup_var(FuncCompiler *fc, int name_node) {
+    AstNode *n = NODE(fc->ast, name_node);
+    VarSlot *v = find_var(fc, n->name);
+    if (!v) compile_error(fc, name_node, "'%.*s' is not declared", (int)n->length, NODE_TEXT(fc->ast, name_node));
+    return v;
+}
+
+int data_type(AstArena *a, int node) {
+    return prod_syms[prod_start[NODE(a, node)->prod - 1]] == T_DEC ? TY_DEC : TY_INT;
+}
+
+// NUMBER: the index of its constant in K[] (set up by compile_program()
+// from the lexer's pool) and its type.
+int compile_literal(FuncCompiler *fc, int node, int *type) {
+    AstArena *a = fc->ast;
+    unsigned int id = NODE(a, node)->name;
+    *type = fc->bc->types[id - 1];
+    if (a->consts->items[id].overflow) {
+        compile_error(fc, node, "%s literal '%.*s' is out of range", TYPE_NAMES[*type], (int)NODE(a, node)->length,
+                      NODE_TEXT(a, node));
+    }
+    return (int)id - 1;
+}
+
+// dec to int, the same in every engine: truncates toward zero, saturates
+// at the ends of the int range and takes NaN to 0. A plain cast is
+// undefined for those, and x86-64's cvttsd2si gives LLONG_MIN for all of
+// them (the native code fixes that up in ll1_d2i_range).
+static inline long long dec_to_int(double d) {
+    if (d != d) return 0;
+    if (d >= 9223372036854775808.0) return LLONG_MAX;
+    if (d < -9223372036854775808.0) return LLONG_MIN;
+    return (long long)d;
+}
+
+// What a loop compares _w against: N in _w's type. An int _w is below a
+// dec N exactly when it is below ceil(N).
+Value loop_bound(Value n, int n_type, int w_type) {
+    Value b = n;
+    if (n_type == w_type) return b;
+    if (w_type == TY_DEC) {
+        b.d = (double)n.i;
+    } else if (n.d >= 9223372036854775807.0) {
+        b.i = LLONG_MAX;
+    } else {
+        b.i = (long long)n.d;
+        if ((double)b.i < n.d) b.i++;
+    }
+    return b;
+}
+
+// Moves src (of type from) into dst as type to, converting if needed.
+void emit_move(FuncCompiler *fc, int dst, int src, int from, int to) {
+    if (from != to) emit(fc, to == TY_DEC ? OP_I2D : OP_D2I, dst, src, 0);
+    else if (dst != src) emit(fc, OP_MOV, dst, src, 0);
+}
+
+int find_function(Bytecode *bc, unsigned int name) {
+    return name < bc->nnames ? bc->func_of_name[name] - 1 : -1;
+}
+
+int compile_expr(FuncCompiler *fc, int node, int *type);
+
+// Term: returns the register holding its value (a variable's own register
+// or a fresh temporary) and its type.
+int compile_term(FuncCompiler *fc, int node, int *type) {
+    AstArena *a = fc->ast;
+    int x = CHILD(a, node, 0);
+    Sym sym = NODE(a, x)->sym;
+    if (sym == T_NUMBER) {
+        int k = compile_literal(fc, x, type), r = new_reg(fc);
+        emit(fc, OP_LOADK, r, k, 0);
+        return r;
+    }
+    if (sym == T_VAR_NAME) {
+        VarSlot *v = lookup_var(fc, x);
+        *type = v ? v->type : TY_INT;
+        return v ? v->reg : 0;
+    }
+
+    // FuncCall -> FUNC_NAME ( CallArgs )
+    int name = CHILD(a, x, 0);
+    int f = find_function(fc->bc, NODE(a, name)->name);
+    if (fc->depth == AST_MAX_NESTING) {
+        compile_error(fc, name, "loops and calls nest more than %d deep", AST_MAX_NESTING);
+        *type = TY_INT;
+        return 0;
+    }
+    if (f < 0) {
+        compile_error(fc, name, "function '%.*s' is not defined", (int)NODE(a, name)->length, NODE_TEXT(a, name));
+        *type = TY_INT;
+        return 0;
+    }
+    VmFunction *callee = &fc->bc->funcs[f];
+    int base = fc->top, nargs = 0;
+    for (int i = 0; i < callee->nparams; i++) new_reg(fc);
+    fc->depth++;
+    for (int args = CHILD(a, x, 1); NODE(a, args)->count; args = CHILD(a, args, 1)) {
+        int t, r = compile_expr(fc, CHILD(a, args, 0), &t);
+        if (nargs < callee->nparams) emit_move(fc, base + nargs, r, t, fc->bc->types[callee->param_types + nargs]);
+        nargs++;
+        fc->top = base + callee->nparams;
+    }
+    fc->depth--;
+    if (nargs != callee->nparams) {
+        compile_error(fc, name, "function '%.*s' takes %d arguments, %d given", callee->name_len, callee->name, callee->nparams, nargs);
+    }
+    if (callee->nparams == 0) new_reg(fc); // somewhere for the result
+    emit(fc, OP_CALL, base, f, base);
+    fc->top = base + 1;
+    *type = callee->ret_type;
+    return base;
+}
+
+// Expression -> Term Expr_Tail: a left-to-right chain of additions.
+int compile_expr(FuncCompiler *fc, int node, int *type) {
+    AstArena *a = fc->ast;
+    int mark = fc->top;
+    int acc = compile_term(fc, CHILD(a, node, 0), type);
+    for (int tail = CHILD(a, node, 1); NODE(a, tail)->count; tail = CHILD(a, tail, 1)) {
+        int t, r = compile_term(fc, CHILD(a, tail, 0), &t);
+        int dst = mark; // the sum so far always lands in the first temporary
+        if (dst >= fc->top) new_reg(fc);
+        if (*type != t) {
+            // int + dec: widen the int side
+            int tmp = new_reg(fc);
+            if (*type == TY_INT) {
+                emit(fc, OP_I2D, tmp, acc, 0);
+                acc = tmp;
+            } else {
+                emit(fc, OP_I2D, tmp, r, 0);
+                r = tmp;
+            }
+            *type = TY_DEC;
+        }
+        emit(fc, *type == TY_DEC ? OP_ADDD : OP_ADDI, dst, acc, r);
+        acc = dst;
+        fc->top = mark + 1;
+    }
+    return acc;
+}
+
+void compile_statements(FuncCompiler *fc, int list);
+
+void compile_statement(FuncCompiler *fc, int stmt) {
+    AstArena *a = fc->ast;
+    int x = CHILD(a, stmt, 0);
+    int mark = fc->top;
+
+    switch (NODE(a, x)->sym - NTER) {
+    case NT_ASSIGNMENT: {
+        int first = CHILD(a, x, 0);
+        if (NODE(a, first)->sym == T_VAR_NAME) { // _v = Expression
+            int t, r = compile_expr(fc, CHILD(a, x, 1), &t);
+            VarSlot *v = lookup_var(fc, first);
+            if (v) emit_move(fc, v->reg, r, t, v->type);
+        } else { // DataType _v OptInit
+            int type = data_type(a, first), init = CHILD(a, x, 2);
+            if (NODE(a, init)->count) {
+                int t, r = compile_expr(fc, CHILD(a, init, 0), &t);
+                VarSlot *v = declare_var(fc, CHILD(a, x, 1), type);
+                emit_move(fc, v->reg, r, t, type);
+            } else {
+                VarSlot *v = declare_var(fc, CHILD(a, x, 1), type);
+                Value zero;
+                zero.i = 0;
+                emit(fc, OP_LOADK, v->reg, add_const(fc->bc, zero), 0);
+            }
+        }
+        break;
+    }
+    case NT_LOOP: {
+        // loop _v : while ( _w < N ) { StatementList break .. }
+        int var = CHILD(a, x, 0), cond = CHILD(a, x, 1), limit = CHILD(a, x, 2);
+        VarSlot *v = find_var(fc, NODE(a, var)->name);
+        if (!v) v = declare_var(fc, var, TY_INT);
+        int v_reg = v->reg, v_type = v->type;
+        Value zero;
+        zero.i = 0;
+        emit(fc, OP_LOADK, v_reg, add_const(fc->bc, zero), 0);
+        VarSlot *w = lookup_var(fc, cond);
+        int w_reg = w ? w->reg : 0, w_type = w ? w->type : TY_INT, n_type;
+        int k = compile_literal(fc, limit, &n_type);
+        if (n_type != w_type) k = add_const(fc->bc, loop_bound(fc->bc->consts[k], n_type, w_type));
+
+        int test = emit(fc, w_type == TY_DEC ? OP_JGED : OP_JGEI, w_reg, k, 0);
+        if (fc->depth == AST_MAX_NESTING) {
+            compile_error(fc, var, "loops and calls nest more than %d deep", AST_MAX_NESTING);
+        } else {
+            fc->depth++;
+            compile_statements(fc, CHILD(a, x, 3));
+            fc->depth--;
+        }
+        emit(fc, v_type == TY_DEC ? OP_INCD : OP_INCI, v_reg, 0, 0);
+        emit(fc, OP_JMP, 0, 0, test);
+        fc->bc->code[test].c = fc->bc->ncode;
+        break;
+    }
+    case NT_PRINTF_CALL: {
+        VarSlot *v = lookup_var(fc, CHILD(a, x, 0));
+        if (v) emit(fc, v->type == TY_DEC ? OP_PRINTD : OP_PRINTI, v->reg, 0, 0);
+        break;
+    }
+    }
+    fc->top = mark; // temporaries die at the end of the statement
+}
+
+void compile_statements(FuncCompiler *fc, int list) {
+    for (; NODE(fc->ast, list)->count; list = CHILD(fc->ast, list, 1)) {
+        compile_statement(fc, CHILD(fc->ast, list, 0));
+    }
+}
+
+// Upper bound on the variables a statement list declares (loops count
+// their variable even if it already exists). Loops nested past
+// AST_MAX_NESTING are not compiled, so their bodies are not counted.
+int count_declarations(AstArena *a, int list, int depth) {
+    int count = 0;
+    for (; NODE(a, list)->count; list = CHILD(a, list, 1)) {
+        int x = CHILD(a, CHILD(a, list, 0), 0);
+        if (NODE(a, x)->sym == SYM_NT(NT_ASSIGNMENT)) count += NODE(a, CHILD(a, x, 0))->sym != T_VAR_NAME;
+        else if (NODE(a, x)->sym == SYM_NT(NT_LOOP)) {
+            count++;
+            if (depth < AST_MAX_NESTING) count += count_declarations(a, CHILD(a, x, 3), depth + 1);
+        }
+    }
+    return count;
+}
+
+void compile_function(Bytecode *bc, AstArena *ast, int f, int *failed) {
+    FuncCompiler fc;
+    memset(&fc, 0, sizeof(fc));
+    fc.bc = bc;
+    fc.ast = ast;
+    fc.fn = &bc->funcs[f];
+    fc.fn->code_start = bc->ncode;
+    // Variables get the registers below the temporaries, so a variable
+    // whose declaration never runs still reads as 0 (frames start zeroed)
+    fc.top = fc.fn->nparams + count_declarations(ast, fc.fn->body, 0);
+    fc.fn->nregs = fc.top;
+    if (fc.top > 65535) compile_error(&fc, fc.fn->node, "function needs more than 65535 registers");
+
+    // Parameters are the first registers
+    for (int p = fc.fn->params; p >= 0 && NODE(ast, p)->count; p = CHILD(ast, p, 2)) {
+        declare_var(&fc, CHILD(ast, p, 1), data_type(ast, CHILD(ast, p, 0)));
+    }
+    compile_statements(&fc, fc.fn->body);
+    int t, r = compile_expr(&fc, CHILD(ast, fc.fn->ret_stmt, 0), &t);
+    if (t != fc.fn->ret_type) {
+        int dst = new_reg(&fc);
+        emit_move(&fc, dst, r, t, fc.fn->ret_type);
+        r = dst;
+    }
+    emit(&fc, OP_RET, r, 0, 0);
+    if (fc.fn->nregs == 0) fc.fn->nregs = 1;
+    free(fc.vars);
+    *failed += fc.failed;
+}
+
+// Lowers an accepted program's AST to bytecode. The parse must have had a
+// name table (CompileContext.names), as names are resolved by interned id,
+// and a constant pool (CompileContext.consts), which becomes the start of
+// K[]. Returns 0 on success, or -1 with the first semantic error in bc->error.
+int compile_program(AstArena *ast, Bytecode *bc) {
+    memset(bc, 0, sizeof(*bc));
+    bc->main_func = -1;
+    int failed = 0;
+    for (unsigned int id = 1; id <= ast->consts->count; id++) {
+        const Literal *lit = &ast->consts->items[id];
+        VEC_PUSH(bc->consts, bc->nconsts, bc->consts_cap);
+        VEC_PUSH(bc->types, bc->ntypes, bc->types_cap);
+        bc->consts[id - 1].i = lit->v.i; // same bits for a dec
+        bc->types[id - 1] = lit->dec ? TY_DEC : TY_INT;
+    }
+    bc->nliterals = bc->nconsts;
+    bc->nnames = ast->names->count + 1;
+    bc->func_of_name = calloc(bc->nnames, sizeof(int));
+    if (!bc->func_of_name) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    // Pass 1: signatures, so calls can refer to functions defined later
+    int defs = CHILD(ast, ast->root, 0); // OptFuncs
+    for (;;) {
+        int ret_type = data_type(ast, CHILD(ast, defs, 0));
+        int top_def = CHILD(ast, defs, 1);
+        int def = CHILD(ast, top_def, 0);
+        int is_main = NODE(ast, def)->sym == SYM_NT(NT_MAIN_FUNC);
+
+        VEC_PUSH(bc->funcs, bc->nfuncs, bc->funcs_cap);
+        VmFunction *fn = &bc->funcs[bc->nfuncs - 1];
+        memset(fn, 0, sizeof(*fn));
+        fn->node = def;
+        fn->ret_type = ret_type;
+        fn->param_types = bc->ntypes;
+        if (is_main) {
+            fn->name = "main";
+            fn->name_len = 4;
+            fn->params = -1;
+            fn->body = CHILD(ast, def, 0);
+            fn->ret_stmt = CHILD(ast, def, 1);
+            bc->main_func = bc->nfuncs - 1;
+        } else {
+            int name = CHILD(ast, def, 0);
+            fn->name = NODE_TEXT(ast, name);
+            fn->name_len = (int)NODE(ast, name)->length;
+            fn->params = CHILD(ast, def, 1);
+            fn->body = CHILD(ast, def, 2);
+            fn->ret_stmt = CHILD(ast, def, 3);
+            for (int p = fn->params; NODE(ast, p)->count; p = CHILD(ast, p, 2)) {
+                VEC_PUSH(bc->types, bc->ntypes, bc->types_cap);
+                bc->types[bc->ntypes - 1] = (unsigned char)data_type(ast, CHILD(ast, p, 0));
+                fn->nparams++;
+            }
+            int *slot = &bc->func_of_name[NODE(ast, name)->name];
+            if (*slot == 0) *slot = bc->nfuncs;
+            else if (!failed++) {
+                snprintf(bc->error, sizeof(bc->error), "Semantic Error at byte %zu: function '%.*s' is defined twice",
+                         NODE(ast, name)->offset, fn->name_len, fn->name);
+            }
+        }
+        if (is_main) break;
+        defs = CHILD(ast, top_def, 1);
+    }
+
+    // Pass 2: bodies
+    for (int f = 0; f < bc->nfuncs; f++) compile_function(bc, ast, f, &failed);
+    return failed ? -1 : 0;
+}
+
+// --- Semantic check: one pass over the AST ---
+// Checks declarations and infers types without generating code, with the
+// same diagnostics as compile_program(). Names resolve through a scoped
+// symbol table indexed by interned id: head[id] is the innermost binding of
+// id and each binding links to the one it shadows, so declaring, looking
+// up and leaving a scope are a few integer operations. The program scope
+// holds the functions, a function scope its parameters and variables (loop
+// bodies share it, as in the VM). The functions are bound from the
+// top-level definitions before any body is walked, so a call has its
+// callee's type wherever the callee is defined. No mix of int and dec is
+// an error, since values convert on assignment, argument passing and
+// return; the conversions are counted instead.
+typedef struct {
+    unsigned int name;
+    int prev;    // binding this one shadows, -1 for none
+    int scope;   // depth of the scope that declared it
+    int type;    // variable type, or function return type
+    int nparams;
+    int param_types; // functions: index into Checker.param_types
+} SymBinding;
+
+typedef struct {
+    int functions;
+    int variables;   // parameters included
+    int conversions; // implicit int <-> dec conversions
+} CheckSummary;
+
+typedef struct {
+    AstArena *ast;
+    int *head;       // [name id] innermost binding, -1 for none
+    SymBinding *bindings;
+    int nbindings, bindings_cap;
+    int scope;
+    int depth;       // loops and call arguments open around the node being checked
+    unsigned char *arg_types;
+    int narg_types, arg_types_cap;
+    unsigned char *param_types; // of every function, so calls need not visit its definition
+    int nparam_types, param_types_cap;
+    CheckSummary sum;
+    int failed;
+    size_t error_at; // byte offset of the error in error
+    char *error;
+    size_t error_size;
+} Checker;
+
+// Keeps the diagnostic that comes first in the source.
+#ifdef __GNUC__
+__attribute__((format(printf, 3, 4)))
+#endif
+void check_error(Checker *ck, int node, const char *fmt, ...) {
+    va_list ap;
+    size_t at = NODE(ck->ast, node)->offset;
+    if (ck->failed++ && at >= ck->error_at) return;
+    ck->error_at = at;
+    int n = snprintf(ck->error, ck->error_size, "Semantic Error at byte %zu: ", at);
+    va_start(ap, fmt);
+    vsnprintf(ck->error + n, ck->error_size - (size_t)n, fmt, ap);
+    va_end(ap);
+}
+
+SymBinding *check_lookup(Checker *ck, int name_node) {
+    int b = ck->head[NODE(ck->ast, name_node)->name];
+    return b >= 0 ? &ck->bindings[b] : NULL;
+}
+
+// Binds the name at name_node in the current scope; NULL if it is taken there.
+SymBinding *check_declare(Checker *ck, int name_node, int is_func, int type) {
+    unsigned int name = NODE(ck->ast, name_node)->name;
+    int prev = ck->head[name];
+    if (prev >= 0 && ck->bindings[prev].scope == ck->scope) return NULL;
+    VEC_PUSH(ck->bindings, ck->nbindings, ck->bindings_cap);
+    SymBinding *b = &ck->bindings[ck->nbindings - 1];
+    b->name = name;
+    b->prev = prev;
+    b->scope = ck->scope;
+    b->type = type;
+    b->nparams = 0;
+    b->param_types = 0;
+    ck->head[name] = ck->nbindings - 1;
+    if (is_func) ck->sum.functions++;
+    else ck->sum.variables++;
+    return b;
+}
+
+void check_leave(Checker *ck) {
+    while (ck->nbindings > 0 && ck->bindings[ck->nbindings - 1].scope == ck->scope) {
+        SymBinding *b = &ck->bindings[--ck->nbindings];
+        ck->head[b->name] = b->prev;
+    }
+    ck->scope--;
+}
+
+// A variable used by name; NULL (reported) if it is not declared.
+SymBinding *check_var(Checker *ck, int name_node) {
+    SymBinding *b = check_lookup(ck, name_node);
+    if (!b) {
+        AstNode *n = NODE(ck->ast, name_node);
+        check_error(ck, name_node, "'%.*s' is not declared", (int)n->length, NODE_TEXT(ck->ast, name_node));
+    }
+    return b;
+}
+
+int check_expr(Checker *ck, int node);
+
+// Arity and argument conversions of a call to the function bound at f.
+void check_args(Checker *ck, int call, SymBinding *f, const unsigned char *types, int nargs) {
+    AstArena *a = ck->ast;
+    int name = CHILD(a, call, 0);
+    if (nargs != f->nparams) {
+        AstNode *n = NODE(a, name);
+        check_error(ck, name, "function '%.*s' takes %d arguments, %d given", (int)n->length, NODE_TEXT(a, name), f->nparams, nargs);
+        return;
+    }
+    for (int i = 0; i < nargs; i++) ck->sum.conversions += types[i] != ck->param_types[f->param_types + i];
+}
+
+// Opens a loop body or a call's arguments at node; 0 (reported) if that
+// would nest them more than AST_MAX_NESTING deep. check_statements() and
+// check_call() recurse per level, as compile_program() and the
+// interpreter do once this accepts the program.
+int check_nest(Checker *ck, int node) {
+    if (ck->depth < AST_MAX_NESTING) {
+        ck->depth++;
+        return 1;
+    }
+    check_error(ck, node, "loops and calls nest more than %d deep", AST_MAX_NESTING);
+    return 0;
+}
+
+// FuncCall -> FUNC_NAME ( CallArgs ); returns the callee's return type
+// (int if it is not defined).
+int check_call(Checker *ck, int call) {
+    AstArena *a = ck->ast;
+    int name = CHILD(a, call, 0), first = ck->narg_types, nargs = 0;
+    if (!check_nest(ck, name)) return TY_INT;
+    for (int args = CHILD(a, call, 1); NODE(a, args)->count; args = CHILD(a, args, 1), nargs++) {
+        int t = check_expr(ck, CHILD(a, args, 0));
+        VEC_PUSH(ck->arg_types, ck->narg_types, ck->arg_types_cap);
+        ck->arg_types[ck->narg_types - 1] = (unsigned char)t;
+    }
+    ck->depth--;
+    SymBinding *f = check_lookup(ck, name);
+    if (f) check_args(ck, call, f, ck->arg_types + first, nargs);
+    else check_error(ck, name, "function '%.*s' is not defined", (int)NODE(a, name)->length, NODE_TEXT(a, name));
+    ck->narg_types = first;
+    return f ? f->type : TY_INT;
+}
+
+// NUMBER: its type, from the constant the lexer decoded.
+int check_literal(Checker *ck, int node) {
+    AstArena *a = ck->ast;
+    const Literal *lit = &a->consts->items[NODE(a, node)->name];
+    int type = lit->dec ? TY_DEC : TY_INT;
+    if (lit->overflow) {
+        check_error(ck, node, "%s literal '%.*s' is out of range", TYPE_NAMES[type], (int)NODE(a, node)->length,
+                    NODE_TEXT(a, node));
+    }
+    return type;
+}
+
+int check_term(Checker *ck, int node) {
+    AstArena *a = ck->ast;
+    int x = CHILD(a, node, 0);
+    if (NODE(a, x)->sym == T_NUMBER) return check_literal(ck, x);
+    if (NODE(a, x)->sym == T_VAR_NAME) {
+        SymBinding *v = check_var(ck, x);
+        return v ? v->type : TY_INT;
+    }
+    return check_call(ck, x);
+}
+
+// Expression -> Term Expr_Tail; returns its type.
+int check_expr(Checker *ck, int node) {
+    AstArena *a = ck->ast;
+    int type = check_term(ck, CHILD(a, node, 0));
+    for (int tail = CHILD(a, node, 1); NODE(a, tail)->count; tail = CHILD(a, tail, 1)) {
+        int t = check_term(ck, CHILD(a, tail, 0));
+        if (t != type) { // int + dec: the int side is widened
+            ck->sum.conversions++;
+            type = TY_DEC;
+        }
+    }
+    return type;
+}
+
+void check_new_var(Checker *ck, int name_node, int type) {
+    if (!check_declare(ck, name_node, 0, type)) {
+        AstNode *n = NODE(ck->ast, name_node);
+        check_error(ck, name_node, "'%.*s' is already declared", (int)n->length, NODE_TEXT(ck->ast, name_node));
+    }
+}
+
+void check_statements(Checker *ck, int list) {
+    AstArena *a = ck->ast;
+    for (; NODE(a, list)->count; list = CHILD(a, list, 1)) {
+        int x = CHILD(a, CHILD(a, list, 0), 0);
+        switch (NODE(a, x)->sym - NTER) {
+        case NT_ASSIGNMENT: {
+            int first = CHILD(a, x, 0);
+            if (NODE(a, first)->sym == T_VAR_NAME) { // _v = Expression
+                SymBinding *v = check_var(ck, first);
+                int t = check_expr(ck, CHILD(a, x, 1));
+                if (v) ck->sum.conversions += t != v->type;
+            } else { // DataType _v OptInit: the initializer cannot see _v
+                int type = data_type(a, first), init = CHILD(a, x, 2);
+                if (NODE(a, init)->count) ck->sum.conversions += check_expr(ck, CHILD(a, init, 0)) != type;
+                check_new_var(ck, CHILD(a, x, 1), type);
+            }
+            break;
+        }
+        case NT_LOOP: // loop _v : while ( _w < N ) { StatementList break .. }
+            if (!check_lookup(ck, CHILD(a, x, 0))) check_declare(ck, CHILD(a, x, 0), 0, TY_INT);
+            check_var(ck, CHILD(a, x, 1));
+            check_literal(ck, CHILD(a, x, 2));
+            if (check_nest(ck, CHILD(a, x, 0))) {
+                check_statements(ck, CHILD(a, x, 3));
+                ck->depth--;
+            }
+            break;
+        case NT_PRINTF_CALL:
+            check_var(ck, CHILD(a, x, 0));
+            break;
+        }
+    }
+}
+
+// Checks an accepted program's AST, which must carry interned names
+// (AstArena.names) and decoded literals (AstArena.consts). Returns 0, or
+// -1 with the first error in the source written to error; summary (may be
+// NULL) gets the counts either way.
+int check_program(AstArena *ast, char *error, size_t error_size, CheckSummary *summary) {
+    Checker ck;
+    memset(&ck, 0, sizeof(ck));
+    ck.ast = ast;
+    ck.error = error;
+    ck.error_size = error_size;
+    ck.head = malloc(((size_t)ast->names->count + 1) * sizeof(int));
+    if (!ck.head) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    memset(ck.head, 0xff, ((size_t)ast->names->count + 1) * sizeof(int)); // all -1
+
+    // Pass 1: the program scope, from the definitions' headers
+    for (int defs = CHILD(ast, ast->root, 0);; defs = CHILD(ast, CHILD(ast, defs, 1), 1)) {
+        int def = CHILD(ast, CHILD(ast, defs, 1), 0);
+        if (NODE(ast, def)->sym == SYM_NT(NT_MAIN_FUNC)) {
+            ck.sum.functions++;
+            break;
+        }
+        int name = CHILD(ast, def, 0);
+        SymBinding *f = check_declare(&ck, name, 1, data_type(ast, CHILD(ast, defs, 0)));
+        if (!f) {
+            check_error(&ck, name, "function '%.*s' is defined twice", (int)NODE(ast, name)->length, NODE_TEXT(ast, name));
+            continue;
+        }
+        f->param_types = ck.nparam_types;
+        for (int p = CHILD(ast, def, 1); NODE(ast, p)->count; p = CHILD(ast, p, 2), f->nparams++) {
+            VEC_PUSH(ck.param_types, ck.nparam_types, ck.param_types_cap);
+            ck.param_types[ck.nparam_types - 1] = (unsigned char)data_type(ast, CHILD(ast, p, 0));
+        }
+    }
+
+    // Pass 2: bodies
+    for (int defs = CHILD(ast, ast->root, 0);; defs = CHILD(ast, CHILD(ast, defs, 1), 1)) {
+        int ret_type = data_type(ast, CHILD(ast, defs, 0));
+        int def = CHILD(ast, CHILD(ast, defs, 1), 0);
+        int is_main = NODE(ast, def)->sym == SYM_NT(NT_MAIN_FUNC);
+        int params = is_main ? -1 : CHILD(ast, def, 1);
+        int body = CHILD(ast, def, is_main ? 0 : 2), ret = CHILD(ast, def, is_main ? 1 : 3);
+        ck.scope++;
+        for (int p = params; p >= 0 && NODE(ast, p)->count; p = CHILD(ast, p, 2)) {
+            check_new_var(&ck, CHILD(ast, p, 1), data_type(ast, CHILD(ast, p, 0)));
+        }
+        check_statements(&ck, body);
+        ck.sum.conversions += check_expr(&ck, CHILD(ast, ret, 0)) != ret_type;
+        check_leave(&ck);
+        if (is_main) break;
+    }
+
+    if (summary) *summary = ck.sum;
+    free(ck.head);
+    free(ck.bindings);
+    free(ck.arg_types);
+    free(ck.param_types);
+    return ck.failed ? -1 : 0;
+}
+
+// --- Optimizer ---
+// Rewrites each function's bytecode in place of a separate IR: the code is
+// already three-address form, and its only control flow is the structured
+// loop `JGE t ... INC v, JMP t` with a single exit. Facts are tracked per
+// register with version numbers, which gives SSA-like value identity
+// without phi nodes. A removed instruction is marked OP_REMOVED until the
+// function is rebuilt.
+#define OP_REMOVED OP_COUNT
+
+typedef struct {
+    Instr *code; // one function, jump targets relative to its start
+    int n, cap;
+    int nregs;
+} OptCode;
+
+// Registers an instruction reads and writes. CALL reads a range.
+typedef struct {
+    int dest;       // -1 if none
+    int reads[2];
+    int nreads;
+    int first, count; // CALL arguments
+    int pure;       // no effect besides writing dest
+} InstrUse;
+
+void instr_use(Bytecode *bc, const Instr *in, InstrUse *u) {
+    u->dest = -1;
+    u->nreads = 0;
+    u->first = u->count = 0;
+    u->pure = 1;
+    switch (in->op) {
+    case OP_ADDI: case OP_ADDD:
+        u->reads[u->nreads++] = in->b;
+        u->reads[u->nreads++] = in->c;
+        u->dest = in->a;
+        break;
+    case OP_MOV: case OP_I2D: case OP_D2I: case OP_MULKI:
+        u->reads[u->nreads++] = in->b;
+        u->dest = in->a;
+        break;
+    case OP_LOADK:
+        u->dest = in->a;
+        break;
+    case OP_INCI: case OP_INCD:
+        u->reads[u->nreads++] = in->a;
+        u->dest = in->a;
+        break;
+    case OP_CALL:
+        u->first = in->c;
+        u->count = bc->funcs[in->b].nparams;
+        u->dest = in->a;
+        u->pure = 0;
+        break;
+    case OP_JGEI: case OP_JGED: case OP_PRINTI: case OP_PRINTD: case OP_RET:
+        u->reads[u->nreads++] = in->a;
+        u->pure = 0;
+        break;
+    default: // OP_JMP, OP_REMOVED
+        u->pure = 0;
+        break;
+    }
+}
+
+// The JMP closing the loop whose test is at t
+#define LOOP_END(oc, t) ((oc)->code[t].c - 1)
+
+// An instruction to insert in front of position `before`. Jumps into that
+// position from below (a loop's back edge) skip the inserted code.
+typedef struct {
+    int before;
+    Instr in;
+} OptInsert;
+
+typedef struct {
+    OptInsert *items;
+    int count, cap;
+} OptInserts;
+
+void opt_insert(OptInserts *list, int before, Instr in) {
+    VEC_PUSH(list->items, list->count, list->cap);
+    list->items[list->count - 1].before = before;
+    list->items[list->count - 1].in = in;
+}
+
+// Applies the insertions (sorted by position), drops removed instructions
+// and renumbers jump targets.
+void opt_rebuild(OptCode *oc, OptInserts *list) {
+    int total = oc->n + list->count;
+    Instr *out = malloc((size_t)(total > 0 ? total : 1) * sizeof(Instr));
+    int *start = malloc((size_t)(oc->n + 1) * sizeof(int)); // output index when position i begins
+    int *self = malloc((size_t)(oc->n + 1) * sizeof(int));  // output index of instruction i
+    if (!out || !start || !self) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    int k = 0, next = 0;
+    for (int i = 0; i <= oc->n; i++) {
+        start[i] = k;
+        for (; next < list->count && list->items[next].before == i; next++) out[k++] = list->items[next].in;
+        self[i] = k;
+        if (i < oc->n && oc->code[i].op != OP_REMOVED) out[k++] = oc->code[i];
+    }
+    for (int i = 0; i < oc->n; i++) {
+        Instr *in = &out[self[i]];
+        if (oc->code[i].op == OP_REMOVED) continue;
+        // Back edges land on the loop test; forward jumps run inserted code
+        if (in->op == OP_JMP && in->c <= i) in->c = self[in->c];
+        else if (in->op == OP_JMP || in->op == OP_JGEI || in->op == OP_JGED) in->c = start[in->c];
+    }
+    free(oc->code);
+    oc->code = out;
+    oc->n = k;
+    oc->cap = total > 0 ? total : 1;
+    list->count = 0;
+    free(start);
+    free(self);
+}
+
+// Adds delta to the write count of each register the loop at t writes,
+// once per writing instruction (inner loops included).
+void opt_loop_writes(Bytecode *bc, OptCode *oc, int t, int *count, int delta) {
+    InstrUse u;
+    for (int i = t; i <= LOOP_END(oc, t); i++) {
+        instr_use(bc, &oc->code[i], &u);
+        if (u.dest >= 0) count[u.dest] += delta;
+    }
+}
+
+// Constant folding and copy propagation, in one forward pass. A fact
+// about r is "r holds K[k]" or "r is a copy of s" (valid while s keeps the
+// version it had). On entering a loop, facts about registers the loop
+// writes are dropped; the same happens on leaving it, since the exit is
+// taken from the loop test.
+enum { FACT_NONE, FACT_CONST, FACT_COPY };
+
+typedef struct {
+    Bytecode *bc;
+    unsigned char *kind;
+    int *value;   // constant index or copied register
+    int *copy_version;
+    int *version;
+} FoldState;
+
+void fold_kill(FoldState *st, int r) {
+    st->kind[r] = FACT_NONE;
+    st->version[r]++;
+}
+
+// The oldest register known to hold r's value
+int fold_source(FoldState *st, int r) {
+    if (st->kind[r] == FACT_COPY && st->version[st->value[r]] == st->copy_version[r]) return st->value[r];
+    return r;
+}
+
+// 1 with *k set if r is a known constant
+int fold_const(FoldState *st, int r, Value *k) {
+    r = fold_source(st, r);
+    if (st->kind[r] != FACT_CONST) return 0;
+    *k = st->bc->consts[st->value[r]];
+    return 1;
+}
+
+void fold_set_const(FoldState *st, Instr *in, Value k) {
+    in->op = OP_LOADK;
+    in->b = add_const(st->bc, k);
+    in->c = 0;
+}
+
+void fold_loop_kill(FoldState *st, OptCode *oc, int t, int *scratch) {
+    for (int i = t; i <= LOOP_END(oc, t); i++) {
+        InstrUse u;
+        instr_use(st->bc, &oc->code[i], &u);
+        if (u.dest >= 0 && !scratch[u.dest]) {
+            scratch[u.dest] = 1;
+            fold_kill(st, u.dest);
+        }
+    }
+    for (int i = t; i <= LOOP_END(oc, t); i++) {
+        InstrUse u;
+        instr_use(st->bc, &oc->code[i], &u);
+        if (u.dest >= 0) scratch[u.dest] = 0;
+    }
+}
+
+void opt_fold(Bytecode *bc, OptCode *oc) {
+    FoldState st;
+    int n = oc->nregs;
+    st.bc = bc;
+    st.kind = calloc((size_t)n, 1);
+    st.value = calloc((size_t)n, sizeof(int));
+    st.copy_version = calloc((size_t)n, sizeof(int));
+    st.version = calloc((size_t)n, sizeof(int));
+    int *scratch = calloc((size_t)n, sizeof(int));
+    if (!st.kind || !st.value || !st.copy_version || !st.version || !scratch) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < oc->n; i++) {
+        Instr *in = &oc->code[i];
+        Value x, y;
+        switch (in->op) {
+        case OP_JGEI: case OP_JGED: {
+            // A loop whose first test fails never runs
+            Value limit = bc->consts[in->b];
+            if (fold_const(&st, in->a, &x) && (in->op == OP_JGEI ? x.i >= limit.i : x.d >= limit.d)) {
+                int end = LOOP_END(oc, i);
+                for (int k = i; k <= end; k++) oc->code[k].op = OP_REMOVED;
+                i = end;
+                break;
+            }
+            fold_loop_kill(&st, oc, i, scratch);
+            in->a = (unsigned short)fold_source(&st, in->a);
+            break;
+        }
+        case OP_JMP:
+            fold_loop_kill(&st, oc, in->c, scratch);
+            break;
+        case OP_MOV: {
+            int src = fold_source(&st, in->b);
+            if (fold_const(&st, src, &x)) {
+                fold_set_const(&st, in, x);
+                fold_kill(&st, in->a);
+                st.kind[in->a] = FACT_CONST;
+                st.value[in->a] = in->b;
+                break;
+            }
+            if (src == in->a) {
+                in->op = OP_REMOVED;
+                break;
+            }
+            in->b = src;
+            fold_kill(&st, in->a);
+            st.kind[in->a] = FACT_COPY;
+            st.value[in->a] = src;
+            st.copy_version[in->a] = st.version[src];
+            break;
+        }
+        case OP_LOADK:
+            fold_kill(&st, in->a);
+            st.kind[in->a] = FACT_CONST;
+            st.value[in->a] = in->b;
+            break;
+        case OP_ADDI: case OP_ADDD: case OP_I2D: case OP_D2I: case OP_MULKI: {
+            int kb = fold_const(&st, in->b, &x), kc = 0, folded = 0;
+            Value r;
+            in->b = fold_source(&st, in->b);
+            if (in->op == OP_ADDI || in->op == OP_ADDD) {
+                kc = fold_const(&st, in->c, &y);
+                in->c = fold_source(&st, in->c);
+            }
+            switch (in->op) {
+            case OP_ADDI:
+                if (kb && kc) r.i = (long long)((unsigned long long)x.i + (unsigned long long)y.i), folded = 1;
+                else if (kb && x.i == 0) in->op = OP_MOV, in->b = in->c;
+                else if (kc && y.i == 0) in->op = OP_MOV;
+                break;
+            case OP_ADDD:
+                if (kb && kc) r.d = x.d + y.d, folded = 1;
+                break;
+            case OP_I2D:
+                if (kb) r.d = (double)x.i, folded = 1;
+                break;
+            case OP_D2I:
+                if (kb) r.i = dec_to_int(x.d), folded = 1;
+                break;
+            case OP_MULKI:
+                if (kb) r.i = (long long)((unsigned long long)x.i * (unsigned long long)bc->consts[in->c].i), folded = 1;
+                break;
+            }
+            if (folded) {
+                fold_set_const(&st, in, r);
+                i--; // record the constant
+                break;
+            }
+            if (in->op == OP_MOV) {
+                i--; // handle as a copy
+                break;
+            }
+            fold_kill(&st, in->a);
+            break;
+        }
+        case OP_INCI: case OP_INCD:
+            if (fold_const(&st, in->a, &x)) {
+                if (in->op == OP_INCI) x.i = (long long)((unsigned long long)x.i + 1);
+                else x.d += 1;
+                fold_set_const(&st, in, x);
+                i--;
+                break;
+            }
+            fold_kill(&st, in->a);
+            break;
+        case OP_PRINTI: case OP_PRINTD: case OP_RET:
+            in->a = (unsigned short)fold_source(&st, in->a);
+            break;
+        case OP_CALL:
+            fold_kill(&st, in->a);
+            break;
+        }
+    }
+    free(st.kind);
+    free(st.value);
+    free(st.copy_version);
+    free(st.version);
+    free(scratch);
+}
+
+// Liveness, as one bitset per loop: registers live at the loop test
+// (head) and at its exit. Everything else is recomputed by a backward
+// scan, which opt_dse() also uses to delete code.
+typedef unsigned long long LiveWord;
+
+typedef struct {
+    int words;
+    int *loop_at;   // position -> loop index (at its test), or -1
+    int *exit_of;   // position -> loop index whose exit it is, or -1
+    int nloops;
+    LiveWord *head; // nloops x words
+    LiveWord *exit;
+    LiveWord *live; // scratch for the scan
+} Liveness;
+
+#define LIVE_GET(set, r) (((set)[(r) >> 6] >> ((r) & 63)) & 1)
+#define LIVE_SET(set, r) ((set)[(r) >> 6] |= 1ULL << ((r) & 63))
+#define LIVE_CLEAR(set, r) ((set)[(r) >> 6] &= ~(1ULL << ((r) & 63)))
+
+void live_free(Liveness *lv) {
+    free(lv->loop_at);
+    free(lv->exit_of);
+    free(lv->head);
+    free(lv->exit);
+    free(lv->live);
+}
+
+// One backward scan. With edit set, deletes pure instructions whose result
+// is dead and folds `op t = ...; MOV x, t` into `op x = ...` when t dies
+// there. Returns 1 if a loop's head set grew (or code changed).
+int live_scan(Bytecode *bc, OptCode *oc, Liveness *lv, int edit) {
+    LiveWord *live = lv->live;
+    int changed = 0;
+    memset(live, 0, (size_t)lv->words * sizeof(LiveWord));
+    for (int i = oc->n - 1; i >= 0; i--) {
+        Instr *in = &oc->code[i];
+        InstrUse u;
+        if (in->op == OP_REMOVED) {
+            // not compacted yet, but may still be a loop's exit
+        } else if (in->op == OP_JMP) {
+            memcpy(live, lv->head + (size_t)lv->loop_at[in->c] * lv->words, (size_t)lv->words * sizeof(LiveWord));
+        } else if (in->op == OP_JGEI || in->op == OP_JGED) {
+            int k = lv->loop_at[i];
+            LiveWord *head = lv->head + (size_t)k * lv->words, *exit = lv->exit + (size_t)k * lv->words;
+            for (int w = 0; w < lv->words; w++) {
+                live[w] |= exit[w];
+                if (w == in->a >> 6) live[w] |= 1ULL << (in->a & 63);
+                if (live[w] & ~head[w]) changed = 1;
+                head[w] |= live[w];
+            }
+        } else {
+            instr_use(bc, in, &u);
+            if (edit && u.pure && !LIVE_GET(live, u.dest)) {
+                in->op = OP_REMOVED;
+                changed = 1;
+                goto next;
+            }
+            if (edit && in->op == OP_MOV && in->b != in->a && !LIVE_GET(live, in->b) && i > 0 &&
+                lv->loop_at[i] < 0 && lv->exit_of[i] < 0) {
+                Instr *prev = &oc->code[i - 1];
+                InstrUse p;
+                instr_use(bc, prev, &p);
+                if (p.dest == in->b && (p.pure || prev->op == OP_CALL) && prev->op != OP_INCI && prev->op != OP_INCD) {
+                    prev->a = in->a;
+                    in->op = OP_REMOVED;
+                    changed = 1;
+                    goto next;
+                }
+            }
+            if (u.dest >= 0) LIVE_CLEAR(live, u.dest);
+            for (int r = 0; r < u.nreads; r++) LIVE_SET(live, u.reads[r]);
+            for (int r = 0; r < u.count; r++) LIVE_SET(live, u.first + r);
+        }
+    next:
+        if (lv->exit_of[i] >= 0) {
+            memcpy(lv->exit + (size_t)lv->exit_of[i] * lv->words, live, (size_t)lv->words * sizeof(LiveWord));
+        }
+    }
+    return changed;
+}
+
+// Computes the head and exit sets to a fixed point.
+void live_compute(Bytecode *bc, OptCode *oc, Liveness *lv) {
+    lv->words = oc->nregs / 64 + 1;
+    lv->loop_at = malloc((size_t)(oc->n + 1) * sizeof(int));
+    lv->exit_of = malloc((size_t)(oc->n + 1) * sizeof(int));
+    lv->live = malloc((size_t)lv->words * sizeof(LiveWord));
+    if (!lv->loop_at || !lv->exit_of || !lv->live) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    lv->nloops = 0;
+    for (int i = 0; i <= oc->n; i++) lv->loop_at[i] = lv->exit_of[i] = -1;
+    for (int i = 0; i < oc->n; i++) {
+        int op = oc->code[i].op;
+        if (op == OP_JGEI || op == OP_JGED) {
+            lv->loop_at[i] = lv->nloops;
+            lv->exit_of[oc->code[i].c] = lv->nloops;
+            lv->nloops++;
+        }
+    }
+    size_t bytes = (size_t)(lv->nloops ? lv->nloops : 1) * (size_t)lv->words * sizeof(LiveWord);
+    lv->head = calloc(1, bytes);
+    lv->exit = calloc(1, bytes);
+    if (!lv->head || !lv->exit) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    while (live_scan(bc, oc, lv, 0)) {
+    }
+}
+
+// Dead-store elimination (with the MOV folding above), until nothing changes.
+void opt_dse(Bytecode *bc, OptCode *oc) {
+    for (int round = 0; round < 8; round++) {
+        Liveness lv;
+        live_compute(bc, oc, &lv);
+        int changed = live_scan(bc, oc, &lv, 1);
+        live_free(&lv);
+        OptInserts none = {0};
+        opt_rebuild(oc, &none);
+        if (!changed) break;
+    }
+}
+
+// Loop-invariant code motion. A pure instruction moves in front of the
+// loop test when its operands are not written in the loop and its result is
+// written only there and is not live at the test (values live after the
+// loop are live at the test too, since the exit is taken from it).
+int opt_licm(Bytecode *bc, OptCode *oc) {
+    Liveness lv;
+    OptInserts moved = {0};
+    int *writes = calloc((size_t)oc->nregs, sizeof(int));
+    int hoisted = 0;
+    if (!writes) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    live_compute(bc, oc, &lv);
+    for (int t = 0; t < oc->n; t++) {
+        int op = oc->code[t].op;
+        if (op != OP_JGEI && op != OP_JGED) continue;
+        int end = LOOP_END(oc, t);
+        LiveWord *head = lv.head + (size_t)lv.loop_at[t] * lv.words;
+        opt_loop_writes(bc, oc, t, writes, 1);
+        for (int i = t + 1; i < end; i++) {
+            Instr *in = &oc->code[i];
+            InstrUse u;
+            instr_use(bc, in, &u);
+            if (!u.pure || in->op == OP_INCI || in->op == OP_INCD) continue;
+            int invariant = writes[u.dest] == 1 && !LIVE_GET(head, u.dest);
+            for (int r = 0; r < u.nreads; r++) invariant = invariant && writes[u.reads[r]] == 0;
+            if (!invariant) continue;
+            opt_insert(&moved, t, *in);
+            writes[u.dest] = 0;
+            in->op = OP_REMOVED;
+            hoisted++;
+        }
+        opt_loop_writes(bc, oc, t, writes, -1);
+    }
+    live_free(&lv);
+    free(writes);
+    opt_rebuild(oc, &moved);
+    free(moved.items);
+    return hoisted;
+}
+
+// Closed forms for counted loops: in a loop that takes its variable v from
+// 0 to N in steps of 1, `ADDI x, x, s` with s invariant and x used nowhere
+// else in the loop becomes x += N * s in front of it. A loop left with
+// nothing but the step becomes v = max(N, 0). dec sums are left alone, as
+// N additions can round differently from one multiplication.
+int opt_closed_form(Bytecode *bc, OptCode *oc) {
+    OptInserts added = {0};
+    int *writes = calloc((size_t)oc->nregs, sizeof(int));
+    int *reads = calloc((size_t)oc->nregs, sizeof(int));
+    int rewritten = 0;
+    if (!writes || !reads) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int t = 0; t < oc->n; t++) {
+        Instr *test = &oc->code[t];
+        if (test->op != OP_JGEI && test->op != OP_JGED) continue;
+        int end = LOOP_END(oc, t), v = test->a;
+        if (test->op != OP_JGEI || oc->code[end - 1].op != OP_INCI || oc->code[end - 1].a != v) continue;
+        int skip_init = 0;
+        for (int i = t - 1; i >= 0 && !skip_init; i--) {
+            InstrUse u;
+            if (oc->code[i].op == OP_REMOVED) continue;
+            instr_use(bc, &oc->code[i], &u);
+            if (u.dest == v) skip_init = oc->code[i].op == OP_LOADK && bc->consts[oc->code[i].b].i == 0 ? 1 : -1;
+            else if (oc->code[i].op == OP_JMP || oc->code[i].op == OP_JGEI || oc->code[i].op == OP_JGED) skip_init = -1;
+        }
+        if (skip_init != 1) continue;
+
+        for (int i = t; i <= end; i++) {
+            InstrUse u;
+            instr_use(bc, &oc->code[i], &u);
+            if (u.dest >= 0) writes[u.dest]++;
+            for (int r = 0; r < u.nreads; r++) reads[u.reads[r]]++;
+            for (int r = 0; r < u.count; r++) reads[u.first + r]++;
+        }
+        long long n = bc->consts[test->b].i, trips = n > 0 ? n : 0;
+        if (writes[v] == 1) {
+            // Only the loop's own body; inner loops run a different number of times
+            for (int i = t + 1; i < end - 1; i++) {
+                Instr *in = &oc->code[i];
+                if (in->op == OP_JGEI || in->op == OP_JGED) {
+                    i = LOOP_END(oc, i);
+                    continue;
+                }
+                if (in->op != OP_ADDI) continue;
+                int x = in->a, s = in->b == x ? in->c : in->b;
+                if ((in->b != x && in->c != x) || s == x || writes[x] != 1 || reads[x] != 1 || writes[s] != 0) continue;
+                if (oc->nregs >= 65535) break; // out of register numbers
+                Value k;
+                k.i = trips;
+                int tmp = oc->nregs++;
+                Instr mul = {OP_MULKI, (unsigned short)tmp, s, add_const(bc, k)};
+                Instr add = {OP_ADDI, (unsigned short)x, x, tmp};
+                opt_insert(&added, t, mul);
+                opt_insert(&added, t, add);
+                in->op = OP_REMOVED;
+                rewritten++;
+            }
+            int empty = 1;
+            for (int i = t + 1; i < end - 1 && empty; i++) empty = oc->code[i].op == OP_REMOVED;
+            if (empty) {
+                Value k;
+                k.i = trips;
+                test->op = OP_LOADK;
+                test->b = add_const(bc, k);
+                test->c = 0;
+                oc->code[end - 1].op = OP_REMOVED;
+                oc->code[end].op = OP_REMOVED;
+                rewritten++;
+            }
+        }
+        for (int i = t; i <= end; i++) {
+            InstrUse u;
+            instr_use(bc, &oc->code[i], &u);
+            if (u.dest >= 0) writes[u.dest] = 0;
+            for (int r = 0; r < u.nreads; r++) reads[u.reads[r]] = 0;
+            for (int r = 0; r < u.count; r++) reads[u.first + r] = 0;
+        }
+    }
+    free(writes);
+    free(reads);
+    opt_rebuild(oc, &added);
+    free(added.items);
+    return rewritten;
+}
+
+// --- Pipeline ---
+enum { PASS_FOLD, PASS_DSE, PASS_LICM, PASS_CLOSED_FORM };
+const char *PASS_NAMES[] = {"fold+copy-prop", "dead-store", "licm", "closed-form"};
+// The second round sees accumulations that the first moved out of inner loops
+const int OPT_PIPELINE[] = {PASS_FOLD, PASS_DSE, PASS_LICM, PASS_CLOSED_FORM,
+                            PASS_FOLD, PASS_DSE, PASS_LICM, PASS_CLOSED_FORM, PASS_FOLD, PASS_DSE};
+#define OPT_NSTEPS ((int)(sizeof(OPT_PIPELINE) / sizeof(OPT_PIPELINE[0])))
+
+// Instruction counts around each step, summed over all functions
+typedef struct {
+    int before[OPT_NSTEPS];
+    int after[OPT_NSTEPS];
+    int rewrites[OPT_NSTEPS]; // instructions moved or replaced (licm, closed-form)
+} OptStats;
+
+// Runs the pipeline on every function and rewrites bc->code.
+void optimize_program(Bytecode *bc, OptStats *stats) {
+    Instr *out = NULL;
+    int nout = 0, cap = 0;
+    if (stats) memset(stats, 0, sizeof(*stats));
+    for (int f = 0; f < bc->nfuncs; f++) {
+        VmFunction *fn = &bc->funcs[f];
+        int end = f + 1 < bc->nfuncs ? bc->funcs[f + 1].code_start : bc->ncode;
+        OptCode oc;
+        oc.n = oc.cap = end - fn->code_start;
+        oc.nregs = fn->nregs;
+        oc.code = malloc((size_t)(oc.n > 0 ? oc.n : 1) * sizeof(Instr));
+        if (!oc.code) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        memcpy(oc.code, bc->code + fn->code_start, (size_t)oc.n * sizeof(Instr));
+        for (int i = 0; i < oc.n; i++) {
+            int op = oc.code[i].op;
+            if (op == OP_JMP || op == OP_JGEI || op == OP_JGED) oc.code[i].c -= fn->code_start;
+        }
+
+        for (int s = 0; s < OPT_NSTEPS; s++) {
+            int rewrites = 0;
+            if (stats) stats->before[s] += oc.n;
+            switch (OPT_PIPELINE[s]) {
+            case PASS_FOLD: {
+                OptInserts none = {0};
+                opt_fold(bc, &oc);
+                opt_rebuild(&oc, &none);
+                break;
+            }
+            case PASS_DSE: opt_dse(bc, &oc); break;
+            case PASS_LICM:
+                // Each round lifts code one loop level further out
+                for (int round = 0; round < 4; round++) {
+                    int moved = opt_licm(bc, &oc);
+                    rewrites += moved;
+                    if (!moved) break;
+                }
+                break;
+            case PASS_CLOSED_FORM: rewrites = opt_closed_form(bc, &oc); break;
+            }
+            if (stats) {
+                stats->after[s] += oc.n;
+                stats->rewrites[s] += rewrites;
+            }
+        }
+
+        fn->code_start = nout;
+        fn->nregs = oc.nregs;
+        for (int i = 0; i < oc.n; i++) {
+            int op = oc.code[i].op;
+            VEC_PUSH(out, nout, cap);
+            out[nout - 1] = oc.code[i];
+            if (op == OP_JMP || op == OP_JGEI || op == OP_JGED) out[nout - 1].c += fn->code_start;
+        }
+        free(oc.code);
+    }
+    free(bc->code);
+    bc->code = out;
+    bc->ncode = nout;
+    bc->code_cap = cap;
+}
+
+void disassemble(FILE *out, Bytecode *bc) {
+    for (int f = 0; f < bc->nfuncs; f++) {
+        VmFunction *fn = &bc->funcs[f];
+        int end = f + 1 < bc->nfuncs ? bc->funcs[f + 1].code_start : bc->ncode;
+        fprintf(out, "%s %.*s: %d params, %d registers\n", TYPE_NAMES[fn->ret_type], fn->name_len, fn->name, fn->nparams, fn->nregs);
+        for (int i = fn->code_start; i < end; i++) {
+            Instr *in = &bc->code[i];
+            fprintf(out, "  %4d  %-7s", i, OP_NAMES[in->op]);
+            switch (in->op) {
+            case OP_LOADK:
+                if (in->b < bc->nliterals && bc->types[in->b] == TY_DEC) {
+                    fprintf(out, "r%d, K%d (%g)\n", in->a, in->b, bc->consts[in->b].d);
+                } else {
+                    fprintf(out, "r%d, K%d (%lld)\n", in->a, in->b, bc->consts[in->b].i);
+                }
+                break;
+            case OP_JGEI: fprintf(out, "r%d, K%d (%lld) -> %d\n", in->a, in->b, bc->consts[in->b].i, in->c); break;
+            case OP_JGED: fprintf(out, "r%d, K%d (%g) -> %d\n", in->a, in->b, bc->consts[in->b].d, in->c); break;
+            case OP_JMP: fprintf(out, "-> %d\n", in->c); break;
+            case OP_CALL: fprintf(out, "r%d, %.*s, r%d\n", in->a, bc->funcs[in->b].name_len, bc->funcs[in->b].name, in->c); break;
+            case OP_ADDI: case OP_ADDD: fprintf(out, "r%d, r%d, r%d\n", in->a, in->b, in->c); break;
+            case OP_MOV: case OP_I2D: case OP_D2I: fprintf(out, "r%d, r%d\n", in->a, in->b); break;
+            case OP_MULKI: fprintf(out, "r%d, r%d, K%d (%lld)\n", in->a, in->b, in->c, bc->consts[in->c].i); break;
+            default: fprintf(out, "r%d\n", in->a); break;
+            }
+        }
+    }
+}
+
+// --- VM ---
+#define VM_MAX_DEPTH 1000 // the language has no conditionals, so recursion never ends
+#define VM_MAX_REGS (1 << 22)
+#define VM_OUT_OF_STEPS (-2) // vm_run() and interp_run(): the step budget ran out
+
+typedef struct {
+    const Instr *ret_pc;
+    Value *base;
+    VmFunction *fn;
+    int ret_reg;
+} VmFrame;
+
+// Runs main. Output goes to out; the result is stored in *result.
+// budget bounds the steps taken, a step being a loop iteration or a call
+// (every other instruction runs a bounded number of times between two);
+// 0 means no bound. Returns 0, -1 on a runtime error or VM_OUT_OF_STEPS
+// (reported on stderr).
+int vm_run(Bytecode *bc, FILE *out, long long *result, long long budget) {
+    Value *regs = calloc(VM_MAX_REGS, sizeof(Value));
+    VmFrame *frames = malloc(VM_MAX_DEPTH * sizeof(VmFrame));
+    if (!regs || !frames) {
+        fprintf(stderr, "Runtime Error: Out of memory for the VM stack\n");
+        free(regs);
+        free(frames);
+        return -1;
+    }
+    const Instr *code = bc->code;
+    const Value *K = bc->consts;
+    VmFunction *main_fn = &bc->funcs[bc->main_func];
+    const Instr *pc = code + main_fn->code_start;
+    Value *r = regs;
+    Value *limit = regs + VM_MAX_REGS;
+    int depth = 0, status = 0;
+    unsigned long long steps = budget > 0 ? (unsigned long long)budget : ULLONG_MAX;
+    VmFunction *fn = main_fn;
+
+#if defined(__GNUC__)
+    // Threaded dispatch: each handler jumps straight to the next one
+    static const void *labels[OP_COUNT] = {
+        &&op_MOV, &&op_LOADK, &&op_ADDI, &&op_ADDD, &&op_I2D, &&op_D2I, &&op_INCI, &&op_INCD,
+        &&op_JGEI, &&op_JGED, &&op_JMP, &&op_PRINTI, &&op_PRINTD, &&op_CALL, &&op_RET, &&op_MULKI
+    };
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() goto *labels[pc->op]
+    VM_NEXT();
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_NEXT() goto dispatch
+dispatch:
+    switch (pc->op) {
+#endif
+
+    VM_CASE(MOV) r[pc->a] = r[pc->b]; pc++; VM_NEXT();
+    VM_CASE(LOADK) r[pc->a] = K[pc->b]; pc++; VM_NEXT();
+    VM_CASE(ADDI) r[pc->a].i = (long long)((unsigned long long)r[pc->b].i + (unsigned long long)r[pc->c].i); pc++; VM_NEXT();
+    VM_CASE(ADDD) r[pc->a].d = r[pc->b].d + r[pc->c].d; pc++; VM_NEXT();
+    VM_CASE(I2D) r[pc->a].d = (double)r[pc->b].i; pc++; VM_NEXT();
+    VM_CASE(D2I) r[pc->a].i = dec_to_int(r[pc->b].d); pc++; VM_NEXT();
+    VM_CASE(MULKI) r[pc->a].i = (long long)((unsigned long long)r[pc->b].i * (unsigned long long)K[pc->c].i); pc++; VM_NEXT();
+    VM_CASE(INCI) r[pc->a].i = (long long)((unsigned long long)r[pc->a].i + 1); pc++; VM_NEXT();
+    VM_CASE(INCD) r[pc->a].d += 1; pc++; VM_NEXT();
+    VM_CASE(JGEI) pc = r[pc->a].i >= K[pc->b].i ? code + pc->c : pc + 1; VM_NEXT();
+    VM_CASE(JGED) pc = r[pc->a].d >= K[pc->b].d ? code + pc->c : pc + 1; VM_NEXT();
+    VM_CASE(JMP) {
+        if (!steps--) goto exhausted; // loops jump back once per iteration
+        pc = code + pc->c;
+        VM_NEXT();
+    }
+    VM_CASE(PRINTI) if (fprintf(out, "%lld\n", r[pc->a].i) < 0) goto unwritable; pc++; VM_NEXT();
+    VM_CASE(PRINTD) if (fprintf(out, "%g\n", r[pc->a].d) < 0) goto unwritable; pc++; VM_NEXT();
+    VM_CASE(CALL) {
+        VmFunction *callee = &bc->funcs[pc->b];
+        Value *callee_regs = r + fn->nregs;
+        if (!steps--) goto exhausted;
+        if (depth == VM_MAX_DEPTH || callee_regs + callee->nregs > limit) {
+            fprintf(stderr, "Runtime Error: Call depth exceeded in %.*s\n", callee->name_len, callee->name);
+            status = -1;
+            goto halt;
+        }
+        frames[depth].ret_pc = pc + 1;
+        frames[depth].base = r;
+        frames[depth].fn = fn;
+        frames[depth].ret_reg = pc->a;
+        depth++;
+        memcpy(callee_regs, r + pc->c, (size_t)callee->nparams * sizeof(Value));
+        memset(callee_regs + callee->nparams, 0, (size_t)(callee->nregs - callee->nparams) * sizeof(Value));
+        r = callee_regs;
+        fn = callee;
+        pc = code + callee->code_start;
+        VM_NEXT();
+    }
+    VM_CASE(RET) {
+        Value v = r[pc->a];
+        if (depth == 0) {
+            *result = fn->ret_type == TY_DEC ? dec_to_int(v.d) : v.i;
+            goto halt;
+        }
+        depth--;
+        r = frames[depth].base;
+        r[frames[depth].ret_reg] = v;
+        pc = frames[depth].ret_pc;
+        fn = frames[depth].fn;
+        VM_NEXT();
+    }
+#if !defined(__GNUC__)
+    }
+#endif
+unwritable:
+    fprintf(stderr, "Runtime Error: Cannot write the program's output\n");
+    status = -1;
+    goto halt;
+exhausted:
+    fprintf(stderr, "Runtime Error: Step budget of %lld exhausted\n", budget);
+    status = VM_OUT_OF_STEPS;
+halt:
+    free(regs);
+    free(frames);
+    return status;
+#undef VM_CASE
+#undef VM_NEXT
+}
+
+// --- Tree-walking interpreter ---
+// Evaluates the AST directly, looking variables up by interned name in a
+// flat per-call environment. It shares the VM's semantics and is kept as the
+// reference the VM (and later back ends) are checked and timed against.
+// The walk keeps its place on a task stack rather than the C stack: every
+// one of VM_MAX_DEPTH calls may sit inside AST_MAX_NESTING loops and call
+// arguments, which recursion per level would not fit.
+typedef struct {
+    unsigned int name;
+    int type;
+    Value v;
+} InterpVar;
+
+typedef struct {
+    InterpVar *vars;
+    int n, cap;
+} InterpEnv;
+
+enum { TASK_STATEMENTS, TASK_LOOP, TASK_STORE, TASK_EXPR, TASK_CALL };
+
+// One walk in progress. A finished expression hands its value to the task
+// below it.
+typedef struct {
+    int kind;
+    int node;  // STATEMENTS: rest of the list; LOOP: the Loop; STORE: the
+               // variable; EXPR: rest of the Expression/Expr_Tail; CALL: the FuncCall
+    int next;  // LOOP: the body has run; CALL: rest of the CallArgs, then -1 while
+               // the body runs and -2 while the return expression is evaluated
+    int param; // CALL: parameter the next argument binds to
+    int func;  // CALL: the callee's index in Bytecode.funcs
+    int type;  // EXPR: type of acc, -1 before the first term
+    Value acc; // EXPR: sum of the terms so far
+    InterpEnv callee; // CALL: the callee's environment as its arguments arrive
+} InterpTask;
+
+typedef struct {
+    AstArena *ast;
+    Bytecode *bc; // function table from compile_program()
+    FILE *out;
+    int depth;
+    int failed; // -1 on a runtime error, VM_OUT_OF_STEPS, else 0
+    long long budget;
+    unsigned long long steps; // left in the budget, counted as in vm_run()
+    InterpTask *tasks;
+    int ntasks, tasks_cap;
+    InterpEnv *envs; // environments of the active calls, main's first
+    int nenvs, envs_cap;
+} Interp;
+
+InterpVar *interp_var(InterpEnv *env, AstArena *a, int name_node) {
+    unsigned int name = NODE(a, name_node)->name;
+    for (int i = env->n - 1; i >= 0; i--) {
+        if (env->vars[i].name == name) return &env->vars[i];
+    }
+    return NULL;
+}
+
+void interp_declare(InterpEnv *env, AstArena *a, int name_node, int type) {
+    if (interp_var(env, a, name_node)) return;
+    VEC_PUSH(env->vars, env->n, env->cap);
+    InterpVar *v = &env->vars[env->n - 1];
+    v->name = NODE(a, name_node)->name;
+    v->type = type;
+    v->v.i = 0;
+}
+
+// Every variable of a function exists (as 0) from its entry, as in the VM.
+void interp_hoist(InterpEnv *env, AstArena *a, int list) {
+    for (; NODE(a, list)->count; list = CHILD(a, list, 1)) {
+        int x = CHILD(a, CHILD(a, list, 0), 0);
+        if (NODE(a, x)->sym == SYM_NT(NT_ASSIGNMENT) && NODE(a, CHILD(a, x, 0))->sym != T_VAR_NAME) {
+            interp_declare(env, a, CHILD(a, x, 1), data_type(a, CHILD(a, x, 0)));
+        } else if (NODE(a, x)->sym == SYM_NT(NT_LOOP)) {
+            interp_declare(env, a, CHILD(a, x, 0), TY_INT);
+            interp_hoist(env, a, CHILD(a, x, 3));
+        }
+    }
+}
+
+Value convert(Value v, int from, int to) {
+    Value r = v;
+    if (from == TY_INT && to == TY_DEC) r.d = (double)v.i;
+    else if (from == TY_DEC && to == TY_INT) r.i = dec_to_int(v.d);
+    return r;
+}
+
+InterpTask *interp_push(Interp *I, int kind, int node) {
+    VEC_PUSH(I->tasks, I->ntasks, I->tasks_cap);
+    InterpTask *t = &I->tasks[I->ntasks - 1];
+    t->kind = kind;
+    t->node = node;
+    t->next = 0;
+    t->type = -1;
+    return t;
+}
+
+// Adds a term to an expression's sum; int + dec widens the int side.
+void interp_add(InterpTask *t, Value v, int type) {
+    if (t->type < 0) {
+        t->acc = v;
+        t->type = type;
+    } else if (t->type == TY_INT && type == TY_INT) {
+        t->acc.i = (long long)((unsigned long long)t->acc.i + (unsigned long long)v.i);
+    } else {
+        t->acc = convert(t->acc, t->type, TY_DEC);
+        v = convert(v, type, TY_DEC);
+        t->acc.d += v.d;
+        t->type = TY_DEC;
+    }
+}
+
+// Adds up the terms of the expression task t until its end (returns -1)
+// or a call, whose result has to come back first (returns the FuncCall).
+int interp_terms(Interp *I, InterpEnv *env, InterpTask *t) {
+    AstArena *a = I->ast;
+    while (NODE(a, t->node)->count) {
+        int x = CHILD(a, CHILD(a, t->node, 0), 0);
+        t->node = CHILD(a, t->node, 1);
+        if (NODE(a, x)->sym == T_NUMBER) {
+            unsigned int id = NODE(a, x)->name;
+            interp_add(t, I->bc->consts[id - 1], I->bc->types[id - 1]);
+        } else if (NODE(a, x)->sym == T_VAR_NAME) {
+            InterpVar *v = interp_var(env, a, x);
+            interp_add(t, v->v, v->type);
+        } else {
+            return x;
+        }
+    }
+    return -1;
+}
+
+// Pushes the call task for a FuncCall met by interp_terms().
+void interp_call(Interp *I, int call) {
+    int f = find_function(I->bc, NODE(I->ast, CHILD(I->ast, call, 0))->name);
+    InterpTask *c = interp_push(I, TASK_CALL, call);
+    c->next = CHILD(I->ast, call, 1);
+    c->param = I->bc->funcs[f].params;
+    c->func = f;
+    memset(&c->callee, 0, sizeof(c->callee));
+}
+
+// Evaluates the Expression at node. Without calls it is summed at once
+// and 1 is returned with the value in *ret; otherwise its tasks are
+// pushed, above a TASK_STORE to the variable store if that is not -1,
+// and 0 is returned.
+int interp_eval(Interp *I, InterpEnv *env, int node, int store, Value *ret, int *ret_type) {
+    InterpTask e;
+    e.kind = TASK_EXPR;
+    e.node = node;
+    e.next = 0;
+    e.type = -1;
+    int call = interp_terms(I, env, &e);
+    if (call < 0) {
+        *ret = e.acc;
+        *ret_type = e.type;
+        return 1;
+    }
+    if (store >= 0) interp_push(I, TASK_STORE, store);
+    *interp_push(I, TASK_EXPR, node) = e;
+    interp_call(I, call);
+    return 0;
+}
+
+// Stops the walk: the budget has run out.
+void interp_exhausted(Interp *I) {
+    fprintf(stderr, "Runtime Error: Step budget of %lld exhausted\n", I->budget);
+    I->failed = VM_OUT_OF_STEPS;
+}
+
+// Runs the tasks on the stack until none is left or a runtime error stops
+// the program. Returns the value the last expression handed down and its
+// type in *type.
+Value interp_exec(Interp *I, int *type) {
+    AstArena *a = I->ast;
+    Value ret;
+    int ret_type = -1; // type of ret while it waits for the top task, else -1
+    ret.i = 0;
+    while (I->ntasks > 0 && !I->failed) {
+        InterpTask *t = &I->tasks[I->ntasks - 1]; // moves with every push
+        InterpEnv *env = &I->envs[I->nenvs - 1];
+        switch (t->kind) {
+        case TASK_STATEMENTS: {
+            int more = 1; // nothing pushed, so t is still the top task
+            while (more && NODE(a, t->node)->count) {
+                int x = CHILD(a, CHILD(a, t->node, 0), 0);
+                t->node = CHILD(a, t->node, 1);
+                switch (NODE(a, x)->sym - NTER) {
+                case NT_ASSIGNMENT: {
+                    int first = CHILD(a, x, 0), init = CHILD(a, x, 2), var = CHILD(a, x, 1), expr = -1;
+                    if (NODE(a, first)->sym == T_VAR_NAME) {
+                        var = first;
+                        expr = CHILD(a, x, 1);
+                    } else if (NODE(a, init)->count) {
+                        expr = CHILD(a, init, 0);
+                    }
+                    Value val;
+                    int t_val = TY_INT;
+                    val.i = 0;
+                    if (expr < 0 || interp_eval(I, env, expr, var, &val, &t_val)) {
+                        InterpVar *v = interp_var(env, a, var);
+                        v->v = convert(val, t_val, v->type);
+                    } else {
+                        more = 0;
+                    }
+                    break;
+                }
+                case NT_LOOP: {
+                    InterpVar *v = interp_var(env, a, CHILD(a, x, 0));
+                    v->v = convert((Value){.i = 0}, TY_INT, v->type);
+                    interp_push(I, TASK_LOOP, x);
+                    more = 0;
+                    break;
+                }
+                case NT_PRINTF_CALL: {
+                    InterpVar *v = interp_var(env, a, CHILD(a, x, 0));
+                    int written = v->type == TY_DEC ? fprintf(I->out, "%g\n", v->v.d) : fprintf(I->out, "%lld\n", v->v.i);
+                    if (written < 0) {
+                        fprintf(stderr, "Runtime Error: Cannot write the program's output\n");
+                        I->failed = -1;
+                        more = 0;
+                    }
+                    break;
+                }
+                }
+            }
+            if (more) I->ntasks--; // the list is done
+            break;
+        }
+        case TASK_LOOP: { // loop _v : while ( _w < N ) { StatementList break .. }
+            int x = t->node;
+            if (t->next) {
+                if (!I->steps--) {
+                    interp_exhausted(I);
+                    break;
+                }
+                InterpVar *v = interp_var(env, a, CHILD(a, x, 0));
+                if (v->type == TY_DEC) v->v.d += 1;
+                else v->v.i = (long long)((unsigned long long)v->v.i + 1);
+            }
+            InterpVar *w = interp_var(env, a, CHILD(a, x, 1));
+            unsigned int id = NODE(a, CHILD(a, x, 2))->name;
+            Value n = loop_bound(I->bc->consts[id - 1], I->bc->types[id - 1], w->type);
+            if (w->type == TY_DEC ? w->v.d >= n.d : w->v.i >= n.i) {
+                I->ntasks--;
+                break;
+            }
+            t->next = 1;
+            interp_push(I, TASK_STATEMENTS, CHILD(a, x, 3));
+            break;
+        }
+        case TASK_STORE: {
+            InterpVar *v = interp_var(env, a, t->node);
+            v->v = convert(ret, ret_type, v->type);
+            ret_type = -1;
+            I->ntasks--;
+            break;
+        }
+        case TASK_EXPR: { // Term Expr_Tail, then + Term Expr_Tail until it is empty
+            interp_add(t, ret, ret_type); // a call's result
+            ret_type = -1;
+            int call = interp_terms(I, env, t);
+            if (call >= 0) {
+                interp_call(I, call);
+            } else {
+                ret = t->acc;
+                ret_type = t->type;
+                I->ntasks--;
+            }
+            break;
+        }
+        case TASK_CALL: {
+            VmFunction *fn = &I->bc->funcs[t->func];
+            if (t->next == -1) { // the body has run: the return expression's value comes back here
+                t->next = -2;
+                if (!interp_eval(I, env, CHILD(a, fn->ret_stmt, 0), -1, &ret, &ret_type)) break;
+            }
+            if (t->next == -2) {
+                ret = convert(ret, ret_type, fn->ret_type);
+                ret_type = fn->ret_type;
+                free(I->envs[--I->nenvs].vars);
+                I->depth--;
+                I->ntasks--;
+                break;
+            }
+            // Arguments are evaluated in the caller's environment
+            int more = 1; // nothing pushed, so t is still the top task
+            while (more) {
+                if (ret_type >= 0) {
+                    int pt = data_type(a, CHILD(a, t->param, 0));
+                    interp_declare(&t->callee, a, CHILD(a, t->param, 1), pt);
+                    t->callee.vars[t->callee.n - 1].v = convert(ret, ret_type, pt);
+                    t->param = CHILD(a, t->param, 2);
+                    ret_type = -1;
+                }
+                if (!NODE(a, t->next)->count) break;
+                int arg = CHILD(a, t->next, 0);
+                t->next = CHILD(a, t->next, 1);
+                more = interp_eval(I, env, arg, -1, &ret, &ret_type); // else its value comes back here
+            }
+            if (!more) break;
+            if (!I->steps--) {
+                interp_exhausted(I);
+                break;
+            }
+            if (I->depth == VM_MAX_DEPTH) {
+                fprintf(stderr, "Runtime Error: Call depth exceeded in %.*s\n", fn->name_len, fn->name);
+                I->failed = -1;
+                break;
+            }
+            I->depth++;
+            VEC_PUSH(I->envs, I->nenvs, I->envs_cap);
+            I->envs[I->nenvs - 1] = t->callee;
+            memset(&t->callee, 0, sizeof(t->callee));
+            t->next = -1;
+            interp_hoist(&I->envs[I->nenvs - 1], a, fn->body);
+            interp_push(I, TASK_STATEMENTS, fn->body);
+            break;
+        }
+        }
+    }
+    *type = ret_type;
+    return ret;
+}
+
+// Runs main by walking the AST. Same contract as vm_run(), with the same
+// steps counted against budget.
+int interp_run(AstArena *ast, Bytecode *bc, FILE *out, long long *result, long long budget) {
+    Interp I;
+    memset(&I, 0, sizeof(I));
+    I.ast = ast;
+    I.bc = bc;
+    I.out = out;
+    I.budget = budget;
+    I.steps = budget > 0 ? (unsigned long long)budget : ULLONG_MAX;
+    VmFunction *fn = &bc->funcs[bc->main_func];
+    VEC_PUSH(I.envs, I.nenvs, I.envs_cap);
+    memset(&I.envs[0], 0, sizeof(InterpEnv));
+    interp_hoist(&I.envs[0], ast, fn->body);
+    interp_push(&I, TASK_STATEMENTS, fn->body);
+    int t;
+    Value v = interp_exec(&I, &t);
+    if (!I.failed && interp_eval(&I, &I.envs[0], CHILD(ast, fn->ret_stmt, 0), -1, &v, &t) == 0) v = interp_exec(&I, &t);
+    if (!I.failed) {
+        v = convert(v, t, fn->ret_type);
+        *result = fn->ret_type == TY_DEC ? dec_to_int(v.d) : v.i;
+    }
+    for (int i = 0; i < I.ntasks; i++) { // left by an error
+        if (I.tasks[i].kind == TASK_CALL) free(I.tasks[i].callee.vars);
+    }
+    for (int i = 0; i < I.nenvs; i++) free(I.envs[i].vars);
+    free(I.tasks);
+    free(I.envs);
+    return I.failed;
+}
+
+// --- Driver ---
+// Checks and compiles a program parsed with a name table and a constant
+// pool, optimized if asked. Returns 0, or -1 with the first error in error
+// (bc is then freed).
+int build_parsed(AstArena *ast, Bytecode *bc, int optimize, char *error, size_t error_size) {
+    if (check_program(ast, error, error_size, NULL) != 0) return -1;
+    if (compile_program(ast, bc) != 0) {
+        snprintf(error, error_size, "%s", bc->error);
+        bytecode_free(bc);
+        return -1;
+    }
+    if (optimize) optimize_program(bc, NULL);
+    return 0;
+}
+
+// Parses filename with an AST, interned names and decoded literals, checks
+// it and compiles it, optimized if asked. On success the program text stays in src (the AST points into it) until the
+// caller frees it.
+int build_program(const char *filename, AstArena *ast, Source *src, Bytecode *bc, int optimize) {
+    CompileContext ctx;
+    Interner names = {0};
+    ConstPool consts = {0};
+    char error[256];
+    context_init(&ctx, stderr, NULL);
+    ctx.ast = ast;
+    ctx.names = &names;
+    ctx.consts = &consts;
+    int accepted = parse_file(&ctx, filename, src);
+    context_free(&ctx);
+    if (accepted < 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        interner_free(&names);
+        const_pool_free(&consts);
+        return -1;
+    }
+    if (!accepted) {
+        source_free(src);
+        interner_free(&names);
+        const_pool_free(&consts);
+        return -1;
+    }
+    int rc = build_parsed(ast, bc, optimize, error, sizeof(error));
+    interner_free(&names); // the AST and bytecode keep only the ids
+    const_pool_free(&consts); // the bytecode has the values (K[id - 1])
+    ast->names = NULL;
+    ast->consts = NULL;
+    if (rc != 0) {
+        fprintf(stderr, "%s\n", error);
+        source_free(src);
+        return -1;
+    }
+    return 0;
+}
+
+enum { RUN_VM, RUN_INTERP, RUN_DUMP };
+
+// --run, --interp and --dump-bytecode. The exit status is main's return
+// value (as the shell sees it), or 1 if the program does not compile or
+// stops with a runtime error. budget is vm_run()'s (0 = unbounded).
+int run_file(const char *filename, int mode, int optimize, long long budget) {
+    AstArena ast = {0};
+    Source src;
+    Bytecode bc;
+    long long result = 0;
+    if (build_program(filename, &ast, &src, &bc, optimize) != 0) {
+        ast_free(&ast);
+        return 1;
+    }
+    int status = 0;
+    if (mode == RUN_DUMP) disassemble(stdout, &bc);
+    else status = (mode == RUN_VM ? vm_run(&bc, stdout, &result, budget) : interp_run(&ast, &bc, stdout, &result, budget)) == 0 ? (int)(result & 0xff) : 1;
+    fflush(stdout);
+    bytecode_free(&bc);
+    ast_free(&ast);
+    source_free(&src);
+    return status;
+}
+
+// --check: parses with interned names and runs the semantic check only.
+int check_file(const char *filename) {
+    CompileContext ctx;
+    Source src;
+    AstArena ast = {0};
+    Interner names = {0};
+    ConstPool consts = {0};
+    CheckSummary sum;
+    char error[256];
+    context_init(&ctx, stderr, NULL);
+    ctx.ast = &ast;
+    ctx.names = &names;
+    ctx.consts = &consts;
+    int accepted = parse_file(&ctx, filename, &src), status = 1;
+    if (accepted < 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        interner_free(&names);
+        const_pool_free(&consts);
+        return 1;
+    }
+    if (accepted && check_program(&ast, error, sizeof(error), &sum) != 0) {
+        fprintf(stderr, "%s\n", error);
+    } else if (accepted) {
+        printf("SEMANTICS ACCEPTED: %d functions, %d variables, %u names, %d implicit conversions\n",
+               sum.functions, sum.variables, names.count, sum.conversions);
+        status = 0;
+    }
+    source_free(&src);
+    ast_free(&ast);
+    interner_free(&names);
+    const_pool_free(&consts);
+    context_free(&ctx);
+    return status;
+}
+
+// Times parsing into an AST alone, with identifiers interned and literals
+// decoded as they are lexed, and with the semantic check on top, to show
+// what the check costs.
+int bench_check(const char *filename, int iterations) {
+    const char *modes[] = {"pull + AST", "pull + AST + names", "pull + AST + names + check"};
+    AstArena ast = {0};
+    ast.root = -1;
+    int status = 0;
+    printf("--- SEMANTIC CHECK BENCHMARK: %s (best of %d) ---\n", filename, iterations);
+    printf("%-28s %10s %10s %10s %9s\n", "Mode", "Names", "Best (ms)", "Overhead", "Result");
+    double baseline = 0;
+    for (int mode = 0; mode < 3 && status == 0; mode++) {
+        double best = 1e30;
+        unsigned int nnames = 0;
+        int ok = 0;
+        for (int it = 0; it < iterations; it++) {
+            CompileContext ctx;
+            TokenPuller tp;
+            Source src;
+            Interner names = {0};
+            ConstPool consts = {0};
+            char error[256];
+            context_init(&ctx, NULL, NULL);
+            ctx.ast = &ast;
+            if (mode > 0) {
+                ctx.names = &names;
+                ctx.consts = &consts;
+            }
+            double t0 = now_seconds();
+            if (stream_file(&ctx, filename, &src, &tp) != 0) {
+                fprintf(stderr, "Error: Cannot open %s\n", filename);
+                status = 1;
+                break;
+            }
+            ok = parse(&ctx);
+            if (ok && mode == 2) ok = check_program(&ast, error, sizeof(error), NULL) == 0;
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+            nnames = names.count;
+            stream_close(&tp);
+            interner_free(&names);
+            const_pool_free(&consts);
+            context_free(&ctx);
+        }
+        if (status) break;
+        if (mode == 0) baseline = best;
+        printf("%-28s %10u %10.3f %9.1f%% %9s\n", modes[mode], nnames, best * 1e3, (best / baseline - 1) * 100,
+               ok ? "accepted" : "rejected");
+    }
+    ast_free(&ast);
+    return status;
+}
+
+// 1 if both files hold the same bytes. Both are read from the start.
+int files_equal(FILE *a, FILE *b) {
+    int ca, cb;
+    rewind(a);
+    rewind(b);
+    do {
+        ca = fgetc(a);
+        cb = fgetc(b);
+    } while (ca == cb && ca != EOF);
+    return ca == cb;
+}
+
+// Checks that both engines print the same output, then times each.
+int bench_run(const char *filename, int iterations, int optimize) {
+    AstArena ast = {0};
+    Source src;
+    Bytecode bc;
+    if (build_program(filename, &ast, &src, &bc, optimize) != 0) {
+        ast_free(&ast);
+        return 1;
+    }
+#ifndef _WIN32
+    FILE *null_out = fopen("/dev/null", "wb");
+#else
+    FILE *null_out = fopen("NUL", "wb");
+#endif
+    FILE *outs[2] = {tmpfile(), tmpfile()};
+    const char *names[2] = {"tree-walking interpreter", "bytecode VM"};
+    long long results[2] = {0, 0};
+    int status = 0;
+    if (!null_out || !outs[0] || !outs[1]) {
+        fprintf(stderr, "Error: Cannot open temporary output files\n");
+        status = 1;
+        goto done;
+    }
+
+    for (int e = 0; e < 2; e++) {
+        int rc = e == 0 ? interp_run(&ast, &bc, outs[e], &results[e], 0) : vm_run(&bc, outs[e], &results[e], 0);
+        if (rc != 0) status = 1;
+    }
+    long sizes[2] = {ftell(outs[0]), ftell(outs[1])};
+    int same = results[0] == results[1] && sizes[0] == sizes[1];
+    same = same && files_equal(outs[0], outs[1]);
+    if (!same) {
+        fprintf(stderr, "Benchmark Error: the interpreter and the VM disagree on %s\n", filename);
+        status = 1;
+    }
+
+    printf("--- EXECUTION BENCHMARK: %s (%d instructions, best of %d) ---\n", filename, bc.ncode, iterations);
+    printf("%-26s %10s %12s %8s\n", "Engine", "Best (ms)", "Output", "Speedup");
+    double baseline = 0;
+    for (int e = 0; e < 2; e++) {
+        double best = 1e30;
+        for (int it = 0; it < iterations; it++) {
+            long long result;
+            double t0 = now_seconds();
+            if (e == 0) interp_run(&ast, &bc, null_out, &result, 0);
+            else vm_run(&bc, null_out, &result, 0);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+        }
+        if (e == 0) baseline = best;
+        printf("%-26s %10.3f %10ld B %7.2fx\n", names[e], best * 1e3, sizes[e], baseline / best);
+    }
+
+done:
+    if (null_out) fclose(null_out);
+    if (outs[0]) fclose(outs[0]);
+    if (outs[1]) fclose(outs[1]);
+    bytecode_free(&bc);
+    ast_free(&ast);
+    source_free(&src);
+    return status;
+}
+
+// Shows what each optimizer pass did, checks that the optimized program
+// behaves like the original on the VM, then times both.
+int bench_opt(const char *filename, int iterations) {
+    AstArena ast[2] = {{0}, {0}};
+    Source src[2];
+    Bytecode bc[2];
+    OptStats stats;
+    for (int v = 0; v < 2; v++) {
+        if (build_program(filename, &ast[v], &src[v], &bc[v], 0) != 0) {
+            ast_free(&ast[v]);
+            if (v == 1) {
+                bytecode_free(&bc[0]);
+                ast_free(&ast[0]);
+                source_free(&src[0]);
+            }
+            return 1;
+        }
+    }
+    optimize_program(&bc[1], &stats);
+#ifndef _WIN32
+    FILE *null_out = fopen("/dev/null", "wb");
+#else
+    FILE *null_out = fopen("NUL", "wb");
+#endif
+    FILE *outs[2] = {tmpfile(), tmpfile()};
+    const char *names[2] = {"bytecode VM", "bytecode VM -O"};
+    long long results[2] = {0, 0};
+    int status = 0;
+    if (!null_out || !outs[0] || !outs[1]) {
+        fprintf(stderr, "Error: Cannot open temporary output files\n");
+        status = 1;
+        goto done;
+    }
+
+    printf("--- OPTIMIZER: %s ---\n", filename);
+    printf("%-16s %8s %8s %9s\n", "Pass", "Before", "After", "Rewrites");
+    for (int s = 0; s < OPT_NSTEPS; s++) {
+        printf("%-16s %8d %8d %9d\n", PASS_NAMES[OPT_PIPELINE[s]], stats.before[s], stats.after[s], stats.rewrites[s]);
+    }
+
+    for (int v = 0; v < 2; v++) {
+        if (vm_run(&bc[v], outs[v], &results[v], 0) != 0) status = 1;
+    }
+    long sizes[2] = {ftell(outs[0]), ftell(outs[1])};
+    int same = results[0] == results[1] && sizes[0] == sizes[1];
+    same = same && files_equal(outs[0], outs[1]);
+    if (!same) {
+        fprintf(stderr, "Benchmark Error: the optimized program disagrees with the original on %s\n", filename);
+        status = 1;
+    }
+
+    printf("\n--- EXECUTION BENCHMARK: %s (best of %d) ---\n", filename, iterations);
+    printf("%-26s %12s %10s %8s\n", "Engine", "Instructions", "Best (ms)", "Speedup");
+    double baseline = 0;
+    for (int v = 0; v < 2; v++) {
+        double best = 1e30;
+        for (int it = 0; it < iterations; it++) {
+            long long result;
+            double t0 = now_seconds();
+            vm_run(&bc[v], null_out, &result, 0);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+        }
+        if (v == 0) baseline = best;
+        printf("%-26s %12d %10.3f %7.2fx\n", names[v], bc[v].ncode, best * 1e3, baseline / best);
+    }
+
+done:
+    if (null_out) fclose(null_out);
+    if (outs[0]) fclose(outs[0]);
+    if (outs[1]) fclose(outs[1]);
+    for (int v = 0; v < 2; v++) {
+        bytecode_free(&bc[v]);
+        ast_free(&ast[v]);
+        source_free(&src[v]);
+    }
+    return status;
+}
+
+
+
+// =================================================================
+// PART 7: NATIVE CODE GENERATION (x86-64)
+// =================================================================
+
+// Lowers the bytecode to x86-64 assembly (GNU as, System V ABI, PIE) that
+// is linked against libc for printf. Each VM register of a function gets
+// one live interval, and a linear scan assigns it a machine register or a
+// stack slot. dec values stay in general registers as raw bits and pass
+// through xmm0/xmm1 only for arithmetic. Calls between program functions
+// push their arguments (first argument at the lowest address) and return
+// in rax. %rax, %r11, %xmm0 and %xmm1 are scratch.
+
+const char *ASM_REGS[] = {"%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9", "%r10", // caller-saved
+                          "%rbx", "%r12", "%r13", "%r14", "%r15"};             // callee-saved
+#define ASM_NREGS 12
+#define ASM_FIRST_SAVED 7
+
+typedef struct {
+    int start, end; // instruction indices relative to the function's code_start
+    int loc;        // index into ASM_REGS, or -1 - spill slot
+    int zero_init;  // may be read before it is written
+} LiveInterval;
+
+typedef struct {
+    FILE *out;
+    Bytecode *bc;
+    int f;
+    LiveInterval *iv;
+    int nsaved, saved[ASM_NREGS - ASM_FIRST_SAVED];
+    int nslots;
+    char buf[2][32];
+} AsmGen;
+
+// Computes [start, end] for every register. Loops are the only back edges
+// (a JMP to an earlier JGE), so a value live into a loop is kept to its
+// end, and a value first set inside a loop but used after it must start
+// at 0, since the loop may not run at all.
+void asm_intervals(Bytecode *bc, int f, LiveInterval *iv) {
+    VmFunction *fn = &bc->funcs[f];
+    int base = fn->code_start;
+    int n = (f + 1 < bc->nfuncs ? bc->funcs[f + 1].code_start : bc->ncode) - base;
+    for (int r = 0; r < fn->nregs; r++) {
+        iv[r].start = INT_MAX;
+        iv[r].end = -1;
+        iv[r].loc = 0;
+        iv[r].zero_init = 0;
+    }
+#define TOUCH(reg, is_read) do { \
+        LiveInterval *t_ = &iv[reg]; \
+        if (t_->start == INT_MAX) { t_->start = i; t_->zero_init = (is_read); } \
+        t_->end = i; \
+    } while (0)
+    for (int i = 0; i < n; i++) {
+        Instr *in = &bc->code[base + i];
+        switch (in->op) {
+        case OP_ADDI: case OP_ADDD: TOUCH(in->b, 1); TOUCH(in->c, 1); TOUCH(in->a, 0); break;
+        case OP_MOV: case OP_I2D: case OP_D2I: case OP_MULKI: TOUCH(in->b, 1); TOUCH(in->a, 0); break;
+        case OP_LOADK: TOUCH(in->a, 0); break;
+        case OP_CALL:
+            for (int k = 0; k < bc->funcs[in->b].nparams; k++) TOUCH(in->c + k, 1);
+            TOUCH(in->a, 0);
+            break;
+        case OP_JMP: break;
+        default: TOUCH(in->a, 1); break; // INC, JGE, PRINT, RET
+        }
+    }
+#undef TOUCH
+    // Parameters are set on entry, unused ones not at all
+    for (int r = 0; r < fn->nregs; r++) {
+        if (r < fn->nparams && iv[r].end >= 0) iv[r].start = 0, iv[r].zero_init = 0;
+        else if (iv[r].zero_init) iv[r].start = 0;
+    }
+
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int j = 0; j < n; j++) {
+            Instr *in = &bc->code[base + j];
+            if (in->op != OP_JMP || in->c - base > j) continue;
+            int t = in->c - base;
+            for (int r = 0; r < fn->nregs; r++) {
+                LiveInterval *v = &iv[r];
+                if (v->end < 0) continue;
+                if (v->start < t && v->end >= t && v->end < j) {
+                    v->end = j;
+                    changed = 1;
+                } else if (v->start >= t && v->start <= j && v->end > j) {
+                    v->start = 0;
+                    v->zero_init = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+int compare_keys(const void *x, const void *y) {
+    long long a = *(const long long *)x, b = *(const long long *)y;
+    return (a > b) - (a < b);
+}
+
+// Linear scan. Intervals that span a call (including printf) only get
+// callee-saved registers. When none is free, whichever of the current
+// interval and the active one ending last ends later is spilled.
+void asm_allocate(AsmGen *g) {
+    Bytecode *bc = g->bc;
+    VmFunction *fn = &bc->funcs[g->f];
+    int base = fn->code_start;
+    int n = (g->f + 1 < bc->nfuncs ? bc->funcs[g->f + 1].code_start : bc->ncode) - base;
+    LiveInterval *iv = g->iv;
+
+    // calls_before[i] = calls at indices < i
+    int *calls_before = malloc((size_t)(n + 1) * sizeof(int));
+    long long *order = malloc((size_t)fn->nregs * sizeof(long long));
+    if (!calls_before || !order) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    calls_before[0] = 0;
+    for (int i = 0; i < n; i++) {
+        int op = bc->code[base + i].op;
+        calls_before[i + 1] = calls_before[i] + (op == OP_CALL || op == OP_PRINTI || op == OP_PRINTD);
+    }
+
+    // Sort by start; the key is start << 32 | register
+    int count = 0;
+    for (int r = 0; r < fn->nregs; r++) {
+        if (iv[r].end >= 0) order[count++] = ((long long)iv[r].start << 32) | r;
+    }
+    qsort(order, (size_t)count, sizeof(*order), compare_keys);
+
+    int owner[ASM_NREGS];
+    int used_saved[ASM_NREGS] = {0};
+    for (int k = 0; k < ASM_NREGS; k++) owner[k] = -1;
+    for (int i = 0; i < count; i++) {
+        int r = (int)(order[i] & 0xffffffff);
+        LiveInterval *cur = &iv[r];
+        for (int k = 0; k < ASM_NREGS; k++) {
+            if (owner[k] >= 0 && iv[owner[k]].end < cur->start) owner[k] = -1;
+        }
+        // Parameters and zero-initialised registers are set before instruction 0
+        int set_on_entry = r < fn->nparams || cur->zero_init;
+        int crosses = calls_before[cur->end] - calls_before[set_on_entry ? 0 : cur->start + 1] > 0;
+        int first = crosses ? ASM_FIRST_SAVED : 0, pick = -1;
+        for (int k = first; k < ASM_NREGS && pick < 0; k++) {
+            if (owner[k] < 0) pick = k;
+        }
+        if (pick < 0) {
+            int victim = -1;
+            for (int k = first; k < ASM_NREGS; k++) {
+                if (victim < 0 || iv[owner[k]].end > iv[owner[victim]].end) victim = k;
+            }
+            if (iv[owner[victim]].end > cur->end) {
+                iv[owner[victim]].loc = -1 - g->nslots++;
+                pick = victim;
+            }
+        }
+        if (pick < 0) {
+            cur->loc = -1 - g->nslots++;
+            continue;
+        }
+        cur->loc = pick;
+        owner[pick] = r;
+        if (pick >= ASM_FIRST_SAVED) used_saved[pick] = 1;
+    }
+    g->nsaved = 0;
+    for (int k = ASM_FIRST_SAVED; k < ASM_NREGS; k++) {
+        if (used_saved[k]) g->saved[g->nsaved++] = k;
+    }
+    free(calls_before);
+    free(order);
+}
+
+// The operand for register r; which selects one of two buffers so an
+// instruction can name two spilled registers.
+const char *asm_operand(AsmGen *g, int r, int which) {
+    int loc = g->iv[r].loc;
+    if (loc >= 0) return ASM_REGS[loc];
+    snprintf(g->buf[which], sizeof(g->buf[which]), "%d(%%rbp)", -8 * (g->nsaved + (-1 - loc) + 1));
+    return g->buf[which];
+}
+
+#define ASM_IN_REG(g, r) ((g)->iv[r].loc >= 0)
+
+// rax = dec_to_int(xmm0). cvttsd2si returns LLONG_MIN for NaN and out of
+// range values; only then (cmp $1 overflows) is ll1_d2i_range called.
+void asm_dec_to_int(FILE *out) {
+    fprintf(out, "\tcvttsd2siq %%xmm0, %%rax\n\tcmpq $1, %%rax\n\tjno 1f\n\tcall ll1_d2i_range\n1:\n");
+}
+#define FITS_IMM32(v) ((v) >= INT_MIN && (v) <= INT_MAX)
+
+void asm_function(AsmGen *g) {
+    FILE *out = g->out;
+    Bytecode *bc = g->bc;
+    VmFunction *fn = &bc->funcs[g->f];
+    int base = fn->code_start;
+    int n = (g->f + 1 < bc->nfuncs ? bc->funcs[g->f + 1].code_start : bc->ncode) - base;
+    int is_main = g->f == bc->main_func;
+
+    unsigned char *target = calloc((size_t)n + 1, 1);
+    if (!target) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        Instr *in = &bc->code[base + i];
+        if (in->op == OP_JMP || in->op == OP_JGEI || in->op == OP_JGED) target[in->c - base] = 1;
+    }
+    g->nslots = 0;
+    asm_intervals(bc, g->f, g->iv);
+    asm_allocate(g);
+    int frame = 8 * (g->nsaved + g->nslots);
+    frame = (frame + 15) & ~15;
+
+    // Prologue
+    if (is_main) {
+        fprintf(out, "\n\t.globl main\n\t.type main, @function\nmain:\n");
+    } else {
+        fprintf(out, "\n\t.type fn_%.*s, @function\nfn_%.*s:\n", fn->name_len, fn->name, fn->name_len, fn->name);
+    }
+    fprintf(out, "\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n");
+    if (frame) fprintf(out, "\tsubq $%d, %%rsp\n", frame);
+    for (int k = 0; k < g->nsaved; k++) fprintf(out, "\tmovq %s, %d(%%rbp)\n", ASM_REGS[g->saved[k]], -8 * (k + 1));
+    if (!is_main) {
+        fprintf(out, "\taddl $1, ll1_depth(%%rip)\n\tcmpl $%d, ll1_depth(%%rip)\n\tja .Ldepth%d\n", VM_MAX_DEPTH, g->f);
+    }
+    for (int r = 0; r < fn->nregs; r++) {
+        if (g->iv[r].end < 0) continue;
+        if (r < fn->nparams) {
+            const char *dst = asm_operand(g, r, 0);
+            if (ASM_IN_REG(g, r)) {
+                fprintf(out, "\tmovq %d(%%rbp), %s\n", 16 + 8 * r, dst);
+            } else {
+                fprintf(out, "\tmovq %d(%%rbp), %%rax\n\tmovq %%rax, %s\n", 16 + 8 * r, dst);
+            }
+        } else if (g->iv[r].zero_init) {
+            fprintf(out, "\tmovq $0, %s\n", asm_operand(g, r, 0));
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        Instr *in = &bc->code[base + i];
+        if (target[i]) fprintf(out, ".L%d:\n", base + i);
+        const char *a = asm_operand(g, in->a, 0);
+        switch (in->op) {
+        case OP_MOV: {
+            const char *b = asm_operand(g, in->b, 1);
+            if (g->iv[in->a].loc == g->iv[in->b].loc) break;
+            if (ASM_IN_REG(g, in->a) || ASM_IN_REG(g, in->b)) fprintf(out, "\tmovq %s, %s\n", b, a);
+            else fprintf(out, "\tmovq %s, %%rax\n\tmovq %%rax, %s\n", b, a);
+            break;
+        }
+        case OP_LOADK: {
+            long long k = bc->consts[in->b].i;
+            if (FITS_IMM32(k)) fprintf(out, "\tmovq $%lld, %s\n", k, a);
+            else fprintf(out, "\tmovabsq $%lld, %%rax\n\tmovq %%rax, %s\n", k, a);
+            break;
+        }
+        case OP_ADDI:
+            fprintf(out, "\tmovq %s, %%rax\n", asm_operand(g, in->b, 1));
+            fprintf(out, "\taddq %s, %%rax\n\tmovq %%rax, %s\n", asm_operand(g, in->c, 1), a);
+            break;
+        case OP_ADDD:
+            fprintf(out, "\tmovq %s, %%xmm0\n", asm_operand(g, in->b, 1));
+            fprintf(out, "\tmovq %s, %%xmm1\n\taddsd %%xmm1, %%xmm0\n\tmovq %%xmm0, %s\n", asm_operand(g, in->c, 1), a);
+            break;
+        case OP_I2D:
+            fprintf(out, "\tcvtsi2sdq %s, %%xmm0\n\tmovq %%xmm0, %s\n", asm_operand(g, in->b, 1), a);
+            break;
+        case OP_D2I:
+            fprintf(out, "\tmovq %s, %%xmm0\n", asm_operand(g, in->b, 1));
+            asm_dec_to_int(out);
+            fprintf(out, "\tmovq %%rax, %s\n", a);
+            break;
+        case OP_MULKI: {
+            long long k = bc->consts[in->c].i;
+            if (FITS_IMM32(k)) fprintf(out, "\timulq $%lld, %s, %%rax\n", k, asm_operand(g, in->b, 1));
+            else fprintf(out, "\tmovabsq $%lld, %%rax\n\timulq %s, %%rax\n", k, asm_operand(g, in->b, 1));
+            fprintf(out, "\tmovq %%rax, %s\n", a);
+            break;
+        }
+        case OP_INCI:
+            fprintf(out, "\taddq $1, %s\n", a);
+            break;
+        case OP_INCD:
+            fprintf(out, "\tmovq %s, %%xmm0\n\taddsd .Lone(%%rip), %%xmm0\n\tmovq %%xmm0, %s\n", a, a);
+            break;
+        case OP_JGEI: {
+            long long k = bc->consts[in->b].i;
+            if (FITS_IMM32(k)) fprintf(out, "\tcmpq $%lld, %s\n", k, a);
+            else fprintf(out, "\tmovabsq $%lld, %%rax\n\tcmpq %%rax, %s\n", k, a);
+            fprintf(out, "\tjge .L%d\n", in->c);
+            break;
+        }
+        case OP_JGED:
+            // jae is not taken for NaN, matching the VM's >=
+            fprintf(out, "\tmovq %s, %%xmm0\n\tucomisd .LK%d(%%rip), %%xmm0\n\tjae .L%d\n", a, in->b, in->c);
+            break;
+        case OP_JMP:
+            fprintf(out, "\tjmp .L%d\n", in->c);
+            break;
+        case OP_PRINTI:
+            fprintf(out, "\tmovq %s, %%rsi\n\tleaq .Lfmt_int(%%rip), %%rdi\n\txorl %%eax, %%eax\n\tcall printf@PLT\n", a);
+            break;
+        case OP_PRINTD:
+            fprintf(out, "\tmovq %s, %%xmm0\n\tleaq .Lfmt_dec(%%rip), %%rdi\n\tmovl $1, %%eax\n\tcall printf@PLT\n", a);
+            break;
+        case OP_CALL: {
+            VmFunction *callee = &bc->funcs[in->b];
+            int pad = (callee->nparams & 1) * 8;
+            if (pad) fprintf(out, "\tsubq $8, %%rsp\n");
+            for (int k = callee->nparams - 1; k >= 0; k--) fprintf(out, "\tpushq %s\n", asm_operand(g, in->c + k, 1));
+            fprintf(out, "\tcall fn_%.*s\n", callee->name_len, callee->name);
+            if (callee->nparams || pad) fprintf(out, "\taddq $%d, %%rsp\n", 8 * callee->nparams + pad);
+            fprintf(out, "\tmovq %%rax, %s\n", a);
+            break;
+        }
+        case OP_RET:
+            fprintf(out, "\tmovq %s, %%rax\n", a);
+            if (is_main && fn->ret_type == TY_DEC) {
+                fprintf(out, "\tmovq %%rax, %%xmm0\n");
+                asm_dec_to_int(out);
+            }
+            if (!is_main) fprintf(out, "\tsubl $1, ll1_depth(%%rip)\n");
+            for (int k = 0; k < g->nsaved; k++) fprintf(out, "\tmovq %d(%%rbp), %s\n", -8 * (k + 1), ASM_REGS[g->saved[k]]);
+            fprintf(out, "\tleave\n\tret\n");
+            break;
+        }
+    }
+    if (!is_main) {
+        fprintf(out, ".Ldepth%d:\n\tleaq .Lname%d(%%rip), %%rdx\n\tjmp ll1_depth_error\n", g->f, g->f);
+    }
+    free(target);
+}
+
+// Writes the whole program as one assembly file.
+void emit_asm(FILE *out, Bytecode *bc) {
+    AsmGen g;
+    int max_regs = 1;
+    memset(&g, 0, sizeof(g));
+    g.out = out;
+    g.bc = bc;
+    for (int f = 0; f < bc->nfuncs; f++) {
+        if (bc->funcs[f].nregs > max_regs) max_regs = bc->funcs[f].nregs;
+    }
+    g.iv = malloc((size_t)max_regs * sizeof(LiveInterval));
+    if (!g.iv) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    fprintf(out, "# Generated by the LL(1) compiler from bytecode (x86-64, System V)\n\t.text\n");
+    // Reached with the function's name in rdx; stdout is flushed by exit()
+    fprintf(out, "\nll1_depth_error:\n"
+                 "\tmovq stderr@GOTPCREL(%%rip), %%rax\n\tmovq (%%rax), %%rdi\n"
+                 "\tleaq .Lfmt_depth(%%rip), %%rsi\n\txorl %%eax, %%eax\n\tcall fprintf@PLT\n"
+                 "\tmovl $1, %%edi\n\tcall exit@PLT\n");
+    // rax is LLONG_MIN from cvttsd2si: LLONG_MAX above 0, 0 for NaN; clobbers xmm1
+    fprintf(out, "\nll1_d2i_range:\n"
+                 "\txorpd %%xmm1, %%xmm1\n\tucomisd %%xmm1, %%xmm0\n\tjp 1f\n\tjbe 2f\n\tnotq %%rax\n"
+                 "2:\n\tret\n1:\n\txorl %%eax, %%eax\n\tret\n");
+    for (g.f = 0; g.f < bc->nfuncs; g.f++) asm_function(&g);
+
+    fprintf(out, "\n\t.section .rodata\n");
+    fprintf(out, ".Lfmt_int:\n\t.string \"%%lld\\n\"\n.Lfmt_dec:\n\t.string \"%%g\\n\"\n");
+    fprintf(out, ".Lfmt_depth:\n\t.string \"Runtime Error: Call depth exceeded in %%s\\n\"\n");
+    for (int f = 0; f < bc->nfuncs; f++) {
+        if (f != bc->main_func) fprintf(out, ".Lname%d:\n\t.string \"%.*s\"\n", f, bc->funcs[f].name_len, bc->funcs[f].name);
+    }
+    fprintf(out, "\t.balign 8\n.Lone:\n\t.quad 0x3ff0000000000000\n");
+    for (int k = 0; k < bc->nconsts; k++) fprintf(out, ".LK%d:\n\t.quad %lld\n", k, bc->consts[k].i);
+    fprintf(out, "\n\t.local ll1_depth\n\t.comm ll1_depth, 4, 4\n");
+    fprintf(out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+    free(g.iv);
+}
+
+#ifndef _WIN32
+// Runs argv with stdout sent to out_fd (unless it is -1). Returns the exit
+// status, or -1 if the program could not be started or was killed.
+int run_process(char *const argv[], int out_fd) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (out_fd >= 0) dup2(out_fd, 1);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Writes exe.s and links it into exe with $CC (default cc).
+int native_build(Bytecode *bc, const char *exe) {
+    char asm_path[4096];
+    snprintf(asm_path, sizeof(asm_path), "%s.s", exe);
+    FILE *fp = fopen(asm_path, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot create %s\n", asm_path);
+        return -1;
+    }
+    emit_asm(fp, bc);
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Cannot write %s\n", asm_path);
+        remove(asm_path);
+        return -1;
+    }
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) cc = "cc";
+    char *argv[] = {(char *)cc, "-o", (char *)exe, asm_path, NULL};
+    int rc = run_process(argv, -1);
+    remove(asm_path);
+    if (rc != 0) {
+        fprintf(stderr, "Error: %s failed to build %s\n", cc, exe);
+        return -1;
+    }
+    return 0;
+}
+#else
+int native_build(Bytecode *bc, const char *exe) {
+    (void)bc;
+    fprintf(stderr, "Error: Cannot build %s: native builds need a POSIX system\n", exe);
+    return -1;
+}
+#endif
+
+// --emit-asm FILE and --build-native FILE OUT
+int native_file(const char *filename, const char *exe, int optimize) {
+    AstArena ast = {0};
+    Source src;
+    Bytecode bc;
+    if (build_program(filename, &ast, &src, &bc, optimize) != 0) {
+        ast_free(&ast);
+        return 1;
+    }
+    int status = 0;
+    if (exe) status = native_build(&bc, exe) == 0 ? 0 : 1;
+    else emit_asm(stdout, &bc);
+    bytecode_free(&bc);
+    ast_free(&ast);
+    source_free(&src);
+    return status;
+}
+
+#define VERIFY_BUDGET 100000000LL // default steps for --verify-native
+
+// Builds each program natively, runs it, and checks its output and exit
+// status against the tree-walking interpreter's. Times all three engines.
+// A program the interpreter cannot finish within budget steps (0 = the
+// default, VERIFY_BUDGET) is skipped rather than run natively, where it
+// could not be stopped. Returns 0 if every other program matches.
+int verify_native(char **files, int nfiles, int optimize, long long budget) {
+#ifndef _WIN32
+    char dir[] = "/tmp/ll1-native-XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Error: Cannot create a temporary directory\n");
+        return 1;
+    }
+    char exe[sizeof(dir) + 8];
+    snprintf(exe, sizeof(exe), "%s/prog", dir);
+    int passed = 0, endless = 0;
+    if (budget <= 0) budget = VERIFY_BUDGET;
+
+    printf("--- NATIVE VERIFICATION: %d programs ---\n", nfiles);
+    printf("%-6s %12s %12s %12s  %s\n", "Result", "Interp (ms)", "VM (ms)", "Native (ms)", "Program");
+    for (int i = 0; i < nfiles; i++) {
+        AstArena ast = {0};
+        Source src;
+        Bytecode bc;
+        if (build_program(files[i], &ast, &src, &bc, optimize) != 0) {
+            printf("%-6s %12s %12s %12s  %s\n", "SKIP", "-", "-", "-", files[i]);
+            ast_free(&ast);
+            continue;
+        }
+        FILE *outs[3] = {tmpfile(), tmpfile(), tmpfile()};
+        int codes[3] = {1, 1, -1}, rc = 0;
+        double times[3] = {0, 0, 0};
+        const char *why = NULL;
+        long long result;
+        if (outs[0]) {
+            double t0 = now_seconds();
+            rc = interp_run(&ast, &bc, outs[0], &result, budget);
+            if (rc == 0) codes[0] = (int)(result & 0xff);
+            times[0] = now_seconds() - t0;
+        }
+        if (!outs[0] || !outs[1] || !outs[2]) {
+            why = "cannot open temporary files";
+        } else if (rc == VM_OUT_OF_STEPS) {
+            printf("%-6s %12s %12s %12s  %s: does not finish within %lld steps\n", "SKIP", "-", "-", "-", files[i], budget);
+            endless++;
+        } else if (native_build(&bc, exe) != 0) {
+            why = "build failed";
+        } else {
+            double t0 = now_seconds();
+            if (vm_run(&bc, outs[1], &result, budget) == 0) codes[1] = (int)(result & 0xff);
+            times[1] = now_seconds() - t0;
+            fflush(outs[2]);
+            char *argv[] = {exe, NULL};
+            t0 = now_seconds();
+            codes[2] = run_process(argv, fileno(outs[2]));
+            times[2] = now_seconds() - t0;
+            fseek(outs[2], 0, SEEK_END);
+            if (codes[2] != codes[0]) why = "exit status differs";
+            else if (!files_equal(outs[0], outs[2])) why = "output differs";
+            else if (codes[1] != codes[0] || !files_equal(outs[0], outs[1])) why = "VM differs";
+        }
+        if (rc != VM_OUT_OF_STEPS || why) {
+            if (!why) passed++;
+            printf("%-6s %12.3f %12.3f %12.3f  %s%s%s\n", why ? "FAIL" : "PASS", times[0] * 1e3, times[1] * 1e3,
+                   times[2] * 1e3, files[i], why ? ": " : "", why ? why : "");
+        }
+        for (int k = 0; k < 3; k++) {
+            if (outs[k]) fclose(outs[k]);
+        }
+        remove(exe);
+        bytecode_free(&bc);
+        ast_free(&ast);
+        source_free(&src);
+    }
+    rmdir(dir);
+    printf("%d of %d programs match, %d do not finish (native times include process start-up)\n", passed, nfiles, endless);
+    return passed + endless == nfiles ? 0 : 1;
+#else
+    (void)files;
+    (void)nfiles;
+    (void)budget;
+    fprintf(stderr, "Error: --verify-native needs a POSIX system\n");
+    return 1;
+#endif
+}
+
+
+// =================================================================
+// PART 8: INCREMENTAL RE-LEXING AND RE-PARSING
+// =================================================================
+
+// An editor buffer that stays lexed and parsed across edits. The text is
+// split into pieces at top-level definitions, each with its own text,
+// tokens and AST. An edit relexes its piece from the last `..`, `{` or `}`
+// before it: no token extends past those, so the DFA is back in S0 after
+// them whatever follows. It stops once a new token of those kinds lands
+// where an old one was, after the edit, and keeps the old tokens from
+// there on. Then only that piece is parsed again, with parse_from(): the
+// first piece from Program and the others from OptFuncs, so pieces that
+// each end between two definitions chain together exactly like one parse
+// of the whole program. Per-piece lengths, token counts, lexer errors and
+// "not OPEN" flags are kept in Fenwick trees, so finding the piece at an
+// offset, numbering its tokens and finding the first error are O(log n)
+// in the number of pieces; a local edit costs the size of the edited
+// definition. Splitting and joining pieces rebuild the trees.
+
+typedef struct {
+    char *text;           // from this piece's first definition up to the next piece
+    size_t len, cap;
+    unsigned char *type;  // tokens, offsets into text, ending with EOF
+    unsigned int *offset;
+    unsigned int *length;
+    int ntokens, tokens_cap;
+    AstNode *nodes;       // AST from the last parse, root 0
+    int nnodes;
+    int status;           // PARSE_* from the last parse
+    int lex_errors;       // bytes that no token covers
+    size_t first_lex_error;
+    char error[256];      // first parser error, token indices counted from error_base
+    int error_base;
+    long long counted[4]; // what the sums hold for this piece
+} IncPiece;
+
+// Per-piece quantities summed in the Fenwick trees
+enum { SUM_LEN, SUM_TOKENS, SUM_NOT_OPEN, SUM_LEX_ERRORS, INC_NSUMS };
+
+typedef struct {
+    IncPiece **pieces;
+    int npieces, cap;
+    long long *sums[INC_NSUMS]; // Fenwick trees over the pieces, 1-based
+    int sums_cap;
+    CompileContext ctx; // scratch for lexing and parsing one piece
+    AstArena ast;
+    int relexed, reparsed; // tokens lexed and parsed by the last edit
+} IncDoc;
+
+// Tokens that no longer token can extend: the lexer restarts in S0 after them
+#define INC_RESTART_TOKEN(t) ((t) == TOKEN_DOTDOT || (t) == TOKEN_OPEN_BRACE || (t) == TOKEN_CLOSE_BRACE || (t) == TOKEN_INCLUDE)
+
+void inc_reserve_tokens(IncPiece *p, int n) {
+    if (n <= p->tokens_cap) return;
+    int cap = p->tokens_cap ? p->tokens_cap : 64;
+    while (cap < n) cap *= 2;
+    unsigned char *type = realloc(p->type, (size_t)cap);
+    unsigned int *offset = type ? realloc(p->offset, (size_t)cap * sizeof(unsigned int)) : NULL;
+    unsigned int *length = offset ? realloc(p->length, (size_t)cap * sizeof(unsigned int)) : NULL;
+    if (!length) {
+        fprintf(stderr, "Error: Out of memory growing an edited buffer\n");
+        exit(1);
+    }
+    p->type = type;
+    p->offset = offset;
+    p->length = length;
+    p->tokens_cap = cap;
+}
+
+void inc_reserve_text(IncPiece *p, size_t n) {
+    if (n <= p->cap) return;
+    size_t cap = p->cap ? p->cap : 256;
+    while (cap < n) cap *= 2;
+    char *grown = realloc(p->text, cap);
+    if (!grown) {
+        fprintf(stderr, "Error: Out of memory growing an edited buffer\n");
+        exit(1);
+    }
+    p->text = grown;
+    p->cap = cap;
+}
+
+void inc_piece_free(IncPiece *p) {
+    free(p->text);
+    free(p->type);
+    free(p->offset);
+    free(p->length);
+    free(p->nodes);
+    memset(p, 0, sizeof(*p));
+}
+
+void inc_free(IncDoc *doc) {
+    for (int k = 0; k < doc->npieces; k++) {
+        inc_piece_free(doc->pieces[k]);
+        free(doc->pieces[k]);
+    }
+    free(doc->pieces);
+    for (int s = 0; s < INC_NSUMS; s++) free(doc->sums[s]);
+    context_free(&doc->ctx);
+    ast_free(&doc->ast);
+    memset(doc, 0, sizeof(*doc));
+}
+
+void inc_values(const IncPiece *p, long long *v) {
+    v[SUM_LEN] = (long long)p->len;
+    v[SUM_TOKENS] = p->ntokens - 1; // not its EOF
+    v[SUM_NOT_OPEN] = p->status != PARSE_OPEN;
+    v[SUM_LEX_ERRORS] = p->lex_errors;
+}
+
+// Sum of quantity s over pieces [0, k)
+long long inc_sum(IncDoc *doc, int s, int k) {
+    long long total = 0;
+    for (; k > 0; k -= k & -k) total += doc->sums[s][k];
+    return total;
+}
+
+// The first piece k at which the sum of s over [0, k] reaches v, or
+// npieces if it never does.
+int inc_search(IncDoc *doc, int s, long long v) {
+    int k = 0, step = 1;
+    while (step * 2 <= doc->npieces) step *= 2;
+    for (; step > 0; step /= 2) {
+        if (k + step <= doc->npieces && doc->sums[s][k + step] < v) {
+            k += step;
+            v -= doc->sums[s][k];
+        }
+    }
+    return k;
+}
+
+// Brings the sums up to date with piece k.
+void inc_count(IncDoc *doc, int k) {
+    IncPiece *p = doc->pieces[k];
+    long long v[INC_NSUMS];
+    inc_values(p, v);
+    for (int s = 0; s < INC_NSUMS; s++) {
+        long long d = v[s] - p->counted[s];
+        for (int i = k + 1; d && i <= doc->npieces; i += i & -i) doc->sums[s][i] += d;
+        p->counted[s] = v[s];
+    }
+}
+
+// Rebuilds the sums after pieces were added or removed.
+void inc_reindex(IncDoc *doc) {
+    if (doc->npieces + 1 > doc->sums_cap) {
+        doc->sums_cap = doc->cap + 1;
+        for (int s = 0; s < INC_NSUMS; s++) {
+            long long *grown = realloc(doc->sums[s], (size_t)doc->sums_cap * sizeof(long long));
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory growing an edited buffer\n");
+                exit(1);
+            }
+            doc->sums[s] = grown;
+        }
+    }
+    for (int s = 0; s < INC_NSUMS; s++) memset(doc->sums[s], 0, (size_t)(doc->npieces + 1) * sizeof(long long));
+    for (int k = 0; k < doc->npieces; k++) {
+        inc_values(doc->pieces[k], doc->pieces[k]->counted);
+        for (int s = 0; s < INC_NSUMS; s++) {
+            int i = k + 1, up = i + (i & -i);
+            doc->sums[s][i] += doc->pieces[k]->counted[s];
+            if (up <= doc->npieces) doc->sums[s][up] += doc->sums[s][i];
+        }
+    }
+}
+
+// Makes room for a piece at index k and returns it, empty. The caller
+// reindexes once the pieces are in place.
+IncPiece *inc_insert_piece(IncDoc *doc, int k) {
+    IncPiece *p = calloc(1, sizeof(IncPiece));
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory growing an edited buffer\n");
+        exit(1);
+    }
+    VEC_PUSH(doc->pieces, doc->npieces, doc->cap);
+    memmove(&doc->pieces[k + 1], &doc->pieces[k], (size_t)(doc->npieces - 1 - k) * sizeof(IncPiece *));
+    doc->pieces[k] = p;
+    return p;
+}
+
+// Lexes piece p whole.
+void inc_lex(IncDoc *doc, IncPiece *p) {
+    CompileContext *ctx = &doc->ctx;
+    lex(ctx, p->text, p->len);
+    inc_reserve_tokens(p, ctx->token_count);
+    for (int i = 0; i < ctx->token_count; i++) {
+        p->type[i] = (unsigned char)token_type(ctx, i);
+        p->offset[i] = (unsigned int)token_offset(ctx, i);
+        p->length[i] = (unsigned int)token_length(ctx, i);
+    }
+    p->ntokens = ctx->token_count;
+    doc->relexed += ctx->token_count;
+}
+
+// Replaces removed bytes at off in p's text with ins, then relexes from
+// the restart point before off until the token stream meets the old one.
+void inc_relex(IncDoc *doc, IncPiece *p, size_t off, size_t removed, const char *ins, size_t ins_len) {
+    // Tokens [0, keep) end before the edit, and the last of them is a restart token
+    int lo = 0, hi = p->ntokens - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (p->offset[mid] + p->length[mid] <= off) lo = mid + 1;
+        else hi = mid;
+    }
+    int keep = lo;
+    while (keep > 0 && !INC_RESTART_TOKEN(p->type[keep - 1])) keep--;
+    size_t restart = keep ? p->offset[keep - 1] + p->length[keep - 1] : 0;
+
+    inc_reserve_text(p, p->len - removed + ins_len + 1);
+    memmove(p->text + off + ins_len, p->text + off + removed, p->len - off - removed);
+    memcpy(p->text + off, ins, ins_len);
+    p->len = p->len - removed + ins_len;
+    long long delta = (long long)ins_len - (long long)removed;
+
+    CompileContext *ctx = &doc->ctx;
+    LexState ls;
+    lex_begin(ctx, &ls);
+    ls.pos = restart;
+    int synced = -1, fresh = 0;
+    while (synced < 0 && !ls.done) {
+        ctx->token_limit = ctx->token_count + 64;
+        lex_feed(ctx, &ls, p->text, p->len, 1);
+        for (; fresh < ctx->token_count && synced < 0; fresh++) {
+            TokenType t = token_type(ctx, fresh);
+            long long at = (long long)token_offset(ctx, fresh) - delta; // where it was before the edit
+            if (!INC_RESTART_TOKEN(t) || token_offset(ctx, fresh) < off + ins_len) continue;
+            int a = keep, b = p->ntokens - 1;
+            while (a < b) {
+                int mid = (a + b) / 2;
+                if ((long long)p->offset[mid] < at) a = mid + 1;
+                else b = mid;
+            }
+            if (a < p->ntokens - 1 && (long long)p->offset[a] == at && p->type[a] == t) synced = a;
+        }
+    }
+    ctx->token_limit = LEX_MAX_TOKENS;
+
+    // keep old tokens, fresh new ones (with EOF if no sync), then the old tail shifted
+    int tail = synced >= 0 ? p->ntokens - synced - 1 : 0;
+    inc_reserve_tokens(p, keep + fresh + tail);
+    memmove(p->type + keep + fresh, p->type + p->ntokens - tail, (size_t)tail);
+    memmove(p->offset + keep + fresh, p->offset + p->ntokens - tail, (size_t)tail * sizeof(unsigned int));
+    memmove(p->length + keep + fresh, p->length + p->ntokens - tail, (size_t)tail * sizeof(unsigned int));
+    for (int i = keep + fresh; i < keep + fresh + tail; i++) p->offset[i] = (unsigned int)(p->offset[i] + delta);
+    for (int i = 0; i < fresh; i++) {
+        p->type[keep + i] = (unsigned char)token_type(ctx, i);
+        p->offset[keep + i] = (unsigned int)token_offset(ctx, i);
+        p->length[keep + i] = (unsigned int)token_length(ctx, i);
+    }
+    p->ntokens = keep + fresh + tail;
+    doc->relexed += fresh;
+}
+
+// Index of piece k's first token in the whole program
+int inc_token_base(IncDoc *doc, int k) {
+    return (int)inc_sum(doc, SUM_TOKENS, k);
+}
+
+// Parses piece k on its own and keeps its AST and first error.
+void inc_parse(IncDoc *doc, int k) {
+    IncPiece *p = doc->pieces[k];
+    CompileContext *ctx = &doc->ctx;
+    ctx->token_count = 0;
+    ctx->tokens.text = p->text;
+    for (int i = 0; i < p->ntokens; i++) add_token(ctx, (TokenType)p->type[i], p->offset[i], p->length[i]);
+    ctx->token_base = inc_token_base(doc, k);
+    ctx->errors = 0;
+    ctx->ast = &doc->ast;
+    p->status = parse_from(ctx, k == 0 ? SYM_NT(NT_PROGRAM) : SYM_NT(NT_OPT_FUNCS), k == doc->npieces - 1);
+    snprintf(p->error, sizeof(p->error), "%s", ctx->errors ? ctx->first_error : "");
+    p->error_base = ctx->token_base;
+    doc->reparsed += p->ntokens;
+
+    // The tree, with its node indices, in one array
+    AstArena *a = &doc->ast;
+    AstNode *nodes = realloc(p->nodes, (size_t)(a->used ? a->used : 1) * sizeof(AstNode));
+    if (!nodes) {
+        fprintf(stderr, "Error: Out of memory growing an edited buffer\n");
+        exit(1);
+    }
+    for (int b = 0; b * AST_BLOCK_SIZE < a->used; b++) {
+        int n = a->used - b * AST_BLOCK_SIZE;
+        memcpy(nodes + b * AST_BLOCK_SIZE, a->blocks[b], (size_t)(n < AST_BLOCK_SIZE ? n : AST_BLOCK_SIZE) * sizeof(AstNode));
+    }
+    p->nodes = nodes;
+    p->nnodes = a->used;
+
+    // The lexer skips exactly one byte per error, and nothing else but space
+    p->lex_errors = 0;
+    size_t at = 0;
+    for (int i = 0; i < p->ntokens; i++) {
+        for (; at < p->offset[i]; at++) {
+            if (!IS_SPACE_BYTE[(unsigned char)p->text[at]] && p->lex_errors++ == 0) p->first_lex_error = at;
+        }
+        at = p->offset[i] + p->length[i];
+    }
+    inc_count(doc, k);
+}
+
+// Appends the text of piece k+1 to piece k and drops piece k+1. Piece k's
+// tokens are stale until it is lexed again.
+void inc_join(IncDoc *doc, int k) {
+    IncPiece *p = doc->pieces[k], *next = doc->pieces[k + 1];
+    inc_reserve_text(p, p->len + next->len + 1);
+    memcpy(p->text + p->len, next->text, next->len);
+    p->len += next->len;
+    inc_piece_free(next);
+    free(next);
+    memmove(&doc->pieces[k + 1], &doc->pieces[k + 2], (size_t)(doc->npieces - k - 2) * sizeof(IncPiece *));
+    doc->npieces--;
+    inc_reindex(doc);
+}
+
+// Joins pieces k and k+1 and relexes the result (the join may not fall
+// between two tokens). It is not parsed yet.
+void inc_merge(IncDoc *doc, int k) {
+    inc_join(doc, k);
+    inc_lex(doc, doc->pieces[k]);
+}
+
+// 1 if pieces k and k+1 lex apart exactly as they would together: there
+// is space on one side of the join, or piece k ends with a restart token.
+int inc_join_safe(IncDoc *doc, int k) {
+    IncPiece *p = doc->pieces[k], *next = doc->pieces[k + 1];
+    if (p->len == 0 || next->len == 0) return 0;
+    if (IS_SPACE_BYTE[(unsigned char)p->text[p->len - 1]] || IS_SPACE_BYTE[(unsigned char)next->text[0]]) return 1;
+    int last = p->ntokens - 2;
+    return last >= 0 && p->offset[last] + p->length[last] == p->len && INC_RESTART_TOKEN(p->type[last]);
+}
+
+// Gives every top-level definition in piece k a piece of its own. A
+// definition starts at an int or dec outside braces right after a `}` or
+// the #include line, so the tokens split where the text does.
+void inc_split(IncDoc *doc, int k) {
+    IncPiece *p = doc->pieces[k];
+    int depth = 0, ncuts = 0, *cuts = NULL, cuts_cap = 0;
+    for (int i = 0; i < p->ntokens - 1; i++) {
+        int t = p->type[i];
+        if (t == TOKEN_OPEN_BRACE) depth++;
+        else if (t == TOKEN_CLOSE_BRACE) depth--;
+        else if ((t == TOKEN_KW_INT || t == TOKEN_KW_DEC) && depth == 0 && i > 0 &&
+                 (p->type[i - 1] == TOKEN_CLOSE_BRACE || p->type[i - 1] == TOKEN_INCLUDE)) {
+            VEC_PUSH(cuts, ncuts, cuts_cap);
+            cuts[ncuts - 1] = i;
+        }
+    }
+    for (int c = ncuts - 1; c >= 0; c--) {
+        // The new piece takes tokens [cuts[c], end) of what is left of p
+        int first = cuts[c], n = p->ntokens - first; // includes EOF
+        size_t start = p->offset[first];
+        IncPiece *q = inc_insert_piece(doc, k + 1);
+        inc_reserve_text(q, p->len - start + 1);
+        memcpy(q->text, p->text + start, p->len - start);
+        q->len = p->len - start;
+        inc_reserve_tokens(q, n);
+        for (int i = 0; i < n; i++) {
+            q->type[i] = p->type[first + i];
+            q->offset[i] = (unsigned int)(p->offset[first + i] - start);
+            q->length[i] = p->length[first + i];
+        }
+        q->ntokens = n;
+        p->len = start;
+        p->ntokens = first + 1;
+        p->type[first] = TOKEN_EOF;
+        p->offset[first] = (unsigned int)start;
+        p->length[first] = 0;
+    }
+    if (ncuts) {
+        inc_reindex(doc);
+        for (int c = 0; c <= ncuts; c++) inc_parse(doc, k + c);
+    }
+    free(cuts);
+}
+
+// Restores the invariants around piece k after it changed: joins are
+// safe, no piece but the first is empty, a piece that ends inside a
+// definition is joined with the next one, and each definition has its own
+// piece. Returns the index piece k's text ended up in.
+int inc_settle(IncDoc *doc, int k) {
+    for (;;) {
+        IncPiece *p = doc->pieces[k];
+        if (k > 0 && (p->ntokens == 1 || !inc_join_safe(doc, k - 1))) {
+            inc_merge(doc, --k);
+            inc_parse(doc, k);
+            continue;
+        }
+        if (k + 1 < doc->npieces && (p->status == PARSE_PARTIAL || !inc_join_safe(doc, k))) {
+            inc_merge(doc, k);
+            inc_parse(doc, k);
+            continue;
+        }
+        break;
+    }
+    inc_split(doc, k);
+    return k;
+}
+
+// Loads text as one piece and splits it into definitions.
+void inc_open(IncDoc *doc, const char *text, size_t len) {
+    memset(doc, 0, sizeof(*doc));
+    context_init(&doc->ctx, NULL, NULL);
+    doc->ast.root = -1;
+    IncPiece *p = inc_insert_piece(doc, 0);
+    inc_reserve_text(p, len + 1);
+    memcpy(p->text, text, len);
+    p->len = len;
+    inc_reindex(doc);
+    inc_lex(doc, p);
+    inc_parse(doc, 0);
+    inc_settle(doc, 0);
+}
+
+size_t inc_length(IncDoc *doc) {
+    return (size_t)inc_sum(doc, SUM_LEN, doc->npieces);
+}
+
+// Replaces removed bytes at offset off with ins. Returns -1 if the range
+// is outside the buffer.
+int inc_edit(IncDoc *doc, size_t off, size_t removed, const char *ins, size_t ins_len) {
+    size_t len = inc_length(doc);
+    if (off > len || removed > len - off) return -1;
+    doc->relexed = doc->reparsed = 0;
+    // Insertions at a join go to the earlier piece; removals start in the later one
+    int k = inc_search(doc, SUM_LEN, (long long)off + (removed ? 1 : 0));
+    if (k >= doc->npieces) k = doc->npieces - 1;
+    size_t base = (size_t)inc_sum(doc, SUM_LEN, k);
+    IncPiece *p = doc->pieces[k];
+    if (off + removed > base + p->len) {
+        // The edit crosses into later pieces: join them first
+        while (off + removed > base + doc->pieces[k]->len) inc_join(doc, k);
+        p = doc->pieces[k];
+        inc_reserve_text(p, p->len - removed + ins_len + 1);
+        memmove(p->text + (off - base) + ins_len, p->text + (off - base) + removed, p->len - (off - base) - removed);
+        memcpy(p->text + (off - base), ins, ins_len);
+        p->len = p->len - removed + ins_len;
+        inc_lex(doc, p);
+    } else {
+        inc_relex(doc, p, off - base, removed, ins, ins_len);
+    }
+    inc_parse(doc, k);
+    inc_settle(doc, k);
+    return 0;
+}
+
+// The verdict on the whole buffer, as one parse of it would give it.
+// Copies the first parser error into error, or leaves it empty.
+int inc_accepted(IncDoc *doc, char *error, size_t size) {
+    error[0] = '\0';
+    for (;;) {
+        int k = inc_search(doc, SUM_NOT_OPEN, 1); // pieces before it end between definitions
+        if (k >= doc->npieces) return 0; // the last one cannot stay open
+        IncPiece *p = doc->pieces[k];
+        if (p->status == PARSE_PARTIAL && k + 1 < doc->npieces) {
+            // Split while it did not parse: the definition goes on in the next piece
+            inc_merge(doc, k);
+            inc_parse(doc, k);
+            continue;
+        }
+        if (p->status == PARSE_ACCEPTED && k + 1 == doc->npieces) return 1;
+        if (p->status == PARSE_ACCEPTED) {
+            // main ended, but more definitions follow
+            snprintf(error, size, "PARSER ERROR: Input not fully consumed or Stack not empty at token index %d",
+                     inc_token_base(doc, k + 1));
+            return 0;
+        }
+        if (p->error_base != inc_token_base(doc, k)) inc_parse(doc, k); // token indices moved
+        snprintf(error, size, "%s", p->error);
+        return 0;
+    }
+}
+
+// Lexer errors in the whole buffer; *first is the offset of the first one.
+int inc_lex_errors(IncDoc *doc, size_t *first) {
+    int count = (int)inc_sum(doc, SUM_LEX_ERRORS, doc->npieces);
+    if (count) {
+        int k = inc_search(doc, SUM_LEX_ERRORS, 1);
+        *first = (size_t)inc_sum(doc, SUM_LEN, k) + doc->pieces[k]->first_lex_error;
+    }
+    return count;
+}
+
+// Order-sensitive digest of the tree under root: symbols, productions and
+// terminal text in preorder. An OptFuncs that was never expanded (the end
+// of a piece) is skipped, so the pieces of a program digest like the
+// program. stack is scratch that grows as needed.
+unsigned long long ast_digest(const AstNode *nodes, int root, const char *text, unsigned long long h, int **stack, int *cap) {
+    int top = 0;
+    if (*cap == 0) {
+        *cap = 256;
+        *stack = malloc((size_t)*cap * sizeof(int));
+        if (!*stack) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    (*stack)[top++] = root;
+    while (top > 0) {
+        const AstNode *n = &nodes[(*stack)[--top]];
+        if (n->sym == SYM_NT(NT_OPT_FUNCS) && n->prod == 0) continue;
+        h = (h ^ n->sym) * 1099511628211ULL;
+        h = (h ^ n->prod) * 1099511628211ULL;
+        if (n->sym < NTER) {
+            for (unsigned int i = 0; i < n->length; i++) h = (h ^ (unsigned char)text[n->offset + i]) * 1099511628211ULL;
+        }
+        if (top + n->count > *cap) {
+            while (top + n->count > *cap) *cap *= 2;
+            int *grown = realloc(*stack, (size_t)*cap * sizeof(int));
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory\n");
+                exit(1);
+            }
+            *stack = grown;
+        }
+        for (int c = n->count - 1; c >= 0; c--) (*stack)[top++] = n->first_child + c;
+    }
+    return h;
+}
+
+// Checks the buffer against a full relex and reparse of its text: same
+// tokens, lexer errors, verdict, first error and (if accepted) tree.
+// *full_seconds gets the time of the full lex and parse.
+int inc_check(IncDoc *doc, double *full_seconds) {
+    size_t len = inc_length(doc), at = 0;
+    char *text = malloc(len + 1);
+    if (!text) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int k = 0; k < doc->npieces; k++) {
+        memcpy(text + at, doc->pieces[k]->text, doc->pieces[k]->len);
+        at += doc->pieces[k]->len;
+    }
+    CompileContext ctx;
+    AstArena ast = {0};
+    ast.root = -1;
+    context_init(&ctx, NULL, NULL);
+    ctx.ast = &ast;
+    double t0 = now_seconds();
+    lex(&ctx, text, len);
+    int full_lex_errors = ctx.lex_errors;
+    ctx.errors = 0; // keep the first parser error, not the first lexer error
+    int accepted = parse(&ctx);
+    *full_seconds = now_seconds() - t0;
+
+    // Tokens, with offsets into the whole text and one EOF
+    unsigned long long h = 1469598103934665603ULL;
+    size_t base = 0;
+    for (int k = 0; k < doc->npieces; k++) {
+        IncPiece *p = doc->pieces[k];
+        for (int i = 0; i < p->ntokens - 1; i++) {
+            h = (h ^ (unsigned long long)p->type[i]) * 1099511628211ULL;
+            h = (h ^ (unsigned long long)(base + p->offset[i])) * 1099511628211ULL;
+            h = (h ^ (unsigned long long)p->length[i]) * 1099511628211ULL;
+        }
+        base += p->len;
+    }
+    h = (h ^ (unsigned long long)TOKEN_EOF) * 1099511628211ULL;
+    h = (h ^ (unsigned long long)len) * 1099511628211ULL;
+    h = (h ^ 0ULL) * 1099511628211ULL;
+    int same = h == token_digest(&ctx);
+
+    size_t first = 0;
+    char error[256];
+    same = same && inc_lex_errors(doc, &first) == full_lex_errors;
+    same = same && inc_accepted(doc, error, sizeof(error)) == accepted;
+    same = same && strcmp(error, accepted ? "" : ctx.first_error) == 0;
+    if (same && accepted) {
+        int *stack = NULL, cap = 0;
+        AstNode *nodes = malloc((size_t)(ast.used ? ast.used : 1) * sizeof(AstNode));
+        if (!nodes) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < ast.used; i++) nodes[i] = *AST_NODE(&ast, i);
+        unsigned long long expected = ast_digest(nodes, ast.root, text, 1469598103934665603ULL, &stack, &cap);
+        unsigned long long got = 1469598103934665603ULL;
+        for (int k = 0; k < doc->npieces; k++) got = ast_digest(doc->pieces[k]->nodes, 0, doc->pieces[k]->text, got, &stack, &cap);
+        same = got == expected;
+        free(nodes);
+        free(stack);
+    }
+    context_free(&ctx);
+    ast_free(&ast);
+    free(text);
+    return same;
+}
+
+// One edit per line: OFFSET REMOVED ["TEXT"], where TEXT may use \n, \t,
+// \r, \" and \\. Blank lines and lines starting with # are skipped.
+// Returns the number of bytes parsed, 0 at the end, or -1 on a bad line.
+long parse_edit_line(const char *s, size_t n, size_t *off, size_t *removed, char *ins, size_t *ins_len) {
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        while (i < n && s[i] != '\n') i++;
+        size_t end = i;
+        if (i < n) i++;
+        size_t j = start;
+        while (j < end && (s[j] == ' ' || s[j] == '\t' || s[j] == '\r')) j++;
+        if (j == end || s[j] == '#') continue;
+        char *stop;
+        *off = strtoull(s + j, &stop, 10);
+        if (stop == s + j) return -1;
+        j = (size_t)(stop - s);
+        *removed = strtoull(s + j, &stop, 10);
+        if (stop == s + j) return -1;
+        j = (size_t)(stop - s);
+        while (j < end && (s[j] == ' ' || s[j] == '\t')) j++;
+        *ins_len = 0;
+        if (j < end && s[j] == '"') {
+            for (j++; j < end && s[j] != '"'; j++) {
+                char c = s[j];
+                if (c == '\\' && j + 1 < end) {
+                    c = s[++j];
+                    c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+                }
+                ins[(*ins_len)++] = c;
+            }
+            if (j == end) return -1;
+        }
+        return (long)i;
+    }
+    return 0;
+}
+
+// --edit-script: loads filename, applies each edit incrementally and
+// prints the verdict after each one. With verify set, every step is also
+// checked against a full relex and reparse.
+int run_edit_script(const char *filename, const char *script, int verify) {
+    Source src, edits;
+    if (read_whole_file(filename, &src) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return 1;
+    }
+    if (read_whole_file(script, &edits) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", script);
+        source_free(&src);
+        return 1;
+    }
+    char *ins = malloc(edits.len + 1);
+    if (!ins) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    IncDoc doc;
+    double t0 = now_seconds();
+    inc_open(&doc, src.data, src.len);
+    double open_time = now_seconds() - t0;
+    printf("--- INCREMENTAL EDITS: %s (%zu bytes, %d definitions, loaded in %.3f ms) ---\n", filename, src.len,
+           doc.npieces - 1, open_time * 1e3);
+
+    int nedits = 0, mismatches = 0, status = 0;
+    double total = 0, worst = 0, full_total = 0;
+    size_t pos = 0;
+    for (;;) {
+        size_t off, removed, ins_len;
+        long used = parse_edit_line(edits.data + pos, edits.len - pos, &off, &removed, ins, &ins_len);
+        if (used == 0) break;
+        if (used < 0) {
+            fprintf(stderr, "Error: Bad edit after byte %zu of %s\n", pos, script);
+            status = 1;
+            break;
+        }
+        pos += (size_t)used;
+        nedits++;
+        char error[256];
+        size_t first = 0;
+        t0 = now_seconds();
+        int rc = inc_edit(&doc, off, removed, ins, ins_len);
+        int accepted = rc == 0 && inc_accepted(&doc, error, sizeof(error));
+        double t = now_seconds() - t0;
+        if (rc != 0) {
+            fprintf(stderr, "Error: Edit %d (offset %zu, %zu bytes) is outside the buffer\n", nedits, off, removed);
+            status = 1;
+            break;
+        }
+        total += t;
+        if (t > worst) worst = t;
+        int lex_errors = inc_lex_errors(&doc, &first);
+        printf("edit %d @%zu -%zu +%zu: %s (relexed %d, reparsed %d tokens, %.1f us)", nedits, off, removed, ins_len,
+               accepted ? "accepted" : "rejected", doc.relexed, doc.reparsed, t * 1e6);
+        if (lex_errors) printf(", %d lexer errors from index %zu", lex_errors, first);
+        if (!accepted) printf(": %s", error);
+        printf("\n");
+        if (verify) {
+            double full;
+            if (!inc_check(&doc, &full)) {
+                printf("edit %d: MISMATCH with a full relex and reparse\n", nedits);
+                mismatches++;
+            }
+            full_total += full;
+        }
+    }
+
+    if (nedits) {
+        printf("%d edits: %.1f us mean, %.1f us worst", nedits, total / nedits * 1e6, worst * 1e6);
+        if (verify) printf("; full relex + reparse %.1f us mean; %d mismatches", full_total / nedits * 1e6, mismatches);
+        printf("\n");
+    }
+    inc_free(&doc);
+    free(ins);
+    source_free(&src);
+    source_free(&edits);
+    return status || mismatches ? 1 : 0;
+}
+
+// =================================================================
+// PART 9: PROGRAM GENERATOR AND BENCHMARK SUITE
+// =================================================================
+
+// Random programs in this grammar, for benchmarks and fuzzing. Valid
+// programs are also accepted by the compiler: variables are declared
+// before use, functions only call functions defined above them, with the
+// right number of arguments, and loop variables are not reassigned inside
+// their loop. The text is streamed, so sizes are only limited by the disk.
+typedef struct {
+    unsigned long long size;  // bytes to aim for (the last statement may overshoot)
+    unsigned long long seed;
+    int funcs;      // definitions before main; -1 = about one per GEN_DEF_BYTES
+    int depth;      // loop nesting: every definition has one nest this deep
+    int expr_terms; // at most this many terms per expression
+    double mutate;  // chance per token of a mutation; 0 = a valid program
+} GenOptions;
+
+#define GEN_OPTS(sz, f, d, e, m) {.size = (sz), .funcs = (f), .depth = (d), .expr_terms = (e), .mutate = (m)}
+#define GEN_DEF_BYTES 2048
+#define GEN_MAX_VARS 4096 // per definition; later declarations become assignments
+#define GEN_FLUSH (64 * 1024)
+
+typedef struct {
+    unsigned long long bytes;
+    long long tokens;
+    int funcs;
+    long long mutations;
+} GenStats;
+
+typedef struct {
+    GenOptions opts;
+    unsigned long long rng;
+    FILE *out;   // NULL: the text accumulates in src
+    Source *src;
+    char *buf;   // pending output when streaming
+    size_t len;
+    int line_start; // no space before the next token
+    unsigned long long body_bytes, body_statements; // top-level statements so far
+    GenStats stats;
+    int *arity;  // parameters of each definition so far
+    int arity_cap;
+    int *var_type; // variables of the current definition
+    int nvars, vars_cap;
+    int *busy;   // variables of the enclosing loops
+    int nbusy, busy_cap;
+} Gen;
+
+unsigned long long gen_next(Gen *g) {
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 2685821657736338717ULL;
+}
+
+int gen_below(Gen *g, int n) {
+    return (int)(gen_next(g) % (unsigned long long)n);
+}
+
+int gen_chance(Gen *g, double p) {
+    return (double)(gen_next(g) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+void gen_write(Gen *g, const char *s, size_t n) {
+    if (g->out) {
+        if (g->len + n > GEN_FLUSH) {
+            fwrite(g->buf, 1, g->len, g->out);
+            g->len = 0;
+        }
+        memcpy(g->buf + g->len, s, n); // tokens are far shorter than GEN_FLUSH
+        g->len += n;
+    } else {
+        Source *src = g->src;
+        if (src->len + n > src->cap) {
+            size_t cap = src->cap ? src->cap : GEN_FLUSH;
+            while (cap < src->len + n) cap *= 2;
+            char *grown = realloc(src->data, cap);
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory generating a program\n");
+                exit(1);
+            }
+            src->data = grown;
+            src->cap = cap;
+        }
+        memcpy(src->data + src->len, s, n);
+        src->len += n;
+    }
+    g->stats.bytes += n;
+}
+
+void gen_newline(Gen *g, int depth) {
+    static const char spaces[] = "\n                                ";
+    int indent = 2 * depth + 1 < (int)sizeof(spaces) - 1 ? 2 * depth + 1 : (int)sizeof(spaces) - 1;
+    gen_write(g, spaces, (size_t)indent);
+    g->line_start = 1;
+}
+
+// Writes one token after a space. A mutated program drops, repeats or
+// replaces tokens, or puts a byte no token starts with in front of one.
+void gen_token(Gen *g, const char *s) {
+    static const char *junk[] = {
+        "int", "dec", "(", ")", "{", "}", "..", "=", "<", "+", ",", ":", "return", "printf",
+        "break", "loop", "while", "main", "7", "_xq1z", "gFn", "@", "$", ".",
+    };
+    int copies = 1;
+    if (g->opts.mutate > 0 && gen_chance(g, g->opts.mutate)) {
+        g->stats.mutations++;
+        switch (gen_below(g, 4)) {
+        case 0: copies = 0; break;
+        case 1: copies = 2; break;
+        case 2: s = junk[gen_below(g, (int)(sizeof(junk) / sizeof(junk[0])))]; break;
+        default: gen_write(g, "@", 1); break;
+        }
+    }
+    for (int i = 0; i < copies; i++) {
+        if (!g->line_start) gen_write(g, " ", 1);
+        g->line_start = 0;
+        gen_write(g, s, strlen(s));
+        g->stats.tokens++;
+    }
+}
+
+// _v, the index in base 26, a digit and a letter: _[a-z]+[0-9][a-z]
+void gen_var(Gen *g, int v) {
+    char name[32];
+    int n = 0;
+    name[n++] = '_';
+    name[n++] = 'v';
+    for (int i = v; ; i /= 26) {
+        name[n++] = (char)('a' + i % 26);
+        if (i < 26) break;
+    }
+    name[n++] = (char)('0' + v % 10);
+    name[n++] = (char)('a' + v % 26);
+    name[n] = '\0';
+    gen_token(g, name);
+}
+
+// f, the index in base 26 and Fn: [a-z][a-z0-9]*Fn
+void gen_func(Gen *g, int f) {
+    char name[32];
+    int n = 0;
+    name[n++] = 'f';
+    for (int i = f; ; i /= 26) {
+        name[n++] = (char)('a' + i % 26);
+        if (i < 26) break;
+    }
+    memcpy(name + n, "Fn", 3);
+    gen_token(g, name);
+}
+
+// Mostly small ints; the rare large ones are dec literals half the time.
+void gen_number(Gen *g) {
+    char digits[24];
+    unsigned long long v = gen_chance(g, 0.05) ? 10000000000ULL + gen_next(g) % 990000000000ULL
+                                               : (unsigned long long)gen_below(g, 21);
+    if (v >= 10000000000ULL && (v & 1)) snprintf(digits, sizeof(digits), "%llu.%06llu", v / 1000000, v % 1000000);
+    else snprintf(digits, sizeof(digits), "%llu", v);
+    gen_token(g, digits);
+}
+
+const char *gen_type(Gen *g) {
+    return gen_below(g, 2) ? "dec" : "int";
+}
+
+int gen_new_var(Gen *g, int type) {
+    VEC_PUSH(g->var_type, g->nvars, g->vars_cap);
+    g->var_type[g->nvars - 1] = type;
+    return g->nvars - 1;
+}
+
+// A variable that is not counting an enclosing loop, or -1
+int gen_free_var(Gen *g) {
+    for (int tries = 0; tries < 4 && g->nvars; tries++) {
+        int v = gen_below(g, g->nvars), busy = 0;
+        for (int i = 0; i < g->nbusy; i++) busy |= g->busy[i] == v;
+        if (!busy) return v;
+    }
+    return -1;
+}
+
+// nfuncs definitions are visible; calls nest at most twice
+void gen_expr(Gen *g, int nfuncs, int calls) {
+    int max_terms = calls && g->opts.expr_terms > 4 ? 4 : g->opts.expr_terms;
+    int terms = 1 + gen_below(g, max_terms);
+    for (int t = 0; t < terms; t++) {
+        if (t) gen_token(g, "+");
+        int r = gen_below(g, 100);
+        if (r < 30 || g->nvars == 0) {
+            gen_number(g);
+        } else if (r < 85 || nfuncs == 0 || calls >= 2) {
+            gen_var(g, gen_below(g, g->nvars));
+        } else {
+            int f = gen_below(g, nfuncs);
+            gen_func(g, f);
+            gen_token(g, "(");
+            for (int a = 0; a < g->arity[f]; a++) {
+                if (a) gen_token(g, ",");
+                gen_expr(g, nfuncs, calls + 1);
+            }
+            gen_token(g, ")");
+        }
+    }
+}
+
+void gen_statement(Gen *g, int nfuncs, int depth, int spine);
+
+// A loop statement at depth (statements at depth d are inside d - 1 loops).
+// With spine set its body opens the next loop of the definition's deepest
+// nest.
+void gen_loop(Gen *g, int nfuncs, int depth, int spine) {
+    int v = gen_below(g, 2) ? gen_free_var(g) : -1;
+    if (v < 0) v = gen_new_var(g, TY_INT);
+    gen_newline(g, depth);
+    gen_token(g, "loop");
+    gen_var(g, v);
+    gen_token(g, ":");
+    gen_token(g, "while");
+    gen_token(g, "(");
+    char limit[8];
+    if (gen_below(g, 5)) {
+        gen_var(g, v);
+        snprintf(limit, sizeof(limit), "%d", gen_below(g, 6));
+    } else {
+        gen_var(g, gen_below(g, g->nvars)); // never negative, so the loop is skipped
+        snprintf(limit, sizeof(limit), "0");
+    }
+    gen_token(g, "<");
+    gen_token(g, limit);
+    gen_token(g, ")");
+    gen_token(g, "{");
+    VEC_PUSH(g->busy, g->nbusy, g->busy_cap);
+    g->busy[g->nbusy - 1] = v;
+    int n = 1 + gen_below(g, 6);
+    for (int i = 0; i < n; i++) gen_statement(g, nfuncs, depth + 1, spine && i == 0);
+    g->nbusy--;
+    gen_newline(g, depth);
+    gen_token(g, "break");
+    gen_token(g, "..");
+    gen_token(g, "}");
+}
+
+void gen_statement(Gen *g, int nfuncs, int depth, int spine) {
+    if (spine && depth <= g->opts.depth) {
+        gen_loop(g, nfuncs, depth, 1);
+        return;
+    }
+    int r = gen_below(g, 100), v;
+    if (r >= 35 && r < 60 && (v = gen_free_var(g)) >= 0) {
+        gen_newline(g, depth);
+        gen_var(g, v);
+        gen_token(g, "=");
+        gen_expr(g, nfuncs, 0);
+        gen_token(g, "..");
+    } else if (r >= 60 && r < 75 && depth <= g->opts.depth) {
+        gen_loop(g, nfuncs, depth, 0);
+    } else if (r >= 35 && g->nvars) {
+        gen_newline(g, depth);
+        gen_token(g, "printf");
+        gen_token(g, "(");
+        gen_var(g, gen_below(g, g->nvars));
+        gen_token(g, ")");
+        gen_token(g, "..");
+    } else if (g->nvars < GEN_MAX_VARS) {
+        const char *type = gen_type(g);
+        int init = gen_chance(g, 0.8);
+        gen_newline(g, depth);
+        gen_token(g, type);
+        if (init) {
+            // The initialiser cannot use the variable it declares
+            v = g->nvars;
+            gen_var(g, v);
+            gen_token(g, "=");
+            gen_expr(g, nfuncs, 0);
+            gen_new_var(g, type[0] == 'd' ? TY_DEC : TY_INT);
+        } else {
+            gen_var(g, gen_new_var(g, type[0] == 'd' ? TY_DEC : TY_INT));
+        }
+        gen_token(g, "..");
+    } else {
+        gen_newline(g, depth);
+        gen_var(g, gen_below(g, g->nvars));
+        gen_token(g, "=");
+        gen_expr(g, nfuncs, 0);
+        gen_token(g, "..");
+    }
+}
+
+// Statements until the definition has used its share of the size. It
+// stops half a mean statement short, so sizes scatter around the target.
+void gen_body(Gen *g, int nfuncs, unsigned long long budget) {
+    unsigned long long start = g->stats.bytes;
+    int spine = g->opts.depth > 0;
+    do {
+        unsigned long long before = g->stats.bytes;
+        gen_statement(g, nfuncs, 1, spine);
+        spine = 0;
+        g->body_bytes += g->stats.bytes - before;
+        g->body_statements++;
+    } while (g->stats.bytes - start + g->body_bytes / g->body_statements / 2 < budget);
+}
+
+// Writes one program to out, or into src when out is NULL.
+void generate_program(const GenOptions *opts, FILE *out, Source *src, GenStats *stats) {
+    Gen g;
+    memset(&g, 0, sizeof(g));
+    g.opts = *opts;
+    if (g.opts.expr_terms < 1) g.opts.expr_terms = 1;
+    g.rng = opts->seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL; // never 0
+    g.out = out;
+    g.src = src;
+    if (out && !(g.buf = malloc(GEN_FLUSH))) {
+        fprintf(stderr, "Error: Out of memory generating a program\n");
+        exit(1);
+    }
+    // A fixed number of definitions share the size equally. Otherwise
+    // definitions of about GEN_DEF_BYTES are added while one more of the
+    // mean size still leaves room for main, which takes the rest.
+    unsigned long long budget = opts->funcs >= 0 ? opts->size / ((unsigned long long)opts->funcs + 1) : GEN_DEF_BYTES;
+    gen_write(&g, "#include<stdio.h>", 17);
+    g.stats.tokens++;
+    for (int f = 0; ; f++) {
+        unsigned long long mean = f ? (g.stats.bytes - 17) / (unsigned long long)f : budget;
+        if (opts->funcs >= 0 ? f >= opts->funcs : g.stats.bytes + mean * 3 / 2 >= opts->size) break;
+        static const int arities[] = {0, 1, 2, 3, 7, 9};
+        int arity = arities[gen_below(&g, 6)];
+        g.nvars = 0;
+        gen_newline(&g, 0);
+        gen_token(&g, gen_type(&g));
+        gen_func(&g, f);
+        gen_token(&g, "(");
+        for (int a = 0; a < arity; a++) {
+            const char *type = gen_type(&g);
+            if (a) gen_token(&g, ",");
+            gen_token(&g, type);
+            gen_var(&g, gen_new_var(&g, type[0] == 'd' ? TY_DEC : TY_INT));
+        }
+        gen_token(&g, ")");
+        gen_token(&g, "{");
+        gen_body(&g, f, budget);
+        gen_newline(&g, 1);
+        gen_token(&g, "return");
+        gen_expr(&g, f, 0);
+        gen_token(&g, "..");
+        gen_newline(&g, 0);
+        gen_token(&g, "}");
+        VEC_PUSH(g.arity, g.stats.funcs, g.arity_cap);
+        g.arity[f] = arity;
+    }
+    int nfuncs = g.stats.funcs;
+    if (opts->funcs < 0) budget = opts->size > g.stats.bytes ? opts->size - g.stats.bytes : 0;
+    g.nvars = 0;
+    gen_newline(&g, 0);
+    gen_token(&g, gen_type(&g));
+    gen_token(&g, "main");
+    gen_token(&g, "(");
+    gen_token(&g, ")");
+    gen_token(&g, "{");
+    gen_body(&g, nfuncs, budget);
+    for (int v = 0; v < g.nvars && v < 5; v++) {
+        gen_newline(&g, 1);
+        gen_token(&g, "printf");
+        gen_token(&g, "(");
+        gen_var(&g, v);
+        gen_token(&g, ")");
+        gen_token(&g, "..");
+    }
+    gen_newline(&g, 1);
+    gen_token(&g, "return");
+    gen_expr(&g, nfuncs, 0);
+    gen_token(&g, "..");
+    gen_newline(&g, 0);
+    if (opts->mutate > 0 && g.stats.mutations == 0) {
+        g.stats.mutations++; // a mutated program always has at least one
+    } else {
+        gen_token(&g, "}");
+    }
+    gen_write(&g, "\n", 1);
+
+    if (out) {
+        fwrite(g.buf, 1, g.len, out);
+        free(g.buf);
+    }
+    free(g.arity);
+    free(g.var_type);
+    free(g.busy);
+    if (stats) *stats = g.stats;
+}
+
+// "64", "512K", "16M", "2G" (binary units). Returns 0 when malformed.
+unsigned long long parse_size(const char *s) {
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+    case 'K': n <<= 10; end++; break;
+    case 'M': n <<= 20; end++; break;
+    case 'G': n <<= 30; end++; break;
+    }
+    return *end || end == s ? 0 : n;
+}
+
+// --- Benchmark suite ---
+
+// One kind of input: programs copies of the generated shape, or one file
+typedef struct {
+    const char *name;
+    int programs;
+    GenOptions opts;
+} SuiteCase;
+
+const SuiteCase SUITE_CASES[] = {
+    {"small programs", 500, GEN_OPTS(2048, -1, 3, 4, 0)},
+    {"1 MB", 1, GEN_OPTS(1 << 20, -1, 3, 4, 0)},
+    {"1 MB, main only", 1, GEN_OPTS(1 << 20, 0, 3, 4, 0)},
+    {"5000 funcs", 1, GEN_OPTS(1 << 20, 5000, 1, 4, 0)},
+    {"1 MB, depth 40", 1, GEN_OPTS(1 << 20, -1, 40, 4, 0)},
+    {"1 MB, 64-term exprs", 1, GEN_OPTS(1 << 20, -1, 3, 64, 0)},
+    {"1 MB, mutated", 1, GEN_OPTS(1 << 20, -1, 3, 4, 0.0002)},
+    {"16 MB", 1, GEN_OPTS(16 << 20, -1, 3, 4, 0)},
+};
+#define NSUITE_CASES ((int)(sizeof(SUITE_CASES) / sizeof(SUITE_CASES[0])))
+
+typedef struct {
+    char name[64];
+    int programs, accepted;
+    unsigned long long bytes; // per iteration
+    long long tokens, steps;  // per iteration
+    double lex_seconds, parse_seconds; // over all iterations
+    double lex_pct[4], parse_pct[4];   // p50, p90, p99, max of one call
+    long peak_rss_kb;
+} SuiteResult;
+
+int compare_seconds(const void *x, const void *y) {
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+// Sorts the samples and picks p50, p90, p99 and the maximum
+void percentiles(double *samples, int n, double *out) {
+    static const double q[4] = {0.50, 0.90, 0.99, 1.0};
+    qsort(samples, (size_t)n, sizeof(double), compare_seconds);
+    for (int i = 0; i < 4; i++) out[i] = samples[(int)(q[i] * (n - 1) + 0.5)];
+}
+
+long peak_rss_kb() {
+#ifndef _WIN32
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) return ru.ru_maxrss; // KB on Linux
+#endif
+    return 0;
+}
+
+// Lexes and then parses each program iterations times (after one untimed
+// pass), timing the two calls separately.
+void suite_measure(Source *texts, int ntexts, int iterations, SuiteResult *r) {
+    CompileContext ctx;
+    context_init(&ctx, NULL, NULL);
+    int nsamples = ntexts * iterations;
+    double *lex_samples = malloc((size_t)nsamples * sizeof(double));
+    double *parse_samples = malloc((size_t)nsamples * sizeof(double));
+    if (!lex_samples || !parse_samples) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    r->programs = ntexts;
+    for (int it = -1; it < iterations; it++) {
+        r->accepted = 0;
+        r->bytes = 0;
+        r->tokens = r->steps = 0;
+        for (int p = 0; p < ntexts; p++) {
+            double t0 = now_seconds();
+            lex(&ctx, texts[p].data, texts[p].len);
+            double t1 = now_seconds();
+            r->accepted += parse(&ctx);
+            double t2 = now_seconds();
+            r->bytes += texts[p].len;
+            r->tokens += ctx.token_count;
+            r->steps += ctx.parse_steps;
+            if (it < 0) continue; // warm-up
+            lex_samples[it * ntexts + p] = t1 - t0;
+            parse_samples[it * ntexts + p] = t2 - t1;
+            r->lex_seconds += t1 - t0;
+            r->parse_seconds += t2 - t1;
+        }
+    }
+    percentiles(lex_samples, nsamples, r->lex_pct);
+    percentiles(parse_samples, nsamples, r->parse_pct);
+    r->peak_rss_kb = peak_rss_kb();
+    free(lex_samples);
+    free(parse_samples);
+    context_free(&ctx);
+}
+
+// Baseline results: "name<TAB>lex p50<TAB>parse p50" per line, in seconds
+int suite_save(const char *path, SuiteResult *results, int n) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!results[i].programs) continue;
+        fprintf(f, "%s\t%.9f\t%.9f\n", results[i].name, results[i].lex_pct[0], results[i].parse_pct[0]);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Prints the median of each case against the baseline and returns the
+// number of cases more than SUITE_TOLERANCE slower in either phase.
+#define SUITE_TOLERANCE 0.10
+int suite_compare(const char *path, SuiteResult *results, int n) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open baseline %s\n", path);
+        return -1;
+    }
+    char line[256];
+    int regressions = 0;
+    printf("\n%-24s %12s %12s\n", "Against baseline", "Lex p50", "Parse p50");
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        double lex_base, parse_base;
+        if (!tab) continue;
+        *tab = '\0';
+        if (sscanf(tab + 1, "%lf %lf", &lex_base, &parse_base) != 2) continue;
+        for (int i = 0; i < n; i++) {
+            if (strcmp(results[i].name, line) != 0) continue;
+            double lex_ratio = results[i].lex_pct[0] / lex_base, parse_ratio = results[i].parse_pct[0] / parse_base;
+            int slower = lex_ratio > 1 + SUITE_TOLERANCE || parse_ratio > 1 + SUITE_TOLERANCE;
+            printf("%-24s %11.2fx %11.2fx%s\n", line, lex_ratio, parse_ratio, slower ? "  REGRESSION" : "");
+            regressions += slower;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+// --bench-suite [-n ITERATIONS] [--save FILE] [--compare FILE] [FILE...]
+// Runs the generated cases, or the given files, and reports throughput,
+// latency percentiles of each lex() and parse() call and peak RSS.
+int bench_suite(int argc, char **argv) {
+    int iterations = 10, nfiles = 0;
+    const char *save = NULL, *compare = NULL;
+    char **files = malloc((size_t)(argc + 1) * sizeof(char *));
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) save = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) compare = argv[++i];
+        else files[nfiles++] = argv[i];
+    }
+    if (iterations < 1) iterations = 1;
+    int ncases = nfiles ? nfiles : NSUITE_CASES, status = 0;
+    SuiteResult *results = calloc((size_t)ncases, sizeof(SuiteResult));
+
+    printf("--- BENCHMARK SUITE (%d iterations) ---\n", iterations);
+    printf("%-24s %10s %10s %9s %9s %9s %10s %10s\n", "Case", "Bytes", "Tokens", "Accepted", "MB/s",
+           "Mtok/s", "Msteps/s", "Peak RSS");
+    for (int c = 0; c < ncases; c++) {
+        SuiteResult *r = &results[c];
+        Source *texts;
+        int ntexts = nfiles ? 1 : SUITE_CASES[c].programs;
+        texts = calloc((size_t)ntexts, sizeof(Source));
+        if (nfiles) {
+            snprintf(r->name, sizeof(r->name), "%s", files[c]);
+            if (read_whole_file(files[c], &texts[0]) != 0) {
+                fprintf(stderr, "Error: Cannot open %s\n", files[c]);
+                free(texts);
+                status = 1;
+                continue;
+            }
+        } else {
+            snprintf(r->name, sizeof(r->name), "%s", SUITE_CASES[c].name);
+            for (int p = 0; p < ntexts; p++) {
+                GenOptions opts = SUITE_CASES[c].opts;
+                opts.seed = (unsigned long long)c * 1000003 + (unsigned long long)p + 1;
+                generate_program(&opts, NULL, &texts[p], NULL);
+            }
+        }
+        suite_measure(texts, ntexts, iterations, r);
+        for (int p = 0; p < ntexts; p++) source_free(&texts[p]);
+        free(texts);
+
+        char accepted[24];
+        snprintf(accepted, sizeof(accepted), "%d/%d", r->accepted, r->programs);
+        double runs = (double)iterations;
+        printf("%-24s %10llu %10lld %9s %9.1f %9.1f %10.1f %7ld MB\n", r->name, r->bytes, r->tokens, accepted,
+               (double)r->bytes * runs / (1024.0 * 1024.0) / r->lex_seconds,
+               (double)r->tokens * runs / 1e6 / r->lex_seconds, (double)r->steps * runs / 1e6 / r->parse_seconds,
+               r->peak_rss_kb / 1024);
+        fflush(stdout);
+    }
+
+    printf("\nLatency of one call (us)\n%-24s %9s %9s %9s %9s %9s %9s %9s %9s\n", "Case", "lex p50", "p90", "p99",
+           "max", "parse p50", "p90", "p99", "max");
+    for (int c = 0; c < ncases; c++) {
+        SuiteResult *r = &results[c];
+        if (!r->programs) continue;
+        printf("%-24s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", r->name, r->lex_pct[0] * 1e6,
+               r->lex_pct[1] * 1e6, r->lex_pct[2] * 1e6, r->lex_pct[3] * 1e6, r->parse_pct[0] * 1e6,
+               r->parse_pct[1] * 1e6, r->parse_pct[2] * 1e6, r->parse_pct[3] * 1e6);
+    }
+
+    if (compare) {
+        int regressions = suite_compare(compare, results, ncases);
+        if (regressions) status = 1;
+        if (regressions > 0) printf("%d case(s) more than %.0f%% slower than the baseline\n", regressions, SUITE_TOLERANCE * 100);
+    }
+    if (save && suite_save(save, results, ncases) != 0) status = 1;
+    free(results);
+    free(files);
+    return status;
+}
+
+// --- Adversarial lexer inputs ---
+
+// Inputs that make maximal munch backtrack: a prefix, then unit repeated.
+// With no whitespace to end a scan, every token start in the first four
+// reads to the end of the input before falling back, which is quadratic
+// for the table and direct-coded engines. The rest backtrack a bounded
+// distance and show what the memo costs when it cannot help.
+typedef struct {
+    const char *name;
+    const char *prefix, *unit;
+} AdversarialCase;
+
+const AdversarialCase ADVERSARIAL_CASES[] = {
+    {"keyword run", "", "int"},          // "int" each time, after reading on as a function name
+    {"unfinished names", "", "a"},       // a function name missing its "Fn" at every byte
+    {"unfinished names, digits", "", "a1"},
+    {"label then names", "loop_", "a"},  // "loop", then the '_' of a variable name, then as above
+    {"unfinished include", "", "#include<stdio.h"},
+    {"dotted numbers", "", "1."},         // "1.1", then a '.' that starts nothing
+    {"error bytes", "", "@"},
+};
+#define NADVERSARIAL_CASES ((int)(sizeof(ADVERSARIAL_CASES) / sizeof(ADVERSARIAL_CASES[0])))
+
+void adversarial_input(const AdversarialCase *c, size_t size, Source *out) {
+    memset(out, 0, sizeof(*out));
+    out->data = malloc(size + 1);
+    if (!out->data) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    size_t plen = strlen(c->prefix), ulen = strlen(c->unit);
+    for (size_t i = 0; i < size; i++) out->data[i] = i < plen ? c->prefix[i] : c->unit[(i - plen) % ulen];
+    out->data[size] = '\0';
+    out->len = out->cap = size;
+}
+
+// A valid program whose main nests depth loops. The parser takes any
+// depth; check_program() rejects it past AST_MAX_NESTING.
+void nested_program(int depth, Source *out) {
+    static const char head[] = "#include<stdio.h>\nint main ( ) {\n", open[] = "loop _va1a : while ( _va1a < 1 ) {\n",
+                      body[] = "printf ( _va1a ) ..\n", close[] = "break .. }\n", tail[] = "return 0 ..\n}\n";
+    size_t size = strlen(head) + (size_t)depth * (strlen(open) + strlen(close)) + strlen(body) + strlen(tail);
+    memset(out, 0, sizeof(*out));
+    out->data = malloc(size + 1);
+    if (!out->data) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    char *p = out->data;
+    p += sprintf(p, "%s", head);
+    for (int i = 0; i < depth; i++) p += sprintf(p, "%s", open);
+    p += sprintf(p, "%s", body);
+    for (int i = 0; i < depth; i++) p += sprintf(p, "%s", close);
+    p += sprintf(p, "%s", tail);
+    out->len = out->cap = size;
+}
+
+// --bench-adversarial [MAX_SIZE] [ITERATIONS]
+// Lexes each adversarial case at doubling sizes from 1 KB with every lexer
+// engine and prints the time per byte: flat for a linear engine, doubling
+// with the size for a quadratic one. An engine is dropped from a case once
+// one run takes longer than a second.
+int bench_adversarial(int argc, char **argv) {
+    unsigned long long max_size = argc >= 1 ? parse_size(argv[0]) : 256 << 10;
+    int iterations = argc >= 2 ? atoi(argv[1]) : 3, status = 0;
+    if (max_size == 0) {
+        fprintf(stderr, "Error: Bad size '%s' (bytes, or a number with K, M or G)\n", argv[0]);
+        return 1;
+    }
+    if (iterations < 1) iterations = 1;
+    lexer_init();
+    int engines[] = {LEX_ENGINE_TABLE, LEX_ENGINE_DIRECT, LEX_ENGINE_LINEAR}, engine = lex_engine;
+    CompileContext ctx;
+    context_init(&ctx, NULL, NULL);
+
+    printf("--- ADVERSARIAL LEXER INPUTS (best of %d) ---\n", iterations);
+    printf("%-26s %9s %11s %11s %11s %9s %9s %9s %10s %9s\n", "Case", "Bytes", "table (ms)", "direct (ms)",
+           "linear (ms)", "table", "direct", "linear", "Tokens", "Errors");
+    printf("%-26s %9s %11s %11s %11s %9s %9s %9s\n", "", "", "", "", "", "ns/byte", "ns/byte", "ns/byte");
+    for (int c = 0; c < NADVERSARIAL_CASES; c++) {
+        int dropped[3] = {0, !direct_scanner_ok, 0};
+        for (unsigned long long size = 1024; size <= max_size; size *= 2) {
+            Source src;
+            adversarial_input(&ADVERSARIAL_CASES[c], (size_t)size, &src);
+            double best[3];
+            unsigned long long digest = 0;
+            int tokens = -1, errors = 0, same = 1;
+            for (int e = 0; e < 3; e++) {
+                best[e] = -1;
+                if (dropped[e]) continue;
+                lex_engine = engines[e];
+                best[e] = 1e30;
+                for (int it = 0; it < iterations; it++) {
+                    double t0 = now_seconds();
+                    lex(&ctx, src.data, src.len);
+                    double t = now_seconds() - t0;
+                    if (t < best[e]) best[e] = t;
+                    if (t > 1.0) break;
+                }
+                if (best[e] > 1.0) dropped[e] = 1;
+                // Every engine must produce the tokens and errors of the first
+                if (tokens < 0) {
+                    digest = token_digest(&ctx);
+                    tokens = ctx.token_count;
+                    errors = ctx.lex_errors;
+                } else if (token_digest(&ctx) != digest || ctx.token_count != tokens || ctx.lex_errors != errors) {
+                    same = 0;
+                }
+            }
+            printf("%-26s %9llu", size == 1024 ? ADVERSARIAL_CASES[c].name : "", size);
+            for (int e = 0; e < 3; e++) {
+                if (best[e] < 0) printf(" %11s", "-");
+                else printf(" %11.3f", best[e] * 1e3);
+            }
+            for (int e = 0; e < 3; e++) {
+                if (best[e] < 0) printf(" %9s", "-");
+                else printf(" %9.2f", best[e] * 1e9 / (double)size);
+            }
+            printf(" %10d %9d%s\n", tokens, errors, same ? "" : "  MISMATCH");
+            if (!same) status = 1;
+            fflush(stdout);
+            source_free(&src);
+        }
+    }
+    lex_engine = engine;
+    context_free(&ctx);
+    return status;
+}
+
+// --gen SIZE [--seed N] [--funcs N] [--depth N] [--expr N] [--mutate P] [--adversarial N] [-o FILE]
+// --adversarial N writes case N of ADVERSARIAL_CASES instead of a program.
+int gen_command(int argc, char **argv) {
+    GenOptions opts = GEN_OPTS(parse_size(argv[0]), -1, 3, 4, 0);
+    opts.seed = 1;
+    const char *path = NULL;
+    int adversarial = -1;
+    if (opts.size == 0) {
+        fprintf(stderr, "Error: Bad size '%s' (bytes, or a number with K, M or G)\n", argv[0]);
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            fprintf(stderr, "Error: %s needs a value\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--seed") == 0) opts.seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i], "--funcs") == 0) opts.funcs = atoi(value);
+        else if (strcmp(argv[i], "--depth") == 0) opts.depth = atoi(value);
+        else if (strcmp(argv[i], "--expr") == 0) opts.expr_terms = atoi(value);
+        else if (strcmp(argv[i], "--mutate") == 0) opts.mutate = atof(value);
+        else if (strcmp(argv[i], "--adversarial") == 0) adversarial = atoi(value);
+        else if (strcmp(argv[i], "-o") == 0) path = value;
+        else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+    if (adversarial >= NADVERSARIAL_CASES) {
+        fprintf(stderr, "Error: No adversarial case %d (0 to %d)\n", adversarial, NADVERSARIAL_CASES - 1);
+        return 1;
+    }
+    FILE *out = path ? fopen(path, "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return 1;
+    }
+    if (adversarial >= 0) {
+        Source src;
+        adversarial_input(&ADVERSARIAL_CASES[adversarial], (size_t)opts.size, &src);
+        fwrite(src.data, 1, src.len, out);
+        source_free(&src);
+        fprintf(stderr, "Generated %llu bytes of '%s'\n", opts.size, ADVERSARIAL_CASES[adversarial].name);
+    } else {
+        GenStats stats;
+        generate_program(&opts, out, NULL, &stats);
+        fprintf(stderr, "Generated %llu bytes, %lld tokens, %d functions, %lld mutations\n", stats.bytes,
+                stats.tokens, stats.funcs, stats.mutations);
+    }
+    int failed = ferror(out);
+    if (path) failed |= fclose(out) != 0;
+    else fflush(out);
+    if (failed) fprintf(stderr, "Error: Writing %s failed\n", path ? path : "stdout");
+    return failed ? 1 : 0;
+}
+
+// =================================================================
+// PART 10: PARALLEL LEXING AND PARSING OF ONE FILE
+// =================================================================
+
+// A large program is cut after the '}' that closes a top-level
+// definition, into chunks of similar size. Workers lex and parse the
+// chunks independently: the first from Program, the rest from OptFuncs,
+// which is exactly the parser state between two definitions. Every '{'
+// and '}' byte is a token of its own, so the chunks lex to the same
+// tokens as the whole file. A chunk that does not end between two
+// definitions (only possible for invalid programs with unbalanced
+// braces) sends the whole file down the serial path, so the verdict,
+// tokens and diagnostics always match lexing everything and then
+// parsing it.
+
+#define PARALLEL_MIN_CHUNK (64 * 1024) // smaller chunks are not worth a worker
+#define PARALLEL_CHUNKS_PER_JOB 4      // spare chunks even out uneven definitions
+
+// What a parse produced, comparable between the serial and parallel paths
+typedef struct {
+    int accepted;
+    long long tokens; // including EOF
+    int lex_errors;
+    unsigned long long digest; // token_digest() of the whole stream
+    char first_error[256];
+    int chunks;
+    int fell_back; // chunks did not line up with definitions
+} ParallelResult;
+
+// Lexes all of text, then parses it, on the calling thread
+void parse_serial(const char *text, size_t len, FILE *diag, CompileStats *stats, ParallelResult *res) {
+    CompileContext ctx;
+    context_init(&ctx, diag, NULL);
+    ctx.stats = stats;
+    lex(&ctx, text, len);
+    memset(res, 0, sizeof(*res));
+    res->accepted = parse(&ctx);
+    res->tokens = ctx.token_count;
+    res->lex_errors = ctx.lex_errors;
+    res->digest = token_digest(&ctx);
+    snprintf(res->first_error, sizeof(res->first_error), "%s", ctx.first_error);
+    res->chunks = 1;
+    context_free(&ctx);
+}
+
+#ifndef _WIN32
+// Index of the first '{' or '}' in p[0, n), or n
+size_t find_brace(const char *p, size_t n) {
+    size_t i = 0;
+#ifdef LEX_X86_SIMD
+    const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned hit = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close)));
+        if (hit) return i + (size_t)__builtin_ctz(hit);
+    }
+#endif
+    for (; i < n && p[i] != '{' && p[i] != '}'; i++) {
+    }
+    return i;
+}
+
+// Brace-depth prescan: fills cuts[] with up to want - 1 offsets just past
+// a '}' that brings the depth back to 0 and is followed by another
+// top-level '{', each at or beyond the next 1/want of the text. Returns
+// the number of cuts.
+int prescan_chunks(const char *text, size_t len, int want, size_t *cuts) {
+    int n = 0, depth = 0;
+    size_t target = len / (size_t)want, pending = 0;
+    for (size_t i = 0; n + 1 < want; i++) {
+        i += find_brace(text + i, len - i);
+        if (i >= len) break;
+        if (text[i] == '{') {
+            if (depth++ == 0 && pending) {
+                cuts[n++] = pending;
+                pending = 0;
+                target = len / (size_t)want * (size_t)(n + 1);
+            }
+        } else if (depth > 0 && --depth == 0 && i + 1 >= target) {
+            pending = i + 1;
+        }
+    }
+    return n;
+}
+
+typedef struct {
+    size_t start, end; // text[start, end)
+    CompileContext ctx;
+    CompileStats stats;
+    int status;        // parse_from() result
+    char *diag;        // lexer errors, as they would have been printed
+    size_t diag_len;
+} ParseChunk;
+
+typedef struct {
+    const char *text;
+    ParseChunk *chunks;
+    int nchunks;
+    int next; // next chunk to take
+    pthread_mutex_t lock;
+    int capture; // keep lexer errors for the caller's diag
+} ParallelJob;
+
+void *parallel_worker(void *arg) {
+    ParallelJob *job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int k = job->next < job->nchunks ? job->next++ : -1;
+        pthread_mutex_unlock(&job->lock);
+        if (k < 0) break;
+
+        ParseChunk *c = &job->chunks[k];
+        CompileContext *ctx = &c->ctx;
+        LexState ls;
+        if (job->capture) ctx->diag = open_memstream(&c->diag, &c->diag_len);
+        lex_begin(ctx, &ls);
+        ls.pos = c->start; // offsets and lexer errors count from the start of the file
+        lex_feed(ctx, &ls, job->text, c->end, 1);
+        if (ctx->diag) fclose(ctx->diag);
+        ctx->diag = NULL; // a parser error is only reported for the first chunk that fails
+        c->status = parse_from(ctx, k == 0 ? SYM_NT(NT_PROGRAM) : SYM_NT(NT_OPT_FUNCS), k == job->nchunks - 1);
+    }
+    return NULL;
+}
+#endif
+
+// Lexes and parses text on up to `jobs` threads. Diagnostics go to diag
+// in source order: every lexer error, then the first parser error. With
+// stats set the workers' counters are added to it.
+void parse_parallel(const char *text, size_t len, int jobs, FILE *diag, CompileStats *stats, ParallelResult *res) {
+    size_t most = len / PARALLEL_MIN_CHUNK;
+    int want = jobs > 1 ? jobs * PARALLEL_CHUNKS_PER_JOB : 1;
+    if ((size_t)want > most) want = (int)most;
+#ifndef _WIN32
+    size_t *cuts = want > 1 ? malloc((size_t)want * sizeof(size_t)) : NULL;
+    int ncuts = cuts ? prescan_chunks(text, len, want, cuts) : 0;
+    if (jobs > 1 && ncuts > 0) {
+        ParallelJob job;
+        job.text = text;
+        job.nchunks = ncuts + 1;
+        job.next = 0;
+        job.capture = diag != NULL;
+        job.chunks = calloc((size_t)job.nchunks, sizeof(ParseChunk));
+        pthread_t *threads = calloc((size_t)jobs, sizeof(pthread_t));
+        if (!job.chunks || !threads) {
+            fprintf(stderr, "Error: Out of memory starting %d workers\n", jobs);
+            exit(1);
+        }
+        pthread_mutex_init(&job.lock, NULL);
+        for (int k = 0; k < job.nchunks; k++) {
+            ParseChunk *c = &job.chunks[k];
+            c->start = k ? cuts[k - 1] : 0;
+            c->end = k < ncuts ? cuts[k] : len;
+            context_init(&c->ctx, NULL, NULL);
+            if (stats) c->ctx.stats = &c->stats;
+        }
+        lexer_init(); // shared tables are built once, before any worker reads them
+        parser_init();
+        int started = 1;
+        for (; started < jobs && started < job.nchunks; started++) {
+            if (pthread_create(&threads[started], NULL, parallel_worker, &job) != 0) break;
+        }
+        parallel_worker(&job); // the calling thread is a worker too
+        for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+        free(threads);
+        pthread_mutex_destroy(&job.lock);
+
+        // Stitch the chunks back together in source order
+        memset(res, 0, sizeof(*res));
+        res->chunks = job.nchunks;
+        res->digest = 1469598103934665603ULL;
+        for (int k = 0; k < job.nchunks; k++) {
+            ParseChunk *c = &job.chunks[k];
+            int last = k == job.nchunks - 1, count = c->ctx.token_count - !last; // EOF only at the end
+            if (c->diag) {
+                fwrite(c->diag, 1, c->diag_len, diag);
+                free(c->diag);
+            }
+            if (c->ctx.lex_errors && !res->lex_errors) {
+                snprintf(res->first_error, sizeof(res->first_error), "%s", c->ctx.first_error);
+            }
+            res->lex_errors += c->ctx.lex_errors;
+            res->digest = token_digest_range(res->digest, &c->ctx, count);
+            res->tokens += count;
+            if (stats) stats_merge(stats, &c->stats);
+        }
+        long long base = 0;
+        for (int k = 0; k < job.nchunks; k++) {
+            ParseChunk *c = &job.chunks[k];
+            int last = k == job.nchunks - 1;
+            if (!last && c->status == PARSE_OPEN) {
+                base += c->ctx.token_count - 1;
+                continue;
+            }
+            if (last && c->status == PARSE_ACCEPTED) {
+                res->accepted = 1;
+            } else if (c->status == PARSE_REJECTED) {
+                // Parse it again with token indices of the whole file to report the error
+                c->ctx.diag = diag;
+                c->ctx.stats = NULL;
+                c->ctx.token_base = base;
+                c->ctx.errors = 0;
+                parse_from(&c->ctx, k == 0 ? SYM_NT(NT_PROGRAM) : SYM_NT(NT_OPT_FUNCS), last);
+                if (!res->lex_errors) snprintf(res->first_error, sizeof(res->first_error), "%s", c->ctx.first_error);
+            } else {
+                res->fell_back = 1;
+            }
+            break;
+        }
+        for (int k = 0; k < job.nchunks; k++) context_free(&job.chunks[k].ctx);
+        free(job.chunks);
+        free(cuts);
+        if (!res->fell_back) return;
+
+        // Lexer errors are out already: parse serially for the verdict and the parser error
+        CompileContext ctx;
+        context_init(&ctx, NULL, NULL);
+        lex(&ctx, text, len);
+        ctx.diag = diag;
+        ctx.errors = 0;
+        res->accepted = parse(&ctx);
+        if (!res->lex_errors) snprintf(res->first_error, sizeof(res->first_error), "%s", ctx.first_error);
+        context_free(&ctx);
+        return;
+    }
+    free(cuts);
+#endif
+    (void)want;
+    parse_serial(text, len, diag, stats, res);
+}
+
+// Parses one file with 1, 2, 4 ... max_jobs workers, checks each result
+// (diagnostics included) against the serial path and reports the best
+// time of each as speedup and efficiency over serial.
+int bench_parallel(const char *filename, int max_jobs, int iterations) {
+    Source src;
+    if (read_whole_file(filename, &src) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return 1;
+    }
+    int status = 0;
+    double serial_best = 0;
+    ParallelResult expected;
+    char *expected_diag = NULL;
+    size_t expected_len = 0;
+
+    printf("--- PARALLEL BENCHMARK: %s (%zu bytes, best of %d, %d cores online) ---\n", filename, src.len, iterations,
+           default_jobs());
+    printf("%-8s %8s %10s %10s %9s %11s %10s\n", "Jobs", "Chunks", "Best (ms)", "MB/s", "Speedup", "Efficiency", "Result");
+    for (int jobs = 0;; jobs = jobs ? jobs * 2 : 1) { // 0 is the serial path
+        if (jobs > max_jobs) jobs = max_jobs;
+        ParallelResult res;
+        char *diag_text = NULL;
+        size_t diag_len = 0;
+#ifndef _WIN32
+        FILE *diag = open_memstream(&diag_text, &diag_len);
+#else
+        FILE *diag = NULL;
+#endif
+        if (jobs == 0) parse_serial(src.data, src.len, diag, NULL, &res);
+        else parse_parallel(src.data, src.len, jobs, diag, NULL, &res);
+        if (diag) fclose(diag);
+        const char *verdict = res.accepted ? "accepted" : "rejected";
+        if (jobs == 0) {
+            expected = res;
+            expected_diag = diag_text;
+            expected_len = diag_len;
+        } else {
+            int same = res.accepted == expected.accepted && res.tokens == expected.tokens &&
+                       res.digest == expected.digest && res.lex_errors == expected.lex_errors &&
+                       strcmp(res.first_error, expected.first_error) == 0 && diag_len == expected_len &&
+                       (diag_len == 0 || memcmp(diag_text, expected_diag, diag_len) == 0);
+            if (!same) {
+                verdict = "MISMATCH";
+                status = 1;
+            }
+            free(diag_text);
+        }
+
+        double best = 1e30;
+        for (int it = 0; it < iterations; it++) {
+            double t0 = now_seconds();
+            if (jobs == 0) parse_serial(src.data, src.len, NULL, NULL, &res);
+            else parse_parallel(src.data, src.len, jobs, NULL, NULL, &res);
+            double t = now_seconds() - t0;
+            if (t < best) best = t;
+        }
+        if (jobs == 0) serial_best = best;
+        char name[16];
+        snprintf(name, sizeof(name), jobs ? "%d" : "serial", jobs);
+        printf("%-8s %8d %10.3f %10.1f %8.2fx %10.0f%% %10s%s\n", name, res.chunks, best * 1e3,
+               (double)src.len / (1024.0 * 1024.0) / best, serial_best / best,
+               100.0 * serial_best / best / (jobs ? jobs : 1), verdict, res.fell_back ? " (serial fallback)" : "");
+        if (jobs == max_jobs) break;
+    }
+    free(expected_diag);
+    source_free(&src);
+    return status;
+}
+
+// =================================================================
+// PART 11: COMPILE SERVER (--serve)
+// =================================================================
+
+// A long-running process that takes requests over stdin/stdout or a Unix
+// socket, so callers pay for lexer and parser tables, thread start-up and
+// warm memory once instead of per run. Requests are handled concurrently
+// by a pool of workers, each with its own context, AST arena, name table
+// and constant pool reused from one request to the next.
+//
+// Framing, both ways: the payload length in decimal, a newline, then the
+// payload. A request payload is `key=value` lines, optionally followed by
+// an empty line and the program text:
+//   op=parse|check|run|shutdown   (default parse)
+//   id=TEXT                       echoed in the response
+//   path=FILE                     the program, if it is not inline (relative to the server's directory)
+//   trace=human|json              include the parser trace
+//   trace_on_error=1              ... only if the parse is rejected
+//   stats=1                       include the counters (as in --stats=json)
+//   optimize=1                    run: optimize the bytecode first
+// A response payload is one JSON object and a newline:
+//   {"id":..,"op":..,"status":"accepted|rejected|unreadable|bad_request|
+//    runtime_error|limit_exceeded",
+//    "message":..,"tokens":N,"lex_errors":N,"micros":N, "cache":"hit|miss"
+//    when the server runs with --cache DIR, then per op
+//    "functions","variables","names","conversions" (check),
+//    "result","output" (run; a run that stops early still has "output"),
+//    and "trace" and "stats" when asked for}
+// Responses on one connection come back as requests finish, not
+// necessarily in order; match them up by id. Past SERVE_MAX_PENDING
+// unanswered requests the server stops reading a connection until one is
+// answered, so a client that pipelines cannot queue without bound. A run
+// stops with limit_exceeded after SERVE_RUN_BUDGET steps (vm_run()) or
+// SERVE_MAX_OUTPUT bytes of output, so a program that never returns only
+// holds its worker that long.
+#ifndef _WIN32
+
+#define SERVE_MAX_REQUEST (256 << 20)
+#define SERVE_MAX_NAMES (1 << 14) // a worker's name table starts over past this
+#define SERVE_READ_SIZE (64 * 1024)
+#define SERVE_MAX_PENDING 16 // unanswered requests per connection
+#define SERVE_RUN_BUDGET 100000000LL // loop iterations and calls per run request
+#define SERVE_MAX_OUTPUT (1 << 20) // bytes of program output per run request
+#define SERVE_PROBE_NESTING 200000 // loops in --bench-serve's nesting probe
+
+enum { SERVE_PARSE, SERVE_CHECK, SERVE_RUN, SERVE_SHUTDOWN };
+const char *SERVE_OP_NAMES[] = {"parse", "check", "run", "shutdown"};
+
+typedef struct Server Server;
+
+typedef struct ServeConn {
+    Server *server;
+    int in_fd, out_fd;
+    pthread_mutex_t write_lock; // one response is written at a time
+    int refs;                   // the reader plus each unanswered request (under Server.lock)
+    pthread_cond_t answered;    // a request was answered (with Server.lock)
+    char buf[SERVE_READ_SIZE];  // reader's input buffer
+    size_t pos, len;
+} ServeConn;
+
+typedef struct ServeJob {
+    ServeConn *conn;
+    char *data; // request payload, owned by the job
+    size_t len;
+    struct ServeJob *next;
+} ServeJob;
+
+struct Server {
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // a job was queued, a reader finished, or stopping was set
+    ServeJob *head, *tail;
+    int readers;            // reader threads still running
+    int stopping;           // no more jobs are queued; workers exit once the queue is empty
+    int wake[2];            // written once on stop, so blocked readers (and accept) return
+    int listen_fd;          // -1 when serving stdin or a benchmark
+    pthread_t *threads;
+    struct ServeWorker *workers;
+    int nworkers;
+    long requests;
+};
+
+// Worker state that stays warm between requests.
+typedef struct ServeWorker {
+    Server *server;
+    CompileContext ctx;
+    AstArena ast;
+    Interner names;
+    ConstPool consts; // emptied per request: compiled programs copy all of it into K[]
+} ServeWorker;
+
+int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+// Buffered read of exactly n bytes; -1 at end of input, on an error, or
+// once the server stops.
+int conn_read(ServeConn *c, char *dst, size_t n) {
+    while (n > 0) {
+        if (c->pos == c->len) {
+            if (c->server) {
+                struct pollfd fds[2] = {{c->in_fd, POLLIN, 0}, {c->server->wake[0], POLLIN, 0}};
+                if (poll(fds, 2, -1) < 0 && errno != EINTR) return -1;
+                if (fds[1].revents) return -1;
+                if (!fds[0].revents) continue;
+            }
+            ssize_t k = read(c->in_fd, c->buf, sizeof(c->buf));
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return -1;
+            c->pos = 0;
+            c->len = (size_t)k;
+        }
+        size_t take = c->len - c->pos < n ? c->len - c->pos : n;
+        memcpy(dst, c->buf + c->pos, take);
+        c->pos += take;
+        dst += take;
+        n -= take;
+    }
+    return 0;
+}
+
+// Reads one frame's length line. Returns the length, or -1 at end of input
+// or on a malformed line (which ends the connection).
+long long conn_read_length(ServeConn *c) {
+    long long n = 0;
+    int digits = 0;
+    for (;;) {
+        char ch;
+        if (conn_read(c, &ch, 1) != 0) return -1;
+        if (ch == '\n' && digits > 0) return n;
+        if (ch == '\r' && digits > 0) continue;
+        if (ch < '0' || ch > '9') return -1;
+        n = n * 10 + (ch - '0');
+        if (n > SERVE_MAX_REQUEST) return -1;
+        digits++;
+    }
+}
+
+// Drops one reference; the last one closes the connection.
+void conn_release(ServeConn *c) {
+    Server *s = c->server;
+    pthread_mutex_lock(&s->lock);
+    int last = --c->refs == 0;
+    if (!last) pthread_cond_signal(&c->answered);
+    pthread_mutex_unlock(&s->lock);
+    if (!last) return;
+    if (c->in_fd > 2) close(c->in_fd);
+    if (c->out_fd > 2 && c->out_fd != c->in_fd) close(c->out_fd);
+    pthread_cond_destroy(&c->answered);
+    pthread_mutex_destroy(&c->write_lock);
+    free(c);
+}
+
+void write_json_string(FILE *out, const char *p, size_t n) {
+    fputc('"', out);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = (unsigned char)p[i];
+        if (ch == '"' || ch == '\\') fprintf(out, "\\%c", ch);
+        else if (ch == '\n') fputs("\\n", out);
+        else if (ch == '\t') fputs("\\t", out);
+        else if (ch == '\r') fputs("\\r", out);
+        else if (ch < 0x20 || ch == 0x7f) fprintf(out, "\\u%04x", ch);
+        else fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+// Request fields; strings point into the payload.
+typedef struct {
+    int op;
+    const char *id, *path;
+    size_t id_len;
+    int trace_format; // -1 = none
+    int trace_on_error;
+    int stats;
+    int optimize;
+    const char *text; // inline program
+    size_t text_len;
+} ServeRequest;
+
+// Splits the payload into fields. Returns NULL, or the first thing wrong
+// with it (the rest is still read, so the id comes back either way).
+const char *serve_parse_request(char *data, size_t len, ServeRequest *rq) {
+    const char *bad = NULL;
+    memset(rq, 0, sizeof(*rq));
+    rq->trace_format = -1;
+    size_t i = 0;
+    while (i < len) {
+        size_t start = i;
+        while (i < len && data[i] != '\n') i++;
+        size_t end = i < len ? i++ : i;
+        if (end > start && data[end - 1] == '\r') end--;
+        if (end == start) { // the program follows the empty line
+            rq->text = data + i;
+            rq->text_len = len - i;
+            break;
+        }
+        char *eq = memchr(data + start, '=', end - start);
+        if (!eq) {
+            if (!bad) bad = "header line without '='";
+            continue;
+        }
+        size_t klen = (size_t)(eq - (data + start)), vlen = end - start - klen - 1;
+        const char *key = data + start, *val = eq + 1;
+#define KEY_IS(k) (klen == strlen(k) && memcmp(key, k, klen) == 0)
+#define VAL_IS(v) (vlen == strlen(v) && memcmp(val, v, vlen) == 0)
+        if (KEY_IS("op")) {
+            rq->op = -1;
+            for (int op = SERVE_PARSE; op <= SERVE_SHUTDOWN; op++) {
+                if (VAL_IS(SERVE_OP_NAMES[op])) rq->op = op;
+            }
+            if (rq->op < 0 && !bad) bad = "unknown op (parse, check, run or shutdown)";
+        } else if (KEY_IS("id")) {
+            rq->id = val;
+            rq->id_len = vlen;
+        } else if (KEY_IS("path")) {
+            rq->path = val;
+            data[end] = '\0'; // for open(): the line break, or the byte past the payload
+        } else if (KEY_IS("trace")) {
+            if (VAL_IS("human")) rq->trace_format = TRACE_HUMAN;
+            else if (VAL_IS("json")) rq->trace_format = TRACE_JSON;
+            else if (!VAL_IS("none") && !bad) bad = "unknown trace format (human, json or none)";
+        } else if (KEY_IS("trace_on_error")) {
+            rq->trace_on_error = VAL_IS("1");
+        } else if (KEY_IS("stats")) {
+            rq->stats = VAL_IS("1");
+        } else if (KEY_IS("optimize")) {
+            rq->optimize = VAL_IS("1");
+        } else if (!bad) {
+            bad = "unknown header";
+        }
+#undef KEY_IS
+#undef VAL_IS
+    }
+    if (!bad && rq->op != SERVE_SHUTDOWN && !rq->path && !rq->text) bad = "no path and no program text";
+    return bad;
+}
+
+// Handles one request with w's warm state and writes the response body
+// to out. data[len] must be writable. Returns 1 for an accepted shutdown.
+int serve_request(ServeWorker *w, char *data, size_t len, FILE *out) {
+    double t0 = now_seconds();
+    ServeRequest rq;
+    const char *bad = serve_parse_request(data, len, &rq);
+    fprintf(out, "{\"id\":");
+    if (rq.id) write_json_string(out, rq.id, rq.id_len);
+    else fputs("null", out);
+    if (bad) {
+        fprintf(out, ",\"status\":\"bad_request\",\"message\":\"%s\"}\n", bad);
+        return 0;
+    }
+    fprintf(out, ",\"op\":\"%s\"", SERVE_OP_NAMES[rq.op]);
+    if (rq.op == SERVE_SHUTDOWN) {
+        fprintf(out, ",\"status\":\"accepted\"}\n");
+        return 1;
+    }
+
+    CompileContext *ctx = &w->ctx;
+    CompileStats stats;
+    TraceSink sink;
+    FILE *trace_out = NULL;
+    char *trace_text = NULL, *run_text = NULL;
+    size_t trace_len = 0, run_len = 0;
+    if (w->names.count > SERVE_MAX_NAMES) interner_free(&w->names);
+    const_pool_clear(&w->consts);
+    ctx->errors = 0;
+    ctx->first_error[0] = '\0';
+    ctx->ast = rq.op == SERVE_PARSE ? NULL : &w->ast;
+    ctx->names = rq.op == SERVE_PARSE ? NULL : &w->names;
+    ctx->consts = rq.op == SERVE_PARSE ? NULL : &w->consts;
+    ctx->stats = NULL;
+    ctx->trace = NULL;
+    if (rq.stats) {
+        memset(&stats, 0, sizeof(stats));
+        ctx->stats = &stats;
+    }
+    if (rq.trace_format >= 0 && (trace_out = open_memstream(&trace_text, &trace_len)) != NULL) {
+        trace_open(&sink, trace_out, rq.trace_format, rq.trace_on_error);
+        ctx->trace = &sink;
+    }
+
+    Source src;
+    int status = BATCH_UNREADABLE, tokens = 0, lex_errors = 0, ran = 0;
+    const char *stopped = NULL; // run: runtime_error or limit_exceeded
+    const char *message = "Cannot open or read file";
+    char error[256];
+    CheckSummary sum;
+    long long result = 0;
+    int accepted;
+    if (rq.path) {
+        accepted = parse_file(ctx, rq.path, &src);
+    } else {
+        memset(&src, 0, sizeof(src));
+        src.data = (char *)rq.text;
+        src.len = rq.text_len;
+        accepted = parse_text(ctx, &src);
+    }
+    if (accepted >= 0) {
+        status = accepted ? BATCH_ACCEPTED : BATCH_REJECTED;
+        tokens = ctx->token_count;
+        lex_errors = ctx->lex_errors;
+        message = ctx->first_error;
+    }
+    if (ctx->trace) {
+        trace_close(&sink);
+        fclose(trace_out);
+    }
+
+    if (status == BATCH_ACCEPTED && rq.op == SERVE_CHECK) {
+        if (check_program(&w->ast, error, sizeof(error), &sum) != 0) {
+            status = BATCH_REJECTED;
+            message = error;
+        }
+    } else if (status == BATCH_ACCEPTED && rq.op == SERVE_RUN) {
+        Bytecode bc;
+        if (build_parsed(&w->ast, &bc, rq.optimize, error, sizeof(error)) != 0) {
+            status = BATCH_REJECTED;
+            message = error;
+        } else {
+            // One byte past the cap tells a full buffer from an overflow
+            run_text = malloc(SERVE_MAX_OUTPUT + 1);
+            FILE *run_out = run_text ? fmemopen(run_text, SERVE_MAX_OUTPUT + 1, "w") : NULL;
+            int rc = run_out ? vm_run(&bc, run_out, &result, SERVE_RUN_BUDGET) : -1, full = 0;
+            if (run_out) {
+                long at = fflush(run_out) == 0 ? ftell(run_out) : -1;
+                full = at < 0 || at > SERVE_MAX_OUTPUT || ferror(run_out); // running out of room is its only error
+                run_len = full ? SERVE_MAX_OUTPUT : (size_t)at;
+                fclose(run_out);
+            }
+            ran = rc == 0 && !full;
+            if (full || rc == VM_OUT_OF_STEPS) {
+                stopped = "limit_exceeded";
+                if (full) snprintf(error, sizeof(error), "Run stopped: output passed %d bytes", SERVE_MAX_OUTPUT);
+                else snprintf(error, sizeof(error), "Run stopped: step budget of %lld exhausted", SERVE_RUN_BUDGET);
+                message = error;
+            } else if (!ran) {
+                stopped = "runtime_error";
+                message = "Runtime Error (details in the server log)";
+            }
+            bytecode_free(&bc);
+        }
+    }
+    if (accepted >= 0 && rq.path) source_free(&src);
+
+    fprintf(out, ",\"status\":\"%s\",\"tokens\":%d,\"lex_errors\":%d",
+            stopped ? stopped : status == BATCH_ACCEPTED ? "accepted" : status == BATCH_REJECTED ? "rejected" : "unreadable",
+            tokens, lex_errors);
+    if (parse_cache && accepted >= 0 && rq.trace_format < 0) {
+        fprintf(out, ",\"cache\":\"%s\"", ctx->cached ? "hit" : "miss");
+    }
+    if (status != BATCH_ACCEPTED || stopped) {
+        fputs(",\"message\":", out);
+        write_json_string(out, message, strlen(message));
+    }
+    if (status == BATCH_ACCEPTED && rq.op == SERVE_CHECK) {
+        fprintf(out, ",\"functions\":%d,\"variables\":%d,\"names\":%u,\"conversions\":%d", sum.functions,
+                sum.variables, w->names.count, sum.conversions);
+    }
+    if (ran) fprintf(out, ",\"result\":%lld", result);
+    if (ran || stopped) {
+        fputs(",\"output\":", out);
+        write_json_string(out, run_text, run_len);
+    }
+    if (trace_text) {
+        fputs(",\"trace\":", out);
+        write_json_string(out, trace_text, trace_len);
+    }
+    if (rq.stats) {
+        fputs(",\"stats\":", out);
+        stats_write_json(out, &stats);
+    }
+    fprintf(out, ",\"micros\":%.0f}\n", (now_seconds() - t0) * 1e6);
+    free(trace_text);
+    free(run_text);
+    return 0;
+}
+
+// Queues a request; the job takes a reference on its connection. Returns
+// 0 if the server is stopping and the request was dropped.
+int server_push(Server *s, ServeConn *c, char *data, size_t len) {
+    ServeJob *job = malloc(sizeof(ServeJob));
+    if (!job) {
+        fprintf(stderr, "Error: Out of memory queueing a request\n");
+        exit(1);
+    }
+    job->conn = c;
+    job->data = data;
+    job->len = len;
+    job->next = NULL;
+    pthread_mutex_lock(&s->lock);
+    int queued = !s->stopping;
+    if (queued) {
+        c->refs++;
+        if (s->tail) s->tail->next = job;
+        else s->head = job;
+        s->tail = job;
+        pthread_cond_signal(&s->changed);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (!queued) free(job);
+    return queued;
+}
+
+// Stops taking requests; queued ones still run. Safe to call more than once.
+void server_stop(Server *s) {
+    pthread_mutex_lock(&s->lock);
+    int first = !s->stopping;
+    s->stopping = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    if (first && write(s->wake[1], "x", 1) < 0) perror("server wake");
+}
+
+void *serve_worker(void *arg) {
+    ServeWorker *w = arg;
+    Server *s = w->server;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->head && !s->stopping) pthread_cond_wait(&s->changed, &s->lock);
+        ServeJob *job = s->head;
+        if (job) {
+            s->head = job->next;
+            if (!s->head) s->tail = NULL;
+            s->requests++;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (!job) break; // stopping and nothing left
+
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        if (!out) {
+            fprintf(stderr, "Error: Out of memory building a response\n");
+            exit(1);
+        }
+        int stop = serve_request(w, job->data, job->len, out);
+        fclose(out);
+        char head[32];
+        int head_len = snprintf(head, sizeof(head), "%zu\n", body_len);
+        ServeConn *c = job->conn;
+        pthread_mutex_lock(&c->write_lock);
+        if (write_all(c->out_fd, head, (size_t)head_len) == 0) write_all(c->out_fd, body, body_len);
+        pthread_mutex_unlock(&c->write_lock);
+        if (stop) server_stop(s); // answered first
+        free(body);
+        free(job->data);
+        free(job);
+        conn_release(c);
+    }
+    return NULL;
+}
+
+// Reads frames from a connection and queues them until its input ends,
+// it sends a bad frame, or the server stops. While SERVE_MAX_PENDING of
+// its requests are unanswered it reads nothing, so the client's writes
+// block instead of the server's memory growing.
+void *serve_reader(void *arg) {
+    ServeConn *c = arg;
+    Server *s = c->server;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (c->refs > SERVE_MAX_PENDING && !s->stopping) pthread_cond_wait(&c->answered, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        long long n = conn_read_length(c);
+        if (n < 0) break;
+        char *data = malloc((size_t)n + 1); // +1: serve_request() may end the path there
+        if (!data) {
+            fprintf(stderr, "Error: Out of memory reading a %lld-byte request\n", n);
+            break;
+        }
+        if (conn_read(c, data, (size_t)n) != 0 || !server_push(s, c, data, (size_t)n)) {
+            free(data);
+            break;
+        }
+    }
+    conn_release(c);
+    pthread_mutex_lock(&s->lock);
+    s->readers--;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// Starts a reader thread for a new connection. in_fd and out_fd (unless
+// they are stdin and stdout) are closed once it is done with.
+int server_add_conn(Server *s, int in_fd, int out_fd) {
+    ServeConn *c = calloc(1, sizeof(ServeConn));
+    if (!c) {
+        fprintf(stderr, "Error: Out of memory accepting a connection\n");
+        return -1;
+    }
+    c->server = s;
+    c->in_fd = in_fd;
+    c->out_fd = out_fd;
+    c->refs = 1;
+    pthread_mutex_init(&c->write_lock, NULL);
+    pthread_cond_init(&c->answered, NULL);
+    pthread_mutex_lock(&s->lock);
+    s->readers++;
+    pthread_mutex_unlock(&s->lock);
+    pthread_t t;
+    if (pthread_create(&t, NULL, serve_reader, c) != 0) {
+        fprintf(stderr, "Error: Cannot start a reader thread\n");
+        pthread_mutex_lock(&s->lock);
+        s->readers--;
+        pthread_mutex_unlock(&s->lock);
+        conn_release(c);
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+// Builds the shared tables and starts `jobs` workers.
+int server_start(Server *s, int jobs) {
+    memset(s, 0, sizeof(*s));
+    s->listen_fd = -1;
+    lexer_init();
+    parser_init();
+    if (pipe(s->wake) != 0) {
+        perror("Error: Cannot create the server's wake-up pipe");
+        return -1;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    signal(SIGPIPE, SIG_IGN); // a client that hangs up only loses its responses
+    s->threads = calloc((size_t)jobs, sizeof(pthread_t));
+    ServeWorker *workers = calloc((size_t)jobs, sizeof(ServeWorker));
+    if (!s->threads || !workers) {
+        fprintf(stderr, "Error: Out of memory starting %d workers\n", jobs);
+        exit(1);
+    }
+    for (int i = 0; i < jobs; i++) {
+        workers[i].server = s;
+        context_init(&workers[i].ctx, NULL, NULL);
+        workers[i].ast.root = -1;
+        if (pthread_create(&s->threads[i], NULL, serve_worker, &workers[i]) != 0) break;
+        s->nworkers++;
+    }
+    s->workers = workers;
+    if (s->nworkers == 0) {
+        fprintf(stderr, "Error: Cannot start server workers\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Waits for the server to stop (a shutdown request, or with no listening
+// socket the last connection ending), then for its readers and workers,
+// and releases everything.
+void server_run(Server *s) {
+    while (s->listen_fd >= 0) {
+        struct pollfd fds[2] = {{s->listen_fd, POLLIN, 0}, {s->wake[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+        if (!fds[0].revents) continue;
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd >= 0) server_add_conn(s, fd, fd);
+        else if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+    }
+    pthread_mutex_lock(&s->lock);
+    while (!s->stopping && s->readers > 0) pthread_cond_wait(&s->changed, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    server_stop(s);
+
+    pthread_mutex_lock(&s->lock);
+    while (s->readers > 0) pthread_cond_wait(&s->changed, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < s->nworkers; i++) {
+        pthread_join(s->threads[i], NULL);
+        context_free(&s->workers[i].ctx);
+        ast_free(&s->workers[i].ast);
+        interner_free(&s->workers[i].names);
+        const_pool_free(&s->workers[i].consts);
+    }
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    close(s->wake[0]);
+    close(s->wake[1]);
+    pthread_cond_destroy(&s->changed);
+    pthread_mutex_destroy(&s->lock);
+    free(s->threads);
+    free(s->workers);
+}
+
+// --serve [--socket PATH] [--jobs N]: serves stdin/stdout until stdin ends,
+// or connections on a Unix socket until a shutdown request.
+int serve_main(const char *socket_path, int jobs) {
+    Server s;
+    if (jobs < 1) jobs = 1;
+    if (server_start(&s, jobs) != 0) return 1;
+    if (socket_path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Error: Socket path too long: %s\n", socket_path);
+            server_run(&s);
+            return 1;
+        }
+        strcpy(addr.sun_path, socket_path);
+        struct stat st;
+        if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socket_path); // left by an earlier server
+        s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s.listen_fd < 0 || bind(s.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(s.listen_fd, 64) != 0) {
+            fprintf(stderr, "Error: Cannot listen on %s: %s\n", socket_path, strerror(errno));
+            if (s.listen_fd >= 0) close(s.listen_fd);
+            s.listen_fd = -1;
+            server_run(&s);
+            return 1;
+        }
+        fprintf(stderr, "Serving on %s with %d workers\n", socket_path, s.nworkers);
+    } else if (server_add_conn(&s, 0, 1) != 0) {
+        server_run(&s);
+        return 1;
+    }
+    server_run(&s);
+    if (socket_path) unlink(socket_path);
+    return 0;
+}
+
+// Client side of one request: sends a frame and reads back one response.
+// Returns the response body (malloc'ed, NUL-terminated), or NULL.
+char *serve_call(ServeConn *c, const char *request, size_t len) {
+    char head[32];
+    int head_len = snprintf(head, sizeof(head), "%zu\n", len);
+    if (write_all(c->out_fd, head, (size_t)head_len) != 0 || write_all(c->out_fd, request, len) != 0) return NULL;
+    long long n = conn_read_length(c);
+    char *body = n >= 0 ? malloc((size_t)n + 1) : NULL;
+    if (!body) return NULL;
+    if (conn_read(c, body, (size_t)n) != 0) {
+        free(body);
+        return NULL;
+    }
+    body[n] = '\0';
+    return body;
+}
+
+typedef struct {
+    ServeConn conn; // client end; conn.server stays NULL
+    const char *request;
+    int count;
+    int failed;
+    double seconds;
+} ServeClient;
+
+void *serve_client(void *arg) {
+    ServeClient *cl = arg;
+    double t0 = now_seconds();
+    for (int i = 0; i < cl->count; i++) {
+        char *resp = serve_call(&cl->conn, cl->request, strlen(cl->request));
+        if (!resp || !strstr(resp, "\"status\":\"accepted\"")) cl->failed++;
+        free(resp);
+    }
+    cl->seconds = now_seconds() - t0;
+    return NULL;
+}
+
+// Runs `clients` connections of `count` back-to-back requests each against
+// an in-process server with `jobs` workers. Returns requests per second.
+double bench_serve_round(const char *request, int clients, int count, int jobs, double *latency, int *failed) {
+    Server s;
+    if (server_start(&s, jobs) != 0) return 0;
+    ServeClient *cl = calloc((size_t)clients, sizeof(ServeClient));
+    pthread_t *threads = calloc((size_t)clients, sizeof(pthread_t));
+    if (!cl || !threads) {
+        fprintf(stderr, "Error: Out of memory starting benchmark clients\n");
+        exit(1);
+    }
+    for (int i = 0; i < clients; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        server_add_conn(&s, fds[0], fds[0]);
+        cl[i].conn.in_fd = cl[i].conn.out_fd = fds[1];
+        cl[i].request = request;
+        cl[i].count = count;
+    }
+    double t0 = now_seconds();
+    for (int i = 0; i < clients; i++) pthread_create(&threads[i], NULL, serve_client, &cl[i]);
+    *latency = 0;
+    *failed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        *latency += cl[i].seconds / count / clients;
+        *failed += cl[i].failed;
+        close(cl[i].conn.in_fd); // the server sees the end of input
+    }
+    double elapsed = now_seconds() - t0;
+    server_run(&s);
+    free(cl);
+    free(threads);
+    return clients * count / elapsed;
+}
+
+// Programs that do not finish: one prints without end, one only counts
+const char *SERVE_PROBE_ENDLESS[] = {
+    "op=run\n\n#include<stdio.h>\nint main ( ) {\n"
+    "  loop _ia1a : while ( _ia1a < 9223372036854775807 ) {\n    printf ( _ia1a ) ..\n  break .. }\n"
+    "  return 0 ..\n}\n",
+    "op=run\n\n#include<stdio.h>\nint main ( ) {\n"
+    "  loop _ia1a : while ( _ia1a < 9223372036854775807 ) {\n  break .. }\n"
+    "  return 0 ..\n}\n",
+};
+#define SERVE_PROBE_NENDLESS ((int)(sizeof(SERVE_PROBE_ENDLESS) / sizeof(SERVE_PROBE_ENDLESS[0])))
+
+// Sends op=check and op=run for a program nested depth loops deep, then
+// the SERVE_PROBE_ENDLESS runs, then request, over one connection to an
+// in-process server. Returns how many responses were not as expected:
+// rejected for the nesting, limit_exceeded for the endless runs, accepted
+// for request.
+int serve_probe_limits(const char *request, int depth, int jobs) {
+    Server s;
+    if (server_start(&s, jobs) != 0) return 1;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    server_add_conn(&s, fds[0], fds[0]);
+    ServeConn *cl = calloc(1, sizeof(ServeConn));
+    Source prog;
+    nested_program(depth, &prog);
+    char *deep = malloc(prog.len + 16);
+    if (!cl || !deep) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    cl->in_fd = cl->out_fd = fds[1];
+    int failed = 0;
+    const char *ops[] = {"check", "run"};
+    for (int op = 0; op < 2; op++) {
+        int head = sprintf(deep, "op=%s\n\n", ops[op]);
+        memcpy(deep + head, prog.data, prog.len);
+        char *resp = serve_call(cl, deep, (size_t)head + prog.len);
+        if (!resp || !strstr(resp, "\"status\":\"rejected\"") || !strstr(resp, "nest more than")) failed++;
+        free(resp);
+    }
+    for (int k = 0; k < SERVE_PROBE_NENDLESS; k++) {
+        char *resp = serve_call(cl, SERVE_PROBE_ENDLESS[k], strlen(SERVE_PROBE_ENDLESS[k]));
+        if (!resp || !strstr(resp, "\"status\":\"limit_exceeded\"")) failed++;
+        free(resp);
+    }
+    char *resp = serve_call(cl, request, strlen(request));
+    if (!resp || !strstr(resp, "\"status\":\"accepted\"")) failed++;
+    free(resp);
+    close(cl->in_fd); // the server sees the end of input
+    server_run(&s);
+    free(cl);
+    free(deep);
+    source_free(&prog);
+    return failed;
+}
+
+// --bench-serve FILE [N] [JOBS]: per-request latency and throughput of the
+// server against starting a fresh process (`--quiet FILE`) per file, and a
+// check that a program nested far past AST_MAX_NESTING is rejected, and
+// programs that never finish are stopped, without taking the server down.
+int bench_serve(const char *self, const char *filename, int count, int jobs) {
+    int status = 0;
+    printf("--- SERVER BENCHMARK: %s (%d requests per client) ---\n", filename, count);
+    printf("%-34s %8s %14s %12s\n", "Mode", "Clients", "Latency (us)", "Requests/s");
+
+    // One process per request, as a build script calling the parser would
+    int spawns = count < 200 ? count : 200, spawn_failed = 0;
+    double t0 = now_seconds();
+    for (int i = 0; i < spawns; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            if (null_fd >= 0) dup2(null_fd, 1);
+            execlp(self, self, "--quiet", filename, (char *)NULL);
+            _exit(127);
+        }
+        int wstatus = 0;
+        if (pid < 0 || waitpid(pid, &wstatus, 0) < 0 || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) spawn_failed++;
+    }
+    double spawn = (now_seconds() - t0) / spawns;
+    printf("%-34s %8d %14.1f %12.0f\n", "process per request (--quiet)", 1, spawn * 1e6, 1 / spawn);
+    if (spawn_failed) {
+        fprintf(stderr, "Benchmark Error: %d of %d spawned runs failed\n", spawn_failed, spawns);
+        status = 1;
+    }
+
+    const char *ops[] = {"parse", "check", "run"};
+    char request[4200];
+    for (int op = 0; op < 3; op++) {
+        snprintf(request, sizeof(request), "op=%s\npath=%s\n", ops[op], filename);
+        for (int clients = 1; clients <= jobs; clients = clients < jobs && clients * 2 > jobs ? jobs : clients * 2) {
+            double latency;
+            int failed;
+            double rate = bench_serve_round(request, clients, count, jobs, &latency, &failed);
+            char name[64];
+            snprintf(name, sizeof(name), "server, op=%s", ops[op]);
+            printf("%-34s %8d %14.1f %12.0f\n", name, clients, latency * 1e6, rate);
+            if (failed) {
+                fprintf(stderr, "Benchmark Error: %d op=%s requests were not accepted\n", failed, ops[op]);
+                status = 1;
+            }
+            if (clients == jobs) break;
+        }
+    }
+
+    snprintf(request, sizeof(request), "op=check\npath=%s\n", filename);
+    double probe_start = now_seconds();
+    int probe_failed = serve_probe_limits(request, SERVE_PROBE_NESTING, jobs);
+    char name[64];
+    snprintf(name, sizeof(name), "server, %d nested + endless", SERVE_PROBE_NESTING);
+    printf("%-34s %s (%.2f s)\n", name, probe_failed ? "NOT STOPPED" : "stopped, server still up", now_seconds() - probe_start);
+    if (probe_failed) {
+        fprintf(stderr, "Benchmark Error: %d limit probe responses were wrong\n", probe_failed);
+        status = 1;
+    }
+    return status;
+}
+
+#endif // _WIN32
+
+
+// =================================================================
+// MAIN FUNCTION
+// =================================================================
+
+// Sets lex_engine from its name in LEX_ENGINE_NAMES
+int lexer_select(const char *name) {
+    for (int e = LEX_ENGINE_TABLE; e <= LEX_ENGINE_LINEAR; e++) {
+        if (strcmp(name, LEX_ENGINE_NAMES[e]) == 0) {
+            lex_engine = e;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Unknown lexer '%s' (table, direct or linear)\n", name);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    // --cache DIR [--cache-max MB] may come anywhere on the command line:
+    // every command that parses files then goes through the parse cache
+    const char *cache_dir = NULL;
+    long long cache_max_mb = 0;
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--cache-max") == 0 && i + 1 < argc) cache_max_mb = atoll(argv[++i]);
+        else argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    if (cache_dir) {
+#ifndef _WIN32
+        if (cache_max_mb <= 0) cache_max_mb = CACHE_DEFAULT_MAX_MB;
+        if ((parse_cache = cache_open(cache_dir, cache_max_mb << 20)) == NULL) return 1;
+#else
+        fprintf(stderr, "Error: --cache is not supported on this platform\n");
+        return 1;
+#endif
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--emit-lexer") == 0) {
+        lexer_init();
+        emit_lexer(stdout);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--emit-table") == 0) {
+        return emit_parser_tables(stdout) == 0 ? 0 : 1;
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-lex") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_lex(argv[2], iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-parse") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_parse(argv[2], iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-trace") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_trace(argv[2], iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-literals") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_literals(argv[2], iterations > 0 ? iterations : 1);
+    }
+#ifndef _WIN32
+    if (argc >= 3 && strcmp(argv[1], "--bench-cache") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_cache(argv[2], iterations > 0 ? iterations : 1);
+    }
+#endif
+    if (argc >= 3 && strcmp(argv[1], "--ast") == 0) {
+        // Parse without a trace and print the tree
+        CompileContext ctx;
+        AstArena ast = {0};
+        Source src;
+        TokenPuller tp;
+        context_init(&ctx, stderr, NULL);
+        ctx.ast = &ast;
+        if (stream_file(&ctx, argv[2], &src, &tp) != 0) {
+            fprintf(stderr, "Error: Cannot open %s\n", argv[2]);
+            return 1;
+        }
+        int accepted = parse(&ctx);
+        if (accepted) ast_print(stdout, &ast, ast.root);
+        stream_close(&tp);
+        ast_free(&ast);
+        context_free(&ctx);
+        return accepted ? 0 : 1;
+    }
+    // The bytecode commands take -O right after the command name, then
+    // --run, --interp and --verify-native take --budget STEPS (loop
+    // iterations and calls)
+    int optimize = argc >= 3 && strcmp(argv[2], "-O") == 0;
+    if (optimize) {
+        argv[2] = argv[1];
+        argv++;
+        argc--;
+    }
+    long long budget = 0;
+    if (argc >= 4 && strcmp(argv[2], "--budget") == 0) {
+        budget = atoll(argv[3]);
+        argv[3] = argv[1];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc >= 3 && strcmp(argv[1], "--run") == 0) return run_file(argv[2], RUN_VM, optimize, budget);
+    if (argc >= 3 && strcmp(argv[1], "--interp") == 0) return run_file(argv[2], RUN_INTERP, 0, budget);
+    if (argc >= 3 && strcmp(argv[1], "--dump-bytecode") == 0) return run_file(argv[2], RUN_DUMP, optimize, 0);
+    if (argc >= 3 && strcmp(argv[1], "--check") == 0) return check_file(argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "--bench-check") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_check(argv[2], iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-run") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_run(argv[2], iterations > 0 ? iterations : 1, optimize);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-opt") == 0) {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        return bench_opt(argv[2], iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--emit-asm") == 0) return native_file(argv[2], NULL, optimize);
+    if (argc >= 4 && strcmp(argv[1], "--build-native") == 0) return native_file(argv[2], argv[3], optimize);
+    if (argc >= 3 && strcmp(argv[1], "--verify-native") == 0) return verify_native(argv + 2, argc - 2, optimize, budget);
+    if (argc >= 4 && strcmp(argv[1], "--edit-script") == 0) {
+        // --edit-script FILE SCRIPT [--verify]
+        return run_edit_script(argv[2], argv[3], argc >= 5 && strcmp(argv[4], "--verify") == 0);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-parallel") == 0) {
+        // --bench-parallel FILE [MAX_JOBS] [ITERATIONS]
+        int max_jobs = argc >= 4 ? atoi(argv[3]) : default_jobs(), iterations = argc >= 5 ? atoi(argv[4]) : 5;
+        return bench_parallel(argv[2], max_jobs > 0 ? max_jobs : 1, iterations > 0 ? iterations : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--gen") == 0) return gen_command(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "--bench-suite") == 0) return bench_suite(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "--bench-adversarial") == 0) return bench_adversarial(argc - 2, argv + 2);
+#ifndef _WIN32
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        // --serve [--socket PATH] [--jobs N] [--lexer=table|direct|linear]
+        const char *socket_path = NULL;
+        int jobs = default_jobs();
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+                socket_path = argv[++i];
+            } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+                jobs = atoi(argv[++i]);
+            } else if (strncmp(argv[i], "--lexer=", 8) == 0) {
+                if (lexer_select(argv[i] + 8) != 0) return 1;
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        return serve_main(socket_path, jobs);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--bench-serve") == 0) {
+        int count = argc >= 4 ? atoi(argv[3]) : 1000;
+        int jobs = argc >= 5 ? atoi(argv[4]) : default_jobs();
+        return bench_serve(argv[0], argv[2], count > 0 ? count : 1, jobs > 0 ? jobs : 1);
+    }
+#endif
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        // --batch [--jobs N] [--stats=json] [--stats-out FILE] [--lexer=NAME] FILE|DIR...
+        int jobs = default_jobs(), first = 2, want_stats = 0;
+        const char *stats_path = NULL;
+        for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+            if (strcmp(argv[first], "--jobs") == 0 && first + 1 < argc) {
+                jobs = atoi(argv[++first]);
+            } else if (strcmp(argv[first], "--stats=json") == 0) {
+                want_stats = 1;
+            } else if (strcmp(argv[first], "--stats-out") == 0 && first + 1 < argc) {
+                stats_path = argv[++first];
+            } else if (strncmp(argv[first], "--lexer=", 8) == 0) {
+                if (lexer_select(argv[first] + 8) != 0) return 1;
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[first]);
+                return 1;
+            }
+        }
+        FILE *stats_out = want_stats ? stdout : NULL;
+        if (want_stats && stats_path && (stats_out = fopen(stats_path, "w")) == NULL) {
+            fprintf(stderr, "Error: Cannot write stats to %s\n", stats_path);
+            return 1;
+        }
+        int status = run_batch(argv + first, argc - first, jobs, stats_out);
+        if (stats_out && stats_out != stdout) fclose(stats_out);
+        return status;
+    }
+
+    // [--trace=human|json|binary|none] [--trace-on-error] [--trace-out FILE] [--quiet]
+    // [--jobs N] [--stats=json] [--stats-out FILE] [--lexer=table|direct|linear] [FILE]
+    // --jobs N (N > 1) means --quiet, lexing and parsing on N threads
+    int format = TRACE_HUMAN, on_error = 0, quiet = 0, want_stats = 0, jobs = 1, arg = 1;
+    const char *trace_path = NULL, *stats_path = NULL;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strncmp(argv[arg], "--trace=", 8) == 0) {
+            const char *name = argv[arg] + 8;
+            format = strcmp(name, "none") == 0 ? -1 : -2;
+            for (int f = TRACE_HUMAN; f <= TRACE_BINARY; f++) {
+                if (strcmp(name, TRACE_FORMAT_NAMES[f]) == 0) format = f;
+            }
+            if (format == -2) {
+                fprintf(stderr, "Error: Unknown trace format '%s' (human, json, binary or none)\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[arg], "--trace-on-error") == 0) {
+            on_error = 1;
+        } else if (strcmp(argv[arg], "--trace-out") == 0 && arg + 1 < argc) {
+            trace_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--quiet") == 0) {
+            quiet = 1;
+            format = -1;
+        } else if (strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc) {
+            jobs = atoi(argv[++arg]);
+            if (jobs > 1) {
+                quiet = 1;
+                format = -1;
+            }
+        } else if (strncmp(argv[arg], "--stats=", 8) == 0) {
+            if (strcmp(argv[arg] + 8, "json") != 0) {
+                fprintf(stderr, "Error: Unknown stats format '%s' (json)\n", argv[arg] + 8);
+                return 1;
+            }
+            want_stats = 1;
+        } else if (strcmp(argv[arg], "--stats-out") == 0 && arg + 1 < argc) {
+            stats_path = argv[++arg];
+        } else if (strncmp(argv[arg], "--lexer=", 8) == 0) {
+            if (lexer_select(argv[arg] + 8) != 0) return 1;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    const char *filename = arg < argc ? argv[arg] : NULL;
+    char typed[4096]; // the name when it is asked for
+    if (!filename) {
+        printf("Enter input file name (e.g., input_src): ");
+        if (fgets(typed, sizeof(typed), stdin) == NULL) {
+            fprintf(stderr, "Error reading filename.\n");
+            return 1;
+        }
+        typed[strcspn(typed, "\n")] = '\0';
+        filename = typed;
+    }
+
+    TraceSink sink;
+    if (format >= 0) {
+        FILE *out = stdout;
+        if (trace_path && (out = fopen(trace_path, format == TRACE_BINARY ? "wb" : "w")) == NULL) {
+            fprintf(stderr, "Error: Cannot write trace to %s\n", trace_path);
+            return 1;
+        }
+        trace_open(&sink, out, format, on_error);
+    }
+    CompileContext ctx;
+    CompileStats stats;
+    context_init(&ctx, stderr, format >= 0 ? &sink : NULL);
+    if (want_stats) {
+        memset(&stats, 0, sizeof(stats));
+        ctx.stats = &stats;
+    }
+    Source src;
+    int accepted;
+
+    if (jobs > 1) {
+        // Verdict only, with every lexer error as when lexing first
+        ParallelResult res;
+        if (read_whole_file(filename, &src) != 0) {
+            printf("Error: Cannot open %s. Make sure the file is in the project folder (or bin/Debug).\n", filename);
+            return 1;
+        }
+        parse_parallel(src.data, src.len, jobs, stderr, want_stats ? &stats : NULL, &res);
+        accepted = res.accepted;
+        source_free(&src);
+    } else if (quiet) {
+        // Verdict only: pull tokens as the parser needs them (or load them from --cache)
+        if ((accepted = parse_file(&ctx, filename, &src)) < 0) {
+            printf("Error: Cannot open %s. Make sure the file is in the project folder (or bin/Debug).\n", filename);
+            return 1;
+        }
+        source_free(&src);
+    } else {
+        // 1. Lexical Analysis (runs while the input is read)
+        if (lex_file(&ctx, filename, &src) != 0) {
+            printf("Error: Cannot open %s. Make sure the file is in the project folder (or bin/Debug).\n", filename);
+            return 1;
+        }
+
+        printf("\n--- INPUT PROGRAM ---\n");
+        fwrite(src.data, 1, src.len, stdout);
+        printf("\n");
+
+        printf("\n--- LEXER OUTPUT (Tokens) ---\n");
+        for (int i = 0; i < ctx.token_count; i++) {
+            int len;
+            const char *lexeme = token_text(&ctx, i, &len);
+            printf("[%d: %.*s] ", token_type(&ctx, i), len, lexeme);
+        }
+        printf("\n");
+        fflush(stdout); // the trace sink writes to the same stream
+
+        // 2. Syntactic Analysis
+        accepted = parse(&ctx);
+        source_free(&src);
+    }
+
+    if (format >= 0) {
+        trace_close(&sink);
+        if (trace_path) fclose(sink.out);
+    }
+    // The human trace on stdout already ends with the verdict
+    if (format != TRACE_HUMAN || trace_path || (on_error && accepted)) {
+        printf("\n%s\n", accepted ? "SYNTAX ACCEPTED (Parser Structure Valid)" : "SYNTAX REJECTED");
+    }
+    if (want_stats) {
+        FILE *out = stdout;
+        if (stats_path && (out = fopen(stats_path, "w")) == NULL) {
+            fprintf(stderr, "Error: Cannot write stats to %s\n", stats_path);
+        } else {
+            fflush(stdout);
+            stats_write_json(out, &stats);
+            if (stats_path) fclose(out);
+        }
+    }
+    context_free(&ctx);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Checks the native back end against the bytecode VM and the interpreter.
+#
+#   tests/verify_native.sh [CC]
+#
+# Builds all_code.c, runs every tests/native/*.src through --run, --run -O
+# and --interp and compares the output and exit status with the matching
+# .out file, then runs --verify-native with and without -O so the native
+# build must agree with both engines. A .src without a .out must not finish:
+# --verify-native has to skip it at the step budget instead of hanging.
+# Exits non-zero on any mismatch.
+
+set -u
+cd "$(dirname "$0")/.." || exit 1
+CC=${1:-${CC:-cc}}
+BUDGET=10000000
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT INT TERM
+bin=$work/all_code
+
+if ! $CC -O2 -pthread -o "$bin" all_code.c -lm; then
+    echo "FAIL: cannot build all_code.c with $CC"
+    exit 1
+fi
+
+failed=0
+for src in tests/native/*.src; do
+    expected=${src%.src}.out
+    [ -f "$expected" ] || continue
+    for mode in "--run" "--run -O" "--interp"; do
+        { "$bin" $mode "$src"; echo "exit $?"; } > "$work/got" 2> /dev/null
+        if ! cmp -s "$expected" "$work/got"; then
+            echo "FAIL: $mode $src differs from $expected"
+            diff "$expected" "$work/got" | head -n 10
+            failed=1
+        fi
+    done
+done
+
+for opt in "" "-O"; do
+    "$bin" --verify-native $opt --budget $BUDGET tests/native/*.src > "$work/verify" 2> /dev/null
+    status=$?
+    cat "$work/verify"
+    [ $status -eq 0 ] || failed=1
+    for src in tests/native/*.src; do
+        [ -f "${src%.src}.out" ] && continue
+        if ! grep -q "^SKIP .*  $src: does not finish" "$work/verify"; then
+            echo "FAIL: --verify-native $opt did not stop $src at the step budget"
+            failed=1
+        fi
+    done
+done
+
+[ $failed -eq 0 ] && echo "native verification passed" || echo "native verification FAILED"
+exit $failed